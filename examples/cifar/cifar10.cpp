@@ -29,11 +29,10 @@ int main(int argc, char** argv) {
     s_Layer pool2 = make_shared<Pooling>(Window(2), Stride(2), conv2);
     s_Layer conv3 = make_shared<Convolution>(
         FilterShape(5, 5), Pad(2), Stride(1), Filters(128), pool2, init);
-    s_Layer pool3 = make_shared<Pooling>(Window(3), Stride(2), conv3);
-    s_Layer d1 = make_shared<Dense>(Features(128), pool3, init);
-    s_Layer drop1 = make_shared<Dropout>(0.5, d1);
-    s_Layer r1 = make_shared<Relu>(drop1);
-    s_Layer d2 = make_shared<Dense>(Features(10), r1, init);
+    // one average per 8x8 feature map instead of a 3/2 max pooling and a
+    // Dense layer on its flattened 128x4x4 output
+    s_Layer pool3 = make_shared<GlobalAvgPooling>(conv3);
+    s_Layer d2 = make_shared<Dense>(Features(10), pool3, init);
     s_Layer drop2 = make_shared<Dropout>(0.5, d2);
     s_Layer s1 = make_shared<Softmax>(drop2);
     std::shared_ptr<Loss> loss =
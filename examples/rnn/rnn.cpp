@@ -52,30 +52,45 @@ int main(int argc, char** argv) {
         }
         new_vec[i++] = char_to_ix[val];
     }
-    Matrix input(Matrix::Zero(new_vec.size() - 1, char_to_ix.size()));
-    Matrix output(Matrix::Zero(new_vec.size() - 1, char_to_ix.size()));
-    int in = new_vec[0];
+    int vocab = char_to_ix.size();
+    Labels input(new_vec.size() - 1);
+    Labels output(new_vec.size() - 1);
     for (size_t i = 0; i < new_vec.size() - 1; ++i) {
-        int out = new_vec[i + 1];
-        input(i, in) = 1.0f;
-        output(i, out) = 1.0f;
-        in = out;
+        input(i) = new_vec[i];
+        output(i) = new_vec[i + 1];
     }
     Init* init = new Glorot();
-    s_Layer l1 = make_shared<Input>(Features(input.cols()));
-    s_Layer rnn1 = make_shared<LSTM>(Features(128), l1, init);
-    s_Layer rnn2 = make_shared<LSTM>(Features(128), rnn1, init);
-    s_Layer d1 = make_shared<Dense>(Features(input.cols()), rnn2, init);
+    s_Layer l1 = make_shared<Input>(Features(1));
+    s_Layer e1 = make_shared<Embedding>(Features(64), Vocabulary(vocab), l1,
+                                        init);
+    // pass "gru" to train GRU layers instead and compare the time per
+    // iteration with the LSTMs
+    bool gru = (argc > 1) and (std::string(argv[1]) == "gru");
+    s_Layer rnn1, rnn2;
+    if (gru) {
+        rnn1 = make_shared<GRU>(Features(128), e1, init);
+        rnn2 = make_shared<GRU>(Features(128), rnn1, init);
+    } else {
+        rnn1 = make_shared<LSTM>(Features(128), e1, init);
+        rnn2 = make_shared<LSTM>(Features(128), rnn1, init);
+    }
+    s_Layer d1 = make_shared<Dense>(Features(vocab), rnn2, init);
     s_Layer s1 = make_shared<Softmax>(d1);
     std::shared_ptr<Loss> loss =
         std::make_shared<CrossEntropy>(CrossEntropy("CPU"));
     NeuralNetwork n1(s1, loss, "CPU");
+    // n1.wavefront(true) runs the two LSTM layers on neighbouring timesteps
+    // in parallel, it stays off as long as the "[benchmark cpu]" case of
+    // test/lstm.cpp shows no gain over running them one after the other
     std::vector<Metric*> test_func(0);
     Metric* val = new CharRNN(500, &n1, ix_to_char, 0.5);
     test_func.push_back(val);
     std::shared_ptr<GradientDescent> sgd =
         std::make_shared<RMSProp>(LearningRate(0.002 * 100), DecayRate(0.95),
                                   WeightDecay(0), LearingRateDecay(10, 0.95));
-    n1.train(input, output, sgd, Epochs(1000), Patience(1000), BatchSize(100),
-             test_func, DebugInfo("", ""), Shuffle(false));
+    // 16 streams of the text advance together, 200 characters per batch
+    // each, backpropagated in windows of 50 characters
+    n1.train(input, output, sgd, Epochs(1000), Patience(1000), BatchSize(200),
+             test_func, DebugInfo("", ""), Shuffle(false), Sequences(16),
+             Truncation(50));
 }
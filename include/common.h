@@ -1,6 +1,7 @@
 #ifndef common_h
 #define common_h
 #include <eigen-git-mirror/Eigen/Core>
+#include <eigen-git-mirror/Eigen/SparseCore>
 #include <fstream>
 #include <iomanip>
 #include <utility>
@@ -9,6 +10,13 @@
 typedef float dtype;
 typedef Eigen::Matrix<dtype, Eigen::Dynamic, Eigen::Dynamic> Matrix;
 typedef Eigen::Vector<dtype, Eigen::Dynamic> Vector;
+// class indices, one per observation, as an alternative to one-hot targets
+typedef Eigen::Matrix<int, Eigen::Dynamic, 1> Labels;
+// compressed sparse rows, one row per observation like the dense features
+typedef Eigen::SparseMatrix<dtype, Eigen::RowMajor> SparseMatrix;
+// rows of a larger matrix, e.g. one half of a concatenated output
+typedef Eigen::Ref<Matrix, 0, Eigen::OuterStride<>> MatrixBlock;
+typedef Eigen::Ref<const Matrix, 0, Eigen::OuterStride<>> ConstMatrixBlock;
 
 template <typename T, typename Paramter>
 class NamedType {
@@ -86,6 +94,12 @@ struct FilterShapeParameter {};
 using FilterShape = NamedPair<int, FilterShapeParameter>;
 struct ImageShapeParameter {};
 using ImageShape = NamedPair<int, ImageShapeParameter>;
+struct VocabularyParameter {};
+using Vocabulary = NamedType<int, VocabularyParameter>;
+struct SequencesParameter {};
+using Sequences = NamedType<int, SequencesParameter>;
+struct TruncationParameter {};
+using Truncation = NamedType<int, TruncationParameter>;
 
 // void print_Matrix_to_stdout(const Eigen::MatrixXd& val, std::string loc) {
 // int rows(val.rows()), cols(val.cols());
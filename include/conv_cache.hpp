@@ -0,0 +1,23 @@
+#pragma once
+#ifndef conv_cache_hpp
+#define conv_cache_hpp
+#include <string>
+// The convolution algorithms an autotuner picked, kept in a text file with
+// one "key<tab>algorithm" line per shape. Keys start with the cpu model so
+// that a file shared between machines does not mix up their choices
+class ConvCache {
+   public:
+    explicit ConvCache(const std::string&);
+    // the model name of /proc/cpuinfo, "unknown cpu" where there is none
+    static std::string cpu_model();
+    // the algorithm last stored for the key, false if there is none
+    bool find(const std::string&, std::string&) const;
+    // appends the choice, later lines win over earlier ones for a key,
+    // false if the file cannot be written
+    bool store(const std::string&, const std::string&) const;
+    const std::string& path() const { return _path; }
+
+   private:
+    std::string _path;
+};
+#endif
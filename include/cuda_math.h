@@ -36,6 +36,10 @@ void sum_cross_entropy_losses(int, float*, const float*);
 void sum_cross_entropy_losses(int, double*, const double*);
 void cross_entropy_gradient(int, int, const double*, const double*, double*);
 void cross_entropy_gradient(int, int, const float*, const float*, float*);
+void all_cross_entropy_losses_labels(int, int, const dtype*, const dtype*,
+                                     dtype*);
+void cross_entropy_gradient_labels(int, int, const dtype*, const dtype*,
+                                   dtype*);
 void matrix_addition_inplace(int, int, const float*, float*, const float);
 void matrix_addition_inplace(int, int, const double*, double*, const float);
 void matrix_addition(int, int, const dtype*, const dtype*, dtype*, const dtype,
@@ -51,6 +55,17 @@ void pooling_backward_gpu(const float* bottom_data, const float* mask,
                           const int window, const int stride, int rows,
                           int cols, const int channels, int out_height,
                           int out_width, const int batches, float* dest);
+void avg_pooling_gpu(const float* bottom_data, int window, int stride,
+                     int rows, int cols, int channels, int out_height,
+                     int out_width, int batches, float* top_data);
+void avg_pooling_backward_gpu(const float* src, int window, int stride,
+                              int rows, int cols, int channels,
+                              int out_height, int out_width, int batches,
+                              float* dest);
+void global_avg_pooling_gpu(const float* bottom_data, int rows, int cols,
+                            int planes, float* top_data);
+void global_avg_pooling_backward_gpu(const float* src, int rows, int cols,
+                                     int planes, float* dest);
 void im2col_gpu(const float* data_im, int channels, int height, const int width,
                 int kernel_h, const int kernel_w, int pad, int stride,
                 float* data_col);
@@ -71,4 +86,6 @@ void copy_data(int, int, const dtype*, dtype*);
 void tanh_deriv(int, int, int, const dtype*, dtype*);
 void sigmoid_deriv(int, int, int, const dtype*, dtype*);
 void clip_gradients_gpu(int, int, dtype, dtype*);
+void embedding_forward(int, int, const dtype*, const dtype*, dtype*);
+void embedding_backward(int, int, const dtype*, const dtype*, dtype*);
 #endif
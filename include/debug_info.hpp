@@ -23,6 +23,7 @@ class DebugInfo {
     std::ofstream _ffw_stream;
     std::ofstream _bwd_stream;
     bool _is_set;
+    dtype input_mean(const SharedStorage&);
 
     void _print_layers(const std::deque<std::shared_ptr<Layer>>& layers,
                        std::ostream& stream);
@@ -0,0 +1,55 @@
+#pragma once
+#ifndef direct_convolution_hpp
+#define direct_convolution_hpp
+#include <vector>
+#include "common.h"
+#include "fast_convolution.hpp"
+// Direct convolution over blocks of 8 or 16 channels (NCHW8c / NCHW16c).
+// Each image is copied into a padded buffer in the blocked layout, a
+// microkernel keeps a row of output positions for a block of filters in
+// vector registers and the results go back to the channel-major layout
+// of the layers around it, or stay blocked for a direct convolution that
+// reads them next
+class DirectConvolution : public FastConvolution {
+   public:
+    enum class Isa { Generic, AVX2, AVX512 };
+    // the widest instruction set the cpu supports
+    static Isa detect();
+    DirectConvolution(FilterShape, Channels, Filters, ImageShape, Pad, Stride,
+                      Isa = detect());
+    int workspace() const override;
+    void forward_cpu(const float*, float*, float*) const override;
+    void backward_cpu(const float*, float*, float*) const override;
+    Isa isa() const { return _isa; }
+    int block() const { return _block; }
+    // whether the images of the input and the output are blocked,
+    // [channel block][row][column][channel in the block], instead of
+    // channel-major; the backward pass reads the output's layout and
+    // writes the input's. A blocked side needs whole blocks of channels
+    void layout(bool, bool);
+    // converts an image of whole blocks of channels, given the channels
+    // and the positions per channel, between the two layouts
+    void to_blocked(const float*, float*, int, int) const;
+    void to_channels(const float*, float*, int, int) const;
+
+   private:
+    // adds up the output row of out positions x block filters
+    typedef void (*Microkernel)(const float*, const float*, int, int, int,
+                                int, int, int, float*);
+    Isa _isa;
+    Microkernel _kernel;
+    // channels per block, i.e. the floats in a vector register
+    int _block;
+    // output positions per microkernel call
+    int _row;
+    bool _blocked_input, _blocked_output;
+    std::vector<float> _forward, _backward;
+    void transform_filters(const Matrix&) override;
+    void block_filters(Direction, const Matrix&, std::vector<float>&) const;
+    int blocks(int) const;
+    int padded_rows(const Pass&) const;
+    int padded_cols(const Pass&) const;
+    int pass_workspace(const Pass&) const;
+    void convolve(Direction, const float*, float*, float*) const;
+};
+#endif
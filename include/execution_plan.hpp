@@ -0,0 +1,56 @@
+#pragma once
+#ifndef execution_plan_hpp
+#define execution_plan_hpp
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "layer/layer.h"
+#include "storage.h"
+class Wavefront;
+// The cpu passes of a network flattened once after its layers are built.
+// Every step holds the raw layer or wavefront and the index of the values
+// it reads, so a training step only walks two vectors instead of searching
+// the stacks and copying shared pointers for every layer. The steps are
+// bound to the values and gradients of a batch when first run on them,
+// the layers which take raw buffers then get only those and the mode.
+class ExecutionPlan {
+    typedef std::shared_ptr<Storage> SharedStorage;
+
+   public:
+    ExecutionPlan() = default;
+    // the stacks are the wavefronts to run, empty if they are disabled
+    void compile(const std::deque<std::shared_ptr<Layer>>&,
+                 const std::vector<std::shared_ptr<Wavefront>>&);
+    void forward_cpu(std::vector<SharedStorage>&, Mode);
+    void backward_cpu(std::vector<SharedStorage>&,
+                      const std::vector<SharedStorage>&);
+    size_t forward_steps() const { return _forward.size(); }
+    size_t backward_steps() const { return _backward.size(); }
+
+   private:
+    // a single layer if stack is null, otherwise the layers first to last
+    struct Step {
+        Layer* layer;
+        Wavefront* stack;
+        int first;
+        int last;
+        // whether the layer runs on the bound buffers
+        bool raw;
+        Buffers buffers;
+        // the slices of the values and gradients of a stack
+        std::vector<SharedStorage> values;
+        std::vector<SharedStorage> gradients;
+    };
+    std::vector<Step> _forward;
+    std::vector<Step> _backward;
+    // the storages the steps are bound to, held so that none of them is
+    // freed and another one allocated in its place
+    std::vector<SharedStorage> _forward_values;
+    std::vector<SharedStorage> _backward_values;
+    std::vector<SharedStorage> _backward_gradients;
+    void bind_forward(const std::vector<SharedStorage>&);
+    void bind_backward(const std::vector<SharedStorage>&,
+                       const std::vector<SharedStorage>&);
+};
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+#ifndef fast_convolution_hpp
+#define fast_convolution_hpp
+#include <memory>
+#include "common.h"
+#include "storage.h"
+// A cpu convolution of single images that does not go through im2col.
+// Images and outputs are channel-major like the ones of the convolution
+// layer, the weights are its (channels * kernel) x filters matrix from
+// which an implementation derives whatever it multiplies with
+class FastConvolution {
+   public:
+    virtual ~FastConvolution() = default;
+    // derives the filters for forward and backward, which is only redone
+    // when the storage reports a change since the last call
+    void prepare(const std::shared_ptr<Storage>&);
+    // floats of scratch memory each concurrent caller of the passes needs
+    virtual int workspace() const = 0;
+    // adds the convolution of the image to out
+    virtual void forward_cpu(const float*, float*, float*) const = 0;
+    // adds the gradient of the image given the gradient of the output
+    virtual void backward_cpu(const float*, float*, float*) const = 0;
+
+   protected:
+    enum class Direction { Forward, Backward };
+    // one direction of the convolution, the backward pass correlates the
+    // output gradient spread out by the stride with the flipped filters
+    struct Pass {
+        int in_channels, height, width, dilation, pad_rows, pad_cols;
+        int out_channels, out_height, out_width, stride;
+    };
+    Pass _forward_pass, _backward_pass;
+    const Pass& pass(Direction direction) const {
+        return (direction == Direction::Forward) ? _forward_pass
+                                                 : _backward_pass;
+    }
+    int _kh, _kw;
+    FastConvolution();
+    // sets up both passes, throws unless the pad is smaller than the filter
+    FastConvolution(FilterShape, Channels, Filters, ImageShape, Pad, Stride);
+    virtual void transform_filters(const Matrix&) = 0;
+    // the filter of a direction from input channel i to output channel o
+    // at row r and column c of the kernel
+    float filter(Direction, const Matrix&, int, int, int, int) const;
+
+   private:
+    bool _prepared;
+    unsigned long _version;
+};
+#endif
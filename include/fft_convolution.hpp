@@ -0,0 +1,49 @@
+#pragma once
+#ifndef fft_convolution_hpp
+#define fft_convolution_hpp
+#include <vector>
+#include "common.h"
+#include "fast_convolution.hpp"
+// Convolution in the frequency domain for large filters. The padded image
+// is cut into blocks which are transformed with an n x n FFT, multiplied
+// with the cached spectra of the filters and transformed back, and the
+// results of neighbouring blocks are added where they overlap
+// (overlap-add). All signals are real: two channels share one complex
+// transform and only the half of each spectrum which the other half
+// mirrors is kept and multiplied. n is the power of two with the fewest
+// operations per output, chosen for each pass on its own.
+class FFTConvolution : public FastConvolution {
+   public:
+    FFTConvolution(FilterShape, Channels, Filters, ImageShape, Pad, Stride);
+    int workspace() const override;
+    void forward_cpu(const float*, float*, float*) const override;
+    void backward_cpu(const float*, float*, float*) const override;
+    // the transform sizes of the forward and the backward pass
+    int size() const { return _forward_fft.n; }
+    int backward_size() const { return _backward_fft.n; }
+
+   private:
+    // twiddle factors and bit reversed indices of the n point FFT
+    struct Transform {
+        int n;
+        std::vector<float> cos, sin;
+        std::vector<int> reversed;
+        // the rows 0 to n / 2 of the n x n spectrum, which determine the
+        // others as the spectrum of a real signal is conjugate symmetric
+        int half() const { return (n / 2 + 1) * n; }
+    };
+    Transform _forward_fft, _backward_fft;
+    // real and imaginary parts of the half spectra of all channel and
+    // filter pairs, conjugated and scaled for the inverse FFT
+    std::vector<float> _forward, _backward;
+    void transform_filters(const Matrix&) override;
+    Transform transform(const Pass&) const;
+    int fft_size(const Pass&) const;
+    void spectra(Direction, const Matrix&, std::vector<float>&) const;
+    void fft(const Transform&, float*, float*, bool) const;
+    void fft_columns(const Transform&, float*, float*, bool) const;
+    void split(const Transform&, const float*, float*, float*) const;
+    void combine(const Transform&, const float*, const float*, float*) const;
+    void convolve(Direction, const float*, float*, float*) const;
+};
+#endif
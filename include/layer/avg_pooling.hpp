@@ -0,0 +1,64 @@
+#pragma once
+#include <memory>
+#ifndef avg_pooling_hpp
+#define avg_pooling_hpp
+#include "../common.h"
+#include "layer.h"
+// Averages every window of every channel, the windows clipped at the border
+// average over the pixels inside the image
+class AvgPooling : public Layer {
+   public:
+    AvgPooling(Window, Stride, ImageShape, Channels);
+    AvgPooling(Window, Stride, const std::shared_ptr<Layer>&);
+    virtual ~AvgPooling() = default;
+    void forward_gpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_gpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    bool binds_buffers() const override { return true; }
+    void forward_bound(const Buffers&, Mode) override;
+    void backward_bound(const Buffers&) override;
+
+   private:
+    Window _window;
+    Stride _stride;
+    ImageShape _inp;
+    Channels _channels;
+    ImageShape _out;
+
+    void check_input_size(int);
+    void initialize_output_dimension() override;
+};
+
+// Reduces every channel to its mean, e.g. to feed the last convolution into
+// a small Dense classifier instead of flattening the whole feature map. The
+// output has the shape channels x 1 x 1
+class GlobalAvgPooling : public Layer {
+   public:
+    GlobalAvgPooling(ImageShape, Channels);
+    explicit GlobalAvgPooling(const std::shared_ptr<Layer>&);
+    virtual ~GlobalAvgPooling() = default;
+    void forward_gpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_gpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    bool binds_buffers() const override { return true; }
+    void forward_bound(const Buffers&, Mode) override;
+    void backward_bound(const Buffers&) override;
+
+   private:
+    ImageShape _inp;
+    Channels _channels;
+
+    void check_input_size(int);
+    void initialize_output_dimension() override;
+};
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+#include <memory>
+#ifndef bilstm_hpp
+#define bilstm_hpp
+#include "../initalization/init.hpp"
+#include "layer.h"
+#include "lstm.hpp"
+// Reads the sequence in both directions with two LSTMs of Features units
+// each, the first half of the output rows is the forward direction and the
+// second half the reverse one. Both directions run in parallel on the cpu
+class BiLSTM : public Layer {
+   public:
+    BiLSTM(Features, Features, Init*);
+    BiLSTM(Features, const std::shared_ptr<Layer>&, Init*);
+    virtual ~BiLSTM() = default;
+    void forward_gpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_gpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    VecSharedStorage return_parameters() override { return parameters; };
+    VecSharedStorage return_gradients() override { return gradients; }
+    VecSharedStorage return_parameters() const override { return parameters; };
+    VecSharedStorage return_gradients() const override { return gradients; }
+    void set_sequences(int) override;
+    void step(const SharedStorage&, SharedStorage&) override;
+
+   private:
+    Features _out;
+    std::unique_ptr<LSTM> _forward;
+    std::unique_ptr<LSTM> _reverse;
+    void initialize_parameters();
+    void initialize_output_dimension() override;
+    void cpu_only(const std::string&);
+};
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#ifndef conv_block_hpp
+#define conv_block_hpp
+#include "convolution.h"
+#include "layer.h"
+#include "pooling.h"
+// A Convolution, optionally followed by a ReLU, and the max Pooling behind
+// it run as one cpu layer. Every thread convolves one image into a buffer
+// of its own, applies the bias and the ReLU and pools it before anything is
+// written, so only the pooled output and a byte of argmax per output leave
+// the cache. The backward pass scatters the gradient through the argmax and
+// hands it to the convolution. NeuralNetwork builds these from chains of
+// the separate layers, the parameters are those of the convolution
+class ConvBlock : public Layer {
+    friend class NeuralNetwork;
+   public:
+    ConvBlock(const std::shared_ptr<Convolution>&, bool,
+              const std::shared_ptr<Pooling>&);
+    virtual ~ConvBlock() = default;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    // whether the pooling reads the convolution's output and its argmax
+    // fits the byte of the fused kernel
+    static bool fusable(const std::shared_ptr<Convolution>&,
+                        const std::shared_ptr<Pooling>&);
+
+   private:
+    std::shared_ptr<Convolution> _conv;
+    bool _relu;
+    std::shared_ptr<Pooling> _pool;
+    std::vector<uint8_t> argmax;
+    // the gradient of the convolution's output, reused between batches
+    SharedStorage conv_gradient;
+
+    int conv_rows();
+    void check_argmax(const SharedStorage&);
+};
+#endif
@@ -4,12 +4,31 @@
 #define convolution_h
 //#include "cublas_v2.h"
 #include "../common.h"
+#include "../conv_cache.hpp"
 #include "../initalization/init.hpp"
+#include "../direct_convolution.hpp"
+#include "../fft_convolution.hpp"
+#include "../winograd.hpp"
 #include "cublas_v2.h"
 #include "layer.h"
+// how a convolution that reads the images directly computes on the cpu,
+// Gemm packs im2col tiles which fit in L2, Im2Col the whole im2col matrix
+// of a sample for one large GEMM, Winograd needs 3x3 filters and stride
+// one, FFT pays off for large filters, layers below their crossover keep
+// the GEMM instead, and Direct runs the vectorized kernels of the widest
+// instruction set
+enum class ConvAlgorithm {
+    Gemm,
+    Im2Col,
+    Winograd2x2,
+    Winograd4x4,
+    FFT,
+    Direct
+};
 class Convolution : public Layer {
     friend class Im2ColLayer;
     friend class Pooling;
+    friend class ConvBlock;
     friend class NeuralNetwork;
    public:
     Convolution(FilterShape, Pad, Stride, Filters, ImageShape, Channels, Init*);
@@ -24,6 +43,17 @@ class Convolution : public Layer {
                       SharedStorage&) override;
     void backward_cpu(const SharedStorage&, const SharedStorage&,
                       SharedStorage&) override;
+    // reads the images themselves and packs im2col tiles inside the GEMM
+    // instead of taking the output of an Im2ColLayer, cpu only
+    void implicit_gemm(bool);
+    void algorithm(ConvAlgorithm);
+    ConvAlgorithm algorithm() const { return _algorithm; }
+    // After this call a convolution reading the images picks the fastest
+    // algorithm for its shape and batch on its next forward pass and
+    // remembers it in the cache file, otherwise it runs the algorithm set
+    // last, the GEMM by default. A convolution taking im2col input always
+    // runs the explicit GEMM
+    void autotune(const std::string& = "conv_algorithms.txt");
 
    private:
     FilterShape _kernel;
@@ -34,6 +64,20 @@ class Convolution : public Layer {
     Channels _channels;
     cublasHandle_t _handle;
     std::vector<SharedStorage> assistance_parameters;
+    bool _implicit;
+    std::unique_ptr<FastConvolution> _fast;
+    ConvAlgorithm _algorithm;
+    bool _tune;
+    std::string _cache;
+    // direct convolutions in a row, with only Relu or Dropout layers in
+    // between, pass their activations and gradients on in the blocked
+    // layout: the network links each to the convolution it reads from, the
+    // reader asks for a blocked output while it runs direct, and the
+    // layouts of a batch are fixed at its forward pass
+    Convolution* _producer;
+    bool _blocked_request;
+    bool _blocked_in, _blocked_out;
+    Matrix _blocked_bias;
 
     void initialize_weight(Init*);
     void initialize_grad();
@@ -50,6 +94,21 @@ class Convolution : public Layer {
     void backwards_weight_grad_para(int&, int&, int&);
     void backwards_out_grad_para(int&, int&, int&);
     void resize_assistance(const SharedStorage&);
+    void reduce_gradients(std::vector<Matrix>&);
+    int tile_positions();
+    std::string tuning_key(int) const;
+    void tune(const SharedStorage&, SharedStorage&);
+    DirectConvolution* direct() const;
+    void choose_layouts();
+    void forward_implicit_cpu(const SharedStorage&, SharedStorage&);
+    int sample_workspace();
+    void forward_sample_cpu(const float*, float*, float*);
+    void backward_explicit_cpu(const SharedStorage&, const SharedStorage&,
+                               SharedStorage&, std::vector<Matrix>&,
+                               std::vector<Matrix>&);
+    void backward_implicit_cpu(const SharedStorage&, const SharedStorage&,
+                               SharedStorage&, std::vector<Matrix>&,
+                               std::vector<Matrix>&);
     void initialize_previous(Layer*);
     void reset_previous(const std::shared_ptr<Layer>&);
 };
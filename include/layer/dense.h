@@ -30,9 +30,14 @@ class Dense : public Layer {
     void initialize_output_dimension() override;
     void initialize_input_dimension(const std::shared_ptr<Layer>&);
     void resize_assistance(int);
+    void check_dense_input(const SharedStorage&);
+    void forward_sparse_cpu(const SharedStorage&, SharedStorage&);
+    void backward_sparse_cpu(const SharedStorage&, const SharedStorage&);
     std::vector<SharedStorage> assistance_parameters;
     cublasHandle_t _handle;
     Features _out;
     Features _in;
+    // weight columns with a gradient from the last sparse backward pass
+    std::vector<int> _touched;
 };
 #endif
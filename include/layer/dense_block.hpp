@@ -0,0 +1,42 @@
+#pragma once
+#include <memory>
+#ifndef dense_block_hpp
+#define dense_block_hpp
+#include "../initalization/init.hpp"
+#include "dense.h"
+#include "layer.h"
+enum class Activation { Relu, Sigmoid, Tanh };
+// A Dense layer and its activation as one cpu layer. The observations are
+// cut into tiles, the GEMM of a tile starts from the bias and the
+// activation is applied while the tile is still in cache. The backward pass
+// multiplies each tile of the incoming gradient with the derivative, taken
+// from the output, right before its GEMMs. NeuralNetwork builds these from
+// a Dense followed by a Relu, sigmoid and tanh blocks are constructed
+// directly. The parameters are those of the Dense layer
+class DenseBlock : public Layer {
+    friend class NeuralNetwork;
+   public:
+    DenseBlock(Features, const std::shared_ptr<Layer>&, Init*, Activation);
+    DenseBlock(const std::shared_ptr<Dense>&, Activation);
+    virtual ~DenseBlock() = default;
+    void forward_gpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_gpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+
+   private:
+    std::shared_ptr<Dense> _dense;
+    Activation _activation;
+    // the output of the last forward pass, the backward pass of the same
+    // batch takes the derivative from it
+    SharedStorage _output;
+
+    int tile_observations();
+    void sparse_backward_cpu(const SharedStorage&, const SharedStorage&,
+                             SharedStorage&);
+};
+#endif
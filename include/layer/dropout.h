@@ -23,17 +23,23 @@ class Dropout : public Layer {
                       SharedStorage&) override;
     void backward_cpu(const SharedStorage&, const SharedStorage&,
                       SharedStorage&) override;
+    bool binds_buffers() const override { return true; }
+    void forward_bound(const Buffers&, Mode) override;
+    void backward_bound(const Buffers&) override;
     std::vector<int> output_dimension() override;
    private:
     curandGenerator_t gen_device;
-    std::mt19937 gen_host;
+    std::vector<std::mt19937> gen_host;
     SharedStorage masking;
     dtype probability;
-    std::uniform_real_distribution<float> dis;
+    // the layer's own random streams, each covering stream_columns columns
+    unsigned _layer;
+    static constexpr int stream_columns = 4;
 
     void initialize_random();
     void initialize_masking();
-    void check_masking(const SharedStorage&);
+    void check_masking(int, int);
+    void check_streams(int);
     void check_backward();
 };
 #endif
@@ -0,0 +1,38 @@
+#pragma once
+#include <memory>
+#ifndef embedding_hpp
+#define embedding_hpp
+#include "../initalization/init.hpp"
+#include "layer.h"
+// Maps token ids, stored one per column in a single row, to the columns of
+// an embedding table
+class Embedding : public Layer {
+   public:
+    Embedding(Features, Vocabulary, Init*);
+    Embedding(Features, Vocabulary, const std::shared_ptr<Layer>&, Init*);
+    virtual ~Embedding() = default;
+    void forward_gpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_gpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    VecSharedStorage return_parameters() override { return parameters; };
+    VecSharedStorage return_gradients() override { return gradients; }
+    VecSharedStorage return_parameters() const override { return parameters; };
+    VecSharedStorage return_gradients() const override { return gradients; }
+
+   private:
+    Features _out;
+    Vocabulary _vocab;
+    // columns of the table gradient written by the last backward pass
+    std::vector<int> _touched;
+    void initialize_weight(Init*);
+    void initialize_grad();
+    void initialize_output_dimension() override;
+    void check_input_dimension(const std::shared_ptr<Layer>&);
+    int token(dtype);
+};
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+#include <memory>
+#ifndef gru_hpp
+#define gru_hpp
+#include "../initalization/init.hpp"
+#include "layer.h"
+// Gated recurrent unit with the update, reset and candidate gates [z, r, n]
+// stacked like the LSTM gates; three gates instead of four make it the
+// cheaper recurrent cell. Only runs on the CPU
+class GRU : public Layer {
+   public:
+    GRU(Features, Features, Init*);
+    GRU(Features, const std::shared_ptr<Layer>&, Init*);
+    virtual ~GRU() = default;
+    void forward_gpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_gpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    VecSharedStorage return_parameters() override { return parameters; };
+    VecSharedStorage return_gradients() override { return gradients; }
+    VecSharedStorage return_parameters() const override { return parameters; };
+    VecSharedStorage return_gradients() const override { return gradients; }
+    void set_sequences(int) override;
+    void step(const SharedStorage&, SharedStorage&) override;
+    void reset_state(int) override;
+
+   private:
+    void initialize_weight(Init*);
+    void initialize_grad();
+    void initialize_output_dimension() override;
+    void initialize_input_dimension(const std::shared_ptr<Layer>&);
+    int active_sequences(const std::string&, int);
+    void maybe_resize_state(int, int);
+    void clip_gradients();
+    Features _out;
+    Features _in;
+    // activated gates, recurrent part of n, states with the initial one
+    // first, and the gate gradients of the input and the recurrent part
+    Matrix _gates;
+    Matrix _hn;
+    Matrix _state;
+    Matrix _d_x;
+    Matrix _d_h;
+    // W_h * h_{t-1} of one step and the state gradients of the sequences
+    Matrix _recurrent;
+    Matrix _d_cum;
+    Matrix _d_state;
+    int _sequences;
+    int _active_sequences;
+    // inference state of step, one column per stream
+    Matrix _step_gates;
+    Matrix _step_recurrent;
+    Matrix _step_hn;
+    Matrix _step_state;
+};
+#endif
@@ -2,8 +2,25 @@
 #ifndef layer_h
 #define layer_h
 #include <memory>
+#include <string>
 #include <vector>
 #include "../storage.h"
+// whether a forward pass trains the network or only predicts
+enum class Mode { Train, Predict };
+Mode mode_of(const std::string&);
+const std::string& mode_name(Mode);
+// The raw cpu buffers of a layer, column major with one observation per
+// column. A compiled plan binds them once for the values and gradients of
+// a batch, the gradients stay null in the forward pass
+struct Buffers {
+    const float* in;
+    float* out;
+    const float* grad_in;
+    float* grad_out;
+    int in_rows;
+    int out_rows;
+    int cols;
+};
 class Layer {
    protected:
     friend class NeuralNetwork;
@@ -35,6 +52,15 @@ class Layer {
                               SharedStorage&);
     virtual void backward_cpu(const SharedStorage&, const SharedStorage&,
                               SharedStorage&);
+    // Layers whose cpu passes need nothing but the raw buffers, a compiled
+    // plan binds those once instead of handing on the storages
+    virtual bool binds_buffers() const { return false; }
+    virtual void forward_bound(const Buffers&, Mode) {};
+    virtual void backward_bound(const Buffers&) {};
+    // the buffers of a forward pass and of a backward pass on storages
+    static Buffers buffers(const SharedStorage&, const SharedStorage&);
+    static Buffers buffers(const SharedStorage&, const SharedStorage&,
+                           const SharedStorage&);
     virtual VecSharedStorage return_parameters();
     virtual VecSharedStorage return_gradients();
     virtual VecSharedStorage return_parameters() const;
@@ -42,6 +68,13 @@ class Layer {
     //virtual void clear_gradients_cpu();
     //virtual void clear_gradients_gpu();
     virtual int n_paras() { return parameters.size(); };
+    // recurrent layers read a training batch as this many sequences which
+    // advance in lockstep
+    virtual void set_sequences(int) {};
+    // advances persistent inference state by one observation per stream,
+    // stateless layers simply run their forward pass
+    virtual void step(const SharedStorage&, SharedStorage&);
+    virtual void reset_state(int) {};
     virtual std::shared_ptr<Layer> previous() {return _previous;};
 };
 #endif
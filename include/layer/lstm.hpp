@@ -6,6 +6,8 @@
 #include "cublas_v2.h"
 #include "layer.h"
 class LSTM : public Layer {
+    friend class BiLSTM;
+
    public:
     LSTM(Features, Features, Init*);
     LSTM(Features, const std::shared_ptr<Layer>&, Init*);
@@ -22,16 +24,35 @@ class LSTM : public Layer {
     VecSharedStorage return_gradients() override { return gradients; }
     VecSharedStorage return_parameters() const override { return parameters; };
     VecSharedStorage return_gradients() const override { return gradients; }
+    void set_sequences(int) override;
+    void step(const SharedStorage&, SharedStorage&) override;
+    void reset_state(int) override;
+    // single steps of the cpu passes, the wavefront executor interleaves
+    // them across stacked layers; the input projection and the input
+    // gradient run as one GEMM over the steps first to last
+    int prepare_forward_cpu(int, const std::string&);
+    void project_input_cpu(const Matrix&, int, int);
+    void forward_step_cpu(Matrix&, int);
+    int prepare_backward_cpu();
+    void backward_step_cpu(const Matrix&, int);
+    void input_gradient_cpu(Matrix&, int, int);
+    void finish_backward_cpu(const Matrix&);
+    // the cpu passes on matrices, the output and the incoming gradient may
+    // be rows of a larger buffer; the input gradient is a separate product
+    // so that several layers can add theirs to the same matrix
+    void forward_cpu(const Matrix&, MatrixBlock, const std::string&);
+    void backward_cpu(const Matrix&, ConstMatrixBlock);
+    void input_gradient_cpu(Matrix&, bool);
 
    private:
     void initialize_weight(Init*);
     void initialize_states();
     void clip_gradients();
     void clip_gradients_gpu();
-    void maybe_resize_state(int);
-    void expand_states(int);
-    void reorganize_states(int);
-    void construct_sigma_cpu();
+    void maybe_resize_state(int, int);
+    void expand_states(int, int);
+    void reorganize_states(int, int);
+    int active_sequences(const std::string&, int);
     void construct_sigma_gpu();
     void initialize_grad();
     void initialize_output_dimension() override;
@@ -45,10 +66,24 @@ class LSTM : public Layer {
     void new_cell_state(int, const SharedStorage&);
     void internal_deriv(int);
     void para_gradients(const SharedStorage&);
+    void recurrent_step_cpu(int);
+    void recurrent_backward_step_cpu(ConstMatrixBlock, int);
+    int previous_col(int);
+    int next_col(int);
     cublasHandle_t _handle;
     Features _out;
     Features _in;
     std::vector<SharedStorage> states;
     std::vector<SharedStorage> assistance_parameters;
+    // sequences per training batch and in the current state layout
+    int _sequences;
+    int _active_sequences;
+    // runs from the last step to the first, the initial state then sits
+    // after the last step and nothing is carried between batches
+    bool _reverse;
+    // inference state of step, one column per stream
+    Matrix _step_gates;
+    Matrix _step_cell;
+    Matrix _step_state;
 };
 #endif
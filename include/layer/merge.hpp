@@ -0,0 +1,91 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#ifndef merge_hpp
+#define merge_hpp
+#include "layer.h"
+// Joins parallel branches which start at the same layer, the fork. Every
+// branch is the chain of layers from the fork to one of the given layers, a
+// branch given as the fork itself passes it on unchanged, e.g. the skip of
+// a residual block. The merge takes the fork as its previous layer and runs
+// the branches itself, each on a thread of its own in both passes, so
+// NeuralNetwork still sees a chain while residual and inception blocks nest
+// as deep as needed. The branch layers are built for the cpu, their
+// parameters are those of the merge. The network fuses and freezes the
+// branches like its own chain of layers
+class Merge : public Layer {
+    friend class NeuralNetwork;
+
+   public:
+    Merge(const std::string&, const std::vector<std::shared_ptr<Layer>>&);
+    virtual ~Merge() = default;
+    void forward_gpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void forward_cpu(const SharedStorage&, SharedStorage&,
+                     const std::string&) override;
+    void backward_gpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void backward_cpu(const SharedStorage&, const SharedStorage&,
+                      SharedStorage&) override;
+    void set_sequences(int) override;
+    void reset_state(int) override;
+    int branches() const { return _branches.size(); }
+    const std::deque<std::shared_ptr<Layer>>& branch(int b) const {
+        return _branches[b];
+    }
+
+   protected:
+    // the layers of each branch, from the one after the fork to its end
+    std::vector<std::deque<std::shared_ptr<Layer>>> _branches;
+    // the output size of each branch
+    std::vector<int> _sizes;
+    // the gradient each branch receives at its end
+    std::vector<SharedStorage> _ends;
+    // combines the branch outputs into the merge's output
+    virtual void combine(const std::vector<const Matrix*>&, Matrix&) = 0;
+    // fills _ends from the gradient of the merge's output
+    virtual void split(const SharedStorage&) = 0;
+
+   private:
+    // the input of every branch layer followed by the branch output, and
+    // the gradients of those inputs but the fork
+    std::vector<std::vector<SharedStorage>> _values;
+    std::vector<std::vector<SharedStorage>> _gradients;
+    // the first branch with layers, it writes its gradient of the fork
+    // straight into the merge's, the others are added to it one by one
+    // through the single buffer _fork
+    int _direct;
+    SharedStorage _fork;
+    int _obs;
+
+    void find_branches(const std::vector<std::shared_ptr<Layer>>&);
+    // takes the parameters and the direct branch from the branch layers,
+    // again whenever the network replaces them
+    void collect();
+    void allocate(const SharedStorage&);
+    const SharedStorage& output(int, const SharedStorage&);
+};
+
+// Sums branches of the same size, the output keeps the first one's shape
+class Add : public Merge {
+   public:
+    explicit Add(const std::vector<std::shared_ptr<Layer>>&);
+
+   protected:
+    void combine(const std::vector<const Matrix*>&, Matrix&) override;
+    void split(const SharedStorage&) override;
+};
+
+// Stacks the branch outputs, in the given order. Images of the same height
+// and width stack along their channels, anything else into one vector
+class Concat : public Merge {
+   public:
+    explicit Concat(const std::vector<std::shared_ptr<Layer>>&);
+
+   protected:
+    void combine(const std::vector<const Matrix*>&, Matrix&) override;
+    void split(const SharedStorage&) override;
+};
+#endif
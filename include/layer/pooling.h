@@ -1,10 +1,13 @@
 #pragma once
+#include <cstdint>
 #include <memory>
+#include <vector>
 #ifndef pooling_h
 #define pooling_h
 #include "layer.h"
 #include "convolution.h"
 class Pooling : public Layer {
+    friend class ConvBlock;
    public:
     //Pooling(int);
     Pooling(Window, Stride, ImageShape, Channels);
@@ -18,10 +21,15 @@ class Pooling : public Layer {
                       SharedStorage&) override;
     void backward_cpu(const SharedStorage&, const SharedStorage&,
                       SharedStorage&) override;
+    bool binds_buffers() const override { return true; }
+    void forward_bound(const Buffers&, Mode) override;
+    void backward_bound(const Buffers&) override;
 
    private:
     SharedStorage mask;
     SharedStorage mask2;
+    // the cpu argmax as the offset within the window, one byte per output
+    std::vector<uint8_t> argmax;
     Window _window;
     Stride _stride;
     ImageShape _inp;
@@ -30,8 +38,9 @@ class Pooling : public Layer {
     int batch_size;
 
     void check_masking(const SharedStorage&);
+    void check_argmax(int, int);
     void initialize_masking();
-    void inline check_input_size(const SharedStorage&);
+    void inline check_input_size(int, int);
     void initialize_output_dimension() override;
     void initialize_from_previous(const std::shared_ptr<Layer>&);
 };
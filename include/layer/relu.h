@@ -19,6 +19,9 @@ class Relu : public Layer {
                       SharedStorage&) override;
     void backward_cpu(const SharedStorage&, const SharedStorage&,
                       SharedStorage&) override;
+    bool binds_buffers() const override { return true; }
+    void forward_bound(const Buffers&, Mode) override;
+    void backward_bound(const Buffers&) override;
 
    private:
     cublasHandle_t _handle;
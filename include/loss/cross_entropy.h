@@ -24,6 +24,10 @@ class CrossEntropy : public Loss {
 
    private:
     dtype vec_loss(const Vector&, const Vector&);
+    // a target with a single row holds class indices instead of one-hot rows
+    bool is_label(const Matrix&, const Matrix&);
+    int check_label(dtype, int);
+    dtype label_loss(const Matrix&, const Matrix&);
     typedef dtype (CrossEntropy::*loss_func)(const SharedStorage&,
                                              const SharedStorage&);
     typedef void (CrossEntropy::*grad_func)(SharedStorage&,
@@ -3,6 +3,7 @@
 #define math_h
 #include <curand.h>
 #include <curand_kernel.h>
+#include <cstdint>
 #include <memory>
 #include "common.h"
 #include "cublas_v2.h"
@@ -31,17 +32,54 @@ void my_Matrix_addition_inplace(const SharedStorage&, SharedStorage&, dtype);
 void my_Matrix_addition(const SharedStorage&, const SharedStorage&,
                         SharedStorage&, dtype, dtype);
 void my_cuda_masking(dtype, SharedStorage&);
+// the argmax of a max pooling output which passes no gradient back
+constexpr uint8_t pooling_no_gradient = 255;
+// pools consecutive planes on the calling thread, relu applies a ReLU to
+// the maxima as the epilogue of a fused convolution block
+void max_pooling_planes_cpu(const float* src, int window, int stride,
+                            int rows, int cols, int planes, int out_height,
+                            int out_width, bool relu, float* dest,
+                            uint8_t* mask);
 void pooling_cpu(const float* src, int window, int stride, int rows, int cols,
                  int channels, int out_height, int out_width, int n_batches,
-                 float* dest, float* mask);
-void pooling_backward_cpu(const float* src, const float* mask, int window,
+                 float* dest, uint8_t* mask);
+void pooling_backward_cpu(const float* src, const uint8_t* mask, int window,
                           int stride, int rows, int cols, int channels,
                           int out_height, int out_width, int n_batches,
                           float* dest);
+void avg_pooling_cpu(const float* src, int window, int stride, int rows,
+                     int cols, int channels, int out_height, int out_width,
+                     int n_batches, float* dest);
+void avg_pooling_backward_cpu(const float* src, int window, int stride,
+                              int rows, int cols, int channels,
+                              int out_height, int out_width, int n_batches,
+                              float* dest);
+void global_avg_pooling_cpu(const float* src, int size, int planes,
+                            float* dest);
+void global_avg_pooling_backward_cpu(const float* src, int size, int planes,
+                                     float* dest);
 void im2col_cpu(const float* data_im, int channels, int rows, int cols,
                 int kernel_h, const int kernel_w, int pad, int stride,
                 float* data_col);
 void col2im_cpu(const dtype* data_col, int channels, int rows, int cols,
                 int kernel_h, int kernel_w, int pad, int stride, dtype*);
+void im2col_tile_cpu(const float* data_im, int channels, int rows, int cols,
+                     int kernel_h, int kernel_w, int pad, int stride,
+                     int first, int count, float* data_col);
+void col2im_tile_cpu(const float* data_col, int channels, int rows, int cols,
+                     int kernel_h, int kernel_w, int pad, int stride,
+                     int first, int count, float* data_im);
 Matrix sigmoid(const Matrix&);
+void lstm_cell_forward_cpu(int nh, int obs, dtype* gates,
+                           const dtype* cell_prev, dtype* cell, dtype* state);
+void lstm_cell_backward_cpu(int nh, int obs, const dtype* gates,
+                            const dtype* cell_prev, const dtype* cell,
+                            const dtype* d_state, dtype* d_cell, dtype* d_all);
+void gru_cell_forward_cpu(int nh, int obs, dtype* gates,
+                          const dtype* recurrent, const dtype* state_prev,
+                          dtype* state, dtype* hn);
+void gru_cell_backward_cpu(int nh, int obs, const dtype* gates,
+                           const dtype* hn, const dtype* state_prev,
+                           const dtype* d_state, dtype* d_x, dtype* d_h,
+                           dtype* d_prev);
 #endif
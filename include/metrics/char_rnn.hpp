@@ -17,5 +17,7 @@ class CharRNN : public Metric {
     dtype temperature;
     void convert_to_stdout(const std::vector<int>&);
     int pick_value(const Matrix&);
+    int first_token(const Matrix&, int);
+    Matrix encode(int, int);
 };
 #endif
@@ -2,6 +2,7 @@
 #ifndef metric_hpp
 #define metric_hpp
 #include <memory>
+#include <stdexcept>
 #include <vector>
 #include "../neural_network.h"
 //#include "../../include/layer/layer.h"
@@ -16,5 +17,10 @@ class Metric {
     Metric(const std::string& s, NeuralNetwork* nn): _name(s), _nn(nn) {};
     virtual ~Metric() {};
     virtual void validate(const Matrix&, const Matrix&) = 0;
+    // metrics which can score sparse features override this
+    virtual void validate(const SparseMatrix&, const Matrix&) {
+        throw std::invalid_argument("The metric " + _name +
+                                    " does not support sparse features");
+    }
 };
 #endif
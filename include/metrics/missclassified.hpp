@@ -8,8 +8,10 @@ class Missclassified : public Metric {
     explicit Missclassified(NeuralNetwork*);
     virtual ~Missclassified(){};
     void validate(const Matrix&, const Matrix&) override;
+    void validate(const SparseMatrix&, const Matrix&) override;
 
    private:
     void n_missclassified(const Matrix&, const Matrix&);
+    int true_class(const Matrix&, int);
 };
 #endif
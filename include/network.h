@@ -9,6 +9,7 @@
 #include <random>
 #include <vector>
 #include "debug_info.hpp"
+#include "execution_plan.hpp"
 #include "gradient_descent/gradient_descent.h"
 #include "layer/layer.h"
 #include "loss/loss.h"
@@ -16,9 +17,17 @@
 #include "trainArgs.h"
 //#include "metrics/metric.hpp"
 class Metric;
+class Merge;
+class Wavefront;
+// what freezing a network for inference eliminated
+struct InferenceReport {
+    int layers;
+    long parameter_bytes;
+    // of the buffers between the layers, per observation
+    long activation_bytes;
+};
 class NeuralNetwork {
     friend class Metric;
-    friend class CharRNN;
 
    public:
     typedef std::vector<std::shared_ptr<Storage>> VecSharedStorage;
@@ -33,6 +42,9 @@ class NeuralNetwork {
     //@brief Returns a prediction from the neural network, calling this
     // function allocates shared storage;
     Matrix predict(const Matrix&, DebugInfo&& = DebugInfo("", ""));
+    //@brief Returns a prediction for sparse features, only the cpu layers
+    // accept them
+    Matrix predict(const SparseMatrix&, DebugInfo&& = DebugInfo("", ""));
     //@brief Returns a prediction from the neural network, calling this
     // function presumes that the SharedStorage is appropriate for all the
     // layers
@@ -40,23 +52,71 @@ class NeuralNetwork {
     // NOT DEFINED !!!
     void backwards(std::vector<SharedStorage>& gradients,
                    const std::vector<SharedStorage>& values, DebugInfo&);
-    std::vector<SharedStorage> allocate_forward(int);
-    std::vector<SharedStorage> allocate_backward(int);
+    //@brief Clears the recurrent inference state of the given number of
+    // streams which step advances together
+    void reset_state(int = 1);
+    //@brief Feeds one observation per stream, one column each, through the
+    // network on the cpu and returns the output of every stream; recurrent
+    // layers continue from the state the previous call left
+    const Matrix& step(const Matrix&);
+    //@brief Same as above for a network reading token ids, one per stream
+    const Matrix& step(const Labels&);
+    //@brief Runs stacked LSTM layers in the cpu passes as a wavefront with
+    // one thread per layer, off by default
+    void wavefront(bool);
+    //@brief Prepares the network for predictions only: the Dropout layers
+    // are dropped, as their input passes on unchanged, consecutive Dense
+    // layers fold into one where that saves work and the convolutions
+    // transform their filters right away. A frozen network cannot be
+    // trained any more
+    InferenceReport freeze();
+    // the storages of a pass over a number of observations, for a sparse
+    // input the first one stays empty until a batch is put in
+    std::vector<SharedStorage> allocate_forward(int, bool = false);
+    std::vector<SharedStorage> allocate_backward(int, bool = false);
     void forward(std::vector<SharedStorage>&, const std::string&, DebugInfo&);
     void fill_hiddens(std::vector<SharedStorage>&, const Matrix&);
     void update_weights(std::shared_ptr<GradientDescent>&,
                         std::vector<VecSharedStorage>&, int);
     void train(std::shared_ptr<GradientDescent>&);
+    //@brief Trains the network, with more than one sequence every batch
+    // holds that many independent streams of BatchSize consecutive
+    // observations each, in time-major column order. A positive Truncation
+    // backpropagates each batch in windows of that many steps, which bounds
+    // the memory, and sums their gradients into one update
     void train(const Matrix&, const Matrix&, std::shared_ptr<GradientDescent>&,
                Epochs, Patience, BatchSize, std::vector<Metric*>&,
-               DebugInfo&& = DebugInfo("", ""), Shuffle = Shuffle(true));
+               DebugInfo&& = DebugInfo("", ""), Shuffle = Shuffle(true),
+               Sequences = Sequences(1), Truncation = Truncation(0));
+    //@brief Trains on class-index targets, each label is the row of the
+    // network's output that should be one
+    void train(const Matrix&, const Labels&, std::shared_ptr<GradientDescent>&,
+               Epochs, Patience, BatchSize, std::vector<Metric*>&,
+               DebugInfo&& = DebugInfo("", ""), Shuffle = Shuffle(true),
+               Sequences = Sequences(1), Truncation = Truncation(0));
+    //@brief Trains on token ids, one per observation, which are fed to an
+    // Embedding layer after the input
+    void train(const Labels&, const Labels&, std::shared_ptr<GradientDescent>&,
+               Epochs, Patience, BatchSize, std::vector<Metric*>&,
+               DebugInfo&& = DebugInfo("", ""), Shuffle = Shuffle(true),
+               Sequences = Sequences(1), Truncation = Truncation(0));
+    //@brief Trains on sparse features, the producer assembles batches in
+    // compressed rows which the first Dense layer consumes on the cpu
+    void train(const SparseMatrix&, const Matrix&,
+               std::shared_ptr<GradientDescent>&, Epochs, Patience, BatchSize,
+               std::vector<Metric*>&, DebugInfo&& = DebugInfo("", ""),
+               Shuffle = Shuffle(true));
+    void train(const SparseMatrix&, const Labels&,
+               std::shared_ptr<GradientDescent>&, Epochs, Patience, BatchSize,
+               std::vector<Metric*>&, DebugInfo&& = DebugInfo("", ""),
+               Shuffle = Shuffle(true));
     dtype validate(std::chrono::milliseconds);
 
    private:
     typedef void (NeuralNetwork::*update_func)(
         std::shared_ptr<GradientDescent>&, std::vector<VecSharedStorage>&, int);
     typedef void (NeuralNetwork::*forward_func)(std::vector<SharedStorage>&,
-                                                const std::string&, DebugInfo&);
+                                                Mode, DebugInfo&);
     typedef void (NeuralNetwork::*backward_func)(
         std::vector<SharedStorage>&, const std::vector<SharedStorage>&,
         DebugInfo&);
@@ -66,20 +126,27 @@ class NeuralNetwork {
     std::deque<std::shared_ptr<Layer>> layers;
     std::shared_ptr<Loss> loss;
     std::unique_ptr<trainArgs> train_args;
+    std::vector<SharedStorage> step_values;
+    std::vector<std::shared_ptr<Wavefront>> wavefronts;
+    ExecutionPlan plan;
+    // parameter gradients summed over the truncation windows of a batch
+    std::vector<Matrix> window_gradients;
+    bool use_wavefront = false;
+    bool frozen = false;
     void create_loss(const std::string& s);
     void update_weights_cpu(std::shared_ptr<GradientDescent>&,
                             std::vector<VecSharedStorage>&, int);
     void update_weights_gpu(std::shared_ptr<GradientDescent>&,
                             std::vector<VecSharedStorage>&, int);
-    void forward_gpu(std::vector<SharedStorage>&, const std::string&,
-                     DebugInfo&);
-    void forward_cpu(std::vector<SharedStorage>&, const std::string&,
-                     DebugInfo&);
+    void forward(std::vector<SharedStorage>&, Mode, DebugInfo&);
+    void forward_gpu(std::vector<SharedStorage>&, Mode, DebugInfo&);
+    void forward_cpu(std::vector<SharedStorage>&, Mode, DebugInfo&);
     void backward_cpu(std::vector<SharedStorage>&,
                       const std::vector<SharedStorage>&, DebugInfo&);
     void backward_gpu(std::vector<SharedStorage>&,
                       const std::vector<SharedStorage>&, DebugInfo&);
     void get_new_sample(const std::vector<int>&, Matrix&, Matrix&);
+    void get_new_sample(const std::vector<int>&, SparseMatrix&, Matrix&);
     void consumer(std::shared_ptr<GradientDescent>&, DebugInfo&,
                   std::vector<Metric*>&);
     void producer();
@@ -91,21 +158,48 @@ class NeuralNetwork {
                           DebugInfo&);
     void producer_predict(const Matrix&,
                           threadsafe_queue<std::vector<SharedStorage>>*);
+    void producer_predict(const SparseMatrix&,
+                          threadsafe_queue<std::vector<SharedStorage>>*);
     void append_convolution_layer(Layer*);
     void construct_layers(std::vector<Layer*>);
-    void insert_cnn_layer(const std::shared_ptr<Layer>&);
-    void construct_layers(std::shared_ptr<Layer>);
+    void insert_cnn_layer(std::deque<std::shared_ptr<Layer>>&,
+                          const std::shared_ptr<Layer>&, bool);
+    std::shared_ptr<Layer> conv_block(const std::shared_ptr<Layer>&);
+    std::shared_ptr<Layer> dense_block(const std::shared_ptr<Layer>&);
+    void construct_layers(std::shared_ptr<Layer>, bool = false);
+    std::deque<std::shared_ptr<Layer>> fuse(std::shared_ptr<Layer>,
+                                            const std::shared_ptr<Layer>&,
+                                            bool = true);
+    void fuse_branches(const std::shared_ptr<Merge>&);
     int convert_output_dimension(const std::shared_ptr<Layer>&);
     void allocate_storage(int, std::vector<SharedStorage>&,
-                          const std::shared_ptr<Layer>&);
+                          const std::shared_ptr<Layer>&, bool);
     void maybe_shuffle(std::vector<int>&, int&, const int&, const int&,
                        std::mt19937&);
     void prepare_subset(const std::vector<int>&, std::vector<int>&, int&,
                         const int&);
+    void prepare_streams(std::vector<int>&, int&);
+    void set_sequences(Sequences, bool);
     int check_input_dimension(const std::vector<int>&);
+    void check_input_features(int);
+    void check_labels(const Labels&);
+    void check_not_frozen();
+    int drop_identities(std::deque<std::shared_ptr<Layer>>&, size_t, size_t,
+                        InferenceReport&);
+    int fold_dense(std::deque<std::shared_ptr<Layer>>&, size_t,
+                   InferenceReport&);
+    void freeze_layers(std::deque<std::shared_ptr<Layer>>&, size_t, size_t,
+                       InferenceReport&);
     void print_network();
+    SharedStorage window_of(const SharedStorage&, int);
+    void accumulate_gradients(int);
+    void swap_window_gradients();
+    void find_recurrent_stacks();
+    void link_convolutions(const std::deque<std::shared_ptr<Layer>>&);
+    void compile_plan();
     void display_train_loss(dtype&);
     void predict(const Matrix&, SharedStorage&, DebugInfo&);
+    void predict(const SparseMatrix&, SharedStorage&, DebugInfo&);
     bool continue_training();
 };
 #endif
@@ -8,9 +8,19 @@
 #include "layer/dropout.h"
 #include "layer/convolution.h"
 #include "layer/pooling.h"
+#include "layer/avg_pooling.hpp"
+#include "layer/conv_block.hpp"
+#include "layer/dense_block.hpp"
+#include "layer/merge.hpp"
 #include "layer/im2col_layer.h"
 #include "layer/lstm.hpp"
+#include "layer/bilstm.hpp"
+#include "layer/gru.hpp"
+#include "layer/embedding.hpp"
 #include "network.h"
+#include "execution_plan.hpp"
+#include "utils/execution_context.hpp"
+#include "wavefront.hpp"
 #include "storage.h"
 #include "loss/cross_entropy.h"
 #include "loss/loss.h"
@@ -7,6 +7,8 @@ class Storage {
    public:
     explicit Storage();
     explicit Storage(const Matrix&);
+    // holds a batch of sparse observations, they are only readable on the cpu
+    explicit Storage(const SparseMatrix&);
     // Storage(const Storage&) = delete;
     Storage& operator=(Storage other) = delete;
     // Storage(const Eigen::MatrixXd&&) // I need to provide that!
@@ -20,21 +22,32 @@ class Storage {
     void update_gpu_data(const dtype*, const unsigned int, const unsigned int);
     dtype* cpu_pointer();
     dtype* gpu_pointer();
-    int get_rows() { return _data.rows(); }
-    int get_cols() { return _data.cols(); }
+    int get_rows() { return _is_sparse ? _sparse.cols() : _data.rows(); }
+    int get_cols() { return _is_sparse ? _sparse.rows() : _data.cols(); }
+    bool is_sparse() { return _is_sparse; }
+    const SparseMatrix& return_sparse_const();
     Matrix& return_data();
     const Matrix& return_data_const();
     Matrix copy_data();
     bool is_set();
+    // increases whenever the data is handed out for writing, lets caches
+    // derived from the data tell whether it may have changed
+    unsigned long version() { return _version; }
 
    private:
+    // which copy holds the latest data, checked by every accessor
+    enum class Head { Uninit, Cpu, Gpu, Sync };
     Matrix _data;
+    SparseMatrix _sparse;
+    bool _is_sparse;
     dtype* _cpu_pointer;
     dtype* _gpu_pointer;
-    std::string recent_head;
+    Head recent_head;
+    unsigned long _version;
     void initialize_gpu_memory();
     void sync_to_cpu();
     void sync_to_gpu();
+    void check_dense(const char*);
 };
 
 bool same_size(const std::shared_ptr<Storage>&,
@@ -17,6 +17,11 @@ class trainArgs {
    public:
     trainArgs() = default;
     trainArgs(const Matrix&, const Matrix&, Epochs, Patience, BatchSize,
+              std::shared_ptr<GradientDescent>&,
+              std::deque<std::shared_ptr<Layer>>&,
+              Shuffle shuffle, Sequences = Sequences(1),
+              Truncation = Truncation(0));
+    trainArgs(const SparseMatrix&, const Matrix&, Epochs, Patience, BatchSize,
               std::shared_ptr<GradientDescent>&,
               std::deque<std::shared_ptr<Layer>>&,
               Shuffle shuffle);
@@ -28,16 +33,26 @@ class trainArgs {
     int cummulative_iter() { return _cum_iter; }
     void advance_cumulative_iter(int step) { _cum_iter += step; }
     int total_iter() { return _total_iter; }
-    void advance_total_iter() { _total_iter += _batch_size; };
-    int max_total_iter() { return _x_train.rows(); }
+    void advance_total_iter() { _total_iter += batch_size(); };
+    int max_total_iter() { return n_train(); }
+    int n_train() { return _sparse ? _x_train_sparse.rows() : _x_train.rows(); }
+    bool sparse() { return _sparse; }
     int epochs() { return _epochs; }
     int current_epoch() { return _current_epoch; }
     void advance_epoch() { _current_epoch++; }
-    int batch_size() { return _batch_size; }
+    // columns per batch, the steps of all sequences
+    int batch_size() { return _batch_size * _sequences; }
+    int steps() { return _batch_size; }
+    int sequences() { return _sequences; }
+    // a batch is backpropagated in windows of this many steps
+    int windows() { return _batch_size / _truncation; }
+    int window_size() { return _truncation * _sequences; }
     dtype& best_error() { return _best_error; }
     const Matrix& x_train() { return _x_train; }
     const Matrix& y_train() { return _y_train; }
     const Matrix& x_val() { return _x_val; }
+    const SparseMatrix& x_train_sparse() { return _x_train_sparse; }
+    const SparseMatrix& x_val_sparse() { return _x_val_sparse; }
     const Matrix& y_val() { return _y_val; }
     const SharedStorage& y_val_shared() { return _y_val_shared; }
     std::vector<std::vector<SharedStorage>>& optimizer() { return _optimizer; }
@@ -49,6 +64,8 @@ class trainArgs {
     Matrix _x_val;
     Matrix _y_train;
     Matrix _y_val;
+    SparseMatrix _x_train_sparse;
+    SparseMatrix _x_val_sparse;
     SharedStorage _y_val_shared;
     std::vector<std::vector<SharedStorage>> _optimizer;
 
@@ -61,7 +78,11 @@ class trainArgs {
     int _epochs;
     int _patience;
     bool _shuffle;
+    bool _sparse;
+    int _sequences;
+    int _truncation;
     void train_test_split(const Matrix&, const Matrix&, dtype);
+    void train_test_split(const SparseMatrix&, const Matrix&, dtype);
     void create_optimizers(const std::shared_ptr<GradientDescent>&,
                            const std::deque<std::shared_ptr<Layer>>&);
 };
@@ -0,0 +1,94 @@
+#pragma once
+#ifndef execution_context_hpp
+#define execution_context_hpp
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+// The cpu threads of the library. A single pool of workers, started once,
+// runs the chunks of every parallel_for, the workers and the caller take
+// the next chunk from a shared counter until none is left. A parallel_for
+// issued while the pool is busy, from one of its chunks or from another
+// thread, runs its chunks on the calling thread instead of starting more
+// threads. OpenBLAS gets the same number of threads outside a job and a
+// single one while the chunks of a job keep the cores busy, so the layers,
+// the BLAS calls and the producer do not oversubscribe the cores.
+class ExecutionContext {
+   public:
+    static ExecutionContext& instance();
+    ExecutionContext(const ExecutionContext&) = delete;
+    ExecutionContext& operator=(const ExecutionContext&) = delete;
+    ~ExecutionContext();
+    // the threads running a parallel_for, the caller included, 0 takes one
+    // per core
+    void threads(int);
+    int threads() const { return _threads; }
+    // pins the workers to one core each, the caller stays where it is
+    void affinity(bool);
+    // calls f(chunk) for every chunk in [0, chunks) and returns when all
+    // are done. If chunks throw, the others still return and the first
+    // exception is thrown again on the caller, the chunks not started by
+    // then are skipped
+    void run(int chunks, const std::function<void(int)>& f);
+    // the generator of a random stream of a layer, the same seed, layer
+    // and stream always give the same numbers whichever thread draws them
+    std::mt19937 generator(unsigned layer, int stream) const;
+    // a new layer for the generators, counted from the last seed in the
+    // order the layers are built
+    unsigned layer() { return _layers++; }
+    void seed(unsigned seed) {
+        _seed = seed;
+        _layers = 0;
+    }
+
+   private:
+    ExecutionContext();
+    int _threads;
+    bool _affinity;
+    unsigned _seed;
+    std::atomic<unsigned> _layers;
+    std::vector<std::thread> _workers;
+    // only one parallel_for at a time owns the workers
+    std::mutex _busy;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _finished;
+    const std::function<void(int)>* _job;
+    int _chunks;
+    std::atomic<int> _next;
+    int _done;
+    // the workers inside the chunks of the current job
+    int _active;
+    // the first exception of a chunk of the current job
+    std::exception_ptr _error;
+    std::atomic<bool> _failed;
+    unsigned long _generation;
+    bool _stop;
+
+    void start();
+    void stop();
+    void work();
+    int take_chunks(const std::function<void(int)>&, int);
+    void pin(std::thread&, int);
+};
+
+// Floats of the calling thread's scratch arena, zeroed like a new
+// std::vector<float> but without the allocation once the thread has needed
+// that much before. The buffers nest, they are given back on destruction
+class ScratchBuffer {
+   public:
+    explicit ScratchBuffer(size_t);
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+    ~ScratchBuffer();
+    float* data() { return _data; }
+
+   private:
+    float* _data;
+};
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+#ifndef libsvm_hpp
+#define libsvm_hpp
+#include <string>
+#include "../common.h"
+// Reads a LibSVM text file, one observation per line written as
+// "label index:value index:value ..." with indices starting at one. The
+// features end up in compressed rows, binary labels given as -1/+1 are
+// mapped to 0/1 so they can index the output of a softmax. The width is
+// taken from the largest index unless n_features is set.
+void read_libsvm(const std::string& path, SparseMatrix& features,
+                 Labels& labels, int n_features = 0);
+#endif
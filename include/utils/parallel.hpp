@@ -0,0 +1,14 @@
+#pragma once
+#ifndef parallel_hpp
+#define parallel_hpp
+#include <functional>
+// Splits [0, n) into contiguous chunks, one per thread of the
+// ExecutionContext, and calls f(begin, end) for every chunk on its pool.
+// The caller works on the chunks too and returns once all are done.
+void parallel_for(int n, const std::function<void(int, int)>& f);
+// Same as above, f(chunk, begin, end) also receives the index of its chunk,
+// e.g. to write to a buffer of its own
+void parallel_for(int n, const std::function<void(int, int, int)>& f);
+// the number of chunks parallel_for splits n items into
+int parallel_chunks(int n);
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+#ifndef wavefront_hpp
+#define wavefront_hpp
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "layer/lstm.hpp"
+#include "storage.h"
+// Runs the cpu passes of stacked LSTM layers with one chunk of the
+// ExecutionContext per layer. As layer l + 1 at step t only needs layer l
+// at step t, the layers work on neighbouring steps at the same time
+// instead of one after the other. The input projections stay GEMMs over
+// blocks of steps: the first layer projects the whole sequence at once,
+// the layers above a block as soon as the one below has finished it, and
+// the input gradients go down the same way.
+class Wavefront {
+    typedef std::shared_ptr<Storage> SharedStorage;
+
+   public:
+    // the layers first to last of the network form the stack
+    Wavefront(const std::deque<std::shared_ptr<Layer>>&, int, int);
+    int first() const { return _first; }
+    int last() const { return _first + _layers.size() - 1; }
+    // values holds the input of the first layer and the output of each
+    void forward_cpu(const std::vector<SharedStorage>&, const std::string&);
+    // gradients holds the gradient of the stack's input and of each output
+    void backward_cpu(const std::vector<SharedStorage>&,
+                      const std::vector<SharedStorage>&);
+
+   private:
+    // the steps a layer above the first projects with one GEMM
+    static const int block = 8;
+    std::vector<std::shared_ptr<LSTM>> _layers;
+    int _first;
+    // the steps each layer has done, a waiting layer sleeps on _progress
+    std::mutex _mutex;
+    std::condition_variable _progress;
+    void wait_for(const std::atomic<int>&, int);
+    void report(std::atomic<int>&, int);
+    // calls layer(l) for every layer, the last one first if reverse
+    void run(bool, std::atomic<int>*, const std::function<void(int)>&);
+};
+#endif
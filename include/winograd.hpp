@@ -0,0 +1,27 @@
+#pragma once
+#ifndef winograd_hpp
+#define winograd_hpp
+#include <vector>
+#include "common.h"
+#include "fast_convolution.hpp"
+// Winograd F(m x m, 3 x 3) convolution with stride one, m being 2 or 4.
+// The output is computed in tiles of m x m whose input and output
+// transforms surround one GEMM per point of the transformed tile.
+class Winograd : public FastConvolution {
+   public:
+    Winograd(int, Channels, Filters, ImageShape, Pad);
+    int workspace() const override;
+    void forward_cpu(const float*, float*, float*) const override;
+    void backward_cpu(const float*, float*, float*) const override;
+    int tile() const { return _m; }
+
+   private:
+    int _m;
+    int _channels, _filters;
+    int _height, _width, _pad;
+    int _out_height, _out_width;
+    int _block;
+    std::vector<float> _forward, _backward;
+    void transform_filters(const Matrix&) override;
+};
+#endif
@@ -0,0 +1,39 @@
+#include "../include/conv_cache.hpp"
+#include <fstream>
+
+ConvCache::ConvCache(const std::string& path) : _path(path){};
+
+std::string ConvCache::cpu_model() {
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 10, "model name")) continue;
+        std::size_t colon = line.find(':');
+        if (colon == std::string::npos) break;
+        std::size_t begin = line.find_first_not_of(" \t", colon + 1);
+        if (begin == std::string::npos) break;
+        return line.substr(begin);
+    }
+    return "unknown cpu";
+}
+
+bool ConvCache::find(const std::string& key, std::string& algorithm) const {
+    std::ifstream in(_path);
+    std::string line;
+    bool found = false;
+    while (std::getline(in, line)) {
+        std::size_t tab = line.rfind('\t');
+        if ((tab == std::string::npos) or line.compare(0, tab, key)) continue;
+        algorithm = line.substr(tab + 1);
+        found = true;
+    }
+    return found;
+}
+
+bool ConvCache::store(const std::string& key,
+                      const std::string& algorithm) const {
+    std::ofstream out(_path, std::ios::app);
+    if (!out) return false;
+    out << key << '\t' << algorithm << '\n';
+    return bool(out);
+}
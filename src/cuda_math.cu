@@ -184,6 +184,30 @@ __global__ void cuda_cross_entropy_gradient(int rows, int cols,
     }
 }
 
+__global__ void cuda_all_cross_entropy_losses_labels(int rows, int cols,
+                                                     const dtype* prediction,
+                                                     const dtype* labels,
+                                                     dtype* losses) {
+    unsigned int col = blockIdx.x * blockDim.x + threadIdx.x;
+    if (col < cols) {
+        int label = labels[col];
+        losses[col] = -1 * log(prediction[col * rows + label]);
+    }
+}
+
+__global__ void cuda_cross_entropy_gradient_labels(int rows, int cols,
+                                                   const dtype* prediction,
+                                                   const dtype* labels,
+                                                   dtype* gradient) {
+    unsigned int row = blockIdx.x * blockDim.x + threadIdx.x;
+    unsigned int col = blockIdx.y * blockDim.y + threadIdx.y;
+    unsigned int linear = row + col * rows;
+    if ((row < rows) && (col < cols)) {
+        int label = labels[col];
+        gradient[linear] = prediction[linear] - ((row == label) ? 1. : 0.);
+    }
+}
+
 // I NEED TO THINK HOW I DO SUCH A SUM BETTER - Reduction!!!
 __global__ void cuda_sum_cross_entropy_losses(int obs, float* loss,
                                               const float* all_losses) {
@@ -330,6 +354,58 @@ __global__ void MaxPoolForward(int nthreads, const dtype* bottom_data, int num,
     }
 }
 
+// The average pooling kernels read the planes row by row like the cpu ones.
+// A global average pooling is one window of the size of the image
+__global__ void AvgPoolForward(int nthreads, const dtype* bottom_data,
+                               int height, int width, int out_height,
+                               int out_width, int window_h, int window_w,
+                               int stride, dtype* top_data) {
+    int index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (index < nthreads) {
+        const int pw = index % out_width;
+        const int ph = (index / out_width) % out_height;
+        const int plane = index / out_width / out_height;
+        const int hstart = ph * stride;
+        const int wstart = pw * stride;
+        const int hend = min(hstart + window_h, height);
+        const int wend = min(wstart + window_w, width);
+        const dtype* bottom_slice = bottom_data + plane * height * width;
+        const int count = (hend - hstart) * (wend - wstart);
+        dtype sum = 0;
+        for (int h = hstart; h < hend; ++h)
+            for (int w = wstart; w < wend; ++w)
+                sum += bottom_slice[h * width + w];
+        top_data[index] = (count > 0) ? sum / count : 0;
+    }
+}
+
+__global__ void AvgPoolBackward(int nthreads, const dtype* top_diff,
+                                int height, int width, int out_height,
+                                int out_width, int window_h, int window_w,
+                                int stride, dtype* bottom_diff) {
+    int index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (index < nthreads) {
+        const int w = index % width;
+        const int h = (index / width) % height;
+        const int plane = index / width / height;
+        const int phstart = (h < window_h) ? 0 : (h - window_h) / stride + 1;
+        const int phend = min(h / stride + 1, out_height);
+        const int pwstart = (w < window_w) ? 0 : (w - window_w) / stride + 1;
+        const int pwend = min(w / stride + 1, out_width);
+        const dtype* top_slice = top_diff + plane * out_height * out_width;
+        dtype gradient = 0;
+        for (int ph = phstart; ph < phend; ++ph) {
+            const int rows = min(ph * stride + window_h, height) - ph * stride;
+            for (int pw = pwstart; pw < pwend; ++pw) {
+                const int cols =
+                    min(pw * stride + window_w, width) - pw * stride;
+                gradient += top_slice[ph * out_width + pw] / (rows * cols);
+            }
+        }
+        bottom_diff[index] = gradient;
+    }
+}
+
 __global__ void im2col_gpu_kernel(int numThreads, const dtype* data_im,
                                   const int height, const int width,
                                   const int kernel_h, const int kernel_w,
@@ -527,6 +603,28 @@ __global__ void cuda_clip_gradients(int rows, int cols, dtype max,
     }
 }
 
+__global__ void cuda_embedding_forward(int rows, int cols, const dtype* table,
+                                       const dtype* ids, dtype* out) {
+    unsigned int row = blockIdx.x * blockDim.x + threadIdx.x;
+    unsigned int col = blockIdx.y * blockDim.y + threadIdx.y;
+    if ((row < rows) && (col < cols)) {
+        int token = ids[col];
+        out[row + col * rows] = table[row + token * rows];
+    }
+}
+
+__global__ void cuda_embedding_backward(int rows, int cols,
+                                        const dtype* grad_in, const dtype* ids,
+                                        dtype* grad_table) {
+    unsigned int row = blockIdx.x * blockDim.x + threadIdx.x;
+    unsigned int col = blockIdx.y * blockDim.y + threadIdx.y;
+    if ((row < rows) && (col < cols)) {
+        int token = ids[col];
+        // the same token can appear several times in a batch
+        atomicAdd(&grad_table[row + token * rows], grad_in[row + col * rows]);
+    }
+}
+
 void add_vec_to_mat_colwise(int rows, int cols, dtype* matrix,
                             const dtype* vector, dtype alpha) {
     dim3 block(256);
@@ -660,6 +758,26 @@ void cross_entropy_gradient(int rows, int cols, const float* prediction,
     // MY_CHECK(cudaDeviceSynchronize());
 }
 
+void all_cross_entropy_losses_labels(int rows, int cols,
+                                     const dtype* prediction,
+                                     const dtype* labels, dtype* losses) {
+    dim3 block(256);
+    dim3 grid((cols + block.x - 1) / block.x);
+    cuda_all_cross_entropy_losses_labels<<<grid, block>>>(rows, cols,
+                                                          prediction, labels,
+                                                          losses);
+    MY_CHECK(cudaPeekAtLastError());
+}
+
+void cross_entropy_gradient_labels(int rows, int cols, const dtype* prediction,
+                                   const dtype* labels, dtype* gradient) {
+    dim3 block(16, 16);
+    dim3 grid((rows + block.x - 1) / block.x, (cols + block.y - 1) / block.y);
+    cuda_cross_entropy_gradient_labels<<<grid, block>>>(rows, cols, prediction,
+                                                        labels, gradient);
+    MY_CHECK(cudaPeekAtLastError());
+}
+
 void matrix_addition(int rows, int cols, const dtype* A, const dtype* B,
                      dtype* C, const dtype alpha_A, const dtype alpha_B) {
     dim3 block(16, 16);
@@ -742,6 +860,49 @@ void pooling_backward_gpu(const float* src, const float* mask, int window,
     MY_CHECK(cudaPeekAtLastError());
 }
 
+void avg_pooling_gpu(const float* bottom_data, int window, int stride,
+                     int rows, int cols, int channels, int out_height,
+                     int out_width, int batches, float* top_data) {
+    dim3 block(512);
+    int eles = out_height * out_width * channels * batches;
+    dim3 grid((eles + block.x - 1) / block.x);
+    AvgPoolForward<<<grid, block>>>(eles, bottom_data, rows, cols, out_height,
+                                    out_width, window, window, stride,
+                                    top_data);
+    MY_CHECK(cudaPeekAtLastError());
+}
+
+void avg_pooling_backward_gpu(const float* src, int window, int stride,
+                              int rows, int cols, int channels,
+                              int out_height, int out_width, int batches,
+                              float* dest) {
+    dim3 block(512);
+    int eles = rows * cols * channels * batches;
+    dim3 grid((eles + block.x - 1) / block.x);
+    AvgPoolBackward<<<grid, block>>>(eles, src, rows, cols, out_height,
+                                     out_width, window, window, stride, dest);
+    MY_CHECK(cudaPeekAtLastError());
+}
+
+void global_avg_pooling_gpu(const float* bottom_data, int rows, int cols,
+                            int planes, float* top_data) {
+    dim3 block(512);
+    dim3 grid((planes + block.x - 1) / block.x);
+    AvgPoolForward<<<grid, block>>>(planes, bottom_data, rows, cols, 1, 1,
+                                    rows, cols, 1, top_data);
+    MY_CHECK(cudaPeekAtLastError());
+}
+
+void global_avg_pooling_backward_gpu(const float* src, int rows, int cols,
+                                     int planes, float* dest) {
+    dim3 block(512);
+    int eles = rows * cols * planes;
+    dim3 grid((eles + block.x - 1) / block.x);
+    AvgPoolBackward<<<grid, block>>>(eles, src, rows, cols, 1, 1, rows, cols,
+                                     1, dest);
+    MY_CHECK(cudaPeekAtLastError());
+}
+
 void im2col_gpu(const float* data_im, int channels, int height, const int width,
                 int kernel_h, const int kernel_w, int pad, int stride,
                 float* data_col) {
@@ -876,3 +1037,20 @@ void clip_gradients_gpu(int rows, int cols, dtype max, dtype* grad) {
     // MY_CHECK(cudaDeviceSynchronize());
     MY_CHECK(cudaPeekAtLastError());
 }
+
+void embedding_forward(int rows, int cols, const dtype* table,
+                       const dtype* ids, dtype* out) {
+    dim3 block(16, 16);
+    dim3 grid((rows + block.x - 1) / block.x, (cols + block.y - 1) / block.y);
+    cuda_embedding_forward<<<grid, block>>>(rows, cols, table, ids, out);
+    MY_CHECK(cudaPeekAtLastError());
+}
+
+void embedding_backward(int rows, int cols, const dtype* grad_in,
+                        const dtype* ids, dtype* grad_table) {
+    dim3 block(16, 16);
+    dim3 grid((rows + block.x - 1) / block.x, (cols + block.y - 1) / block.y);
+    cuda_embedding_backward<<<grid, block>>>(rows, cols, grad_in, ids,
+                                             grad_table);
+    MY_CHECK(cudaPeekAtLastError());
+}
@@ -4,7 +4,7 @@
 #include <ostream>
 
 DebugInfo::DebugInfo(std::string fwd, std::string bwd)
-    : _ffw_stream(fwd), _bwd_stream(bwd) {
+    : _ffw_stream(fwd), _bwd_stream(bwd), _is_set(false) {
     if ((fwd.size() > 0) and (bwd.size() > 0)) {
         _is_set = true;
     }
@@ -12,10 +12,18 @@ DebugInfo::DebugInfo(std::string fwd, std::string bwd)
 
 bool DebugInfo::is_set() { return _is_set; }
 
+// sparse inputs have no dense copy and their gradient is never allocated
+dtype DebugInfo::input_mean(const SharedStorage& storage) {
+    dtype size = storage->get_rows() * storage->get_cols();
+    if (size == 0) return 0;
+    if (storage->is_sparse()) return storage->return_sparse_const().sum() / size;
+    return storage->return_data_const().mean();
+}
+
 void DebugInfo::backward_debug_info(
     const std::vector<std::shared_ptr<Storage>>& grad,
     const std::deque<std::shared_ptr<Layer>>& layers, int batch_size) {
-    _bwd_stream << grad[0]->return_data_const().mean();
+    _bwd_stream << input_mean(grad[0]);
     for (size_t i = 1; i < grad.size(); ++i) {
         _bwd_stream << " ";
         _bwd_stream << grad[i]->return_data_const().mean();
@@ -34,7 +42,7 @@ void DebugInfo::backward_debug_info(
 void DebugInfo::forward_debug_info(
     const std::vector<std::shared_ptr<Storage>>& values,
     const std::deque<std::shared_ptr<Layer>>& layers, int batch_size) {
-    _ffw_stream << values[0]->return_data_const().mean();
+    _ffw_stream << input_mean(values[0]);
     for (size_t i = 1; i < values.size(); ++i) {
         _ffw_stream << " ";
         _ffw_stream << values[i]->return_data_const().mean();
@@ -0,0 +1,289 @@
+#include "../include/direct_convolution.hpp"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DIRECT_CONVOLUTION_X86
+#endif
+
+namespace {
+// The microkernels compute row output positions for block filters. in
+// points to the padded input of the first position, w to the blocked
+// filters, the sums over the channel blocks and the kernel go to out which
+// holds the filters of each position next to each other
+template <int block, int row>
+void microkernel(const float* in, const float* w, int blocks,
+                 int block_stride, int row_stride, int kh, int kw, int stride,
+                 float* out) {
+    float acc[row][block] = {};
+    for (int b = 0; b < blocks; ++b)
+        for (int kr = 0; kr < kh; ++kr) {
+            const float* line = in + b * block_stride + kr * row_stride;
+            const float* wk = w + (b * kh + kr) * kw * block * block;
+            for (int kc = 0; kc < kw; ++kc)
+                for (int c = 0; c < block; ++c) {
+                    const float* wv = wk + (kc * block + c) * block;
+                    for (int j = 0; j < row; ++j) {
+                        float x = line[(j * stride + kc) * block + c];
+                        for (int f = 0; f < block; ++f) acc[j][f] += x * wv[f];
+                    }
+                }
+        }
+    for (int j = 0; j < row; ++j)
+        std::copy(acc[j], acc[j] + block, out + j * block);
+}
+
+#ifdef DIRECT_CONVOLUTION_X86
+__attribute__((target("avx2,fma"))) void microkernel_avx2(
+    const float* in, const float* w, int blocks, int block_stride,
+    int row_stride, int kh, int kw, int stride, float* out) {
+    constexpr int block = 8, row = 8;
+    __m256 acc[row];
+    for (int j = 0; j < row; ++j) acc[j] = _mm256_setzero_ps();
+    for (int b = 0; b < blocks; ++b)
+        for (int kr = 0; kr < kh; ++kr) {
+            const float* line = in + b * block_stride + kr * row_stride;
+            const float* wk = w + (b * kh + kr) * kw * block * block;
+            for (int kc = 0; kc < kw; ++kc)
+                for (int c = 0; c < block; ++c) {
+                    __m256 wv = _mm256_loadu_ps(wk + (kc * block + c) * block);
+                    const float* x = line + kc * block + c;
+                    for (int j = 0; j < row; ++j)
+                        acc[j] = _mm256_fmadd_ps(
+                            _mm256_broadcast_ss(x + j * stride * block), wv,
+                            acc[j]);
+                }
+        }
+    for (int j = 0; j < row; ++j) _mm256_storeu_ps(out + j * block, acc[j]);
+}
+
+__attribute__((target("avx512f"))) void microkernel_avx512(
+    const float* in, const float* w, int blocks, int block_stride,
+    int row_stride, int kh, int kw, int stride, float* out) {
+    constexpr int block = 16, row = 12;
+    __m512 acc[row];
+    for (int j = 0; j < row; ++j) acc[j] = _mm512_setzero_ps();
+    for (int b = 0; b < blocks; ++b)
+        for (int kr = 0; kr < kh; ++kr) {
+            const float* line = in + b * block_stride + kr * row_stride;
+            const float* wk = w + (b * kh + kr) * kw * block * block;
+            for (int kc = 0; kc < kw; ++kc)
+                for (int c = 0; c < block; ++c) {
+                    __m512 wv = _mm512_loadu_ps(wk + (kc * block + c) * block);
+                    const float* x = line + kc * block + c;
+                    for (int j = 0; j < row; ++j)
+                        acc[j] = _mm512_fmadd_ps(
+                            _mm512_set1_ps(x[j * stride * block]), wv, acc[j]);
+                }
+        }
+    for (int j = 0; j < row; ++j) _mm512_storeu_ps(out + j * block, acc[j]);
+}
+#endif
+}  // namespace
+
+DirectConvolution::Isa DirectConvolution::detect() {
+#ifdef DIRECT_CONVOLUTION_X86
+    if (__builtin_cpu_supports("avx512f")) return Isa::AVX512;
+    if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+        return Isa::AVX2;
+#endif
+    return Isa::Generic;
+}
+
+DirectConvolution::DirectConvolution(FilterShape kernel, Channels channels,
+                                     Filters filters, ImageShape image,
+                                     Pad pad, Stride stride, Isa isa)
+    : FastConvolution(kernel, channels, filters, image, pad, stride),
+      _isa(isa),
+      _kernel(microkernel<8, 8>),
+      _block(8),
+      _row(8),
+      _blocked_input(false),
+      _blocked_output(false) {
+#ifdef DIRECT_CONVOLUTION_X86
+    if (_isa == Isa::AVX512) {
+        _kernel = microkernel_avx512;
+        _block = 16;
+        _row = 12;
+    } else if (_isa == Isa::AVX2) {
+        _kernel = microkernel_avx2;
+    }
+#else
+    _isa = Isa::Generic;
+#endif
+}
+
+void DirectConvolution::layout(bool input, bool output) {
+    if ((input and (_forward_pass.in_channels % _block)) or
+        (output and (_forward_pass.out_channels % _block))) {
+        std::stringstream ss;
+        ss << "The blocked layout needs whole blocks of " << _block
+           << " channels, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    _blocked_input = input;
+    _blocked_output = output;
+}
+
+void DirectConvolution::to_blocked(const float* in, float* out, int channels,
+                                   int positions) const {
+    for (int c = 0; c < channels; ++c) {
+        const float* channel = in + c * positions;
+        float* target = out + (c / _block) * positions * _block + c % _block;
+        for (int p = 0; p < positions; ++p) target[p * _block] = channel[p];
+    }
+}
+
+void DirectConvolution::to_channels(const float* in, float* out,
+                                    int channels, int positions) const {
+    for (int c = 0; c < channels; ++c) {
+        const float* source =
+            in + (c / _block) * positions * _block + c % _block;
+        float* channel = out + c * positions;
+        for (int p = 0; p < positions; ++p) channel[p] = source[p * _block];
+    }
+}
+
+int DirectConvolution::blocks(int channels) const {
+    return (channels + _block - 1) / _block;
+}
+
+// Enough rows and columns that every microkernel call reads inside the
+// buffer, also for the positions past the output's last row of positions
+int DirectConvolution::padded_rows(const Pass& pass) const {
+    return (pass.out_height - 1) * pass.stride + _kh;
+}
+
+int DirectConvolution::padded_cols(const Pass& pass) const {
+    int calls = (pass.out_width + _row - 1) / _row;
+    return (calls * _row - 1) * pass.stride + _kw;
+}
+
+int DirectConvolution::pass_workspace(const Pass& pass) const {
+    return blocks(pass.in_channels) * _block * padded_rows(pass) *
+               padded_cols(pass) +
+           _row * _block;
+}
+
+int DirectConvolution::workspace() const {
+    return std::max(pass_workspace(_forward_pass),
+                    pass_workspace(_backward_pass));
+}
+
+// blocked[out block][in block][kernel row][kernel col][in][out], missing
+// channels of the last blocks are zero
+void DirectConvolution::block_filters(Direction direction,
+                                      const Matrix& weights,
+                                      std::vector<float>& blocked) const {
+    const Pass& pass = this->pass(direction);
+    int in_blocks = blocks(pass.in_channels);
+    int out_blocks = blocks(pass.out_channels);
+    blocked.assign(out_blocks * in_blocks * _kh * _kw * _block * _block, 0.0f);
+    for (int o = 0; o < pass.out_channels; ++o)
+        for (int i = 0; i < pass.in_channels; ++i)
+            for (int r = 0; r < _kh; ++r)
+                for (int c = 0; c < _kw; ++c) {
+                    int index = (o / _block) * in_blocks + i / _block;
+                    index = (index * _kh + r) * _kw + c;
+                    index = (index * _block + i % _block) * _block + o % _block;
+                    blocked[index] = filter(direction, weights, i, o, r, c);
+                }
+}
+
+void DirectConvolution::transform_filters(const Matrix& weights) {
+    block_filters(Direction::Forward, weights, _forward);
+    block_filters(Direction::Backward, weights, _backward);
+}
+
+void DirectConvolution::convolve(Direction direction, const float* in,
+                                 float* out, float* work) const {
+    const Pass& pass = this->pass(direction);
+    bool forward = direction == Direction::Forward;
+    const std::vector<float>& filters = forward ? _forward : _backward;
+    bool blocked_in = forward ? _blocked_input : _blocked_output;
+    bool blocked_out = forward ? _blocked_output : _blocked_input;
+    int rows = padded_rows(pass);
+    int cols = padded_cols(pass);
+    int in_blocks = blocks(pass.in_channels);
+    int block_stride = rows * cols * _block;
+    float* padded = work;
+    float* result = work + in_blocks * block_stride;
+    // the input goes to its place in the padded, spread out and blocked
+    // buffer, everything else is zero
+    std::fill(padded, result, 0.0f);
+    auto source = [&](int position, int pad, int size) {
+        position -= pad;
+        if ((position < 0) or (position % pass.dilation)) return -1;
+        position /= pass.dilation;
+        return position < size ? position : -1;
+    };
+    // a blocked input moves a whole block of channels per position
+    for (int b = 0; blocked_in and (b < in_blocks); ++b) {
+        const float* image = in + b * pass.height * pass.width * _block;
+        for (int y = 0; y < rows; ++y) {
+            int row = source(y, pass.pad_rows, pass.height);
+            if (row < 0) continue;
+            for (int x = 0; x < cols; ++x) {
+                int col = source(x, pass.pad_cols, pass.width);
+                if (col >= 0)
+                    std::copy_n(image + (row * pass.width + col) * _block,
+                                _block,
+                                padded + b * block_stride +
+                                    (y * cols + x) * _block);
+            }
+        }
+    }
+    for (int i = 0; !blocked_in and (i < pass.in_channels); ++i) {
+        const float* channel = in + i * pass.height * pass.width;
+        float* target = padded + (i / _block) * block_stride + i % _block;
+        for (int y = 0; y < rows; ++y) {
+            int row = source(y, pass.pad_rows, pass.height);
+            if (row < 0) continue;
+            for (int x = 0; x < cols; ++x) {
+                int col = source(x, pass.pad_cols, pass.width);
+                if (col >= 0)
+                    target[(y * cols + x) * _block] =
+                        channel[row * pass.width + col];
+            }
+        }
+    }
+    int out_size = pass.out_height * pass.out_width;
+    int filter_block = in_blocks * _kh * _kw * _block * _block;
+    for (int ob = 0; ob < blocks(pass.out_channels); ++ob) {
+        int count_filters = std::min(_block, pass.out_channels - ob * _block);
+        for (int oh = 0; oh < pass.out_height; ++oh)
+            for (int ow = 0; ow < pass.out_width; ow += _row) {
+                _kernel(padded + (oh * cols + ow) * pass.stride * _block,
+                        filters.data() + ob * filter_block, in_blocks,
+                        block_stride, cols * _block, _kh, _kw, pass.stride,
+                        result);
+                int count = std::min(_row, pass.out_width - ow);
+                if (blocked_out) {
+                    float* line = out + ob * out_size * _block +
+                                  (oh * pass.out_width + ow) * _block;
+                    for (int k = 0; k < count * _block; ++k)
+                        line[k] += result[k];
+                    continue;
+                }
+                for (int f = 0; f < count_filters; ++f) {
+                    float* line = out + (ob * _block + f) * out_size +
+                                  oh * pass.out_width + ow;
+                    for (int j = 0; j < count; ++j)
+                        line[j] += result[j * _block + f];
+                }
+            }
+    }
+}
+
+void DirectConvolution::forward_cpu(const float* image, float* out,
+                                    float* work) const {
+    convolve(Direction::Forward, image, out, work);
+}
+
+void DirectConvolution::backward_cpu(const float* grad, float* image_grad,
+                                     float* work) const {
+    convolve(Direction::Backward, grad, image_grad, work);
+}
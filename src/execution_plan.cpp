@@ -0,0 +1,126 @@
+#include "../include/execution_plan.hpp"
+#include <algorithm>
+#include "../include/wavefront.hpp"
+
+// The forward pass enters a stack at its first layer, the backward pass at
+// its last one, the output layer itself has no backward step
+void ExecutionPlan::compile(
+    const std::deque<std::shared_ptr<Layer>>& layers,
+    const std::vector<std::shared_ptr<Wavefront>>& stacks) {
+    _forward.clear();
+    _backward.clear();
+    _forward_values.clear();
+    _backward_values.clear();
+    _backward_gradients.clear();
+    int n_layers = layers.size();
+    int i = 1;
+    while (i < n_layers) {
+        Step step{layers[i].get(), nullptr, i, i, false, {}, {}, {}};
+        for (const std::shared_ptr<Wavefront>& stack : stacks)
+            if (stack->first() == i)
+                step = Step{nullptr, stack.get(), i, stack->last(), false,
+                            {}, {}, {}};
+        _forward.push_back(step);
+        i = step.last + 1;
+    }
+    i = n_layers - 2;
+    while (i > 0) {
+        Step step{layers[i].get(), nullptr, i, i, false, {}, {}, {}};
+        for (const std::shared_ptr<Wavefront>& stack : stacks)
+            if (stack->last() == i)
+                step = Step{nullptr, stack.get(), stack->first(), i, false,
+                            {}, {}, {}};
+        _backward.push_back(step);
+        i = step.first - 1;
+    }
+}
+
+// Whether the storages from first to last are those a step was bound to
+static bool same_storages(const std::vector<std::shared_ptr<Storage>>& now,
+                          const std::vector<std::shared_ptr<Storage>>& bound,
+                          int first, int last) {
+    return (now.size() == bound.size()) and
+           std::equal(now.begin() + first, now.begin() + last + 1,
+                      bound.begin() + first);
+}
+
+// The storages of a batch keep their shape, so the buffers stay valid as
+// long as the same storages come back. Only the steps whose storages were
+// exchanged, like the input of every new batch, are bound again. Sparse
+// inputs have no raw buffer
+void ExecutionPlan::bind_forward(const std::vector<SharedStorage>& values) {
+    for (Step& step : _forward) {
+        if (same_storages(values, _forward_values, step.first - 1, step.last))
+            continue;
+        const SharedStorage& in = values[step.first - 1];
+        if (step.stack) {
+            step.values.assign(values.begin() + step.first - 1,
+                               values.begin() + step.last + 1);
+            continue;
+        }
+        step.raw = step.layer->binds_buffers() and !in->is_sparse();
+        if (step.raw) step.buffers = Layer::buffers(in, values[step.first]);
+    }
+    _forward_values = values;
+}
+
+void ExecutionPlan::bind_backward(const std::vector<SharedStorage>& gradients,
+                                  const std::vector<SharedStorage>& values) {
+    for (Step& step : _backward) {
+        if (same_storages(values, _backward_values, step.first - 1,
+                          step.last) and
+            same_storages(gradients, _backward_gradients, step.first - 1,
+                          step.last))
+            continue;
+        const SharedStorage& in = values[step.first - 1];
+        if (step.stack) {
+            step.gradients.assign(gradients.begin() + step.first - 1,
+                                  gradients.begin() + step.last + 1);
+            step.values.assign(values.begin() + step.first - 1,
+                               values.begin() + step.last + 1);
+            continue;
+        }
+        step.raw = step.layer->binds_buffers() and !in->is_sparse();
+        if (step.raw) {
+            step.buffers = Layer::buffers(in, gradients[step.first],
+                                          gradients[step.first - 1]);
+            step.buffers.out = values[step.first]->cpu_pointer();
+        }
+    }
+    _backward_gradients = gradients;
+    _backward_values = values;
+}
+
+void ExecutionPlan::forward_cpu(std::vector<SharedStorage>& values,
+                                Mode mode) {
+    if (values != _forward_values) bind_forward(values);
+    // a bound step writes past its storage, asking for the writable
+    // pointer marks the cpu copy as the recent one
+    for (const Step& step : _forward) {
+        if (step.raw) {
+            values[step.first]->cpu_pointer();
+            step.layer->forward_bound(step.buffers, mode);
+        } else if (step.stack)
+            step.stack->forward_cpu(step.values, mode_name(mode));
+        else
+            step.layer->forward_cpu(values[step.first - 1],
+                                    values[step.first], mode_name(mode));
+    }
+}
+
+void ExecutionPlan::backward_cpu(std::vector<SharedStorage>& gradients,
+                                 const std::vector<SharedStorage>& values) {
+    if ((gradients != _backward_gradients) or (values != _backward_values))
+        bind_backward(gradients, values);
+    for (const Step& step : _backward) {
+        if (step.raw) {
+            gradients[step.first - 1]->cpu_pointer();
+            step.layer->backward_bound(step.buffers);
+        } else if (step.stack)
+            step.stack->backward_cpu(step.gradients, step.values);
+        else
+            step.layer->backward_cpu(values[step.first - 1],
+                                     gradients[step.first],
+                                     gradients[step.first - 1]);
+    }
+}
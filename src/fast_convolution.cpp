@@ -0,0 +1,52 @@
+#include "../include/fast_convolution.hpp"
+#include <sstream>
+#include <stdexcept>
+
+FastConvolution::FastConvolution()
+    : _forward_pass(),
+      _backward_pass(),
+      _kh(0),
+      _kw(0),
+      _prepared(false),
+      _version(0){};
+
+FastConvolution::FastConvolution(FilterShape kernel, Channels channels,
+                                 Filters filters, ImageShape image, Pad pad,
+                                 Stride stride)
+    : _kh(kernel.first()),
+      _kw(kernel.second()),
+      _prepared(false),
+      _version(0) {
+    int p(pad.get()), s(stride.get());
+    if ((p >= _kh) or (p >= _kw)) {
+        std::stringstream ss;
+        ss << "The backward pass needs a pad smaller than the filters, "
+              "received pad "
+           << p << " in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    int out_height = (image.first() + 2 * p - _kh) / s + 1;
+    int out_width = (image.second() + 2 * p - _kw) / s + 1;
+    _forward_pass = {channels.get(), image.first(), image.second(), 1, p, p,
+                     filters.get(), out_height, out_width, s};
+    _backward_pass = {filters.get(), out_height, out_width, s, _kh - 1 - p,
+                      _kw - 1 - p, channels.get(), image.first(),
+                      image.second(), 1};
+}
+
+float FastConvolution::filter(Direction direction, const Matrix& weights,
+                              int i, int o, int r, int c) const {
+    // the backward pass maps filters to input channels and flips the kernel
+    if (direction == Direction::Forward)
+        return weights((i * _kh + r) * _kw + c, o);
+    return weights((o * _kh + _kh - 1 - r) * _kw + _kw - 1 - c, i);
+}
+
+void FastConvolution::prepare(const std::shared_ptr<Storage>& weights) {
+    if (_prepared and (weights->version() == _version)) return;
+    transform_filters(weights->return_data_const());
+    _version = weights->version();
+    _prepared = true;
+}
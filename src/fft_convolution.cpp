@@ -0,0 +1,297 @@
+#include "../include/fft_convolution.hpp"
+#include <algorithm>
+#include <cmath>
+
+FFTConvolution::FFTConvolution(FilterShape kernel, Channels channels,
+                               Filters filters, ImageShape image, Pad pad,
+                               Stride stride)
+    : FastConvolution(kernel, channels, filters, image, pad, stride),
+      _forward_fft(),
+      _backward_fft() {
+    _forward_fft = transform(_forward_pass);
+    _backward_fft = transform(_backward_pass);
+}
+
+FFTConvolution::Transform FFTConvolution::transform(const Pass& pass) const {
+    Transform t;
+    t.n = fft_size(pass);
+    t.cos.resize(t.n);
+    t.sin.resize(t.n);
+    for (int k = 0; k < t.n; ++k) {
+        t.cos[k] = std::cos(2 * M_PI * k / t.n);
+        t.sin[k] = std::sin(2 * M_PI * k / t.n);
+    }
+    int bits = std::log2(t.n);
+    t.reversed.resize(t.n);
+    for (int i = 0; i < t.n; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+        t.reversed[i] = r;
+    }
+    return t;
+}
+
+// Every block needs a complex FFT per two input and per two output
+// channels and a complex multiply-add per frequency of the half spectrum
+// and channel pair. Larger transforms mean fewer blocks but more work per
+// block, the cheapest size for the pass wins
+int FFTConvolution::fft_size(const Pass& pass) const {
+    int rows = 2 * pass.pad_rows + (pass.height - 1) * pass.dilation + 1;
+    int cols = 2 * pass.pad_cols + (pass.width - 1) * pass.dilation + 1;
+    int pairs = pass.in_channels * pass.out_channels;
+    int transforms = (pass.in_channels + 1) / 2 + (pass.out_channels + 1) / 2;
+    int best(0);
+    double best_cost(0);
+    for (int n = 8; n / 2 < std::max(rows + _kh, cols + _kw); n *= 2) {
+        if ((n < _kh) or (n < _kw)) continue;
+        int blocks = ((rows + n - _kh) / (n - _kh + 1)) *
+                     ((cols + n - _kw) / (n - _kw + 1));
+        double cost = double(blocks) * n * n *
+                      (4. * pairs + 10. * transforms * std::log2(n));
+        if ((best == 0) or (cost < best_cost)) {
+            best = n;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+// Transforms along the first index of the n x n array, i.e. every butterfly
+// combines two whole rows, which keeps the inner loop contiguous
+void FFTConvolution::fft_columns(const Transform& t, float* re, float* im,
+                                 bool inverse) const {
+    int n = t.n;
+    for (int i = 0; i < n; ++i) {
+        int r = t.reversed[i];
+        if (i < r) {
+            std::swap_ranges(re + i * n, re + (i + 1) * n, re + r * n);
+            std::swap_ranges(im + i * n, im + (i + 1) * n, im + r * n);
+        }
+    }
+    for (int len = 2; len <= n; len *= 2) {
+        int half = len / 2;
+        int step = n / len;
+        for (int first = 0; first < n; first += len)
+            for (int j = 0; j < half; ++j) {
+                float wr = t.cos[j * step];
+                float wi = inverse ? t.sin[j * step] : -t.sin[j * step];
+                float* ar = re + (first + j) * n;
+                float* ai = im + (first + j) * n;
+                float* br = ar + half * n;
+                float* bi = ai + half * n;
+                for (int c = 0; c < n; ++c) {
+                    float tr = br[c] * wr - bi[c] * wi;
+                    float ti = br[c] * wi + bi[c] * wr;
+                    br[c] = ar[c] - tr;
+                    bi[c] = ai[c] - ti;
+                    ar[c] += tr;
+                    ai[c] += ti;
+                }
+            }
+    }
+}
+
+// The forward transform leaves the spectrum transposed, which the inverse
+// undoes, products of two spectra do not care and neither does the
+// symmetry, frequency -k sits where -k does. The inverse is not scaled
+void FFTConvolution::fft(const Transform& t, float* re, float* im,
+                         bool inverse) const {
+    int n = t.n;
+    fft_columns(t, re, im, inverse);
+    for (int r = 0; r < n; ++r)
+        for (int c = r + 1; c < n; ++c) {
+            std::swap(re[r * n + c], re[c * n + r]);
+            std::swap(im[r * n + c], im[c * n + r]);
+        }
+    fft_columns(t, re, im, inverse);
+}
+
+// Separates the spectrum z of a + ib into the half spectra of a and b,
+// each times two: 2A(k) = z(k) + conj(z(-k)), 2B(k) = -i (z(k) - conj(z(-k)))
+void FFTConvolution::split(const Transform& t, const float* z, float* a,
+                           float* b) const {
+    int n = t.n, nn = n * n, half = t.half();
+    const float* zr = z;
+    const float* zi = z + nn;
+    for (int r = 0; r <= n / 2; ++r) {
+        const float* mr = zr + ((n - r) % n) * n;
+        const float* mi = zi + ((n - r) % n) * n;
+        for (int c = 0; c < n; ++c) {
+            int k = r * n + c;
+            int m = (n - c) % n;
+            a[k] = zr[k] + mr[m];
+            a[half + k] = zi[k] - mi[m];
+            if (b) {
+                b[k] = zi[k] + mi[m];
+                b[half + k] = mr[m] - zr[k];
+            }
+        }
+    }
+}
+
+// The full spectrum z of y1 + iy2 from the half spectra of y1 and y2, the
+// rows past n / 2 mirror the conjugates of the stored ones
+void FFTConvolution::combine(const Transform& t, const float* y1,
+                             const float* y2, float* z) const {
+    int n = t.n, nn = n * n, half = t.half();
+    float* zr = z;
+    float* zi = z + nn;
+    for (int k = 0; k < half; ++k) {
+        zr[k] = y1[k] - (y2 ? y2[half + k] : 0.0f);
+        zi[k] = y1[half + k] + (y2 ? y2[k] : 0.0f);
+    }
+    for (int r = n / 2 + 1; r < n; ++r)
+        for (int c = 0; c < n; ++c) {
+            int k = r * n + c;
+            int j = (n - r) * n + (n - c) % n;
+            zr[k] = y1[j] + (y2 ? y2[half + j] : 0.0f);
+            zi[k] = -y1[half + j] + (y2 ? y2[j] : 0.0f);
+        }
+}
+
+// The inputs come out of split doubled, the scale takes that back too
+void FFTConvolution::spectra(Direction direction, const Matrix& weights,
+                             std::vector<float>& out) const {
+    const Pass& pass = this->pass(direction);
+    const Transform& t =
+        (direction == Direction::Forward) ? _forward_fft : _backward_fft;
+    int n = t.n, nn = n * n, half = t.half();
+    float scale = 0.5f / nn;
+    std::vector<float> z(2 * nn);
+    out.assign(2 * half * pass.in_channels * pass.out_channels, 0.0f);
+    for (int o = 0; o < pass.out_channels; ++o)
+        for (int i = 0; i < pass.in_channels; ++i) {
+            float* re = out.data() + (o * pass.in_channels + i) * 2 * half;
+            float* im = re + half;
+            std::fill(z.begin(), z.end(), 0.0f);
+            for (int r = 0; r < _kh; ++r)
+                for (int c = 0; c < _kw; ++c)
+                    z[r * n + c] = filter(direction, weights, i, o, r, c);
+            fft(t, z.data(), z.data() + nn, false);
+            for (int k = 0; k < half; ++k) {
+                re[k] = z[k] * scale;
+                im[k] = -z[nn + k] * scale;
+            }
+        }
+}
+
+void FFTConvolution::transform_filters(const Matrix& weights) {
+    spectra(Direction::Forward, weights, _forward);
+    spectra(Direction::Backward, weights, _backward);
+}
+
+// the half spectra of the input channels, one complex n x n array and the
+// two half spectra being summed
+int FFTConvolution::workspace() const {
+    auto floats = [](const Pass& pass, const Transform& t) {
+        return 2 * t.half() * (pass.in_channels + 2) + 2 * t.n * t.n;
+    };
+    return std::max(floats(_forward_pass, _forward_fft),
+                    floats(_backward_pass, _backward_fft));
+}
+
+// Each block of the padded input is correlated with all filters at once,
+// the correlation of a block of b values with a filter of k has b + k - 1
+// values which fit the n point transform without wrapping around
+void FFTConvolution::convolve(Direction direction, const float* in,
+                              float* out, float* work) const {
+    const Pass& pass = this->pass(direction);
+    bool forward = direction == Direction::Forward;
+    const Transform& t = forward ? _forward_fft : _backward_fft;
+    const std::vector<float>& spectra = forward ? _forward : _backward;
+    int n = t.n, nn = n * n, half = t.half();
+    int block_rows = n - _kh + 1;
+    int block_cols = n - _kw + 1;
+    int rows = 2 * pass.pad_rows + (pass.height - 1) * pass.dilation + 1;
+    int cols = 2 * pass.pad_cols + (pass.width - 1) * pass.dilation + 1;
+    rows = std::min(rows, (pass.out_height - 1) * pass.stride + _kh);
+    cols = std::min(cols, (pass.out_width - 1) * pass.stride + _kw);
+    int in_size = pass.height * pass.width;
+    int out_size = pass.out_height * pass.out_width;
+    float* X = work;
+    float* Y = X + 2 * half * pass.in_channels;
+    float* Z = Y + 4 * half;
+    // index into the input of a row or column of the padded, spread input
+    auto source = [&](int position, int pad, int size) {
+        position -= pad;
+        if ((position < 0) or (position % pass.dilation)) return -1;
+        position /= pass.dilation;
+        return position < size ? position : -1;
+    };
+    auto load = [&](int channel, float* re, int top, int left) {
+        const float* image = in + channel * in_size;
+        for (int r = 0; r < std::min(block_rows, rows - top); ++r) {
+            int row = source(top + r, pass.pad_rows, pass.height);
+            if (row < 0) continue;
+            for (int c = 0; c < std::min(block_cols, cols - left); ++c) {
+                int col = source(left + c, pass.pad_cols, pass.width);
+                if (col >= 0) re[r * n + c] = image[row * pass.width + col];
+            }
+        }
+    };
+    // the block's correlation starts k - 1 before its corner
+    auto store = [&](const float* y, float* o_image, int top, int left) {
+        for (int dr = 1 - _kh; dr < block_rows; ++dr) {
+            int p = top + dr;
+            if ((p < 0) or (p % pass.stride) or
+                (p / pass.stride >= pass.out_height))
+                continue;
+            const float* y_row = y + ((dr + n) % n) * n;
+            float* o_row = o_image + (p / pass.stride) * pass.out_width;
+            for (int dc = 1 - _kw; dc < block_cols; ++dc) {
+                int q = left + dc;
+                if ((q < 0) or (q % pass.stride) or
+                    (q / pass.stride >= pass.out_width))
+                    continue;
+                o_row[q / pass.stride] += y_row[(dc + n) % n];
+            }
+        }
+    };
+    for (int top = 0; top < rows; top += block_rows)
+        for (int left = 0; left < cols; left += block_cols) {
+            // two channels per transform, the real and the imaginary part
+            for (int i = 0; i < pass.in_channels; i += 2) {
+                bool pair = i + 1 < pass.in_channels;
+                std::fill(Z, Z + 2 * nn, 0.0f);
+                load(i, Z, top, left);
+                if (pair) load(i + 1, Z + nn, top, left);
+                fft(t, Z, Z + nn, false);
+                split(t, Z, X + 2 * half * i,
+                      pair ? X + 2 * half * (i + 1) : nullptr);
+            }
+            for (int o = 0; o < pass.out_channels; o += 2) {
+                bool pair = o + 1 < pass.out_channels;
+                for (int p = 0; p < (pair ? 2 : 1); ++p) {
+                    Eigen::Map<Eigen::ArrayXf> yr(Y + 2 * half * p, half),
+                        yi(Y + 2 * half * p + half, half);
+                    yr.setZero();
+                    yi.setZero();
+                    for (int i = 0; i < pass.in_channels; ++i) {
+                        const float* s = spectra.data() +
+                                         ((o + p) * pass.in_channels + i) *
+                                             2 * half;
+                        Eigen::Map<const Eigen::ArrayXf> xr(X + 2 * half * i,
+                                                            half),
+                            xi(X + 2 * half * i + half, half), sr(s, half),
+                            si(s + half, half);
+                        yr += xr * sr - xi * si;
+                        yi += xr * si + xi * sr;
+                    }
+                }
+                combine(t, Y, pair ? Y + 2 * half : nullptr, Z);
+                fft(t, Z, Z + nn, true);
+                store(Z, out + o * out_size, top, left);
+                if (pair) store(Z + nn, out + (o + 1) * out_size, top, left);
+            }
+        }
+}
+
+void FFTConvolution::forward_cpu(const float* image, float* out,
+                                 float* work) const {
+    convolve(Direction::Forward, image, out, work);
+}
+
+void FFTConvolution::backward_cpu(const float* grad, float* image_grad,
+                                  float* work) const {
+    convolve(Direction::Backward, grad, image_grad, work);
+}
@@ -0,0 +1,154 @@
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "../include/initalization/glorot.hpp"
+#include "../include/layer/conv_block.hpp"
+#include "../include/layer/convolution.h"
+#include "../include/layer/dense.h"
+#include "../include/layer/dense_block.hpp"
+#include "../include/layer/merge.hpp"
+#include "../include/network.h"
+#include "../include/wavefront.hpp"
+
+namespace {
+long parameter_bytes(const std::shared_ptr<Layer>& layer) {
+    long bytes = 0;
+    for (const std::shared_ptr<Storage>& para : layer->return_parameters())
+        bytes += para->get_rows() * para->get_cols() * sizeof(dtype);
+    return bytes;
+}
+
+// The Dense layer computing second(first(x)), with the weights W2 * W1 and
+// the bias W2 * b1 + b2
+std::shared_ptr<Dense> fold(const std::shared_ptr<Dense>& first,
+                            const std::shared_ptr<Dense>& second) {
+    const Matrix& w1 = first->return_parameters()[0]->return_data_const();
+    const Matrix& b1 = first->return_parameters()[1]->return_data_const();
+    const Matrix& w2 = second->return_parameters()[0]->return_data_const();
+    const Matrix& b2 = second->return_parameters()[1]->return_data_const();
+    Glorot init;
+    std::shared_ptr<Dense> dense = std::make_shared<Dense>(
+        Features(w2.rows()), Features(w1.cols()), &init);
+    dense->return_parameters()[0]->update_cpu_data(w2 * w1);
+    dense->return_parameters()[1]->update_cpu_data(w2 * b1 + b2);
+    return dense;
+}
+
+// folding pays off if the product has fewer weights than the two factors
+bool cheaper(const std::shared_ptr<Dense>& first,
+             const std::shared_ptr<Dense>& second) {
+    long in = first->return_parameters()[0]->get_cols();
+    long hidden = first->return_parameters()[0]->get_rows();
+    long out = second->return_parameters()[0]->get_rows();
+    return out * in <= hidden * (in + out);
+}
+}  // namespace
+
+void NeuralNetwork::check_not_frozen() {
+    if (frozen) {
+        std::stringstream ss;
+        ss << "The network is frozen for inference and cannot be trained, "
+              "in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+// At predict time a Dropout writes its input to its output, without it the
+// next layer reads the previous one's output directly. The search starts at
+// the index from and leaves the last keep layers alone
+int NeuralNetwork::drop_identities(std::deque<std::shared_ptr<Layer>>& chain,
+                                   size_t from, size_t keep,
+                                   InferenceReport& report) {
+    int dropped = 0;
+    size_t i = from;
+    while (i + keep < chain.size()) {
+        if (chain[i]->name() == "Dropout") {
+            report.activation_bytes +=
+                convert_output_dimension(chain[i]) * sizeof(dtype);
+            chain.erase(chain.begin() + i);
+            dropped++;
+        } else {
+            i++;
+        }
+    }
+    return dropped;
+}
+
+// A Dense layer followed by another one, or by the Dense layer of a
+// DenseBlock, applies a single affine map
+int NeuralNetwork::fold_dense(std::deque<std::shared_ptr<Layer>>& chain,
+                              size_t from, InferenceReport& report) {
+    int folded = 0;
+    size_t i = from;
+    while (i + 1 < chain.size()) {
+        std::shared_ptr<Dense> first =
+            std::dynamic_pointer_cast<Dense>(chain[i]);
+        std::shared_ptr<Layer> next = chain[i + 1];
+        std::shared_ptr<Dense> second = std::dynamic_pointer_cast<Dense>(next);
+        std::shared_ptr<DenseBlock> block =
+            std::dynamic_pointer_cast<DenseBlock>(next);
+        if (block) second = block->_dense;
+        if (!first or !second or !cheaper(first, second)) {
+            i++;
+            continue;
+        }
+        std::shared_ptr<Dense> dense = fold(first, second);
+        std::shared_ptr<Layer> merged = dense;
+        if (block)
+            merged = std::make_shared<DenseBlock>(dense, block->_activation);
+        report.parameter_bytes += parameter_bytes(chain[i]) +
+                                  parameter_bytes(next) -
+                                  parameter_bytes(merged);
+        report.activation_bytes +=
+            convert_output_dimension(chain[i]) * sizeof(dtype);
+        chain.erase(chain.begin() + i);
+        chain[i] = merged;
+        folded++;
+    }
+    return folded;
+}
+
+// Freezes the layers starting at the index from but the last keep ones.
+// The branches of a merge end in the merge itself, all their layers may go
+void NeuralNetwork::freeze_layers(std::deque<std::shared_ptr<Layer>>& chain,
+                                  size_t from, size_t keep,
+                                  InferenceReport& report) {
+    for (std::shared_ptr<Layer> layer : chain) {
+        std::shared_ptr<Merge> merge = std::dynamic_pointer_cast<Merge>(layer);
+        if (!merge) continue;
+        for (std::deque<std::shared_ptr<Layer>>& branch : merge->_branches)
+            freeze_layers(branch, 0, 0, report);
+        merge->collect();
+    }
+    report.layers += drop_identities(chain, from, keep, report);
+    report.layers += fold_dense(chain, from, report);
+    for (std::shared_ptr<Layer> layer : chain) {
+        std::shared_ptr<Convolution> conv =
+            std::dynamic_pointer_cast<Convolution>(layer);
+        std::shared_ptr<ConvBlock> block =
+            std::dynamic_pointer_cast<ConvBlock>(layer);
+        if (block) conv = block->_conv;
+        if (conv and conv->_fast) conv->_fast->prepare(conv->parameters[0]);
+    }
+}
+
+InferenceReport NeuralNetwork::freeze() {
+    InferenceReport report{0, 0, 0};
+    freeze_layers(layers, 1, 1, report);
+    // the stacks and the plan refer to the positions of the layers
+    wavefronts.clear();
+    find_recurrent_stacks();
+    link_convolutions(layers);
+    compile_plan();
+    step_values.clear();
+    frozen = true;
+    std::cout << "Freezing removed " << report.layers << " layers, "
+              << report.parameter_bytes << " bytes of parameters and "
+              << report.activation_bytes << " bytes of activations per "
+              << "observation" << std::endl;
+    print_network();
+    return report;
+}
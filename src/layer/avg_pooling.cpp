@@ -0,0 +1,189 @@
+#include "../../include/layer/avg_pooling.hpp"
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include "../../include/cuda_math.h"
+#include "../../include/math.h"
+
+namespace {
+// the channels and image of a layer with an image output
+void image_input(const std::shared_ptr<Layer>& previous, Channels& channels,
+                 ImageShape& image) {
+    std::vector<int> shapes = previous->output_dimension();
+    if (shapes.size() != 3) {
+        std::stringstream ss;
+        ss << "The pooling needs an image input, layer " << previous->name()
+           << " has the output dimension ";
+        std::copy(shapes.begin(), shapes.end(),
+                  std::ostream_iterator<int>(ss, " "));
+        ss << "in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    channels = Channels(shapes[0]);
+    image = ImageShape(shapes[1], shapes[2]);
+}
+
+void check_rows(int in_rows, int rows) {
+    if (in_rows != rows) {
+        std::stringstream ss;
+        ss << "Dimension do not fit, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+}
+}  // namespace
+
+AvgPooling::AvgPooling(Window window, Stride stride, ImageShape imageshape,
+                       Channels channels)
+    : Layer("AvgPooling"),
+      _window(window),
+      _stride(stride),
+      _inp(imageshape),
+      _channels(channels),
+      _out(0, 0) {
+    initialize_output_dimension();
+}
+
+AvgPooling::AvgPooling(Window window, Stride stride,
+                       const std::shared_ptr<Layer>& previous)
+    : Layer("AvgPooling"),
+      _window(window),
+      _stride(stride),
+      _inp(0, 0),
+      _channels(0),
+      _out(0, 0) {
+    image_input(previous, _channels, _inp);
+    initialize_output_dimension();
+    _previous = previous;
+}
+
+// the same output size as the max pooling
+void AvgPooling::initialize_output_dimension() {
+    int out_height =
+        static_cast<int>(ceil(static_cast<float>(_inp.first() - _window.get()) /
+                              _stride.get())) +
+        1;
+    int out_width = static_cast<int>(
+                        ceil(static_cast<float>(_inp.second() - _window.get()) /
+                             _stride.get())) +
+                    1;
+    _out = ImageShape(out_height, out_width);
+    _out_dim[0] = _channels.get();
+    _out_dim.push_back(out_height);
+    _out_dim.push_back(out_width);
+}
+
+void AvgPooling::check_input_size(int rows) {
+    check_rows(rows, _channels.get() * _inp.first() * _inp.second());
+}
+
+void AvgPooling::forward_gpu(const SharedStorage& in, SharedStorage& out,
+                             const std::string&) {
+    check_input_size(in->get_rows());
+    avg_pooling_gpu(in->gpu_pointer_const(), _window.get(), _stride.get(),
+                    _inp.first(), _inp.second(), _channels.get(),
+                    _out.first(), _out.second(), in->get_cols(),
+                    out->gpu_pointer());
+}
+
+void AvgPooling::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                             const std::string&) {
+    forward_bound(buffers(in, out), Mode::Predict);
+}
+
+void AvgPooling::forward_bound(const Buffers& buffers, Mode) {
+    check_input_size(buffers.in_rows);
+    avg_pooling_cpu(buffers.in, _window.get(), _stride.get(), _inp.first(),
+                    _inp.second(), _channels.get(), _out.first(),
+                    _out.second(), buffers.cols, buffers.out);
+}
+
+void AvgPooling::backward_gpu(const SharedStorage&,
+                              const SharedStorage& gradient_in,
+                              SharedStorage& gradient_out) {
+    avg_pooling_backward_gpu(gradient_in->gpu_pointer_const(), _window.get(),
+                             _stride.get(), _inp.first(), _inp.second(),
+                             _channels.get(), _out.first(), _out.second(),
+                             gradient_in->get_cols(),
+                             gradient_out->gpu_pointer());
+}
+
+void AvgPooling::backward_cpu(const SharedStorage& values,
+                              const SharedStorage& gradient_in,
+                              SharedStorage& gradient_out) {
+    backward_bound(buffers(values, gradient_in, gradient_out));
+}
+
+void AvgPooling::backward_bound(const Buffers& buffers) {
+    avg_pooling_backward_cpu(buffers.grad_in, _window.get(), _stride.get(),
+                             _inp.first(), _inp.second(), _channels.get(),
+                             _out.first(), _out.second(), buffers.cols,
+                             buffers.grad_out);
+}
+
+GlobalAvgPooling::GlobalAvgPooling(ImageShape imageshape, Channels channels)
+    : Layer("GlobalAvgPooling"), _inp(imageshape), _channels(channels) {
+    initialize_output_dimension();
+}
+
+GlobalAvgPooling::GlobalAvgPooling(const std::shared_ptr<Layer>& previous)
+    : Layer("GlobalAvgPooling"), _inp(0, 0), _channels(0) {
+    image_input(previous, _channels, _inp);
+    initialize_output_dimension();
+    _previous = previous;
+}
+
+void GlobalAvgPooling::initialize_output_dimension() {
+    _out_dim[0] = _channels.get();
+    _out_dim.push_back(1);
+    _out_dim.push_back(1);
+}
+
+void GlobalAvgPooling::check_input_size(int rows) {
+    check_rows(rows, _channels.get() * _inp.first() * _inp.second());
+}
+
+void GlobalAvgPooling::forward_gpu(const SharedStorage& in,
+                                   SharedStorage& out, const std::string&) {
+    check_input_size(in->get_rows());
+    global_avg_pooling_gpu(in->gpu_pointer_const(), _inp.first(),
+                           _inp.second(), _channels.get() * in->get_cols(),
+                           out->gpu_pointer());
+}
+
+void GlobalAvgPooling::forward_cpu(const SharedStorage& in,
+                                   SharedStorage& out, const std::string&) {
+    forward_bound(buffers(in, out), Mode::Predict);
+}
+
+void GlobalAvgPooling::forward_bound(const Buffers& buffers, Mode) {
+    check_input_size(buffers.in_rows);
+    global_avg_pooling_cpu(buffers.in, _inp.first() * _inp.second(),
+                           _channels.get() * buffers.cols, buffers.out);
+}
+
+void GlobalAvgPooling::backward_gpu(const SharedStorage&,
+                                    const SharedStorage& gradient_in,
+                                    SharedStorage& gradient_out) {
+    global_avg_pooling_backward_gpu(gradient_in->gpu_pointer_const(),
+                                    _inp.first(), _inp.second(),
+                                    _channels.get() * gradient_in->get_cols(),
+                                    gradient_out->gpu_pointer());
+}
+
+void GlobalAvgPooling::backward_cpu(const SharedStorage& values,
+                                    const SharedStorage& gradient_in,
+                                    SharedStorage& gradient_out) {
+    backward_bound(buffers(values, gradient_in, gradient_out));
+}
+
+void GlobalAvgPooling::backward_bound(const Buffers& buffers) {
+    global_avg_pooling_backward_cpu(buffers.grad_in,
+                                    _inp.first() * _inp.second(),
+                                    _channels.get() * buffers.cols,
+                                    buffers.grad_out);
+}
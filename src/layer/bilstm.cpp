@@ -0,0 +1,98 @@
+#include "../../include/layer/bilstm.hpp"
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "../../include/utils/execution_context.hpp"
+
+BiLSTM::BiLSTM(Features out, Features in, Init* init)
+    : Layer("BiLSTM"), _out(out),
+      _forward(std::make_unique<LSTM>(out, in, init)),
+      _reverse(std::make_unique<LSTM>(out, in, init)) {
+    _previous = NULL;
+    initialize_parameters();
+    initialize_output_dimension();
+}
+
+BiLSTM::BiLSTM(Features out, const std::shared_ptr<Layer>& previous,
+               Init* init)
+    : Layer("BiLSTM"), _out(out),
+      _forward(std::make_unique<LSTM>(out, previous, init)),
+      _reverse(std::make_unique<LSTM>(out, previous, init)) {
+    _previous = previous;
+    initialize_parameters();
+    initialize_output_dimension();
+}
+
+// The parameters and gradients are the storages of the two directions, so
+// the optimizers update those directly
+void BiLSTM::initialize_parameters() {
+    _reverse->_reverse = true;
+    for (LSTM* lstm : {_forward.get(), _reverse.get()}) {
+        for (SharedStorage& para : lstm->parameters) parameters.push_back(para);
+        for (SharedStorage& grad : lstm->gradients) gradients.push_back(grad);
+    }
+}
+
+void BiLSTM::initialize_output_dimension() { _out_dim[0] = 2 * _out.get(); }
+
+void BiLSTM::set_sequences(int sequences) {
+    _forward->set_sequences(sequences);
+    _reverse->set_sequences(sequences);
+}
+
+// The two directions are two chunks on the pool, each writes its own rows
+// of the output
+void BiLSTM::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                         const std::string& type) {
+    const Matrix& input = in->return_data_const();
+    Matrix& output = out->return_data();
+    int nh = _out.get();
+    ExecutionContext::instance().run(2, [&](int direction) {
+        if (direction == 0)
+            _forward->forward_cpu(input, output.topRows(nh), type);
+        else
+            _reverse->forward_cpu(input, output.bottomRows(nh), type);
+    });
+}
+
+// Both directions read their half of the incoming gradient, their input
+// gradients are summed into grad_out once both are done
+void BiLSTM::backward_cpu(const SharedStorage& values,
+                          const SharedStorage& grad_in,
+                          SharedStorage& grad_out) {
+    const Matrix& input = values->return_data_const();
+    const Matrix& gradient = grad_in->return_data_const();
+    int nh = _out.get();
+    ExecutionContext::instance().run(2, [&](int direction) {
+        if (direction == 0)
+            _forward->backward_cpu(input, gradient.topRows(nh));
+        else
+            _reverse->backward_cpu(input, gradient.bottomRows(nh));
+    });
+    _forward->input_gradient_cpu(grad_out->return_data(), false);
+    _reverse->input_gradient_cpu(grad_out->return_data(), true);
+}
+
+void BiLSTM::cpu_only(const std::string& what) {
+    std::stringstream ss;
+    ss << "The BiLSTM " << what << ", in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::invalid_argument(ss.str());
+}
+
+void BiLSTM::forward_gpu(const SharedStorage&, SharedStorage&,
+                         const std::string&) {
+    cpu_only("only runs on the CPU");
+}
+
+void BiLSTM::backward_gpu(const SharedStorage&, const SharedStorage&,
+                          SharedStorage&) {
+    cpu_only("only runs on the CPU");
+}
+
+// The reverse direction needs the whole sequence, so there is no
+// streaming inference
+void BiLSTM::step(const SharedStorage&, SharedStorage&) {
+    cpu_only("needs the whole sequence and cannot step");
+}
@@ -0,0 +1,85 @@
+#include "../../include/layer/conv_block.hpp"
+#include <stdexcept>
+#include "../../include/math.h"
+#include "../../include/utils/execution_context.hpp"
+#include "../../include/utils/parallel.hpp"
+
+ConvBlock::ConvBlock(const std::shared_ptr<Convolution>& conv, bool relu,
+                     const std::shared_ptr<Pooling>& pool)
+    : Layer("ConvBlock"),
+      _conv(conv),
+      _relu(relu),
+      _pool(pool),
+      argmax(),
+      conv_gradient(std::make_shared<Storage>()) {
+    _conv->implicit_gemm(true);
+    parameters = _conv->parameters;
+    gradients = _conv->gradients;
+    _out_dim = _pool->output_dimension();
+    _previous = _conv->previous();
+}
+
+bool ConvBlock::fusable(const std::shared_ptr<Convolution>& conv,
+                        const std::shared_ptr<Pooling>& pool) {
+    return (pool->_channels.get() == conv->_filters.get()) and
+           (pool->_inp.first() == conv->_out.first()) and
+           (pool->_inp.second() == conv->_out.second()) and
+           (pool->_window.get() <= 15);
+}
+
+int ConvBlock::conv_rows() {
+    return _conv->_filters.get() * _conv->_out.first() * _conv->_out.second();
+}
+
+void ConvBlock::check_argmax(const SharedStorage& out) {
+    argmax.resize(out->get_rows() * out->get_cols());
+}
+
+void ConvBlock::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                            const std::string&) {
+    check_argmax(out);
+    if (_conv->_tune) {
+        SharedStorage tmp = std::make_shared<Storage>(
+            Matrix::Zero(conv_rows(), in->get_cols()));
+        _conv->tune(in, tmp);
+    }
+    if (_conv->_fast) _conv->_fast->prepare(parameters[0]);
+    const float* inpp = in->cpu_pointer_const();
+    float* outp = out->cpu_pointer();
+    uint8_t* maskp = argmax.data();
+    int image = in->get_rows();
+    int pooled = out->get_rows();
+    int filters = _conv->_filters.get();
+    const ImageShape& conv_out = _conv->_out;
+    const ImageShape& pool_out = _pool->_out;
+    parallel_for(in->get_cols(), [&](int begin, int end) {
+        ScratchBuffer cols(_conv->sample_workspace());
+        ScratchBuffer sample(conv_rows());
+        for (int n = begin; n < end; ++n) {
+            _conv->forward_sample_cpu(inpp + n * image, sample.data(),
+                                      cols.data());
+            max_pooling_planes_cpu(
+                sample.data(), _pool->_window.get(), _pool->_stride.get(),
+                conv_out.first(), conv_out.second(), filters, pool_out.first(),
+                pool_out.second(), _relu, outp + n * pooled,
+                maskp + n * pooled);
+        }
+    });
+}
+
+void ConvBlock::backward_cpu(const SharedStorage& values,
+                             const SharedStorage& gradient_in,
+                             SharedStorage& gradient_out) {
+    int obs = gradient_in->get_cols();
+    if ((conv_gradient->get_rows() != conv_rows()) or
+        (conv_gradient->get_cols() != obs))
+        conv_gradient =
+            std::make_shared<Storage>(Matrix::Zero(conv_rows(), obs));
+    pooling_backward_cpu(gradient_in->cpu_pointer_const(), argmax.data(),
+                         _pool->_window.get(), _pool->_stride.get(),
+                         _conv->_out.first(), _conv->_out.second(),
+                         _conv->_filters.get(), _pool->_out.first(),
+                         _pool->_out.second(), obs,
+                         conv_gradient->cpu_pointer());
+    _conv->backward_cpu(values, conv_gradient, gradient_out);
+}
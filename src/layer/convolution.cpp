@@ -1,15 +1,31 @@
 #include "../../include/layer/convolution.h"
 #include <cblas.h>
 #include <algorithm>
+#include <chrono>
 //#include "/usr/lib/x86_64-linux-gnu/cblas_atlas.h>
 // c
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <random>
 #include <stdexcept>
 #include "../../include/cuda_math.h"
 #include "../../include/math.h"
+#include "../../include/utils/execution_context.hpp"
+#include "../../include/utils/parallel.hpp"
+
+namespace {
+// the names of the algorithms in the tuning cache, also the order in which
+// the autotuner tries them
+const std::vector<std::pair<ConvAlgorithm, std::string>> algorithm_names{
+    {ConvAlgorithm::Gemm, "gemm"},
+    {ConvAlgorithm::Im2Col, "im2col"},
+    {ConvAlgorithm::Winograd2x2, "winograd2x2"},
+    {ConvAlgorithm::Winograd4x4, "winograd4x4"},
+    {ConvAlgorithm::FFT, "fft"},
+    {ConvAlgorithm::Direct, "direct"}};
+}  // namespace
 
 Convolution::Convolution(FilterShape filtershape, Pad pad, Stride stride,
                          Filters filters, ImageShape imageshape,
@@ -21,7 +37,16 @@ Convolution::Convolution(FilterShape filtershape, Pad pad, Stride stride,
       _filters(filters),
       _inp(imageshape),
       _out(0, 0),
-      _channels(channels) {
+      _channels(channels),
+      _implicit(false),
+      _algorithm(ConvAlgorithm::Gemm),
+      _tune(false),
+      _cache(),
+      _producer(nullptr),
+      _blocked_request(false),
+      _blocked_in(false),
+      _blocked_out(false),
+      _blocked_bias() {
     cublasStatus_t stat = cublasCreate(&_handle);
     CHECK_CUBLAS(stat);
     initialize_output_dimension();
@@ -40,7 +65,16 @@ Convolution::Convolution(FilterShape filtershape, Pad pad, Stride stride,
       _filters(filters),
       _inp(0, 0),
       _out(0, 0),
-      _channels(0) {
+      _channels(0),
+      _implicit(false),
+      _algorithm(ConvAlgorithm::Gemm),
+      _tune(false),
+      _cache(),
+      _producer(nullptr),
+      _blocked_request(false),
+      _blocked_in(false),
+      _blocked_out(false),
+      _blocked_bias() {
     cublasStatus_t stat = cublasCreate(&_handle);
     CHECK_CUBLAS(stat);
     initialize_input_dimension(previous);
@@ -173,18 +207,208 @@ void Convolution::forward_gpu(const SharedStorage& in, SharedStorage& out,
     my_add_vec_to_mat_colwise(out, parameters[1], 1.0f);
 }
 
+void Convolution::implicit_gemm(bool implicit) { _implicit = implicit; }
+
+void Convolution::algorithm(ConvAlgorithm algorithm) {
+    _tune = false;
+    if ((algorithm == ConvAlgorithm::Gemm) or
+        (algorithm == ConvAlgorithm::Im2Col)) {
+        _fast.reset();
+    } else if (algorithm == ConvAlgorithm::FFT) {
+        _fast = std::make_unique<FFTConvolution>(_kernel, _channels, _filters,
+                                                 _inp, _pad, _stride);
+    } else if (algorithm == ConvAlgorithm::Direct) {
+        _fast = std::make_unique<DirectConvolution>(
+            _kernel, _channels, _filters, _inp, _pad, _stride);
+    } else if ((_kernel.first() == 3) and (_kernel.second() == 3) and
+               (_stride.get() == 1) and (_pad.get() <= 2)) {
+        int tile = (algorithm == ConvAlgorithm::Winograd2x2) ? 2 : 4;
+        _fast = std::make_unique<Winograd>(tile, _channels, _filters, _inp,
+                                           _pad);
+    } else {
+        std::stringstream ss;
+        ss << "Winograd needs 3x3 filters, stride 1 and a pad of at most 2,"
+              " in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    _algorithm = algorithm;
+    // the next batch reaches this layer in the channel-major layout again
+    if (_producer and (algorithm != ConvAlgorithm::Direct))
+        _producer->_blocked_request = false;
+}
+
+DirectConvolution* Convolution::direct() const {
+    if (_algorithm != ConvAlgorithm::Direct) return nullptr;
+    return static_cast<DirectConvolution*>(_fast.get());
+}
+
+// The output of the batch is blocked if the reader asked for it at the
+// last batch, the input if the producer wrote it blocked. The producer
+// writes the next batch blocked if both run direct on whole blocks
+void Convolution::choose_layouts() {
+    DirectConvolution* kernels = direct();
+    _blocked_out = _blocked_request and kernels;
+    _blocked_in = _producer and _producer->_blocked_out;
+    if (_producer) {
+        DirectConvolution* producer = _producer->direct();
+        _producer->_blocked_request =
+            kernels and producer and
+            (producer->block() == kernels->block()) and
+            (_channels.get() % kernels->block() == 0);
+    }
+    if (kernels) kernels->layout(_blocked_in, _blocked_out);
+}
+
+void Convolution::autotune(const std::string& cache) {
+    _tune = true;
+    _cache = cache;
+}
+
+// the cpu, the threads and everything about the shape that the speed of
+// the algorithms depends on
+std::string Convolution::tuning_key(int batch) const {
+    std::stringstream ss;
+    ss << ConvCache::cpu_model() << " threads "
+       << ExecutionContext::instance().threads() << ": " << _channels.get()
+       << "x" << _inp.first() << "x" << _inp.second() << " kernel "
+       << _kernel.first() << "x" << _kernel.second() << " pad " << _pad.get()
+       << " stride " << _stride.get() << " filters " << _filters.get()
+       << " batch " << batch;
+    return ss.str();
+}
+
+// Takes the algorithm from the cache if it has one for the key, otherwise
+// times a forward and a backward pass over the batch with every algorithm
+// the shape allows and stores the fastest. A first pair of passes prepares
+// the filters and warms the caches, the best of the next few counts. The
+// parameter gradients it leaves are overwritten by the real backward pass
+void Convolution::tune(const SharedStorage& in, SharedStorage& out) {
+    const int repetitions = 3;
+    _tune = false;
+    ConvCache cache(_cache);
+    std::string key = tuning_key(in->get_cols());
+    std::string name;
+    if (cache.find(key, name))
+        for (const auto& candidate : algorithm_names)
+            if (candidate.second == name) return algorithm(candidate.first);
+    SharedStorage grad_images = std::make_shared<Storage>(
+        Matrix::Zero(in->get_rows(), in->get_cols()));
+    ConvAlgorithm best = ConvAlgorithm::Gemm;
+    double best_time = std::numeric_limits<double>::max();
+    for (const auto& candidate : algorithm_names) {
+        try {
+            algorithm(candidate.first);
+        } catch (const std::invalid_argument&) {
+            continue;
+        }
+        for (int i = 0; i <= repetitions; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            forward_implicit_cpu(in, out);
+            backward_cpu(in, out, grad_images);
+            std::chrono::duration<double> time =
+                std::chrono::steady_clock::now() - start;
+            if ((i > 0) and (time.count() < best_time)) {
+                best_time = time.count();
+                best = candidate.first;
+                name = candidate.second;
+            }
+        }
+    }
+    algorithm(best);
+    if (!cache.store(key, name))
+        std::cout << "Cannot write the convolution cache " << cache.path()
+                  << ", the choice of " << name << " is not kept"
+                  << std::endl;
+}
+
+// Every sample is one GEMM of its im2col block with the filters, spread
+// over the threads. The bias is copied into the output first and the GEMM
+// accumulates onto it, which fuses the bias add into the GEMM
 void Convolution::forward_cpu(const SharedStorage& in, SharedStorage& out,
                               const std::string&) {
+    check_size(out);
+    if (_implicit and _tune) tune(in, out);
+    if (_implicit) choose_layouts();
+    if (_implicit) return forward_implicit_cpu(in, out);
     const float* inpp = in->cpu_pointer_const();
+    const float* wp = parameters[0]->cpu_pointer_const();
+    const Matrix& bias = parameters[1]->return_data_const();
     float* outp = out->cpu_pointer();
     int M = _out.first() * _out.second();
     int N = _filters.get();
     int K = _channels.get() * _kernel.first() * _kernel.second();
-    for (int n = 0; n < n_batches(in); ++n) {
-        cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, M, N, K, 1.0f,
-                    inpp, M, parameters[0]->cpu_pointer_const(), K, 0.0f, outp,
-                    M);
-        advance_pointers_forward(inpp, outp);
+    parallel_for(n_batches(in), [&](int begin, int end) {
+        for (int n = begin; n < end; ++n) {
+            float* sample = outp + n * M * N;
+            Eigen::Map<Matrix>(sample, M * N, 1) = bias;
+            cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, M, N, K,
+                        1.0f, inpp + n * M * K, M, wp, K, 1.0f, sample, M);
+        }
+    });
+}
+
+// Output positions per im2col tile, so that a tile takes about 256kB and
+// stays in L2 during its GEMM, the Im2Col algorithm packs all at once
+int Convolution::tile_positions() {
+    int depth = _channels.get() * _kernel.first() * _kernel.second();
+    int positions = _out.first() * _out.second();
+    if (_algorithm == ConvAlgorithm::Im2Col) return positions;
+    return std::max(1, std::min(positions, (1 << 16) / depth));
+}
+
+// Same as the explicit GEMM but on blocks of output positions whose im2col
+// rows are packed into a buffer per thread right before they are needed,
+// so the batch never exists in im2col form. The other algorithms use the
+// buffer for their transformed or blocked copies instead
+void Convolution::forward_implicit_cpu(const SharedStorage& in,
+                                       SharedStorage& out) {
+    const float* inpp = in->cpu_pointer_const();
+    float* outp = out->cpu_pointer();
+    int image = in->get_rows();
+    int sample = out->get_rows();
+    if (_fast) _fast->prepare(parameters[0]);
+    if (_blocked_out) {
+        _blocked_bias.resize(sample, 1);
+        direct()->to_blocked(parameters[1]->cpu_pointer_const(),
+                             _blocked_bias.data(), _filters.get(),
+                             _out.first() * _out.second());
+    }
+    parallel_for(in->get_cols(), [&](int begin, int end) {
+        ScratchBuffer cols(sample_workspace());
+        for (int n = begin; n < end; ++n)
+            forward_sample_cpu(inpp + n * image, outp + n * sample,
+                               cols.data());
+    });
+}
+
+// the floats of the buffer forward_sample_cpu needs
+int Convolution::sample_workspace() {
+    int K = _channels.get() * _kernel.first() * _kernel.second();
+    return _fast ? _fast->workspace() : tile_positions() * K;
+}
+
+// The output of one image, the filters of the fast algorithms have to be
+// prepared beforehand
+void Convolution::forward_sample_cpu(const float* image, float* sample,
+                                     float* cols) {
+    const float* wp = parameters[0]->cpu_pointer_const();
+    const Matrix& bias =
+        _blocked_out ? _blocked_bias : parameters[1]->return_data_const();
+    int M = _out.first() * _out.second();
+    int N = _filters.get();
+    int K = _channels.get() * _kernel.first() * _kernel.second();
+    int tile = tile_positions();
+    Eigen::Map<Matrix>(sample, M * N, 1) = bias;
+    if (_fast) return _fast->forward_cpu(image, sample, cols);
+    for (int first = 0; first < M; first += tile) {
+        int count = std::min(tile, M - first);
+        im2col_tile_cpu(image, _channels.get(), _inp.first(), _inp.second(),
+                        _kernel.first(), _kernel.second(), _pad.get(),
+                        _stride.get(), first, count, cols);
+        cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, count, N, K,
+                    1.0f, cols, count, wp, K, 1.0f, sample + first, M);
     }
 }
 
@@ -260,24 +484,134 @@ void Convolution::backward_gpu(const SharedStorage& values,
     }
 }
 
+// The samples are spread over the threads, each sums the weight and bias
+// gradients of its samples into buffers of its own which a tree reduction
+// adds up afterwards
 void Convolution::backward_cpu(const SharedStorage& values,
                                const SharedStorage& gradient_in,
                                SharedStorage& gradient_out) {
     check_size_backwards(values, gradient_out);
     int M, N, K;
     backwards_weight_grad_para(M, N, K);
+    int chunks = parallel_chunks(gradient_in->get_cols());
+    std::vector<Matrix> weight_grads(chunks, Matrix::Zero(M, N));
+    std::vector<Matrix> bias_grads(chunks, Matrix::Zero(N * K, 1));
+    if (_implicit)
+        backward_implicit_cpu(values, gradient_in, gradient_out, weight_grads,
+                              bias_grads);
+    else
+        backward_explicit_cpu(values, gradient_in, gradient_out, weight_grads,
+                              bias_grads);
+    reduce_gradients(weight_grads);
+    reduce_gradients(bias_grads);
+    gradients[0]->return_data() = weight_grads[0];
+    gradients[1]->return_data() = bias_grads[0];
+}
+
+void Convolution::backward_explicit_cpu(const SharedStorage& values,
+                                        const SharedStorage& gradient_in,
+                                        SharedStorage& gradient_out,
+                                        std::vector<Matrix>& weight_grads,
+                                        std::vector<Matrix>& bias_grads) {
+    int M, N, K;
+    backwards_weight_grad_para(M, N, K);
     const float* valp = values->cpu_pointer_const();
     const float* grad_inp = gradient_in->cpu_pointer_const();
     const float* wp = parameters[0]->cpu_pointer_const();
-    float* weight_gradp = gradients[0]->cpu_pointer();
     float* grad_outp = gradient_out->cpu_pointer();
-    float beta = 0.0f;
-    for (int n = 0; n < gradient_in->get_cols(); ++n) {
-        cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, M, N, K, 1.0f,
-                    valp, K, grad_inp, K, beta, weight_gradp, M);
-        cblas_sgemm(CblasColMajor, CblasNoTrans, CblasTrans, K, M, N, 1.0f,
-                    grad_inp, K, wp, M, 0.0f, grad_outp, K);
-        beta = 1.0f;
-        advance_pointers_backward(grad_inp, valp, grad_outp);
+    parallel_for(gradient_in->get_cols(), [&](int chunk, int begin, int end) {
+        for (int n = begin; n < end; ++n) {
+            const float* sample_grad = grad_inp + n * K * N;
+            const float* sample_vals = valp + n * K * M;
+            cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, M, N, K, 1.0f,
+                        sample_vals, K, sample_grad, K, 1.0f,
+                        weight_grads[chunk].data(), M);
+            cblas_sgemm(CblasColMajor, CblasNoTrans, CblasTrans, K, M, N, 1.0f,
+                        sample_grad, K, wp, M, 0.0f, grad_outp + n * K * M, K);
+            bias_grads[chunk] +=
+                Eigen::Map<const Matrix>(sample_grad, N * K, 1);
+        }
+    });
+}
+
+// Repacks the im2col tiles of the forward pass, the gradient of each tile
+// is added back onto the image gradient right away. With the other
+// algorithms the tiles only serve the weight gradient and they compute the
+// image's. The tiles read channel-major images, blocked ones are converted
+// per sample for them
+void Convolution::backward_implicit_cpu(const SharedStorage& values,
+                                        const SharedStorage& gradient_in,
+                                        SharedStorage& gradient_out,
+                                        std::vector<Matrix>& weight_grads,
+                                        std::vector<Matrix>& bias_grads) {
+    int M, N, K;
+    backwards_weight_grad_para(M, N, K);
+    const float* valp = values->cpu_pointer_const();
+    const float* grad_inp = gradient_in->cpu_pointer_const();
+    const float* wp = parameters[0]->cpu_pointer_const();
+    float* grad_outp = gradient_out->cpu_pointer();
+    int image = values->get_rows();
+    int tile = tile_positions();
+    if (_fast) _fast->prepare(parameters[0]);
+    parallel_for(gradient_in->get_cols(), [&](int chunk, int begin, int end) {
+        ScratchBuffer cols(tile * M);
+        ScratchBuffer grad_cols(_fast ? _fast->workspace() : tile * M);
+        ScratchBuffer plain_image(_blocked_in ? image : 0);
+        ScratchBuffer plain_grad(_blocked_out ? K * N : 0);
+        for (int n = begin; n < end; ++n) {
+            const float* blocked_grad = grad_inp + n * K * N;
+            const float* sample_grad = blocked_grad;
+            const float* sample_vals = valp + n * image;
+            if (_blocked_out) {
+                direct()->to_channels(blocked_grad, plain_grad.data(), N, K);
+                sample_grad = plain_grad.data();
+            }
+            if (_blocked_in) {
+                direct()->to_channels(sample_vals, plain_image.data(),
+                                      _channels.get(),
+                                      _inp.first() * _inp.second());
+                sample_vals = plain_image.data();
+            }
+            float* image_grad = grad_outp + n * image;
+            std::fill(image_grad, image_grad + image, 0.0f);
+            for (int first = 0; first < K; first += tile) {
+                int count = std::min(tile, K - first);
+                im2col_tile_cpu(sample_vals, _channels.get(),
+                                _inp.first(), _inp.second(), _kernel.first(),
+                                _kernel.second(), _pad.get(), _stride.get(),
+                                first, count, cols.data());
+                cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, M, N,
+                            count, 1.0f, cols.data(), count,
+                            sample_grad + first, K, 1.0f,
+                            weight_grads[chunk].data(), M);
+                if (_fast) continue;
+                cblas_sgemm(CblasColMajor, CblasNoTrans, CblasTrans, count, M,
+                            N, 1.0f, sample_grad + first, K, wp, M, 0.0f,
+                            grad_cols.data(), count);
+                col2im_tile_cpu(grad_cols.data(), _channels.get(),
+                                _inp.first(), _inp.second(), _kernel.first(),
+                                _kernel.second(), _pad.get(), _stride.get(),
+                                first, count, image_grad);
+            }
+            if (_fast)
+                _fast->backward_cpu(blocked_grad, image_grad,
+                                    grad_cols.data());
+            bias_grads[chunk] +=
+                Eigen::Map<const Matrix>(sample_grad, N * K, 1);
+        }
+    });
+}
+
+// Adds the buffers pairwise in log2(n) rounds, the sum ends up in the first
+void Convolution::reduce_gradients(std::vector<Matrix>& partial) {
+    int n = partial.size();
+    for (int stride = 1; stride < n; stride *= 2) {
+        int pairs = (n - stride + 2 * stride - 1) / (2 * stride);
+        parallel_for(pairs, [&](int begin, int end) {
+            for (int pair = begin; pair < end; ++pair) {
+                int i = 2 * stride * pair;
+                partial[i] += partial[i + stride];
+            }
+        });
     }
 }
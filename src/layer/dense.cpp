@@ -74,8 +74,56 @@ void Dense::initialize_input_dimension(const std::shared_ptr<Layer>& previous) {
 void Dense::initialize_output_dimension() { 
     _out_dim[0] =_out.get(); }
 
+void Dense::check_dense_input(const SharedStorage& in) {
+    if (in->is_sparse()) {
+        std::stringstream ss;
+        ss << "Sparse inputs are only supported on the CPU, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+}
+
+// Every non-zero adds a scaled weight column to the output of its
+// observation, so the cost scales with nnz instead of the input width
+void Dense::forward_sparse_cpu(const SharedStorage& in, SharedStorage& out) {
+    const SparseMatrix& in_ref = in->return_sparse_const();
+    const Matrix& weight = parameters[0]->return_data_const();
+    Matrix& out_ref = out->return_data();
+    for (int obs = 0; obs < in_ref.outerSize(); ++obs) {
+        out_ref.col(obs) = parameters[1]->return_data_const();
+        for (SparseMatrix::InnerIterator it(in_ref, obs); it; ++it)
+            out_ref.col(obs) += it.value() * weight.col(it.col());
+    }
+}
+
+// Only the weight columns of active features receive a gradient, the ones
+// written in the previous pass are reset instead of the whole matrix (after
+// a dense pass, which leaves no record, everything is cleared once). The
+// input gradient is skipped as nothing upstream of a sparse input uses it
+void Dense::backward_sparse_cpu(const SharedStorage& values,
+                                const SharedStorage& gradient_in) {
+    const SparseMatrix& val_ref = values->return_sparse_const();
+    const Matrix& grad_in = gradient_in->return_data_const();
+    Matrix& weight_ref = gradients[0]->return_data();
+    gradients[1]->return_data() = grad_in.rowwise().sum();
+    if (_touched.empty()) weight_ref.setZero();
+    for (int col : _touched) weight_ref.col(col).setZero();
+    _touched.clear();
+    for (int obs = 0; obs < val_ref.outerSize(); ++obs) {
+        for (SparseMatrix::InnerIterator it(val_ref, obs); it; ++it) {
+            weight_ref.col(it.col()) += it.value() * grad_in.col(obs);
+            _touched.push_back(it.col());
+        }
+    }
+}
+
 void Dense::forward_cpu(const SharedStorage& in, SharedStorage& out,
                         const std::string&) {
+    if (in->is_sparse()) {
+        forward_sparse_cpu(in, out);
+        return;
+    }
     const Matrix& in_ref = in->return_data_const();
     out->return_data() = parameters[0]->return_data_const() * in_ref;
     for (int i = 0; i < out->get_cols(); i++)
@@ -84,6 +132,7 @@ void Dense::forward_cpu(const SharedStorage& in, SharedStorage& out,
 
 void Dense::forward_gpu(const SharedStorage& in, SharedStorage& out,
                         const std::string&) {
+    check_dense_input(in);
     cublasOperation_t transA = CUBLAS_OP_N;
     cublasOperation_t transB = CUBLAS_OP_N;
     dtype alpha = 1;
@@ -102,6 +151,7 @@ void Dense::resize_assistance(int batches) {
 void Dense::backward_gpu(const SharedStorage& values,
                          const SharedStorage& gradient_in,
                          SharedStorage& gradient_out) {
+    check_dense_input(values);
     resize_assistance(gradient_in->get_cols());
     Matrix test = gradient_in->return_data_const().rowwise().sum();
     my_Dgemv(_handle, CUBLAS_OP_N, gradient_in, assistance_parameters[0],
@@ -115,6 +165,11 @@ void Dense::backward_gpu(const SharedStorage& values,
 void Dense::backward_cpu(const SharedStorage& values,
                          const SharedStorage& gradient_in,
                          SharedStorage& gradient_out) {
+    if (values->is_sparse()) {
+        backward_sparse_cpu(values, gradient_in);
+        return;
+    }
+    _touched.clear();
     Matrix& bias_ref = gradients[1]->return_data();
     Matrix& weight_ref = gradients[0]->return_data();
     bias_ref = gradient_in->return_data_const().rowwise().sum();
@@ -0,0 +1,163 @@
+#include "../../include/layer/dense_block.hpp"
+#include <cblas.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "../../include/utils/execution_context.hpp"
+#include "../../include/utils/parallel.hpp"
+
+namespace {
+void activate(Activation activation, float* data, int n) {
+    if (activation == Activation::Relu) {
+        for (int i = 0; i < n; ++i) data[i] = std::max(data[i], 0.f);
+    } else if (activation == Activation::Sigmoid) {
+        for (int i = 0; i < n; ++i) {
+            float x = data[i];
+            data[i] = (x > 0) ? 1.f / (1.f + std::exp(-x))
+                              : std::exp(x) / (1.f + std::exp(x));
+        }
+    } else {
+        for (int i = 0; i < n; ++i) data[i] = std::tanh(data[i]);
+    }
+}
+
+// grad times the derivative of the activation at the output y
+void derivative(Activation activation, const float* y, const float* grad,
+                float* out, int n) {
+    if (activation == Activation::Relu) {
+        for (int i = 0; i < n; ++i) out[i] = (y[i] > 0) ? grad[i] : 0.f;
+    } else if (activation == Activation::Sigmoid) {
+        for (int i = 0; i < n; ++i) out[i] = grad[i] * y[i] * (1.f - y[i]);
+    } else {
+        for (int i = 0; i < n; ++i) out[i] = grad[i] * (1.f - y[i] * y[i]);
+    }
+}
+}  // namespace
+
+DenseBlock::DenseBlock(Features out, const std::shared_ptr<Layer>& previous,
+                       Init* init, Activation activation)
+    : DenseBlock(std::make_shared<Dense>(out, previous, init), activation) {}
+
+DenseBlock::DenseBlock(const std::shared_ptr<Dense>& dense,
+                       Activation activation)
+    : Layer("DenseBlock"),
+      _dense(dense),
+      _activation(activation),
+      _output() {
+    parameters = _dense->return_parameters();
+    gradients = _dense->return_gradients();
+    _out_dim = _dense->output_dimension();
+    _previous = _dense->previous();
+}
+
+// Observations per tile, so that the inputs and outputs of a tile take
+// about 256kB and stay in L2 between the GEMM and the activation
+int DenseBlock::tile_observations() {
+    int width = parameters[0]->get_rows() + parameters[0]->get_cols();
+    return std::max(1, (1 << 16) / width);
+}
+
+void DenseBlock::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                             const std::string& type) {
+    _output = out;
+    if (in->is_sparse()) {
+        _dense->forward_cpu(in, out, type);
+        activate(_activation, out->cpu_pointer(),
+                 out->get_rows() * out->get_cols());
+        return;
+    }
+    const float* inpp = in->cpu_pointer_const();
+    const float* wp = parameters[0]->cpu_pointer_const();
+    const Matrix& bias = parameters[1]->return_data_const();
+    float* outp = out->cpu_pointer();
+    int M = parameters[0]->get_rows();
+    int K = parameters[0]->get_cols();
+    int tile = tile_observations();
+    parallel_for(in->get_cols(), [&](int begin, int end) {
+        for (int first = begin; first < end; first += tile) {
+            int count = std::min(tile, end - first);
+            float* outt = outp + first * M;
+            Eigen::Map<Matrix>(outt, M, count).colwise() = bias.col(0);
+            cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, M, count,
+                        K, 1.0f, wp, M, inpp + first * K, K, 1.0f, outt, M);
+            activate(_activation, outt, M * count);
+        }
+    });
+}
+
+// The derivative of a tile goes into a buffer of the thread, from which the
+// input gradient and the thread's weight and bias gradients are computed;
+// the latter are summed up afterwards
+void DenseBlock::backward_cpu(const SharedStorage& values,
+                              const SharedStorage& gradient_in,
+                              SharedStorage& gradient_out) {
+    if (values->is_sparse())
+        return sparse_backward_cpu(values, gradient_in, gradient_out);
+    const float* valp = values->cpu_pointer_const();
+    const float* gradp = gradient_in->cpu_pointer_const();
+    const float* yp = _output->cpu_pointer_const();
+    const float* wp = parameters[0]->cpu_pointer_const();
+    float* grad_outp = gradient_out->cpu_pointer();
+    int M = parameters[0]->get_rows();
+    int K = parameters[0]->get_cols();
+    int tile = tile_observations();
+    int chunks = parallel_chunks(gradient_in->get_cols());
+    std::vector<Matrix> weight_grads(chunks, Matrix::Zero(M, K));
+    std::vector<Matrix> bias_grads(chunks, Matrix::Zero(M, 1));
+    parallel_for(gradient_in->get_cols(), [&](int chunk, int begin, int end) {
+        ScratchBuffer delta(M * tile);
+        for (int first = begin; first < end; first += tile) {
+            int count = std::min(tile, end - first);
+            derivative(_activation, yp + first * M, gradp + first * M,
+                       delta.data(), M * count);
+            cblas_sgemm(CblasColMajor, CblasNoTrans, CblasTrans, M, K, count,
+                        1.0f, delta.data(), M, valp + first * K, K, 1.0f,
+                        weight_grads[chunk].data(), M);
+            cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, K, count, M,
+                        1.0f, wp, M, delta.data(), M, 0.0f,
+                        grad_outp + first * K, K);
+            bias_grads[chunk] +=
+                Eigen::Map<const Matrix>(delta.data(), M, count)
+                    .rowwise()
+                    .sum();
+        }
+    });
+    for (int chunk = 1; chunk < chunks; ++chunk) {
+        weight_grads[0] += weight_grads[chunk];
+        bias_grads[0] += bias_grads[chunk];
+    }
+    gradients[0]->return_data() = weight_grads[0];
+    gradients[1]->return_data() = bias_grads[0];
+}
+
+// sparse inputs take the sparse path of the Dense layer with the derivative
+// applied beforehand
+void DenseBlock::sparse_backward_cpu(const SharedStorage& values,
+                                     const SharedStorage& gradient_in,
+                                     SharedStorage& gradient_out) {
+    SharedStorage delta = std::make_shared<Storage>(
+        Matrix(gradient_in->get_rows(), gradient_in->get_cols()));
+    derivative(_activation, _output->cpu_pointer_const(),
+               gradient_in->cpu_pointer_const(), delta->cpu_pointer(),
+               gradient_in->get_rows() * gradient_in->get_cols());
+    _dense->backward_cpu(values, delta, gradient_out);
+}
+
+void DenseBlock::forward_gpu(const SharedStorage&, SharedStorage&,
+                             const std::string&) {
+    std::stringstream ss;
+    ss << "The fused dense block runs on the cpu only, in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::runtime_error(ss.str());
+}
+
+void DenseBlock::backward_gpu(const SharedStorage&, const SharedStorage&,
+                              SharedStorage&) {
+    std::stringstream ss;
+    ss << "The fused dense block runs on the cpu only, in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::runtime_error(ss.str());
+}
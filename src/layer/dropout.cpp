@@ -1,24 +1,31 @@
 #include "../../include/layer/dropout.h"
 #include <curand.h>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <sstream>
 #include <stdexcept>
 #include "../../include/cuda_math.h"
 #include "../../include/math.h"
+#include "../../include/utils/execution_context.hpp"
+#include "../../include/utils/parallel.hpp"
 
-Dropout::Dropout(dtype prob) : Layer("Dropout"), probability(prob) {
+Dropout::Dropout(dtype prob)
+    : Layer("Dropout"),
+      probability(prob),
+      _layer(ExecutionContext::instance().layer()) {
     initialize_random();
     initialize_masking();
-    dis = std::uniform_real_distribution<float>(0.0, 1.0);
 }
 
 Dropout::Dropout(dtype prob, const std::shared_ptr<Layer>& previous)
-    : Layer("Dropout"), probability(prob) {
+    : Layer("Dropout"),
+      probability(prob),
+      _layer(ExecutionContext::instance().layer()) {
     initialize_random();
     initialize_masking();
-    dis = std::uniform_real_distribution<float>(0.0, 1.0);
     _previous = previous;
 }
 
@@ -28,41 +35,59 @@ void Dropout::initialize_masking() { masking = std::make_shared<Storage>(); }
 Dropout::~Dropout() { CHECK_CURAND(curandDestroyGenerator(gen_device)); }
 
 void Dropout::initialize_random() {
-    std::random_device rd;
-    gen_host = std::mt19937(rd());
-    gen_host.seed(0);
-    dis = std::uniform_real_distribution<float>(0.0, 1.0);
     CHECK_CURAND(curandCreateGenerator(&gen_device, CURAND_RNG_PSEUDO_DEFAULT));
     CHECK_CURAND(curandSetPseudoRandomGeneratorSeed(gen_device, 1234ULL));
 }
 
-void Dropout::check_masking(const SharedStorage& in) {
-    if (!same_size(in, masking)) {
-        masking = std::make_shared<Storage>(
-            Matrix::Zero(in->get_rows(), in->get_cols()));
-    }
+void Dropout::check_masking(int rows, int cols) {
+    if ((masking->get_rows() != rows) or (masking->get_cols() != cols))
+        masking = std::make_shared<Storage>(Matrix::Zero(rows, cols));
 }
 
 void Dropout::forward_cpu(const SharedStorage& in, SharedStorage& out,
                           const std::string& type) {
-    if (type == "predict") {
-        out->update_cpu_data(in->return_data_const());
+    if (!same_size(in, out)) {
+        std::stringstream ss;
+        ss << "Dimension do not fit, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    forward_bound(buffers(in, out), mode_of(type));
+}
+
+void Dropout::forward_bound(const Buffers& buffers, Mode mode) {
+    int rows = buffers.in_rows;
+    int cols = buffers.cols;
+    if (mode == Mode::Predict) {
+        std::copy(buffers.in, buffers.in + rows * cols, buffers.out);
         return;
     }
-    check_masking(in);
-    int rows = in->get_rows();
-    int cols = in->get_cols();
-    Matrix bern =
-        Matrix::NullaryExpr(rows, cols, [&]() { return dis(gen_host); });
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; j++) {
-            masking->return_data()(i, j) =
-                (bern(i, j) < probability) ? 1. / probability : 0.;
+    check_masking(rows, cols);
+    int streams = (cols + stream_columns - 1) / stream_columns;
+    check_streams(streams);
+    float* mask = masking->cpu_pointer();
+    parallel_for(streams, [&](int begin, int end) {
+        std::uniform_real_distribution<float> dis(0.0, 1.0);
+        for (int stream = begin; stream < end; ++stream) {
+            std::mt19937& gen = gen_host[stream];
+            int last = std::min((stream + 1) * stream_columns, cols) * rows;
+            for (int i = stream * stream_columns * rows; i < last; ++i) {
+                mask[i] = (dis(gen) < probability) ? 1. / probability : 0.;
+                buffers.out[i] = buffers.in[i] * mask[i];
+            }
         }
-    }
-    out->return_data() =
-        (in->return_data_const().array() * masking->return_data_const().array())
-            .matrix();
+    });
+}
+
+// One random stream of the layer per stream_columns columns, so the masks
+// depend neither on the threads nor on which of them draws them
+void Dropout::check_streams(int streams) {
+    if (int(gen_host.size()) == streams) return;
+    gen_host.clear();
+    for (int stream = 0; stream < streams; ++stream)
+        gen_host.push_back(
+            ExecutionContext::instance().generator(_layer, stream));
 }
 
 void Dropout::forward_gpu(const SharedStorage& in, SharedStorage& out,
@@ -72,7 +97,7 @@ void Dropout::forward_gpu(const SharedStorage& in, SharedStorage& out,
         return;
     };
     srand((unsigned int)0);
-    check_masking(in);
+    check_masking(in->get_rows(), in->get_cols());
     int rows = in->get_rows();
     int cols = in->get_cols();
     curandGenerateUniform(gen_device, masking->gpu_pointer(), rows * cols);
@@ -93,12 +118,26 @@ void Dropout::backward_gpu(const SharedStorage&, const SharedStorage& grad_in,
     my_mult_elementwise(grad_in, masking, grad_out);
 };
 
-void Dropout::backward_cpu(const SharedStorage&, const SharedStorage& grad_in,
+void Dropout::backward_cpu(const SharedStorage& values,
+                           const SharedStorage& grad_in,
                            SharedStorage& grad_out) {
     check_backward();
-    grad_out->return_data() = (masking->return_data_const().array() *
-                               grad_in->return_data_const().array())
-                                  .matrix();
+    if (!same_size(grad_in, masking) or !same_size(grad_out, masking)) {
+        std::stringstream ss;
+        ss << "Dimension do not fit, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    backward_bound(buffers(values, grad_in, grad_out));
+}
+
+void Dropout::backward_bound(const Buffers& buffers) {
+    check_backward();
+    const float* mask = masking->cpu_pointer_const();
+    int size = masking->get_rows() * masking->get_cols();
+    for (int i = 0; i < size; ++i)
+        buffers.grad_out[i] = mask[i] * buffers.grad_in[i];
 }
 
 std::vector<int> Dropout::output_dimension() {
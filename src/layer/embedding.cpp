@@ -0,0 +1,103 @@
+#include "../../include/layer/embedding.hpp"
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include "../../include/cuda_math.h"
+#include "../../include/math.h"
+
+Embedding::Embedding(Features out, Vocabulary vocab, Init* init)
+    : Layer("Embedding"), _out(out), _vocab(vocab), _touched() {
+    _previous = NULL;
+    initialize_weight(init);
+    initialize_grad();
+    initialize_output_dimension();
+}
+
+Embedding::Embedding(Features out, Vocabulary vocab,
+                     const std::shared_ptr<Layer>& previous, Init* init)
+    : Layer("Embedding"), _out(out), _vocab(vocab), _touched() {
+    check_input_dimension(previous);
+    _previous = previous;
+    initialize_weight(init);
+    initialize_grad();
+    initialize_output_dimension();
+}
+
+void Embedding::check_input_dimension(const std::shared_ptr<Layer>& previous) {
+    std::vector<int> in = previous->output_dimension();
+    if ((in.size() != 1) or (in[0] != 1)) {
+        std::stringstream ss;
+        ss << "The embedding expects one token id per observation, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled with layer " << previous->name()
+           << " from\n"
+           << __FILE__ << " at " << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+}
+
+void Embedding::initialize_output_dimension() { _out_dim[0] = _out.get(); }
+
+void Embedding::initialize_weight(Init* init) {
+    Matrix table = init->weights(_out.get(), _vocab.get());
+    parameters.push_back(std::make_shared<Storage>(table));
+}
+
+void Embedding::initialize_grad() {
+    Matrix tmp = Matrix::Zero(_out.get(), _vocab.get());
+    gradients.push_back(std::make_shared<Storage>(tmp));
+}
+
+int Embedding::token(dtype id) {
+    int idx = static_cast<int>(id);
+    if ((idx < 0) or (idx >= _vocab.get())) {
+        std::stringstream ss;
+        ss << "Token id " << idx << " is outside the vocabulary of size "
+           << _vocab.get() << ", in:\n"
+           << __PRETTY_FUNCTION__;
+        throw std::invalid_argument(ss.str());
+    }
+    return idx;
+}
+
+void Embedding::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                            const std::string&) {
+    const Matrix& ids = in->return_data_const();
+    const Matrix& table = parameters[0]->return_data_const();
+    Matrix& out_ref = out->return_data();
+    for (int i = 0; i < ids.cols(); ++i)
+        out_ref.col(i) = table.col(token(ids(0, i)));
+}
+
+void Embedding::forward_gpu(const SharedStorage& in, SharedStorage& out,
+                            const std::string&) {
+    ::embedding_forward(_out.get(), in->get_cols(),
+                        parameters[0]->gpu_pointer_const(),
+                        in->gpu_pointer_const(), out->gpu_pointer());
+}
+
+void Embedding::backward_cpu(const SharedStorage& values,
+                             const SharedStorage& gradient_in,
+                             SharedStorage&) {
+    const Matrix& ids = values->return_data_const();
+    const Matrix& grad_in = gradient_in->return_data_const();
+    Matrix& grad = gradients[0]->return_data();
+    // only the columns written last time need to be cleared
+    for (int idx : _touched) grad.col(idx).setZero();
+    _touched.clear();
+    for (int i = 0; i < ids.cols(); ++i) {
+        int idx = token(ids(0, i));
+        grad.col(idx) += grad_in.col(i);
+        _touched.push_back(idx);
+    }
+}
+
+void Embedding::backward_gpu(const SharedStorage& values,
+                             const SharedStorage& gradient_in,
+                             SharedStorage&) {
+    gradients[0]->update_gpu_data(0.);
+    _touched.clear();
+    ::embedding_backward(_out.get(), gradient_in->get_cols(),
+                         gradient_in->gpu_pointer_const(),
+                         values->gpu_pointer_const(),
+                         gradients[0]->gpu_pointer());
+}
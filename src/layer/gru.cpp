@@ -0,0 +1,203 @@
+#include "../../include/layer/gru.hpp"
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "../../include/math.h"
+
+GRU::GRU(Features out, Features in, Init* init)
+    : Layer("GRU"), _out(out), _in(in), _sequences(1), _active_sequences(1) {
+    _previous = NULL;
+    initialize_weight(init);
+    initialize_grad();
+    initialize_output_dimension();
+    maybe_resize_state(0, 1);
+}
+
+GRU::GRU(Features out, const std::shared_ptr<Layer>& previous, Init* init)
+    : Layer("GRU"), _out(out), _in(0), _sequences(1), _active_sequences(1) {
+    _previous = previous;
+    initialize_input_dimension(previous);
+    initialize_weight(init);
+    initialize_grad();
+    initialize_output_dimension();
+    maybe_resize_state(0, 1);
+}
+
+void GRU::initialize_input_dimension(const std::shared_ptr<Layer>& previous) {
+    std::vector<int> in = previous->output_dimension();
+    int i = 1;
+    if ((in.size() == 1) and (in[0] > 0)) {
+        i = in[0];
+    } else if (in.size() == 3) {
+        for (int shape : in) i *= shape;
+    } else {
+        std::stringstream ss;
+        ss << "Dimension do not fit, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled with layer " << previous->name()
+           << " from\n"
+           << __FILE__ << " at " << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    _in = Features(i);
+}
+
+void GRU::initialize_output_dimension() { _out_dim[0] = _out.get(); }
+
+void GRU::initialize_weight(Init* init) {
+    Matrix wx = init->weights(3 * _out.get(), _in.get());
+    Matrix wh = init->weights(3 * _out.get(), _out.get());
+    Matrix b = init->weights(3 * _out.get(), 1);
+    parameters.push_back(std::make_shared<Storage>(wx));
+    parameters.push_back(std::make_shared<Storage>(wh));
+    parameters.push_back(std::make_shared<Storage>(b));
+}
+
+void GRU::initialize_grad() {
+    Matrix wx = Matrix::Zero(3 * _out.get(), _in.get());
+    Matrix wh = Matrix::Zero(3 * _out.get(), _out.get());
+    Matrix b = Matrix::Zero(3 * _out.get(), 1);
+    gradients.push_back(std::make_shared<Storage>(wx));
+    gradients.push_back(std::make_shared<Storage>(wh));
+    gradients.push_back(std::make_shared<Storage>(b));
+}
+
+void GRU::set_sequences(int sequences) {
+    if (sequences < 1) {
+        std::stringstream ss;
+        ss << "The number of sequences must be positive but is " << sequences
+           << ", in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    _sequences = sequences;
+}
+
+// Same column layout as the LSTM, the column of sequence b at step t is
+// t * _sequences + b and predictions run a single sequence
+int GRU::active_sequences(const std::string& type, int cols) {
+    int sequences = (type == "train") ? _sequences : 1;
+    if (cols % sequences) {
+        std::stringstream ss;
+        ss << "A batch of " << cols << " columns cannot hold " << sequences
+           << " sequences, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    return sequences;
+}
+
+// The last state of every sequence is carried over, a different number of
+// sequences starts again from zero
+void GRU::maybe_resize_state(int cols, int seq) {
+    if ((cols == _gates.cols()) and (seq == _active_sequences) and
+        (_state.cols() == cols + seq))
+        return;
+    int nh = _out.get();
+    Matrix initial = Matrix::Zero(nh, seq);
+    if ((seq == _active_sequences) and (_state.cols() >= seq))
+        initial = _state.rightCols(seq);
+    _gates = Matrix::Zero(3 * nh, cols);
+    _hn = Matrix::Zero(nh, cols);
+    _state = Matrix::Zero(nh, cols + seq);
+    _state.rightCols(seq) = initial;
+    _d_x = Matrix::Zero(3 * nh, cols);
+    _d_h = Matrix::Zero(3 * nh, cols);
+    _recurrent = Matrix::Zero(3 * nh, seq);
+    _d_cum = Matrix::Zero(nh, seq);
+    _d_state = Matrix::Zero(nh, seq);
+    _active_sequences = seq;
+}
+
+// The input projection of all timesteps is one GEMM ahead of the recurrence
+void GRU::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                      const std::string& type) {
+    int cols = in->get_cols();
+    int seq = active_sequences(type, cols);
+    maybe_resize_state(cols, seq);
+    _state.leftCols(seq) = _state.rightCols(seq);
+    _gates.noalias() = parameters[0]->return_data_const() *
+                       in->return_data_const();
+    _gates.colwise() += parameters[2]->return_data_const().col(0);
+    const Matrix& wh = parameters[1]->return_data_const();
+    for (int col = 0; col < cols; col += seq) {
+        _recurrent.noalias() = wh * _state.middleCols(col, seq);
+        gru_cell_forward_cpu(_out.get(), seq, _gates.col(col).data(),
+                             _recurrent.data(), _state.col(col).data(),
+                             _state.col(col + seq).data(),
+                             _hn.col(col).data());
+    }
+    out->return_data() = _state.rightCols(cols);
+}
+
+void GRU::backward_cpu(const SharedStorage& values,
+                       const SharedStorage& grad_in, SharedStorage& grad_out) {
+    const Matrix& g_in = grad_in->return_data_const();
+    const Matrix& wh = parameters[1]->return_data_const();
+    int seq = _active_sequences;
+    int cols = _gates.cols();
+    _d_cum.setZero();
+    for (int col = cols - seq; col >= 0; col -= seq) {
+        _d_state = g_in.middleCols(col, seq) + _d_cum;
+        gru_cell_backward_cpu(_out.get(), seq, _gates.col(col).data(),
+                              _hn.col(col).data(), _state.col(col).data(),
+                              _d_state.data(), _d_x.col(col).data(),
+                              _d_h.col(col).data(), _d_cum.data());
+        _d_cum.noalias() += wh.transpose() * _d_h.middleCols(col, seq);
+    }
+    grad_out->return_data().noalias() =
+        parameters[0]->return_data_const().transpose() * _d_x;
+    gradients[0]->return_data().noalias() =
+        _d_x * values->return_data_const().transpose();
+    gradients[1]->return_data().noalias() =
+        _d_h * _state.leftCols(cols).transpose();
+    gradients[2]->return_data() = _d_x.rowwise().sum();
+    clip_gradients();
+}
+
+void GRU::clip_gradients() {
+    for (SharedStorage& sgrad : gradients) {
+        Matrix& grad = sgrad->return_data();
+        grad = grad.cwiseMax(-5).cwiseMin(5);
+    }
+}
+
+void GRU::reset_state(int streams) {
+    _step_gates = Matrix::Zero(3 * _out.get(), streams);
+    _step_recurrent = Matrix::Zero(3 * _out.get(), streams);
+    _step_hn = Matrix::Zero(_out.get(), streams);
+    _step_state = Matrix::Zero(_out.get(), streams);
+}
+
+// One recurrent update of all streams on buffers which persist between the
+// calls, independent of the states used for training
+void GRU::step(const SharedStorage& in, SharedStorage& out) {
+    if (_step_state.cols() != in->get_cols()) reset_state(in->get_cols());
+    _step_gates.noalias() =
+        parameters[0]->return_data_const() * in->return_data_const();
+    _step_gates.colwise() += parameters[2]->return_data_const().col(0);
+    _step_recurrent.noalias() = parameters[1]->return_data_const() * _step_state;
+    gru_cell_forward_cpu(_out.get(), in->get_cols(), _step_gates.data(),
+                         _step_recurrent.data(), _step_state.data(),
+                         _step_state.data(), _step_hn.data());
+    out->return_data() = _step_state;
+}
+
+void GRU::forward_gpu(const SharedStorage&, SharedStorage&,
+                      const std::string&) {
+    std::stringstream ss;
+    ss << "The GRU only runs on the CPU, in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::invalid_argument(ss.str());
+}
+
+void GRU::backward_gpu(const SharedStorage&, const SharedStorage&,
+                       SharedStorage&) {
+    std::stringstream ss;
+    ss << "The GRU only runs on the CPU, in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::invalid_argument(ss.str());
+}
@@ -1,4 +1,23 @@
 #include "../../include/layer/layer.h"
+#include <sstream>
+#include <stdexcept>
+
+Mode mode_of(const std::string& type) {
+    if (type == "train") return Mode::Train;
+    if (type == "predict") return Mode::Predict;
+    std::stringstream ss;
+    ss << "Unknown mode " << type << ", expected train or predict, in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::invalid_argument(ss.str());
+}
+
+// for the layers which still take the mode as a string, built only once
+const std::string& mode_name(Mode mode) {
+    static const std::string train("train");
+    static const std::string predict("predict");
+    return (mode == Mode::Train) ? train : predict;
+}
 
 Layer::Layer(const std::string& s)
     : _name(s), _out_dim(1), parameters(), gradients(), _previous(NULL) {
@@ -28,6 +47,23 @@ void Layer::backward_cpu(const SharedStorage&, const SharedStorage&,
                          SharedStorage&) {
     ;
 };
+void Layer::step(const SharedStorage& in, SharedStorage& out) {
+    forward_cpu(in, out, "predict");
+}
+Buffers Layer::buffers(const SharedStorage& in, const SharedStorage& out) {
+    return Buffers{in->cpu_pointer_const(), out->cpu_pointer(), nullptr,
+                   nullptr, in->get_rows(), out->get_rows(), in->get_cols()};
+}
+
+Buffers Layer::buffers(const SharedStorage& values,
+                       const SharedStorage& grad_in,
+                       const SharedStorage& grad_out) {
+    return Buffers{values->cpu_pointer_const(), nullptr,
+                   grad_in->cpu_pointer_const(), grad_out->cpu_pointer(),
+                   values->get_rows(), grad_in->get_rows(),
+                   values->get_cols()};
+}
+
 VecSharedStorage Layer::return_parameters() { return parameters; };
 VecSharedStorage Layer::return_gradients() { return gradients; };
 VecSharedStorage Layer::return_parameters() const { return parameters; };
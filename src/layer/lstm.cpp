@@ -12,7 +12,11 @@ double cpuSecond2() {
 }
 
 LSTM::LSTM(Features out, Features in, Init* init)
-    : Layer("LSTM"), _out(out), _in(in), states(6), assistance_parameters(0) {
+    : Layer("LSTM"), _out(out), _in(in), states(6),
+      assistance_parameters(0),
+      _sequences(1),
+      _active_sequences(1),
+      _reverse(false) {
     _previous = NULL;
     cublasStatus_t stat = cublasCreate(&_handle);
     CHECK_CUBLAS(stat);
@@ -23,7 +27,11 @@ LSTM::LSTM(Features out, Features in, Init* init)
 }
 
 LSTM::LSTM(Features out, const std::shared_ptr<Layer>& previous, Init* init)
-    : Layer("LSTM"), _out(out), _in(0), states(6), assistance_parameters(0) {
+    : Layer("LSTM"), _out(out), _in(0), states(6),
+      assistance_parameters(0),
+      _sequences(1),
+      _active_sequences(1),
+      _reverse(false) {
     _previous = previous;
     initialize_input_dimension(previous);
     cublasStatus_t stat = cublasCreate(&_handle);
@@ -63,6 +71,34 @@ void LSTM::initialize_input_dimension(const std::shared_ptr<Layer>& previous) {
 
 void LSTM::initialize_output_dimension() { _out_dim[0] = _out.get(); }
 
+void LSTM::set_sequences(int sequences) {
+    if (sequences < 1) {
+        std::stringstream ss;
+        ss << "The number of sequences must be positive but is " << sequences
+           << ", in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    _sequences = sequences;
+}
+
+// Training batches hold _sequences independent sequences in lockstep, the
+// column of sequence b at step t is t * _sequences + b. Predictions run a
+// single sequence
+int LSTM::active_sequences(const std::string& type, int cols) {
+    int sequences = (type == "train") ? _sequences : 1;
+    if (cols % sequences) {
+        std::stringstream ss;
+        ss << "A batch of " << cols << " columns cannot hold " << sequences
+           << " sequences, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    return sequences;
+}
+
 void LSTM::multiply_one_col_fwd(const SharedStorage& in, int col) {
     cublasOperation_t transA = CUBLAS_OP_N;
     cublasOperation_t transB = CUBLAS_OP_N;
@@ -143,8 +179,16 @@ void LSTM::compute_next_state(int t) {
 }
 
 void LSTM::forward_gpu(const SharedStorage& in, SharedStorage& out,
-                       const std::string&) {
-    maybe_resize_state(in->get_cols());
+                       const std::string& type) {
+    if (active_sequences(type, in->get_cols()) != 1) {
+        std::stringstream ss;
+        ss << "Batches of several sequences are only supported on the CPU, "
+           << "in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    maybe_resize_state(in->get_cols(), 1);
     for (int t = 0; t < in->get_cols(); ++t) {
         multiply_one_col_fwd(in, t);
         nonlinear_transformations(t);
@@ -155,46 +199,105 @@ void LSTM::forward_gpu(const SharedStorage& in, SharedStorage& out,
               out->gpu_pointer());
 };
 
-void LSTM::forward_cpu(const SharedStorage& in, SharedStorage& out,
-                       const std::string&) {
-    maybe_resize_state(in->get_cols());
-    int cols = states[2]->get_cols();
+// Resizes the states for the batch and carries the last states of every
+// sequence over, returns the number of steps
+int LSTM::prepare_forward_cpu(int cols, const std::string& type) {
+    int seq = active_sequences(type, cols);
+    maybe_resize_state(cols, seq);
     Matrix& state = states[2]->return_data();
     Matrix& cell = states[1]->return_data();
-    Matrix& funcs = states[0]->return_data();
-    state(all, 0) = state(all, cols - 1);
-    cell(all, 0) = states[1]->return_data()(all, cols - 1);
-    Matrix& tmp = assistance_parameters[0]->return_data();
-    const int sigmoid_rows = _out.get() * 3;
-    for (int t = 0; t < in->get_cols(); ++t) {
-        tmp = parameters[0]->return_data_const() *
-                  in->return_data_const()(all, t) +
-              parameters[1]->return_data_const() * state(all, t) +
-              parameters[2]->return_data_const();
-        funcs.block(0, t, sigmoid_rows, 1) = sigmoid(tmp.topRows(sigmoid_rows));
-        funcs.block(sigmoid_rows, t, _out.get(), 1) =
-            tmp.bottomRows(_out.get()).array().tanh();
-        const Matrix& i = funcs.block(0, t, _out.get(), 1);
-        const Matrix& f = funcs.block(_out.get(), t, _out.get(), 1);
-        const Matrix& o = funcs.block(2 * _out.get(), t, _out.get(), 1);
-        const Matrix& g = funcs.block(3 * _out.get(), t, _out.get(), 1);
-        cell(all, t + 1) =
-            f.array() * cell(all, t).array() + i.array() * g.array();
-        state(all, t + 1) = o.array() * cell(all, t + 1).array().tanh();
+    if (_reverse) {
+        state.rightCols(seq).setZero();
+        cell.rightCols(seq).setZero();
+    } else {
+        state.leftCols(seq) = state.rightCols(seq);
+        cell.leftCols(seq) = cell.rightCols(seq);
     }
-    out->return_data() = state.rightCols(cols - 1);
+    return cols / seq;
 }
 
-void LSTM::construct_sigma_cpu() {
-    Matrix& sigma = states[4]->return_data();
-    const Matrix& state = states[0]->return_data_const();
-    int n_sig = 3 * _out.get();
-    sigma.topRows(n_sig) = state.topRows(n_sig).array() *
-                           (Matrix::Ones(n_sig, sigma.cols()).array() -
-                            state.topRows(n_sig).array());
-    sigma.bottomRows(_out.get()) =
-        Matrix::Ones(_out.get(), sigma.cols()).array() -
-        state.bottomRows(_out.get()).array().pow(2);
+// Columns of the states before and after step t
+int LSTM::previous_col(int t) {
+    return (_reverse ? t + 1 : t) * _active_sequences;
+}
+
+int LSTM::next_col(int t) { return (_reverse ? t : t + 1) * _active_sequences; }
+
+// Adds W_h * h_{t-1} to the projected input of step t of all sequences and
+// runs the fused cell
+void LSTM::recurrent_step_cpu(int t) {
+    int seq = _active_sequences;
+    int col = t * seq;
+    int prev = previous_col(t);
+    int next = next_col(t);
+    Matrix& state = states[2]->return_data();
+    Matrix& cell = states[1]->return_data();
+    Matrix& funcs = states[0]->return_data();
+    funcs.middleCols(col, seq).noalias() +=
+        parameters[1]->return_data_const() * state.middleCols(prev, seq);
+    lstm_cell_forward_cpu(_out.get(), seq, funcs.col(col).data(),
+                          cell.col(prev).data(), cell.col(next).data(),
+                          state.col(next).data());
+}
+
+void LSTM::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                       const std::string& type) {
+    forward_cpu(in->return_data_const(), out->return_data(), type);
+}
+
+// The input projection of all timesteps is one GEMM ahead of the recurrence
+void LSTM::forward_cpu(const Matrix& in, MatrixBlock out,
+                       const std::string& type) {
+    int steps = prepare_forward_cpu(in.cols(), type);
+    Matrix& funcs = states[0]->return_data();
+    funcs.noalias() = parameters[0]->return_data_const() * in;
+    funcs.colwise() += parameters[2]->return_data_const().col(0);
+    if (_reverse)
+        for (int t = steps - 1; t >= 0; --t) recurrent_step_cpu(t);
+    else
+        for (int t = 0; t < steps; ++t) recurrent_step_cpu(t);
+    out = states[2]->return_data_const().middleCols(next_col(0), in.cols());
+}
+
+// Projects the input of the steps first to last, the wavefront executor
+// calls it once the layer below has produced them
+void LSTM::project_input_cpu(const Matrix& in, int first, int last) {
+    int seq = _active_sequences;
+    int cols = (last - first) * seq;
+    Matrix& funcs = states[0]->return_data();
+    funcs.middleCols(first * seq, cols).noalias() =
+        parameters[0]->return_data_const() * in.middleCols(first * seq, cols);
+    funcs.middleCols(first * seq, cols).colwise() +=
+        parameters[2]->return_data_const().col(0);
+}
+
+// Runs step t on its projected input and writes its output columns, so a
+// layer stacked on top can start on them right away
+void LSTM::forward_step_cpu(Matrix& out, int t) {
+    int seq = _active_sequences;
+    recurrent_step_cpu(t);
+    out.middleCols(t * seq, seq) =
+        states[2]->return_data_const().middleCols(next_col(t), seq);
+}
+
+void LSTM::reset_state(int streams) {
+    _step_gates = Matrix::Zero(4 * _out.get(), streams);
+    _step_cell = Matrix::Zero(_out.get(), streams);
+    _step_state = Matrix::Zero(_out.get(), streams);
+}
+
+// One recurrent update of all streams on buffers which persist between the
+// calls, independent of the states used for training
+void LSTM::step(const SharedStorage& in, SharedStorage& out) {
+    if (_step_state.cols() != in->get_cols()) reset_state(in->get_cols());
+    _step_gates.noalias() =
+        parameters[0]->return_data_const() * in->return_data_const();
+    _step_gates.noalias() += parameters[1]->return_data_const() * _step_state;
+    _step_gates.colwise() += parameters[2]->return_data_const().col(0);
+    lstm_cell_forward_cpu(_out.get(), in->get_cols(), _step_gates.data(),
+                          _step_cell.data(), _step_cell.data(),
+                          _step_state.data());
+    out->return_data() = _step_state;
 }
 
 void LSTM::construct_sigma_gpu() {
@@ -270,63 +373,98 @@ void LSTM::backward_gpu(const SharedStorage& values,
     };
     para_gradients(values);
 }
-// assistance_parameters1: dcum_s, dcum_c, dh, dc, d_tmp;
-void LSTM::backward_cpu(const SharedStorage& values,
-                        const SharedStorage& grad_in, SharedStorage& grad_out) {
-    int nh = _out.get();
-    int sz = grad_in->get_cols();
-    const Matrix& state = states[2]->return_data_const();
+// returns the number of steps of the last forward pass
+int LSTM::prepare_backward_cpu() {
+    assistance_parameters[1]->return_data().setZero();
+    assistance_parameters[2]->return_data().setZero();
+    return states[3]->get_cols() / _active_sequences;
+}
+
+// assistance_parameters1: dcum_s, dcum_c, dh;
+// Computes the gate gradients of step t and passes the state gradient back
+// to the step before
+void LSTM::recurrent_backward_step_cpu(ConstMatrixBlock grad_in, int t) {
+    int seq = _active_sequences;
+    int col = t * seq;
     const Matrix& cell = states[1]->return_data_const();
-    const Matrix& funcs = states[0]->return_data_const();
-    Matrix& sigma = states[4]->return_data();
-    Matrix sigma_c =
-        Matrix::Ones(nh, sz + 1).array() - cell.array().tanh().pow(2);
-    construct_sigma_cpu();
     Matrix& dcum_s = assistance_parameters[1]->return_data();
     Matrix& dcum_c = assistance_parameters[2]->return_data();
     Matrix& dh = assistance_parameters[3]->return_data();
-    Matrix& dc = assistance_parameters[4]->return_data();
-    Matrix& d_tmp = assistance_parameters[5]->return_data();
     Matrix& d_all = states[3]->return_data();
-    dcum_s.setZero();
-    dcum_c.setZero();
-    for (int t = sz - 1; t >= 0; --t) {
-        const Matrix& i = funcs.block(0, t, nh, 1);
-        const Matrix& f = funcs.block(nh, t, nh, 1);
-        const Matrix& o = funcs.block(2 * nh, t, nh, 1);
-        const Matrix& g = funcs.block(3 * nh, t, nh, 1);
-        dh = grad_in->return_data_const()(all, t) + dcum_s;
-        dc = dcum_c.array() +
-             dh.array() * o.array() * sigma_c(all, t + 1).array();
-        d_tmp.block(2 * nh, 0, nh, 1) =
-            dh.array() * cell(all, t + 1).array().tanh();
-        d_tmp.block(0, 0, nh, 1) = dc.array() * g.array();
-        d_tmp.block(nh, 0, nh, 1) = dc.array() * cell(all, t).array();
-        d_tmp.block(3 * nh, 0, nh, 1) = dc.array() * i.array();
-        d_all(all, t) = sigma(all, t).array() * d_tmp.array();
-        dcum_s = parameters[1]->return_data_const().transpose() * d_all(all, t);
-        grad_out->return_data()(all, t) =
-            parameters[0]->return_data_const().transpose() * d_all(all, t);
-        dcum_c = dc.array() * f.array();
-    }
-    gradients[0]->return_data() =
-        d_all * values->return_data_const().transpose();
-    gradients[1]->return_data() = d_all * state.leftCols(sz).transpose();
+    dh = grad_in.middleCols(col, seq) + dcum_s;
+    lstm_cell_backward_cpu(_out.get(), seq,
+                           states[0]->return_data_const().col(col).data(),
+                           cell.col(previous_col(t)).data(),
+                           cell.col(next_col(t)).data(), dh.data(),
+                           dcum_c.data(), d_all.col(col).data());
+    dcum_s.noalias() = parameters[1]->return_data_const().transpose() *
+                       d_all.middleCols(col, seq);
+}
+
+void LSTM::finish_backward_cpu(const Matrix& values) {
+    const Matrix& d_all = states[3]->return_data_const();
+    const Matrix& state = states[2]->return_data_const();
+    gradients[0]->return_data().noalias() = d_all * values.transpose();
+    gradients[1]->return_data().noalias() =
+        d_all * state.middleCols(previous_col(0), d_all.cols()).transpose();
     gradients[2]->return_data() = d_all.rowwise().sum();
     clip_gradients();
 }
 
-void LSTM::expand_states(int cols) {
+void LSTM::backward_cpu(const SharedStorage& values,
+                        const SharedStorage& grad_in, SharedStorage& grad_out) {
+    backward_cpu(values->return_data_const(), grad_in->return_data_const());
+    input_gradient_cpu(grad_out->return_data(), false);
+}
+
+// Only the recurrent product stays in the loop, the input gradient of all
+// timesteps is one GEMM afterwards
+void LSTM::backward_cpu(const Matrix& values, ConstMatrixBlock grad_in) {
+    int steps = prepare_backward_cpu();
+    if (_reverse)
+        for (int t = 0; t < steps; ++t) recurrent_backward_step_cpu(grad_in, t);
+    else
+        for (int t = steps - 1; t >= 0; --t)
+            recurrent_backward_step_cpu(grad_in, t);
+    finish_backward_cpu(values);
+}
+
+void LSTM::input_gradient_cpu(Matrix& grad_out, bool add) {
+    if (add)
+        grad_out.noalias() += parameters[0]->return_data_const().transpose() *
+                              states[3]->return_data_const();
+    else
+        grad_out.noalias() = parameters[0]->return_data_const().transpose() *
+                             states[3]->return_data_const();
+}
+
+// Backward pass of step t alone, its input gradient waits for
+// input_gradient_cpu
+void LSTM::backward_step_cpu(const Matrix& grad_in, int t) {
+    recurrent_backward_step_cpu(grad_in, t);
+}
+
+// The input gradient of the steps first to last
+void LSTM::input_gradient_cpu(Matrix& grad_out, int first, int last) {
+    int seq = _active_sequences;
+    int cols = (last - first) * seq;
+    grad_out.middleCols(first * seq, cols).noalias() =
+        parameters[0]->return_data_const().transpose() *
+        states[3]->return_data_const().middleCols(first * seq, cols);
+}
+
+void LSTM::expand_states(int cols, int seq) {
     states[0] = std::make_shared<Storage>(Matrix::Zero(4 * _out.get(), cols));
-    states[1] = std::make_shared<Storage>(Matrix::Zero(_out.get(), cols + 1));
-    states[2] = std::make_shared<Storage>(Matrix::Zero(_out.get(), cols + 1));
+    states[1] = std::make_shared<Storage>(Matrix::Zero(_out.get(), cols + seq));
+    states[2] = std::make_shared<Storage>(Matrix::Zero(_out.get(), cols + seq));
     states[3] = std::make_shared<Storage>(Matrix::Zero(4 * _out.get(), cols));
     states[4] = std::make_shared<Storage>(Matrix::Zero(4 * _out.get(), cols));
-    states[5] = std::make_shared<Storage>(Matrix::Zero(_out.get(), cols + 1));
+    states[5] = std::make_shared<Storage>(Matrix::Zero(_out.get(), cols + seq));
 }
 
-void LSTM::maybe_resize_state(int cols) {
-    if (cols != states[0]->get_cols()) reorganize_states(cols);
+void LSTM::maybe_resize_state(int cols, int seq) {
+    if ((cols != states[0]->get_cols()) or (seq != _active_sequences))
+        reorganize_states(cols, seq);
 }
 
 void LSTM::clip_gradients() {
@@ -343,16 +481,22 @@ void LSTM::clip_gradients() {
     }
 }
 
-void LSTM::reorganize_states(int cols) {
-    Matrix initial_cell =
-        states[1]->return_data_const()(all, states[1]->get_cols() - 1);
-    Matrix initial_state =
-        states[2]->return_data_const()(all, states[2]->get_cols() - 1);
-    expand_states(cols);
-    states[1]->return_data()(all, states[1]->get_cols() - 1) =
-        initial_cell(all, 0);
-    states[2]->return_data()(all, states[2]->get_cols() - 1) =
-        initial_state(all, 0);
+// The last states of every sequence are carried over, a different number
+// of sequences starts again from zero
+void LSTM::reorganize_states(int cols, int seq) {
+    if (seq != _active_sequences) {
+        expand_states(cols, seq);
+        for (int i = 1; i < 4; ++i)
+            assistance_parameters[i] =
+                std::make_shared<Storage>(Matrix::Zero(_out.get(), seq));
+        _active_sequences = seq;
+        return;
+    }
+    Matrix initial_cell = states[1]->return_data_const().rightCols(seq);
+    Matrix initial_state = states[2]->return_data_const().rightCols(seq);
+    expand_states(cols, seq);
+    states[1]->return_data().rightCols(seq) = initial_cell;
+    states[2]->return_data().rightCols(seq) = initial_state;
 }
 
 void LSTM::initialize_grad() {
@@ -0,0 +1,278 @@
+#include "../../include/layer/merge.hpp"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "../../include/layer/convolution.h"
+#include "../../include/utils/parallel.hpp"
+
+namespace {
+int size_of(const std::vector<int>& shape) {
+    int size = 1;
+    for (int dim : shape) size *= dim;
+    return size;
+}
+}  // namespace
+
+Merge::Merge(const std::string& name,
+             const std::vector<std::shared_ptr<Layer>>& ends)
+    : Layer(name),
+      _branches(),
+      _sizes(),
+      _ends(ends.size()),
+      _values(ends.size()),
+      _gradients(ends.size()),
+      _direct(-1),
+      _fork(),
+      _obs(0) {
+    if (ends.size() < 2) {
+        std::stringstream ss;
+        ss << "A merge needs at least two branches, received " << ends.size()
+           << " in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    find_branches(ends);
+    for (const std::shared_ptr<Layer>& end : ends)
+        _sizes.push_back(size_of(end->output_dimension()));
+    collect();
+}
+
+void Merge::collect() {
+    _direct = -1;
+    _obs = 0;
+    parameters.clear();
+    gradients.clear();
+    for (size_t b = 0; b < _branches.size(); ++b) {
+        if ((_direct < 0) and !_branches[b].empty()) _direct = b;
+        for (const std::shared_ptr<Layer>& layer : _branches[b]) {
+            std::shared_ptr<Convolution> conv =
+                std::dynamic_pointer_cast<Convolution>(layer);
+            if (conv) conv->implicit_gemm(true);
+            for (const SharedStorage& para : layer->return_parameters())
+                parameters.push_back(para);
+            for (const SharedStorage& grad : layer->return_gradients())
+                gradients.push_back(grad);
+        }
+    }
+}
+
+// The fork is the layer closest to the first end that every branch passes
+void Merge::find_branches(const std::vector<std::shared_ptr<Layer>>& ends) {
+    std::vector<std::vector<std::shared_ptr<Layer>>> chains;
+    for (std::shared_ptr<Layer> layer : ends) {
+        std::vector<std::shared_ptr<Layer>> chain;
+        for (; layer; layer = layer->previous()) chain.push_back(layer);
+        chains.push_back(chain);
+    }
+    for (const std::shared_ptr<Layer>& candidate : chains[0]) {
+        bool shared = std::all_of(
+            chains.begin() + 1, chains.end(),
+            [&](const std::vector<std::shared_ptr<Layer>>& chain) {
+                return std::find(chain.begin(), chain.end(), candidate) !=
+                       chain.end();
+            });
+        if (shared) {
+            _previous = candidate;
+            break;
+        }
+    }
+    if (!_previous) {
+        std::stringstream ss;
+        ss << "The branches share no layer to start from in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    for (const std::vector<std::shared_ptr<Layer>>& chain : chains) {
+        auto fork = std::find(chain.begin(), chain.end(), _previous);
+        _branches.emplace_back(std::make_reverse_iterator(fork), chain.rend());
+    }
+}
+
+// The inputs of the branch layers and their gradients, reallocated only
+// when the batch size changes. The gradients of the fork are not kept per
+// branch, they go straight into the merge's
+void Merge::allocate(const SharedStorage& in) {
+    int obs = in->get_cols();
+    if (obs == _obs) return;
+    _obs = obs;
+    int fork = in->get_rows();
+    _fork = std::make_shared<Storage>(Matrix::Zero(fork, obs));
+    for (size_t b = 0; b < _branches.size(); ++b) {
+        std::vector<SharedStorage>& values = _values[b];
+        std::vector<SharedStorage>& grads = _gradients[b];
+        values.assign(1, in);
+        grads.clear();
+        for (const std::shared_ptr<Layer>& layer : _branches[b]) {
+            int rows = values.back()->get_rows();
+            grads.push_back((values.size() == 1)
+                                ? nullptr
+                                : std::make_shared<Storage>(
+                                      Matrix::Zero(rows, obs)));
+            values.push_back(std::make_shared<Storage>(
+                Matrix::Zero(size_of(layer->output_dimension()), obs)));
+        }
+    }
+}
+
+const Merge::SharedStorage& Merge::output(int branch, const SharedStorage& in) {
+    return _branches[branch].empty() ? in : _values[branch].back();
+}
+
+// The branches only read the fork's output, it is synced before they start
+void Merge::forward_cpu(const SharedStorage& in, SharedStorage& out,
+                        const std::string& type) {
+    allocate(in);
+    in->return_data_const();
+    for (std::vector<SharedStorage>& values : _values) values[0] = in;
+    parallel_for(branches(), [&](int begin, int end) {
+        for (int b = begin; b < end; ++b) {
+            std::vector<SharedStorage>& values = _values[b];
+            for (size_t k = 0; k < _branches[b].size(); ++k)
+                _branches[b][k]->forward_cpu(values[k], values[k + 1], type);
+        }
+    });
+    std::vector<const Matrix*> outputs;
+    for (int b = 0; b < branches(); ++b)
+        outputs.push_back(&output(b, in)->return_data_const());
+    combine(outputs, out->return_data());
+}
+
+// Every branch passes its end's gradient back to its first layer, on a
+// thread of its own. The first layers then add their gradients of the fork
+// into the merge's one after another, the direct branch writes it first
+void Merge::backward_cpu(const SharedStorage& values,
+                         const SharedStorage& gradient_in,
+                         SharedStorage& gradient_out) {
+    split(gradient_in);
+    values->return_data_const();
+    for (int b = 0; b < branches(); ++b) {
+        _values[b][0] = values;
+        _ends[b]->return_data_const();
+    }
+    auto grad_in = [&](int b, int k) -> const SharedStorage& {
+        return (k + 1 == int(_branches[b].size())) ? _ends[b]
+                                                    : _gradients[b][k + 1];
+    };
+    parallel_for(branches(), [&](int begin, int end) {
+        for (int b = begin; b < end; ++b) {
+            std::deque<std::shared_ptr<Layer>>& layers = _branches[b];
+            for (int k = layers.size() - 1; k > 0; --k)
+                layers[k]->backward_cpu(_values[b][k], grad_in(b, k),
+                                        _gradients[b][k]);
+        }
+    });
+    if (_direct < 0)
+        gradient_out->return_data().setZero();
+    else
+        _branches[_direct][0]->backward_cpu(values, grad_in(_direct, 0),
+                                            gradient_out);
+    Matrix& total = gradient_out->return_data();
+    for (int b = 0; b < branches(); ++b) {
+        if (b == _direct) continue;
+        if (_branches[b].empty()) {
+            total += _ends[b]->return_data_const();
+        } else {
+            _branches[b][0]->backward_cpu(values, grad_in(b, 0), _fork);
+            total += _fork->return_data_const();
+        }
+    }
+}
+
+void Merge::forward_gpu(const SharedStorage&, SharedStorage&,
+                        const std::string&) {
+    std::stringstream ss;
+    ss << "The branches of a merge run on the cpu only, in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::runtime_error(ss.str());
+}
+
+void Merge::backward_gpu(const SharedStorage&, const SharedStorage&,
+                         SharedStorage&) {
+    std::stringstream ss;
+    ss << "The branches of a merge run on the cpu only, in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::runtime_error(ss.str());
+}
+
+void Merge::set_sequences(int sequences) {
+    for (std::deque<std::shared_ptr<Layer>>& layers : _branches)
+        for (std::shared_ptr<Layer>& layer : layers)
+            layer->set_sequences(sequences);
+}
+
+void Merge::reset_state(int streams) {
+    for (std::deque<std::shared_ptr<Layer>>& layers : _branches)
+        for (std::shared_ptr<Layer>& layer : layers)
+            layer->reset_state(streams);
+}
+
+Add::Add(const std::vector<std::shared_ptr<Layer>>& ends)
+    : Merge("Add", ends) {
+    for (size_t b = 1; b < _sizes.size(); ++b) {
+        if (_sizes[b] != _sizes[0]) {
+            std::stringstream ss;
+            ss << "Branch " << b << " has " << _sizes[b]
+               << " outputs but the first one " << _sizes[0]
+               << ", only branches of the same size add up, in:\n"
+               << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__
+               << " at " << __LINE__;
+            throw std::invalid_argument(ss.str());
+        }
+    }
+    _out_dim = ends[0]->output_dimension();
+}
+
+void Add::combine(const std::vector<const Matrix*>& outputs, Matrix& out) {
+    out = *outputs[0];
+    for (size_t b = 1; b < outputs.size(); ++b) out += *outputs[b];
+}
+
+// every branch reads the merge's gradient itself
+void Add::split(const SharedStorage& gradient_in) {
+    for (SharedStorage& end : _ends) end = gradient_in;
+}
+
+Concat::Concat(const std::vector<std::shared_ptr<Layer>>& ends)
+    : Merge("Concat", ends) {
+    std::vector<int> shape = ends[0]->output_dimension();
+    bool images = true;
+    int channels = 0;
+    for (const std::shared_ptr<Layer>& end : ends) {
+        std::vector<int> dims = end->output_dimension();
+        images = images and (dims.size() == 3) and (shape.size() == 3) and
+                 (dims[1] == shape[1]) and (dims[2] == shape[2]);
+        if (images) channels += dims[0];
+    }
+    int total = 0;
+    for (int size : _sizes) total += size;
+    if (images)
+        _out_dim = {channels, shape[1], shape[2]};
+    else
+        _out_dim = {total};
+}
+
+void Concat::combine(const std::vector<const Matrix*>& outputs,
+                     Matrix& out) {
+    int offset = 0;
+    for (size_t b = 0; b < outputs.size(); ++b) {
+        out.middleRows(offset, _sizes[b]) = *outputs[b];
+        offset += _sizes[b];
+    }
+}
+
+void Concat::split(const SharedStorage& gradient_in) {
+    const Matrix& grad = gradient_in->return_data_const();
+    int offset = 0;
+    for (size_t b = 0; b < _ends.size(); ++b) {
+        if (!_ends[b] or (_ends[b]->get_cols() != grad.cols()))
+            _ends[b] = std::make_shared<Storage>(
+                Matrix(grad.middleRows(offset, _sizes[b])));
+        else
+            _ends[b]->return_data() = grad.middleRows(offset, _sizes[b]);
+        offset += _sizes[b];
+    }
+}
@@ -2,6 +2,7 @@
 #include <float.h>
 #include <sys/time.h>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <stdexcept>
 #include "../../include/cuda_math.h"
@@ -35,16 +36,23 @@ Pooling::Pooling(Window window, Stride stride,
     _previous = previous;
 }
 
+// takes the channels and image of any layer with an image output, e.g. a
+// convolution or the ReLU behind it
 void Pooling::initialize_from_previous(const std::shared_ptr<Layer>& previous) {
-    if (previous->name() == "Convolution") {
-        std::shared_ptr<Convolution> conv =
-            std::dynamic_pointer_cast<Convolution>(previous);
-        _inp = conv->_inp;
-        _channels.get() = conv->_filters.get();
-        _out = conv->_out;
-    } else {
-        throw std::runtime_error("Can only convert conv\n");
+    std::vector<int> shapes = previous->output_dimension();
+    if (shapes.size() != 3) {
+        std::stringstream ss;
+        ss << "The pooling needs an image input, layer " << previous->name()
+           << " has the output dimension ";
+        std::copy(shapes.begin(), shapes.end(),
+                  std::ostream_iterator<int>(ss, " "));
+        ss << "in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
     }
+    _channels = Channels(shapes[0]);
+    _inp = ImageShape(shapes[1], shapes[2]);
 }
 
 void Pooling::initialize_output_dimension() {
@@ -67,9 +75,9 @@ void Pooling::initialize_masking() {
     mask2 = std::make_shared<Storage>();
 }
 
-void inline Pooling::check_input_size(const SharedStorage& in) {
+void inline Pooling::check_input_size(int in_rows, int cols) {
     int rows = _channels.get() * _inp.first() * _inp.second();
-    if ((rows != in->get_rows()) or (batch_size != in->get_cols())) {
+    if ((rows != in_rows) or (batch_size != cols)) {
         std::stringstream ss;
         ss << "Dimension do not fit, in:\n"
            << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
@@ -88,6 +96,21 @@ void Pooling::check_masking(const SharedStorage& out) {
     }
 }
 
+// the byte of the argmax holds the offsets within the window, 255 is
+// reserved for outputs without gradient
+void Pooling::check_argmax(int rows, int cols) {
+    if (_window.get() > 15) {
+        std::stringstream ss;
+        ss << "The cpu pooling supports windows up to 15, received "
+           << _window.get() << " in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    argmax.resize(rows * cols);
+    batch_size = cols;
+}
+
 void dump_file2(const dtype* val, int size, const char* name) {
     std::ofstream file(name);
     for (int i = 0; i < size; ++i) {
@@ -98,7 +121,7 @@ void dump_file2(const dtype* val, int size, const char* name) {
 void Pooling::forward_gpu(const std::shared_ptr<Storage>& in,
                           std::shared_ptr<Storage>& out, const std::string&) {
     check_masking(out);
-    check_input_size(in);
+    check_input_size(in->get_rows(), in->get_cols());
     pooling_gpu(in->gpu_pointer_const(), _window.get(), _stride.get(),
                 _inp.first(), _inp.second(), _channels.get(), _out.first(),
                 _out.second(), batch_size, out->gpu_pointer(),
@@ -107,14 +130,15 @@ void Pooling::forward_gpu(const std::shared_ptr<Storage>& in,
 
 void Pooling::forward_cpu(const std::shared_ptr<Storage>& in,
                           std::shared_ptr<Storage>& out, const std::string&) {
-    check_masking(in);
-    check_input_size(in);
-    dtype min = -FLT_MAX;
-    out->update_cpu_data(min);
-    pooling_cpu(in->cpu_pointer_const(), _window.get(), _stride.get(),
-                _inp.first(), _inp.second(), _channels.get(), _out.first(),
-                _out.second(), batch_size, out->cpu_pointer(),
-                mask->cpu_pointer());
+    forward_bound(buffers(in, out), Mode::Predict);
+}
+
+void Pooling::forward_bound(const Buffers& buffers, Mode) {
+    check_argmax(buffers.out_rows, buffers.cols);
+    check_input_size(buffers.in_rows, buffers.cols);
+    pooling_cpu(buffers.in, _window.get(), _stride.get(), _inp.first(),
+                _inp.second(), _channels.get(), _out.first(), _out.second(),
+                batch_size, buffers.out, argmax.data());
 }
 
 void Pooling::backward_gpu(const SharedStorage&,
@@ -127,12 +151,15 @@ void Pooling::backward_gpu(const SharedStorage&,
                          batch_size, gradient_out->gpu_pointer());
 };
 
-void Pooling::backward_cpu(const SharedStorage&,
+void Pooling::backward_cpu(const SharedStorage& values,
                            const SharedStorage& gradient_in,
                            SharedStorage& gradient_out) {
-    pooling_backward_cpu(gradient_in->cpu_pointer_const(),
-                         mask->cpu_pointer_const(), _window.get(),
+    backward_bound(buffers(values, gradient_in, gradient_out));
+}
+
+void Pooling::backward_bound(const Buffers& buffers) {
+    pooling_backward_cpu(buffers.grad_in, argmax.data(), _window.get(),
                          _stride.get(), _inp.first(), _inp.second(),
                          _channels.get(), _out.first(), _out.second(),
-                         batch_size, gradient_out->cpu_pointer());
-};
+                         batch_size, buffers.grad_out);
+}
@@ -2,10 +2,14 @@
 #include <eigen-git-mirror/Eigen/Dense>
 //#include <iostream>
 //#include <memory>
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <sstream>
+#include <stdexcept>
 #include "../../include/layer/layer.h"
 #include "../../include/math.h"
+#include "../../include/utils/parallel.hpp"
 
 using std::vector;
 Relu::Relu() : Layer("Relu") {
@@ -16,13 +20,30 @@ Relu::Relu() : Layer("Relu") {
 Relu::Relu(const std::shared_ptr<Layer>& previous) : Layer("Relu") {
     cublasStatus_t stat = cublasCreate(&_handle);
     CHECK_CUBLAS(stat);
-    initialize_output_dimension(previous);
+    // keeps the image shape of a convolution for a pooling behind it
+    _out_dim = previous->output_dimension();
     _previous = previous;
 }
 
 void Relu::forward_cpu(const SharedStorage& in, SharedStorage& out,
                        const std::string&) {
-    out->return_data() = in->return_data_const().cwiseMax(0.);
+    if (!same_size(in, out)) {
+        std::stringstream ss;
+        ss << "Dimension do not fit, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    forward_bound(buffers(in, out), Mode::Predict);
+}
+
+// the columns are contiguous, every thread takes a range of them
+void Relu::forward_bound(const Buffers& buffers, Mode) {
+    int rows = buffers.in_rows;
+    parallel_for(buffers.cols, [&](int begin, int end) {
+        for (int i = begin * rows; i < end * rows; ++i)
+            buffers.out[i] = std::max(buffers.in[i], 0.f);
+    });
 }
 
 void Relu::forward_gpu(const SharedStorage& in, SharedStorage& out,
@@ -39,19 +60,17 @@ void Relu::backward_gpu(const SharedStorage& values,
 void Relu::backward_cpu(const SharedStorage& values,
                         const SharedStorage& gradient_in,
                         SharedStorage& gradient_out) {
-    const Matrix& value_ref = values->return_data_const();
-    const Matrix& grad_in = gradient_in->return_data_const();
-    Matrix& grad_out = gradient_out->return_data();
-    Matrix tmp(values->get_rows(), values->get_cols());
-    for (int i = 0; i < values->get_cols(); i++) {
-        for (int j = 0; j < values->get_rows(); j++)
-            tmp(j, i) = (value_ref(j, i) > 0) ? 1. : 0.;
-    }
-    Matrix out = grad_in.array() * tmp.array();
-    if ((tmp.rows() != gradient_out->get_rows()) or
-        (tmp.cols() != gradient_out->get_cols())) {
+    if (!same_size(gradient_in, gradient_out) or
+        !same_size(values, gradient_out))
         throw std::runtime_error("Doesn work");
-    } else {
-        grad_out = out;
-    }
+    backward_bound(buffers(values, gradient_in, gradient_out));
+}
+
+void Relu::backward_bound(const Buffers& buffers) {
+    int rows = buffers.in_rows;
+    parallel_for(buffers.cols, [&](int begin, int end) {
+        for (int i = begin * rows; i < end * rows; ++i)
+            buffers.grad_out[i] =
+                (buffers.in[i] > 0) ? buffers.grad_in[i] : 0.f;
+    });
 }
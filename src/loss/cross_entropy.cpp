@@ -22,6 +22,7 @@ dtype CrossEntropy::loss_cpu(const SharedStorage& prediction,
                              const SharedStorage& actual) {
     const Matrix& pred = prediction->return_data_const();
     const Matrix& act = actual->return_data_const();
+    if (is_label(pred, act)) return label_loss(pred, act);
     if ((pred.rows() != act.rows()) or (pred.cols() != act.cols())) {
         std::string m("prediction must have the same shape a target, in:\n");
         throw std::runtime_error(m + __PRETTY_FUNCTION__);
@@ -63,12 +64,42 @@ dtype CrossEntropy::vec_loss(const Vector& pred, const Vector& actual) {
     }
     return loss;
 }
+bool CrossEntropy::is_label(const Matrix& pred, const Matrix& act) {
+    return (act.rows() == 1) and (pred.rows() > 1) and
+           (pred.cols() == act.cols());
+}
+
+int CrossEntropy::check_label(dtype label, int classes) {
+    int idx = static_cast<int>(label);
+    if ((idx < 0) or (idx >= classes)) {
+        std::string m("label " + std::to_string(idx) + " is out of range, in:\n");
+        throw std::runtime_error(m + __PRETTY_FUNCTION__);
+    }
+    return idx;
+}
+
+dtype CrossEntropy::label_loss(const Matrix& pred, const Matrix& labels) {
+    dtype tot(0.);
+    for (int i = 0; i < pred.cols(); i++) {
+        tot -= log(pred(check_label(labels(0, i), pred.rows()), i));
+    }
+    return tot;
+}
+
 void CrossEntropy::grad_loss_cpu(SharedStorage& gradient,
                                  const SharedStorage& prediction,
                                  const SharedStorage& target,
                                  const SharedStorage&) {
-    gradient->return_data() =
-        prediction->return_data_const() - target->return_data_const();
+    const Matrix& pred = prediction->return_data_const();
+    const Matrix& act = target->return_data_const();
+    if (is_label(pred, act)) {
+        Matrix& grad = gradient->return_data();
+        grad = pred;
+        for (int i = 0; i < grad.cols(); i++)
+            grad(check_label(act(0, i), grad.rows()), i) -= 1;
+        return;
+    }
+    gradient->return_data() = pred - act;
 }
 
 void CrossEntropy::grad_loss_gpu(SharedStorage& gradient,
@@ -1,9 +1,15 @@
 #include "../include/math.h"
+#include <cfloat>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 #include "../include/common.h"
 #include "../include/cuda_math.h"
+#include "../include/utils/parallel.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 void my_Dgemm(cublasHandle_t handle, cublasOperation_t transA,
               cublasOperation_t transB, const SharedStorage& A,
               const SharedStorage& B, SharedStorage& C, dtype alpha,
@@ -123,7 +129,10 @@ void my_cross_entropy_loss(dtype& loss, const SharedStorage& prediction,
     const dtype* d_A = prediction->gpu_pointer_const();
     const dtype* d_B = actual->gpu_pointer_const();
     dtype* d_C = all_losses->gpu_pointer();
-    all_cross_entropy_losses(rows, cols, d_A, d_B, d_C);
+    if ((actual->get_rows() == 1) and (rows > 1))
+        all_cross_entropy_losses_labels(rows, cols, d_A, d_B, d_C);
+    else
+        all_cross_entropy_losses(rows, cols, d_A, d_B, d_C);
     loss = all_losses->return_data_const().sum();
 }
 
@@ -135,7 +144,10 @@ void my_cross_entropy_gradient(SharedStorage& gradient,
     const dtype* d_A = prediction->gpu_pointer_const();
     const dtype* d_B = target->gpu_pointer_const();
     dtype* d_C = gradient->gpu_pointer();
-    cross_entropy_gradient(rows, cols, d_A, d_B, d_C);
+    if ((target->get_rows() == 1) and (rows > 1))
+        cross_entropy_gradient_labels(rows, cols, d_A, d_B, d_C);
+    else
+        cross_entropy_gradient(rows, cols, d_A, d_B, d_C);
 }
 
 // IN PRICINPILE THATS A DUPLICATE FROM ABOVE!!!! FIND COMMON MATH FUNCTION!!!
@@ -248,57 +260,427 @@ void col2im_cpu(const dtype* data_col, int channels, int rows, int cols,
     }
 }
 
-void pooling_cpu(const float* src, int window, int stride, int rows, int cols,
-                 int channels, int out_height, int out_width, int n_batches,
-                 float* dest, float* mask) {
-    for (int n = 0; n < n_batches; ++n) {
-        for (int c = 0; c < channels; ++c) {
-            for (int ph = 0; ph < out_height; ++ph) {
-                for (int pw = 0; pw < out_width; ++pw) {
-                    int hstart = ph * stride;
-                    int wstart = pw * stride;
-                    int hend = std::min(hstart + window, rows);
-                    int wend = std::min(wstart + window, cols);
-                    hstart = std::max(hstart, 0);
-                    wstart = std::max(wstart, 0);
-                    const int pool_index = ph * out_width + pw;
-                    for (int h = hstart; h < hend; ++h) {
-                        for (int w = wstart; w < wend; ++w) {
-                            const int index = h * cols + w;
-                            if (src[index] > dest[pool_index]) {
-                                dest[pool_index] = src[index];
-                                mask[pool_index] = index;
-                            }
-                        }
-                    }
+// Writes the im2col rows of the output positions first to first + count of
+// one image, a count x (channels * kernel_h * kernel_w) column-major tile
+void im2col_tile_cpu(const float* data_im, int channels, int rows, int cols,
+                     int kernel_h, int kernel_w, int pad, int stride,
+                     int first, int count, float* data_col) {
+    const int out_width = (cols + 2 * pad - kernel_w) / stride + 1;
+    for (int c = 0; c < channels; ++c, data_im += rows * cols) {
+        for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
+            for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
+                for (int p = first; p < first + count; ++p) {
+                    int input_row = (p / out_width) * stride - pad + kernel_row;
+                    int input_col = (p % out_width) * stride - pad + kernel_col;
+                    *(data_col++) =
+                        (is_a_ge_zero_and_a_lt_b(input_row, rows) and
+                         is_a_ge_zero_and_a_lt_b(input_col, cols))
+                            ? data_im[input_row * cols + input_col]
+                            : 0;
                 }
             }
-            src += (rows * cols);
-            dest += (out_height * out_width);
-            mask += (out_height * out_width);
         }
     }
 }
 
-void pooling_backward_cpu(const float* src, const float* mask, int window,
-                          int stride, int rows, int cols, int channels,
-                          int out_height, int out_width,
-                          int n_batches, float* dest) {
-    for (int n = 0; n < n_batches; ++n) {
-        for (int c = 0; c < channels; ++c) {
-            for (int ph = 0; ph < out_height; ++ph) {
-                for (int pw = 0; pw < out_width; ++pw) {
-                    int index = ph * out_width + pw;
-                    int dest_idx = mask[index];
-                    dest[dest_idx] += src[index];
+// Adds a tile in the layout of im2col_tile_cpu back onto the image
+void col2im_tile_cpu(const float* data_col, int channels, int rows, int cols,
+                     int kernel_h, int kernel_w, int pad, int stride,
+                     int first, int count, float* data_im) {
+    const int out_width = (cols + 2 * pad - kernel_w) / stride + 1;
+    for (int c = 0; c < channels; ++c, data_im += rows * cols) {
+        for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
+            for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
+                for (int p = first; p < first + count; ++p, ++data_col) {
+                    int input_row = (p / out_width) * stride - pad + kernel_row;
+                    int input_col = (p % out_width) * stride - pad + kernel_col;
+                    if (is_a_ge_zero_and_a_lt_b(input_row, rows) and
+                        is_a_ge_zero_and_a_lt_b(input_col, cols))
+                        data_im[input_row * cols + input_col] += *data_col;
+                }
+            }
+        }
+    }
+}
+
+namespace {
+// The maxima of the first width windows of a row of stride 2 windows
+// starting at line. Four outputs load eight columns of every window row
+// and take their even, odd and, for W = 3, next even columns apart with
+// SSE shuffles, so no load reaches past the last window. Each window
+// position is then one compare and two blends, visited in the order of the
+// scalar loop so that ties keep the first. The last four outputs are
+// computed again instead of one by one
+template <int W>
+void max_pool_row_stride2(const float* line, int cols, int width,
+                          float* dest, uint8_t* mask) {
+#ifdef __SSE2__
+    for (int next = 0; (width >= 4) and (next < width); next += 4) {
+        const int pw = std::min(next, width - 4);
+        const float* x = line + 2 * pw;
+        __m128 best = _mm_setzero_ps();
+        __m128i arg = _mm_setzero_si128();
+        for (int r = 0; r < W; ++r, x += cols) {
+            __m128 low = _mm_loadu_ps(x), high = _mm_loadu_ps(x + 4);
+            __m128 columns[3];
+            columns[0] = _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+            columns[1] = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+            if (W == 3)
+                columns[2] = _mm_shuffle_ps(_mm_loadu_ps(x + 2),
+                                            _mm_loadu_ps(x + 5),
+                                            _MM_SHUFFLE(3, 1, 2, 0));
+            for (int c = 0; c < W; ++c) {
+                if ((r == 0) and (c == 0)) {
+                    best = columns[0];
+                    continue;
+                }
+                __m128 greater = _mm_cmpgt_ps(columns[c], best);
+                __m128i select = _mm_castps_si128(greater);
+                best = _mm_or_ps(_mm_and_ps(greater, columns[c]),
+                                 _mm_andnot_ps(greater, best));
+                arg = _mm_or_si128(
+                    _mm_and_si128(select, _mm_set1_epi32(r * W + c)),
+                    _mm_andnot_si128(select, arg));
+            }
+        }
+        _mm_storeu_ps(dest + pw, best);
+        arg = _mm_packs_epi32(arg, arg);
+        int args = _mm_cvtsi128_si32(_mm_packus_epi16(arg, arg));
+        std::memcpy(mask + pw, &args, 4);
+    }
+    if (width >= 4) return;
+#endif
+    for (int pw = 0; pw < width; ++pw) {
+        const float* x = line + 2 * pw;
+        float best = x[0];
+        int arg = 0;
+        for (int r = 0; r < W; ++r)
+            for (int c = 0; c < W; ++c) {
+                float v = x[r * cols + c];
+                bool greater = v > best;
+                best = greater ? v : best;
+                arg = greater ? r * W + c : arg;
+            }
+        dest[pw] = best;
+        mask[pw] = arg;
+    }
+}
+
+// Max pooling of one channel of one image. The argmax is stored as the
+// offset r * window + c within the window, for the windows clipped at the
+// border as well, windows past the border get no gradient. With relu the
+// maxima are passed through a ReLU, which commutes with the max, and the
+// outputs it cuts off get no gradient. With the template arguments 2/2 and
+// 3/2 the windows inside the image run on SSE, 0 takes the window and
+// stride from the arguments
+template <int W, int S>
+void max_pool_plane(const float* src, int window_arg, int stride_arg,
+                    int rows, int cols, int out_height, int out_width,
+                    bool relu, float* dest, uint8_t* mask) {
+    const int window = W ? W : window_arg;
+    const int stride = S ? S : stride_arg;
+    // the output columns whose window lies inside the image
+    const int full_width =
+        (cols < window) ? 0 : std::min((cols - window) / stride + 1, out_width);
+    for (int ph = 0; ph < out_height; ++ph) {
+        const int hstart = ph * stride;
+        const float* line = src + hstart * cols;
+        float* d = dest + ph * out_width;
+        uint8_t* m = mask + ph * out_width;
+        int pw = 0;
+        if ((S == 2) and (hstart + window <= rows)) {
+            max_pool_row_stride2<W>(line, cols, full_width, d, m);
+            pw = full_width;
+        } else if (hstart + window <= rows) {
+            for (; pw < full_width; ++pw) {
+                const float* x = line + pw * stride;
+                float best = x[0];
+                int arg = 0;
+                for (int r = 0; r < window; ++r)
+                    for (int c = 0; c < window; ++c) {
+                        float v = x[r * cols + c];
+                        bool greater = v > best;
+                        best = greater ? v : best;
+                        arg = greater ? r * window + c : arg;
+                    }
+                d[pw] = best;
+                m[pw] = arg;
+            }
+        }
+        const int hend = std::min(hstart + window, rows);
+        for (; pw < out_width; ++pw) {
+            const int wstart = pw * stride;
+            const int wend = std::min(wstart + window, cols);
+            float best = -FLT_MAX;
+            int arg = ((hend > hstart) and (wend > wstart))
+                          ? 0
+                          : pooling_no_gradient;
+            // the select is done in integers, the compiler branches on a
+            // float compare and mispredicts on random data
+            for (int h = hstart; h < hend; ++h)
+                for (int w = wstart; w < wend; ++w) {
+                    float v = src[h * cols + w];
+                    int greater = v > best;
+                    best = std::max(best, v);
+                    arg += ((h - hstart) * window + w - wstart - arg) &
+                           -greater;
+                }
+            d[pw] = best;
+            m[pw] = arg;
+        }
+        if (relu)
+            for (pw = 0; pw < out_width; ++pw)
+                if (!(d[pw] > 0)) {
+                    d[pw] = 0;
+                    m[pw] = pooling_no_gradient;
                 }
+    }
+}
+
+// Overwrites the plane with the gradient, every output routes its gradient
+// to the input its argmax points at and windows that overlap add up
+template <int W, int S>
+void max_pool_backward_plane(const float* src, const uint8_t* mask,
+                             int window_arg, int stride_arg, int rows,
+                             int cols, int out_height, int out_width,
+                             float* dest) {
+    const int window = W ? W : window_arg;
+    const int stride = S ? S : stride_arg;
+    std::fill(dest, dest + rows * cols, 0.f);
+    for (int ph = 0; ph < out_height; ++ph) {
+        float* line = dest + ph * stride * cols;
+        for (int pw = 0; pw < out_width; ++pw) {
+            const int index = ph * out_width + pw;
+            const int arg = mask[index];
+            if (arg == pooling_no_gradient) continue;
+            line[(arg / window) * cols + pw * stride + arg % window] +=
+                src[index];
+        }
+    }
+}
+
+using PoolPlane = void (*)(const float*, int, int, int, int, int, int, bool,
+                           float*, uint8_t*);
+using PoolBackwardPlane = void (*)(const float*, const uint8_t*, int, int,
+                                   int, int, int, int, float*);
+
+// The averages of the first width windows of a row of stride 2 windows
+// starting at line, as max_pool_row_stride2. The W rows of eight columns
+// are added first, four outputs then take their even, odd and, for W = 3,
+// next even columns out of the sums with SSE shuffles
+template <int W>
+void avg_pool_row_stride2(const float* line, int cols, int width,
+                          float scale, float* dest) {
+#ifdef __SSE2__
+    const __m128 factor = _mm_set1_ps(scale);
+    for (int next = 0; (width >= 4) and (next < width); next += 4) {
+        const int pw = std::min(next, width - 4);
+        const float* x = line + 2 * pw;
+        __m128 low = _mm_setzero_ps(), high = _mm_setzero_ps();
+        __m128 next_low = _mm_setzero_ps(), next_high = _mm_setzero_ps();
+        for (int r = 0; r < W; ++r, x += cols) {
+            low = _mm_add_ps(low, _mm_loadu_ps(x));
+            high = _mm_add_ps(high, _mm_loadu_ps(x + 4));
+            if (W == 3) {
+                next_low = _mm_add_ps(next_low, _mm_loadu_ps(x + 2));
+                next_high = _mm_add_ps(next_high, _mm_loadu_ps(x + 5));
             }
-            dest += (rows * cols);
-            src += out_height * out_width;
-            mask += out_height * out_width;
         }
+        __m128 sum =
+            _mm_add_ps(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)),
+                       _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+        if (W == 3)
+            sum = _mm_add_ps(sum, _mm_shuffle_ps(next_low, next_high,
+                                                 _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm_storeu_ps(dest + pw, _mm_mul_ps(sum, factor));
+    }
+    if (width >= 4) return;
+#endif
+    for (int pw = 0; pw < width; ++pw) {
+        const float* x = line + 2 * pw;
+        float sum = 0;
+        for (int r = 0; r < W; ++r)
+            for (int c = 0; c < W; ++c) sum += x[r * cols + c];
+        dest[pw] = sum * scale;
     }
 }
+
+// Average pooling of one plane, the windows clipped at the border average
+// over the pixels inside the image only, those past it give zero. The
+// template arguments work as for max_pool_plane
+template <int W, int S>
+void avg_pool_plane(const float* src, int window_arg, int stride_arg,
+                    int rows, int cols, int out_height, int out_width,
+                    float* dest) {
+    const int window = W ? W : window_arg;
+    const int stride = S ? S : stride_arg;
+    const int full_width =
+        (cols < window) ? 0 : std::min((cols - window) / stride + 1, out_width);
+    const float scale = 1.f / (window * window);
+    for (int ph = 0; ph < out_height; ++ph) {
+        const int hstart = ph * stride;
+        const int hend = std::min(hstart + window, rows);
+        const float* line = src + hstart * cols;
+        float* d = dest + ph * out_width;
+        int pw = 0;
+        if ((S == 2) and (hend - hstart == window)) {
+            avg_pool_row_stride2<W>(line, cols, full_width, scale, d);
+            pw = full_width;
+        } else if (hend - hstart == window) {
+            for (; pw < full_width; ++pw) {
+                const float* x = line + pw * stride;
+                float sum = 0;
+                for (int r = 0; r < window; ++r)
+                    for (int c = 0; c < window; ++c) sum += x[r * cols + c];
+                d[pw] = sum * scale;
+            }
+        }
+        for (; pw < out_width; ++pw) {
+            const int wstart = pw * stride;
+            const int wend = std::min(wstart + window, cols);
+            const int count = (hend - hstart) * (wend - wstart);
+            float sum = 0;
+            for (int h = hstart; h < hend; ++h)
+                for (int w = wstart; w < wend; ++w) sum += src[h * cols + w];
+            d[pw] = (count > 0) ? sum / count : 0;
+        }
+    }
+}
+
+// Overwrites the plane with the gradient, every output spreads its gradient
+// evenly over the pixels it averaged
+template <int W, int S>
+void avg_pool_backward_plane(const float* src, int window_arg, int stride_arg,
+                             int rows, int cols, int out_height,
+                             int out_width, float* dest) {
+    const int window = W ? W : window_arg;
+    const int stride = S ? S : stride_arg;
+    std::fill(dest, dest + rows * cols, 0.f);
+    for (int ph = 0; ph < out_height; ++ph) {
+        const int hstart = ph * stride;
+        const int hend = std::min(hstart + window, rows);
+        for (int pw = 0; pw < out_width; ++pw) {
+            const int wstart = pw * stride;
+            const int wend = std::min(wstart + window, cols);
+            const float g = src[ph * out_width + pw] /
+                            ((hend - hstart) * (wend - wstart));
+            for (int h = hstart; h < hend; ++h)
+                for (int w = wstart; w < wend; ++w) dest[h * cols + w] += g;
+        }
+    }
+}
+
+using AvgPoolPlane = void (*)(const float*, int, int, int, int, int, int,
+                              float*);
+
+AvgPoolPlane avg_pool_plane(int window, int stride) {
+    if ((window == 2) and (stride == 2)) return avg_pool_plane<2, 2>;
+    if ((window == 3) and (stride == 2)) return avg_pool_plane<3, 2>;
+    return avg_pool_plane<0, 0>;
+}
+
+AvgPoolPlane avg_pool_backward_plane(int window, int stride) {
+    if ((window == 2) and (stride == 2)) return avg_pool_backward_plane<2, 2>;
+    if ((window == 3) and (stride == 2)) return avg_pool_backward_plane<3, 2>;
+    return avg_pool_backward_plane<0, 0>;
+}
+
+PoolPlane pool_plane(int window, int stride) {
+    if ((window == 2) and (stride == 2)) return max_pool_plane<2, 2>;
+    if ((window == 3) and (stride == 2)) return max_pool_plane<3, 2>;
+    return max_pool_plane<0, 0>;
+}
+
+PoolBackwardPlane pool_backward_plane(int window, int stride) {
+    if ((window == 2) and (stride == 2)) return max_pool_backward_plane<2, 2>;
+    if ((window == 3) and (stride == 2)) return max_pool_backward_plane<3, 2>;
+    return max_pool_backward_plane<0, 0>;
+}
+}  // namespace
+
+void max_pooling_planes_cpu(const float* src, int window, int stride,
+                            int rows, int cols, int planes, int out_height,
+                            int out_width, bool relu, float* dest,
+                            uint8_t* mask) {
+    PoolPlane plane = pool_plane(window, stride);
+    const int in_size = rows * cols, out_size = out_height * out_width;
+    for (int p = 0; p < planes; ++p)
+        plane(src + p * in_size, window, stride, rows, cols, out_height,
+              out_width, relu, dest + p * out_size, mask + p * out_size);
+}
+
+// Every channel of every image is pooled on its own, so the planes are
+// spread over the threads without any synchronization
+void pooling_cpu(const float* src, int window, int stride, int rows, int cols,
+                 int channels, int out_height, int out_width, int n_batches,
+                 float* dest, uint8_t* mask) {
+    const int in_size = rows * cols, out_size = out_height * out_width;
+    parallel_for(n_batches * channels, [&](int begin, int end) {
+        max_pooling_planes_cpu(src + begin * in_size, window, stride, rows,
+                               cols, end - begin, out_height, out_width,
+                               false, dest + begin * out_size,
+                               mask + begin * out_size);
+    });
+}
+
+void pooling_backward_cpu(const float* src, const uint8_t* mask, int window,
+                          int stride, int rows, int cols, int channels,
+                          int out_height, int out_width,
+                          int n_batches, float* dest) {
+    PoolBackwardPlane plane = pool_backward_plane(window, stride);
+    const int in_size = rows * cols, out_size = out_height * out_width;
+    parallel_for(n_batches * channels, [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+            plane(src + p * out_size, mask + p * out_size, window, stride,
+                  rows, cols, out_height, out_width, dest + p * in_size);
+    });
+}
+
+void avg_pooling_cpu(const float* src, int window, int stride, int rows,
+                     int cols, int channels, int out_height, int out_width,
+                     int n_batches, float* dest) {
+    AvgPoolPlane plane = avg_pool_plane(window, stride);
+    const int in_size = rows * cols, out_size = out_height * out_width;
+    parallel_for(n_batches * channels, [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+            plane(src + p * in_size, window, stride, rows, cols, out_height,
+                  out_width, dest + p * out_size);
+    });
+}
+
+void avg_pooling_backward_cpu(const float* src, int window, int stride,
+                              int rows, int cols, int channels,
+                              int out_height, int out_width, int n_batches,
+                              float* dest) {
+    AvgPoolPlane plane = avg_pool_backward_plane(window, stride);
+    const int in_size = rows * cols, out_size = out_height * out_width;
+    parallel_for(n_batches * channels, [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+            plane(src + p * out_size, window, stride, rows, cols, out_height,
+                  out_width, dest + p * in_size);
+    });
+}
+
+// The planes are contiguous, so the mean of each is a vectorized Eigen
+// reduction
+void global_avg_pooling_cpu(const float* src, int size, int planes,
+                            float* dest) {
+    parallel_for(planes, [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+            dest[p] = Eigen::Map<const Eigen::ArrayXf>(src + p * size, size)
+                          .mean();
+    });
+}
+
+void global_avg_pooling_backward_cpu(const float* src, int size, int planes,
+                                     float* dest) {
+    parallel_for(planes, [&](int begin, int end) {
+        for (int p = begin; p < end; ++p)
+            Eigen::Map<Eigen::ArrayXf>(dest + p * size, size)
+                .setConstant(src[p] / size);
+    });
+}
+
 Matrix sigmoid(const Matrix& inp) {
     Matrix output(Matrix::Zero(inp.rows(), inp.cols()));
     //Matrix& res = output->return_data();
@@ -313,3 +695,96 @@ Matrix sigmoid(const Matrix& inp) {
     }
     return output;
 }
+
+// The gates hold the pre-activations [i, f, o, g] of obs columns and are
+// overwritten with their activations; the cell and state of the next step
+// follow in the same pass without temporaries
+void lstm_cell_forward_cpu(int nh, int obs, dtype* gates,
+                           const dtype* cell_prev, dtype* cell, dtype* state) {
+    Eigen::Map<Matrix> z(gates, 4 * nh, obs);
+    Eigen::Map<const Matrix> c_prev(cell_prev, nh, obs);
+    Eigen::Map<Matrix> c(cell, nh, obs);
+    Eigen::Map<Matrix> h(state, nh, obs);
+    z.topRows(3 * nh) = (1 + (-z.topRows(3 * nh).array()).exp()).inverse();
+    z.bottomRows(nh) = z.bottomRows(nh).array().tanh();
+    c = z.middleRows(nh, nh).array() * c_prev.array() +
+        z.topRows(nh).array() * z.bottomRows(nh).array();
+    h = z.middleRows(2 * nh, nh).array() * c.array().tanh();
+}
+
+// Writes the pre-activation gradient of the gates to d_all, d_cell carries
+// the cell gradient from the following step in and to the previous step out
+void lstm_cell_backward_cpu(int nh, int obs, const dtype* gates,
+                            const dtype* cell_prev, const dtype* cell,
+                            const dtype* d_state, dtype* d_cell,
+                            dtype* d_all) {
+    Eigen::Map<const Matrix> z(gates, 4 * nh, obs);
+    Eigen::Map<const Matrix> c_prev(cell_prev, nh, obs);
+    Eigen::Map<const Matrix> c(cell, nh, obs);
+    Eigen::Map<const Matrix> dh(d_state, nh, obs);
+    Eigen::Map<Matrix> dc(d_cell, nh, obs);
+    Eigen::Map<Matrix> d(d_all, 4 * nh, obs);
+    auto i = z.topRows(nh).array();
+    auto f = z.middleRows(nh, nh).array();
+    auto o = z.middleRows(2 * nh, nh).array();
+    auto g = z.bottomRows(nh).array();
+    // the output gate block holds tanh(c) until it is needed last
+    d.middleRows(2 * nh, nh) = c.array().tanh();
+    auto tanh_c = d.middleRows(2 * nh, nh).array();
+    dc.array() += dh.array() * o * (1 - tanh_c.square());
+    d.topRows(nh) = dc.array() * g * i * (1 - i);
+    d.middleRows(nh, nh) = dc.array() * c_prev.array() * f * (1 - f);
+    d.bottomRows(nh) = dc.array() * i * (1 - g.square());
+    d.middleRows(2 * nh, nh) = dh.array() * tanh_c * o * (1 - o);
+    dc.array() *= f;
+}
+
+// The gates hold the input pre-activations [z, r, n] of obs columns and
+// recurrent the matching W_h * h_{t-1}; the reset gate only scales the
+// recurrent part of n. The gates are overwritten with their activations and
+// hn keeps the recurrent part of n for the backward pass
+void gru_cell_forward_cpu(int nh, int obs, dtype* gates,
+                          const dtype* recurrent, const dtype* state_prev,
+                          dtype* state, dtype* hn) {
+    Eigen::Map<Matrix> g(gates, 3 * nh, obs);
+    Eigen::Map<const Matrix> u(recurrent, 3 * nh, obs);
+    Eigen::Map<const Matrix> h_prev(state_prev, nh, obs);
+    Eigen::Map<Matrix> h(state, nh, obs);
+    Eigen::Map<Matrix> n_rec(hn, nh, obs);
+    g.topRows(2 * nh) =
+        (1 + (-(g.topRows(2 * nh) + u.topRows(2 * nh)).array()).exp())
+            .inverse();
+    n_rec = u.bottomRows(nh);
+    g.bottomRows(nh) = (g.bottomRows(nh).array() +
+                        g.middleRows(nh, nh).array() * n_rec.array())
+                           .tanh();
+    h = g.bottomRows(nh).array() +
+        g.topRows(nh).array() *
+            (h_prev.array() - g.bottomRows(nh).array());
+}
+
+// Writes the pre-activation gradients of the input part to d_x and of the
+// recurrent part to d_h, d_prev receives the part of the gradient of the
+// previous state which bypasses W_h
+void gru_cell_backward_cpu(int nh, int obs, const dtype* gates,
+                           const dtype* hn, const dtype* state_prev,
+                           const dtype* d_state, dtype* d_x, dtype* d_h,
+                           dtype* d_prev) {
+    Eigen::Map<const Matrix> g(gates, 3 * nh, obs);
+    Eigen::Map<const Matrix> n_rec(hn, nh, obs);
+    Eigen::Map<const Matrix> h_prev(state_prev, nh, obs);
+    Eigen::Map<const Matrix> dh(d_state, nh, obs);
+    Eigen::Map<Matrix> dx(d_x, 3 * nh, obs);
+    Eigen::Map<Matrix> drec(d_h, 3 * nh, obs);
+    Eigen::Map<Matrix> dp(d_prev, nh, obs);
+    auto z = g.topRows(nh).array();
+    auto r = g.middleRows(nh, nh).array();
+    auto n = g.bottomRows(nh).array();
+    dx.topRows(nh) = dh.array() * (h_prev.array() - n) * z * (1 - z);
+    dx.bottomRows(nh) = dh.array() * (1 - z) * (1 - n.square());
+    dx.middleRows(nh, nh) =
+        dx.bottomRows(nh).array() * n_rec.array() * r * (1 - r);
+    drec.topRows(2 * nh) = dx.topRows(2 * nh);
+    drec.bottomRows(nh) = dx.bottomRows(nh).array() * r;
+    dp = dh.array() * z;
+}
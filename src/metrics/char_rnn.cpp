@@ -31,24 +31,36 @@ int CharRNN::pick_value(const Matrix& input) {
     return input.rows() - 1;
 }
 
+int CharRNN::first_token(const Matrix& features, int row) {
+    if (features.cols() == 1) return static_cast<int>(features(row, 0));
+    int token = 0;
+    features.row(row).maxCoeff(&token);
+    return token;
+}
+
+Matrix CharRNN::encode(int token, int rows) {
+    // a network starting with an embedding reads the id directly
+    if (rows == 1) return Matrix::Constant(1, 1, token);
+    Matrix in = Matrix::Zero(rows, 1);
+    in(token, 0) = 1;
+    return in;
+}
+
 void CharRNN::validate(const Matrix& features, const Matrix& targets) {
-    DebugInfo no_debugging("", "");
     std::uniform_int_distribution<int> dist(0, features.rows() - 1);
-    int start = dist(gen);
+    int start = first_token(features, dist(gen));
     vector<int> sequence = {start};
-    vector<SharedStorage> vals = _nn->allocate_forward(1);
-    vals[0]->update_cpu_data(features(start, Eigen::all).transpose());
-    const std::string type("predict");
+    _nn->reset_state(1);
+    Matrix input = encode(start, features.cols());
     for (int i = 0; i < _length; ++i) {
-        _nn->forward(vals, type, no_debugging);
-        if (temperature < 1) {
-            vals[vals.size() - 2]->return_data() /= temperature;
-            _nn->layers[_nn->layers.size() - 1]->forward_cpu(
-                vals[vals.size() - 2], vals[vals.size() - 1], "predict");
+        Matrix probs = _nn->step(input);
+        // equivalent to a softmax over the logits divided by the temperature
+        if (temperature != 1) {
+            probs = probs.array().pow(1. / temperature);
+            probs /= probs.sum();
         }
-        int sample = pick_value(vals.back()->return_data_const().transpose());
-        vals[0]->return_data().setZero();
-        vals[0]->return_data()(sample, 0) = 1;
+        int sample = pick_value(probs.transpose());
+        input = encode(sample, features.cols());
         sequence.push_back(sample);
     }
     convert_to_stdout(sequence);
@@ -10,25 +10,27 @@ void Missclassified::validate(const Matrix& features, const Matrix& targets) {
     n_missclassified(res, targets);
 }
 
+void Missclassified::validate(const SparseMatrix& features,
+                              const Matrix& targets) {
+    Matrix res = _nn->predict(features);
+    n_missclassified(res, targets);
+}
+
+int Missclassified::true_class(const Matrix& y_true, int row) {
+    // a single column holds the class index directly
+    if (y_true.cols() == 1) return static_cast<int>(y_true(row, 0));
+    int arg_true = 0;
+    y_true.row(row).maxCoeff(&arg_true);
+    return arg_true;
+}
+
 void Missclassified::n_missclassified(const Matrix& y_pred,
                                       const Matrix& y_true) {
     int missclassified(0);
     for (int i = 0; i < y_pred.rows(); ++i) {
         int arg_pred = 0;
-        int arg_true = 0;
-        dtype max_pred = y_pred(i, 0);
-        dtype max_true = y_true(i, 0);
-        for (int j = 0; j < 10; ++j) {
-            if (max_pred < y_pred(i, j)) {
-                arg_pred = j;
-                max_pred = y_pred(i, j);
-            }
-            if (max_true < y_true(i, j)) {
-                arg_true = j;
-                max_true = y_true(i, j);
-            }
-        }
-        if (arg_true != arg_pred) missclassified++;
+        y_pred.row(i).maxCoeff(&arg_pred);
+        if (true_class(y_true, i) != arg_pred) missclassified++;
     }
     std::cout << "fraction miassclassified : "
               << float(missclassified) / y_pred.rows() << " and "
@@ -4,11 +4,27 @@
 #include <memory>
 #include <stdexcept>
 #include <thread>
+#include "../include/execution_plan.hpp"
+#include "../include/layer/conv_block.hpp"
+#include "../include/layer/dense_block.hpp"
 #include "../include/layer/im2col_layer.h"
+#include "../include/layer/merge.hpp"
 #include "../include/loss/cross_entropy.h"
+#include "../include/wavefront.hpp"
 using std::shared_ptr;
 using std::vector;
 
+namespace {
+// whether the layers a block replaces, from curr back to the block's
+// previous one, include stop
+bool absorbs(std::shared_ptr<Layer> curr, const std::shared_ptr<Layer>& block,
+             const std::shared_ptr<Layer>& stop) {
+    for (; curr != block->previous(); curr = curr->previous())
+        if (curr == stop) return true;
+    return false;
+}
+}  // namespace
+
 //void print_Matrix_to_stdout3(const Matrix& val, std::string loc) {
     //int rows(val.rows()), cols(val.cols());
     //std::ofstream myfile(loc);
@@ -27,6 +43,9 @@ NeuralNetwork::NeuralNetwork(const std::shared_ptr<Layer>& last_layer,
                              std::shared_ptr<Loss>& _loss)
     : layers(), loss(_loss) {
     construct_layers(last_layer);
+    find_recurrent_stacks();
+    link_convolutions(layers);
+    compile_plan();
     fun_forward = &NeuralNetwork::forward_gpu;
     fun_backward = &NeuralNetwork::backward_gpu;
     fun_update = &NeuralNetwork::update_weights_gpu;
@@ -37,7 +56,10 @@ NeuralNetwork::NeuralNetwork(const std::shared_ptr<Layer>& last_layer,
                              std::shared_ptr<Loss>& _loss,
                              const std::string& device)
     : layers(), loss(_loss) {
-    construct_layers(last_layer);
+    construct_layers(last_layer, device != "GPU");
+    find_recurrent_stacks();
+    link_convolutions(layers);
+    compile_plan();
     if (device == "GPU") {
         fun_forward = &NeuralNetwork::forward_gpu;
         fun_backward = &NeuralNetwork::backward_gpu;
@@ -64,32 +86,97 @@ void NeuralNetwork::print_network() {
     }
 }
 
-void NeuralNetwork::insert_cnn_layer(const std::shared_ptr<Layer>& layer) {
+// On the cpu the convolution packs its im2col tiles itself, otherwise an
+// Im2ColLayer is put in front of it
+void NeuralNetwork::insert_cnn_layer(std::deque<shared_ptr<Layer>>& chain,
+                                     const std::shared_ptr<Layer>& layer,
+                                     bool implicit) {
     std::shared_ptr<Convolution> derived =
         std::dynamic_pointer_cast<Convolution>(layer);
+    derived->implicit_gemm(implicit);
+    if (implicit) {
+        chain.push_front(layer);
+        return;
+    }
     std::shared_ptr<Layer> im2col = std::make_shared<Im2ColLayer>(derived);
     // std::shared_ptr<Layer> tmp = layer->_previous;
     layer->_previous = im2col;
-    layers.push_front(layer);
-    layers.push_front(im2col);
+    chain.push_front(layer);
+    chain.push_front(im2col);
 }
 
-void NeuralNetwork::construct_layers(std::shared_ptr<Layer> curr) {
-    while (curr->previous()) {
-        if (curr->name() == "Convolution") {
-            insert_cnn_layer(curr);
+// A max Pooling behind a Convolution, with or without a Relu in between,
+// becomes one ConvBlock which never stores the full size activations
+std::shared_ptr<Layer> NeuralNetwork::conv_block(
+    const std::shared_ptr<Layer>& layer) {
+    if (layer->name() != "Pooling") return nullptr;
+    std::shared_ptr<Layer> prev = layer->previous();
+    bool relu = prev and (prev->name() == "Relu");
+    if (relu) prev = prev->previous();
+    if (!prev or (prev->name() != "Convolution")) return nullptr;
+    std::shared_ptr<Convolution> conv =
+        std::dynamic_pointer_cast<Convolution>(prev);
+    std::shared_ptr<Pooling> pool = std::dynamic_pointer_cast<Pooling>(layer);
+    if (!ConvBlock::fusable(conv, pool)) return nullptr;
+    return std::make_shared<ConvBlock>(conv, relu, pool);
+}
+
+// A Relu behind a Dense layer becomes one DenseBlock
+std::shared_ptr<Layer> NeuralNetwork::dense_block(
+    const std::shared_ptr<Layer>& layer) {
+    if (layer->name() != "Relu") return nullptr;
+    std::shared_ptr<Dense> dense =
+        std::dynamic_pointer_cast<Dense>(layer->previous());
+    if (!dense) return nullptr;
+    return std::make_shared<DenseBlock>(dense, Activation::Relu);
+}
+
+// The layers from curr back to stop, which is left out, with the fusable
+// ones fused. A block never takes in stop, the fork of the branches of a
+// merge, whose output the other branches read as well
+std::deque<shared_ptr<Layer>> NeuralNetwork::fuse(
+    std::shared_ptr<Layer> curr, const std::shared_ptr<Layer>& stop,
+    bool implicit) {
+    std::deque<shared_ptr<Layer>> chain;
+    while (curr != stop) {
+        std::shared_ptr<Layer> block = nullptr;
+        if (implicit) block = conv_block(curr);
+        if (implicit and !block) block = dense_block(curr);
+        if (block and absorbs(curr, block, stop)) block = nullptr;
+        std::shared_ptr<Merge> merge = std::dynamic_pointer_cast<Merge>(curr);
+        if (merge) fuse_branches(merge);
+        if (block) {
+            chain.push_front(block);
+            curr = block;
+        } else if (curr->name() == "Convolution") {
+            insert_cnn_layer(chain, curr, implicit);
         } else if (curr->name() == "Im2ColLayer") {
             ;
         } else
-            layers.push_front(curr);
+            chain.push_front(curr);
         std::shared_ptr<Layer> tmp = curr->previous();
         curr.swap(tmp);
     }
-    if (curr->name() == "Input")
-        layers.push_front(curr);
+    return chain;
+}
+
+// The branches run on the cpu, their convolutions pack the tiles themselves
+void NeuralNetwork::fuse_branches(const std::shared_ptr<Merge>& merge) {
+    for (std::deque<shared_ptr<Layer>>& branch : merge->_branches)
+        if (!branch.empty()) branch = fuse(branch.back(), merge->_previous);
+    merge->collect();
+}
+
+void NeuralNetwork::construct_layers(std::shared_ptr<Layer> curr,
+                                     bool implicit) {
+    std::shared_ptr<Layer> first = curr;
+    while (first->previous()) first = first->previous();
+    layers = fuse(curr, first, implicit);
+    if (first->name() == "Input")
+        layers.push_front(first);
     else {
         std::stringstream ss;
-        ss << "Cannot recognize the layer name " << curr->name() << " in:\n"
+        ss << "Cannot recognize the layer name " << first->name() << " in:\n"
            << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
            << __LINE__;
         throw std::invalid_argument(ss.str());
@@ -103,34 +190,59 @@ int NeuralNetwork::convert_output_dimension(const shared_ptr<Layer>& layer) {
 }
 
 void NeuralNetwork::allocate_storage(int obs, std::vector<SharedStorage>& inp,
-                                     const std::shared_ptr<Layer>& layer) {
+                                     const std::shared_ptr<Layer>& layer,
+                                     bool sparse) {
     if (layer->name() == "Im2ColLayer") {
         obs *= layer->input_dimension();
     }
+    if (sparse and (layer == layers.front())) {
+        inp.push_back(std::make_shared<Storage>());
+        return;
+    }
     int out_dim = convert_output_dimension(layer);
     inp.push_back(std::make_shared<Storage>(Matrix::Zero(out_dim, obs)));
 }
 
-vector<SharedStorage> NeuralNetwork::allocate_forward(int obs) {
+vector<SharedStorage> NeuralNetwork::allocate_forward(int obs, bool sparse) {
     vector<SharedStorage> vals;
     for (shared_ptr<Layer> layer : layers) {
-        allocate_storage(obs, vals, layer);
+        allocate_storage(obs, vals, layer, sparse);
     }
     return vals;
 }
 
-vector<SharedStorage> NeuralNetwork::allocate_backward(int obs) {
+vector<SharedStorage> NeuralNetwork::allocate_backward(int obs,
+                                                       bool sparse) {
     vector<SharedStorage> vals;
     std::deque<shared_ptr<Layer>>::iterator layer = layers.begin();
     std::deque<shared_ptr<Layer>>::iterator end = layers.end();
     --end;
     while (layer != end) {
-        allocate_storage(obs, vals, *layer);
+        allocate_storage(obs, vals, *layer, sparse);
         ++layer;
     }
     return vals;
 }
 
+void NeuralNetwork::reset_state(int streams) {
+    step_values = allocate_forward(streams);
+    for (shared_ptr<Layer> layer : layers) layer->reset_state(streams);
+}
+
+const Matrix& NeuralNetwork::step(const Matrix& input) {
+    if (step_values.empty() or (step_values[0]->get_cols() != input.cols()))
+        reset_state(input.cols());
+    step_values[0]->update_cpu_data(input);
+    for (size_t i = 1; i < layers.size(); ++i)
+        layers[i]->step(step_values[i - 1], step_values[i]);
+    return step_values.back()->return_data_const();
+}
+
+const Matrix& NeuralNetwork::step(const Labels& tokens) {
+    Matrix input = tokens.transpose().cast<dtype>();
+    return step(input);
+}
+
 void NeuralNetwork::fill_hiddens(vector<SharedStorage>& values,
                                  const Matrix& features) {
     values[0]->update_cpu_data(features);
@@ -139,12 +251,17 @@ void NeuralNetwork::fill_hiddens(vector<SharedStorage>& values,
 void NeuralNetwork::forward(vector<SharedStorage>& values,
                             const std::string& type,
                             DebugInfo& debug) {
-    (this->*fun_forward)(values, type, debug);
+    forward(values, mode_of(type), debug);
 }
 
-void NeuralNetwork::forward_gpu(vector<SharedStorage>& values,
-                                const std::string& type,
+void NeuralNetwork::forward(vector<SharedStorage>& values, Mode mode,
+                            DebugInfo& debug) {
+    (this->*fun_forward)(values, mode, debug);
+}
+
+void NeuralNetwork::forward_gpu(vector<SharedStorage>& values, Mode mode,
                                 DebugInfo& debug) {
+    const std::string& type = mode_name(mode);
     int i = 0;
     std::deque<shared_ptr<Layer>>::iterator layer = layers.begin();
     ++layer;
@@ -156,20 +273,64 @@ void NeuralNetwork::forward_gpu(vector<SharedStorage>& values,
     if (debug.is_set()) debug.forward_debug_info(values, layers, 32);
 }
 
-void NeuralNetwork::forward_cpu(vector<SharedStorage>& values,
-                                const std::string& type,
+void NeuralNetwork::forward_cpu(vector<SharedStorage>& values, Mode mode,
                                 DebugInfo& debug) {
-    int i = 0;
-    std::deque<shared_ptr<Layer>>::iterator layer = layers.begin();
-    ++layer;
-    while (layer != layers.end()) {
-        (*layer)->forward_cpu(values[i], values[i + 1], type);
-        i++;
-        ++layer;
-    }
+    plan.forward_cpu(values, mode);
     if (debug.is_set()) debug.forward_debug_info(values, layers, 32);
 }
 
+// Collects the runs of consecutive LSTM layers that can run as a wavefront
+void NeuralNetwork::find_recurrent_stacks() {
+    size_t i = 1;
+    while (i < layers.size()) {
+        size_t last = i;
+        while ((last + 1 < layers.size()) and (layers[i]->name() == "LSTM") and
+               (layers[last + 1]->name() == "LSTM"))
+            last++;
+        if (last > i)
+            wavefronts.push_back(std::make_shared<Wavefront>(layers, i, last));
+        i = last + 1;
+    }
+}
+
+// Links every convolution reading the images directly to the one before
+// it if only elementwise layers lie in between, which leave the layout of
+// their values alone, so the two can pass them on blocked. The branches of
+// a merge are linked on their own
+void NeuralNetwork::link_convolutions(
+    const std::deque<shared_ptr<Layer>>& chain) {
+    std::shared_ptr<Convolution> producer = nullptr;
+    for (const std::shared_ptr<Layer>& layer : chain) {
+        std::shared_ptr<Convolution> conv =
+            std::dynamic_pointer_cast<Convolution>(layer);
+        std::shared_ptr<Merge> merge = std::dynamic_pointer_cast<Merge>(layer);
+        if (merge)
+            for (const std::deque<shared_ptr<Layer>>& branch : merge->_branches)
+                link_convolutions(branch);
+        if (conv and conv->_implicit) {
+            conv->_producer = producer.get();
+            conv->_blocked_request = false;
+            producer = conv;
+        } else if ((layer->name() != "Relu") and
+                   (layer->name() != "Dropout")) {
+            producer = nullptr;
+        }
+    }
+}
+
+// Flattens the cpu passes, again whenever the wavefronts are switched
+void NeuralNetwork::compile_plan() {
+    if (use_wavefront)
+        plan.compile(layers, wavefronts);
+    else
+        plan.compile(layers, {});
+}
+
+void NeuralNetwork::wavefront(bool enable) {
+    use_wavefront = enable;
+    compile_plan();
+}
+
 void NeuralNetwork::get_new_predict_sample(const vector<int>& samples,
                                            const Matrix& all, Matrix& subset) {
     subset = all(samples, Eigen::all).transpose();
@@ -204,6 +365,29 @@ void NeuralNetwork::producer_predict(
     }
 }
 
+void NeuralNetwork::producer_predict(
+    const SparseMatrix& input,
+    threadsafe_queue<vector<SharedStorage>>* pred_queue) {
+    int iter = 0;
+    int total = input.rows();
+    vector<SharedStorage> vals;
+    int batch_size(0);
+    while (iter < total) {
+        if (pred_queue->size() < 5) {
+            int obs = std::min(32, total - iter);
+            SparseMatrix x = input.middleRows(iter, obs);
+            iter += obs;
+            SharedStorage inp = std::make_shared<Storage>(x);
+            if (inp->get_cols() != batch_size) {
+                vals = allocate_forward(obs, true);
+                batch_size = inp->get_cols();
+            }
+            vals[0] = inp;
+            pred_queue->push(vals);
+        }
+    }
+}
+
 void NeuralNetwork::consumer_predict(
     SharedStorage& target,
     threadsafe_queue<vector<SharedStorage>>* pred_queue,
@@ -213,7 +397,7 @@ void NeuralNetwork::consumer_predict(
     while (iter < total) {
         std::shared_ptr<vector<SharedStorage>> out = pred_queue->wait_and_pop();
         unsigned int start_position = iter * out->back()->get_rows();
-        forward(*out, "predict", debug);
+        forward(*out, Mode::Predict, debug);
         unsigned int obs = (*out)[0]->get_cols();
         target->update_gpu_data(out->back()->gpu_pointer_const(),
                                 start_position, obs * out->back()->get_rows());
@@ -239,3 +423,22 @@ Matrix NeuralNetwork::predict(const Matrix& input, DebugInfo&&
     predict(input, SharedTarget, debug);
     return SharedTarget->return_data_const().transpose();
 }
+
+void NeuralNetwork::predict(const SparseMatrix& input,
+                            SharedStorage& SharedTarget, DebugInfo& debug) {
+    threadsafe_queue<vector<SharedStorage>> pred_queue;
+    threadsafe_queue<vector<SharedStorage>>* ppred_queue = &pred_queue;
+    std::thread produce([&]() { producer_predict(input, ppred_queue); });
+    std::thread consume(
+        [&]() { consumer_predict(SharedTarget, ppred_queue, debug); });
+    produce.join();
+    consume.join();
+}
+
+Matrix NeuralNetwork::predict(const SparseMatrix& input, DebugInfo&& debug) {
+    int output_size = layers.back()->output_dimension()[0];
+    Matrix output = Matrix::Zero(output_size, input.rows());
+    SharedStorage SharedTarget = std::make_shared<Storage>(output);
+    predict(input, SharedTarget, debug);
+    return SharedTarget->return_data_const().transpose();
+}
@@ -1,21 +1,42 @@
 #include "../include/storage.h"
 #include <cuda_runtime.h>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include "../include/common.h"
 
 Storage::Storage()
-    : _data(), _cpu_pointer(NULL), _gpu_pointer(NULL), recent_head("UNINIT"){};
+    : _data(),
+      _sparse(),
+      _is_sparse(false),
+      _cpu_pointer(NULL),
+      _gpu_pointer(NULL),
+      recent_head(Head::Uninit),
+      _version(0){};
 
 Storage::Storage(const Matrix& data)
     : _data(data),
+      _sparse(),
+      _is_sparse(false),
       _cpu_pointer(_data.data()),
       _gpu_pointer(),
-      recent_head("SYNC") {
+      recent_head(Head::Sync),
+      _version(0) {
     initialize_gpu_memory();
 };
 
-bool Storage::is_set() { return recent_head != "UNINIT"; }
+Storage::Storage(const SparseMatrix& data)
+    : _data(),
+      _sparse(data),
+      _is_sparse(true),
+      _cpu_pointer(NULL),
+      _gpu_pointer(NULL),
+      recent_head(Head::Cpu),
+      _version(0) {
+    _sparse.makeCompressed();
+};
+
+bool Storage::is_set() { return recent_head != Head::Uninit; }
 
 Storage::~Storage() {
     // delete _cpu_pointer; // I don't know how to delete this pointer properly
@@ -31,7 +52,7 @@ void Storage::initialize_gpu_memory() {
 }
 
 void Storage::update_cpu_data(Matrix new_data) {
-    if (recent_head == "UNINIT") {
+    if (recent_head == Head::Uninit) {
         std::string m("No data set yet, in:\n");
         throw std::invalid_argument(m + __PRETTY_FUNCTION__);
     }
@@ -41,21 +62,24 @@ void Storage::update_cpu_data(Matrix new_data) {
     }
     _data = new_data;
     _cpu_pointer = _data.data();
-    recent_head = "CPU";
+    recent_head = Head::Cpu;
+    ++_version;
 }
 
 void Storage::update_gpu_data(const dtype new_data) {
     unsigned int nBytes = _data.rows() * _data.cols() * sizeof(dtype);
     MY_CHECK(cudaMemset(_gpu_pointer, new_data, nBytes));
     MY_CHECK(cudaDeviceSynchronize());
-    recent_head = "GPU";
+    recent_head = Head::Gpu;
+    ++_version;
 }
 
 void Storage::update_gpu_data(const dtype* src) {
     unsigned int nBytes = _data.rows() * _data.cols() * sizeof(dtype);
     MY_CHECK(cudaMemcpy(_gpu_pointer, src, nBytes, cudaMemcpyDeviceToDevice));
     MY_CHECK(cudaDeviceSynchronize());
-    recent_head = "GPU";
+    recent_head = Head::Gpu;
+    ++_version;
 }
 
 void Storage::update_gpu_data(const dtype* src,
@@ -64,73 +88,102 @@ void Storage::update_gpu_data(const dtype* src,
     MY_CHECK(cudaMemcpy(&_gpu_pointer[dest_position], src,
                         length * sizeof(dtype), cudaMemcpyDeviceToDevice));
     MY_CHECK(cudaDeviceSynchronize());
-    recent_head = "GPU";
+    recent_head = Head::Gpu;
+    ++_version;
 }
 
 void Storage::update_cpu_data(const dtype src) {
     _data.fill(src);
-    recent_head = "CPU";
+    recent_head = Head::Cpu;
+    ++_version;
 }
 
 void Storage::sync_to_cpu() {
-    if (recent_head == "GPU") {
+    if (recent_head == Head::Gpu) {
         //std::cout << "copying to CPU\n";
         unsigned int nBytes = _data.rows() * _data.cols() * sizeof(dtype);
         MY_CHECK(cudaMemcpy(_cpu_pointer, _gpu_pointer, nBytes,
                             cudaMemcpyDeviceToHost));
         MY_CHECK(cudaDeviceSynchronize());
-        recent_head = "SYNC";
+        recent_head = Head::Sync;
     }
 }
 
 void Storage::sync_to_gpu() {
-    if (recent_head == "CPU") {
+    if (recent_head == Head::Cpu) {
         // std::cout << "syncing to GPU\n";
         unsigned int nBytes = _data.rows() * _data.cols() * sizeof(dtype);
         MY_CHECK(cudaMemcpy(_gpu_pointer, _data.data(), nBytes,
                             cudaMemcpyHostToDevice));
         MY_CHECK(cudaDeviceSynchronize());
-        recent_head = "SYNC";
+        recent_head = Head::Sync;
+    }
+}
+
+void Storage::check_dense(const char* caller) {
+    if (_is_sparse) {
+        std::stringstream ss;
+        ss << "The storage holds sparse data, use return_sparse_const, in:\n"
+           << caller;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+const SparseMatrix& Storage::return_sparse_const() {
+    if (!_is_sparse) {
+        std::string m("The storage holds dense data, in:\n");
+        throw std::runtime_error(m + __PRETTY_FUNCTION__);
     }
+    return _sparse;
 }
 
 const dtype* Storage::cpu_pointer_const() {
+    check_dense(__PRETTY_FUNCTION__);
     sync_to_cpu();
     const dtype* cp = const_cast<const dtype*>(_cpu_pointer);
     return cp;
 }
 
 const dtype* Storage::gpu_pointer_const() {
+    check_dense(__PRETTY_FUNCTION__);
     sync_to_gpu();
     const dtype* cp = const_cast<const dtype*>(_gpu_pointer);
     return cp;
 }
 
 dtype* Storage::cpu_pointer() {
+    check_dense(__PRETTY_FUNCTION__);
     sync_to_cpu();
-    recent_head = "CPU";
+    recent_head = Head::Cpu;
+    ++_version;
     return _cpu_pointer;
 }
 
 dtype* Storage::gpu_pointer() {
+    check_dense(__PRETTY_FUNCTION__);
     sync_to_gpu();
-    recent_head = "GPU";
+    recent_head = Head::Gpu;
+    ++_version;
     return _gpu_pointer;
 }
 
 const Matrix& Storage::return_data_const() {
+    check_dense(__PRETTY_FUNCTION__);
     sync_to_cpu();
     return _data;
 }
 
 Matrix Storage::copy_data() {
+    check_dense(__PRETTY_FUNCTION__);
     sync_to_cpu();
     return _data;
 }
 
 Matrix& Storage::return_data() {
+    check_dense(__PRETTY_FUNCTION__);
     sync_to_cpu();
-    recent_head = "CPU";
+    recent_head = Head::Cpu;
+    ++_version;
     return _data;
 }
 
@@ -13,6 +13,7 @@
 #include "../include/network.h"
 #include "../include/threadsafe_queue.hpp"
 #include "../include/metrics/metric.hpp"
+#include "../include/utils/parallel.hpp"
 
 using Eigen::all;
 using std::make_shared;
@@ -42,14 +43,7 @@ void NeuralNetwork::backwards(std::vector<SharedStorage>& gradients,
 void NeuralNetwork::backward_cpu(std::vector<SharedStorage>& gradients,
                                  const std::vector<SharedStorage>& values,
                                  DebugInfo& debug) {
-    int idx = gradients.size() - 1;
-    for (int i = layers.size() - 2; i > 0; i--) {
-        const SharedStorage& gradient_in = gradients[idx];
-        SharedStorage& gradient_out = gradients[idx - 1];
-        const SharedStorage& vals = values[idx - 1];
-        layers[i]->backward_cpu(vals, gradient_in, gradient_out);
-        idx--;
-    }
+    plan.backward_cpu(gradients, values);
     if (debug.is_set()) debug.backward_debug_info(gradients, layers, 32);
 }
 
@@ -73,18 +67,23 @@ void NeuralNetwork::update_weights(std::shared_ptr<GradientDescent>& opt,
     (this->*fun_update)(opt, helper, batch_size);
 }
 
+// The layers own their parameters and helpers, so they are updated in
+// parallel
 void NeuralNetwork::update_weights_cpu(std::shared_ptr<GradientDescent>& opt,
                                        vector<VecSharedStorage>& helpers,
                                        int batch_size) {
-    int i = 0;
-    for (std::shared_ptr<Layer> layer : layers) {
-        if (layer->n_paras() > 0) {
-            vector<SharedStorage> parameters = layer->return_parameters();
-            const vector<SharedStorage>& gradients = layer->return_gradients();
-            VecSharedStorage& helper = helpers[i++];
-            opt->weight_update_cpu(gradients, parameters, batch_size, helper);
+    vector<std::shared_ptr<Layer>> trained;
+    for (std::shared_ptr<Layer> layer : layers)
+        if (layer->n_paras() > 0) trained.push_back(layer);
+    parallel_for(trained.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            vector<SharedStorage> parameters = trained[i]->return_parameters();
+            const vector<SharedStorage>& gradients =
+                trained[i]->return_gradients();
+            opt->weight_update_cpu(gradients, parameters, batch_size,
+                                   helpers[i]);
         }
-    }
+    });
 }
 
 void NeuralNetwork::update_weights_gpu(std::shared_ptr<GradientDescent>& opt,
@@ -112,6 +111,19 @@ void NeuralNetwork::prepare_subset(const vector<int>& pop, vector<int>& subset,
     start += n_samples;
 }
 
+// Splits the training set into one contiguous stream per sequence, a batch
+// then continues every stream by the next steps in time-major order
+void NeuralNetwork::prepare_streams(vector<int>& subset, int& start) {
+    int sequences = train_args->sequences();
+    int steps = train_args->steps();
+    int length = train_args->n_train() / sequences;
+    if (start + steps > length) start = 0;
+    for (int t = 0; t < steps; ++t)
+        for (int b = 0; b < sequences; ++b)
+            subset[t * sequences + b] = b * length + start + t;
+    start += steps;
+}
+
 void NeuralNetwork::maybe_shuffle(vector<int>& pop, int& start, const int& end,
                                   const int& step, std::mt19937& gen) {
     if (start + step >= end) {
@@ -129,24 +141,35 @@ void NeuralNetwork::get_new_sample(const vector<int>& samples, Matrix& x_train,
     y_train = train_args->y_train()(samples, all).transpose();
 }
 
+void NeuralNetwork::get_new_sample(const vector<int>& samples,
+                                   SparseMatrix& x_train, Matrix& y_train) {
+    if (!train_args) throw std::runtime_error("Train args is not set");
+    const SparseMatrix& features = train_args->x_train_sparse();
+    int nnz = 0;
+    for (int sample : samples) nnz += features.innerVector(sample).nonZeros();
+    x_train.resize(samples.size(), features.cols());
+    x_train.reserve(nnz);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        x_train.startVec(i);
+        for (SparseMatrix::InnerIterator it(features, samples[i]); it; ++it)
+            x_train.insertBack(i, it.col()) = it.value();
+    }
+    x_train.finalize();
+    y_train = train_args->y_train()(samples, all).transpose();
+}
+
 int NeuralNetwork::check_input_dimension(const std::vector<int>& dim) {
     int i = 1;
     for (int shape : dim) i *= shape;
     return i;
 }
 
-void NeuralNetwork::train(const Matrix& features, const Matrix& targets,
-                          std::shared_ptr<GradientDescent>& sgd, Epochs _epoch,
-                          Patience _patience, BatchSize _batch_size,
-                          vector<Metric*>& metrics, DebugInfo&& debug_info,
-                          Shuffle shuffle) {
+void NeuralNetwork::check_input_features(int features) {
     std::vector<int> input_dim = layers[0]->output_dimension();
-    std::cout << "features, target" << features.rows() << ", " << targets.rows()
-              << std::endl;
     int expected_cols = check_input_dimension(input_dim);
-    if (expected_cols != features.cols()) {
+    if (expected_cols != features) {
         std::stringstream ss;
-        ss << "The number of input features is: " << features.cols()
+        ss << "The number of input features is: " << features
            << " but the input layer expects: ";
         std::copy(input_dim.begin(), input_dim.end(),
                   std::ostream_iterator<int>(ss, " "));
@@ -155,17 +178,130 @@ void NeuralNetwork::train(const Matrix& features, const Matrix& targets,
            << __LINE__;
         throw std::invalid_argument(ss.str());
     }
+}
+
+void NeuralNetwork::train(const Matrix& features, const Matrix& targets,
+                          std::shared_ptr<GradientDescent>& sgd, Epochs _epoch,
+                          Patience _patience, BatchSize _batch_size,
+                          vector<Metric*>& metrics, DebugInfo&& debug_info,
+                          Shuffle shuffle, Sequences sequences,
+                          Truncation truncation) {
+    std::cout << "features, target" << features.rows() << ", " << targets.rows()
+              << std::endl;
+    check_not_frozen();
+    check_input_features(features.cols());
+    set_sequences(sequences, shuffle.get());
+    train_args = std::make_unique<trainArgs>(features, targets, _epoch,
+                                             _patience, _batch_size, sgd,
+                                             layers, shuffle, sequences,
+                                             truncation);
+    if (train_args->n_train() / sequences.get() < train_args->steps()) {
+        std::stringstream ss;
+        ss << "The " << train_args->n_train() << " training observations "
+           << "cannot fill " << sequences.get() << " sequences of "
+           << train_args->steps() << " steps, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    if (train_args->steps() % (train_args->window_size() / sequences.get())) {
+        std::stringstream ss;
+        ss << "Batches of " << train_args->steps() << " steps cannot be split "
+           << "into windows of " << truncation.get() << " steps, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    if (debug_info.is_set()) debug_info.print_layers(layers);
+    // train(sgd);
+    std::thread produce([&]() { producer(); });
+    std::thread consume([&]() { consumer(sgd, debug_info, metrics); });
+    produce.join();
+    consume.join();
+}
+
+void NeuralNetwork::train(const SparseMatrix& features, const Matrix& targets,
+                          std::shared_ptr<GradientDescent>& sgd, Epochs _epoch,
+                          Patience _patience, BatchSize _batch_size,
+                          vector<Metric*>& metrics, DebugInfo&& debug_info,
+                          Shuffle shuffle) {
+    std::cout << "features, target" << features.rows() << ", " << targets.rows()
+              << std::endl;
+    check_not_frozen();
+    check_input_features(features.cols());
+    set_sequences(Sequences(1), shuffle.get());
     train_args =
         std::make_unique<trainArgs>(features, targets, _epoch, _patience,
                                     _batch_size, sgd, layers, shuffle);
     if (debug_info.is_set()) debug_info.print_layers(layers);
-    // train(sgd);
     std::thread produce([&]() { producer(); });
     std::thread consume([&]() { consumer(sgd, debug_info, metrics); });
     produce.join();
     consume.join();
 }
 
+void NeuralNetwork::train(const SparseMatrix& features, const Labels& targets,
+                          std::shared_ptr<GradientDescent>& sgd, Epochs _epoch,
+                          Patience _patience, BatchSize _batch_size,
+                          vector<Metric*>& metrics, DebugInfo&& debug_info,
+                          Shuffle shuffle) {
+    check_labels(targets);
+    Matrix labels = targets.cast<dtype>();
+    train(features, labels, sgd, _epoch, _patience, _batch_size, metrics,
+          std::move(debug_info), shuffle);
+}
+
+void NeuralNetwork::check_labels(const Labels& targets) {
+    int classes = layers.back()->output_dimension()[0];
+    if ((targets.size() > 0) and
+        ((targets.minCoeff() < 0) or (targets.maxCoeff() >= classes))) {
+        std::stringstream ss;
+        ss << "The labels must lie in [0, " << classes << ") but range from "
+           << targets.minCoeff() << " to " << targets.maxCoeff() << ", in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+}
+
+void NeuralNetwork::train(const Matrix& features, const Labels& targets,
+                          std::shared_ptr<GradientDescent>& sgd, Epochs _epoch,
+                          Patience _patience, BatchSize _batch_size,
+                          vector<Metric*>& metrics, DebugInfo&& debug_info,
+                          Shuffle shuffle, Sequences sequences,
+                          Truncation truncation) {
+    check_labels(targets);
+    // The labels are kept as a single column, the producer then assembles
+    // batches of one row which the loss treats as class indices
+    Matrix labels = targets.cast<dtype>();
+    train(features, labels, sgd, _epoch, _patience, _batch_size, metrics,
+          std::move(debug_info), shuffle, sequences, truncation);
+}
+
+void NeuralNetwork::train(const Labels& tokens, const Labels& targets,
+                          std::shared_ptr<GradientDescent>& sgd, Epochs _epoch,
+                          Patience _patience, BatchSize _batch_size,
+                          vector<Metric*>& metrics, DebugInfo&& debug_info,
+                          Shuffle shuffle, Sequences sequences,
+                          Truncation truncation) {
+    Matrix features = tokens.cast<dtype>();
+    train(features, targets, sgd, _epoch, _patience, _batch_size, metrics,
+          std::move(debug_info), shuffle, sequences, truncation);
+}
+
+void NeuralNetwork::set_sequences(Sequences sequences, bool shuffle) {
+    if ((sequences.get() > 1) and shuffle) {
+        std::stringstream ss;
+        ss << "Shuffling would break up the " << sequences.get()
+           << " sequences, in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    for (std::shared_ptr<Layer> layer : layers)
+        layer->set_sequences(sequences.get());
+}
+
 bool NeuralNetwork::continue_training() {
     return (train_args->current_epoch() < train_args->epochs()) and
            (train_args->iter_since_update() <= train_args->patience());
@@ -175,23 +311,34 @@ void NeuralNetwork::producer() {
     std::mt19937 gen;
     // gen.seed(10);
     Matrix x_train, y_train;
+    SparseMatrix x_sparse;
     vector<int> samples(train_args->batch_size());
-    vector<int> population(train_args->x_train().rows());
+    vector<int> population(train_args->n_train());
     std::iota(population.begin(), population.end(), 0);
     std::pair<SharedStorage, SharedStorage> data;
     int producer_idx(0);
-    int end(train_args->x_train().rows());
+    int end(train_args->n_train());
     if (train_args->shuffle())
         std::shuffle(population.begin(), population.end(), gen);
     while (continue_training()) {
         // while (train_args->current_epoch() < train_args->epochs()) {
         if (train_args->data_queue.size() < 5) {
-            maybe_shuffle(population, producer_idx, end,
-                          train_args->batch_size(), gen);
-            prepare_subset(population, samples, producer_idx,
-                           train_args->batch_size());
-            get_new_sample(samples, x_train, y_train);
-            shared_ptr<Storage> SharedInput = make_shared<Storage>(x_train);
+            if (train_args->sequences() > 1) {
+                prepare_streams(samples, producer_idx);
+            } else {
+                maybe_shuffle(population, producer_idx, end,
+                              train_args->batch_size(), gen);
+                prepare_subset(population, samples, producer_idx,
+                               train_args->batch_size());
+            }
+            shared_ptr<Storage> SharedInput;
+            if (train_args->sparse()) {
+                get_new_sample(samples, x_sparse, y_train);
+                SharedInput = make_shared<Storage>(x_sparse);
+            } else {
+                get_new_sample(samples, x_train, y_train);
+                SharedInput = make_shared<Storage>(x_train);
+            }
             shared_ptr<Storage> SharedTarget = make_shared<Storage>(y_train);
             data = std::make_pair(SharedInput, SharedTarget);
             train_args->data_queue.push(data);
@@ -203,11 +350,14 @@ dtype NeuralNetwork::validate(std::chrono::milliseconds diff) {
     dtype total_loss(0.);
     DebugInfo no_debugging("", "");
     int out_size = layers[layers.size() - 1]->output_dimension()[0];
-    Matrix output = Matrix::Zero(out_size, train_args->x_val().rows());
+    size_t obs = train_args->y_val().rows();
+    Matrix output = Matrix::Zero(out_size, obs);
     SharedStorage SharedPred = std::make_shared<Storage>(output);
-    predict(train_args->x_val(), SharedPred, no_debugging);
+    if (train_args->sparse())
+        predict(train_args->x_val_sparse(), SharedPred, no_debugging);
+    else
+        predict(train_args->x_val(), SharedPred, no_debugging);
     total_loss = loss->loss(SharedPred, train_args->y_val_shared());
-    size_t obs = train_args->x_val().rows();
     std::cout << "after iter " << train_args->current_epoch() << " the loss is "
               << total_loss / obs << ", in " << diff.count() << " milliseconds"
               << std::endl;
@@ -226,32 +376,81 @@ void NeuralNetwork::display_train_loss(dtype& train_loss) {
     }
 }
 
+// The columns of one truncation window of a batch, the recurrent layers
+// carry their state from one window to the next
+SharedStorage NeuralNetwork::window_of(const SharedStorage& batch,
+                                       int window) {
+    if (train_args->windows() == 1) return batch;
+    int cols = train_args->window_size();
+    return make_shared<Storage>(
+        Matrix(batch->return_data_const().middleCols(window * cols, cols)));
+}
+
+// Sums the parameter gradients over the windows of a batch
+void NeuralNetwork::accumulate_gradients(int window) {
+    size_t i = 0;
+    for (std::shared_ptr<Layer> layer : layers) {
+        for (SharedStorage& grad : layer->return_gradients()) {
+            if (window_gradients.size() <= i)
+                window_gradients.push_back(grad->return_data_const());
+            else if (window == 0)
+                window_gradients[i] = grad->return_data_const();
+            else
+                window_gradients[i] += grad->return_data_const();
+            i++;
+        }
+    }
+}
+
+// Exchanges the sums with the gradients of the last window, before the
+// update and again after it, as layers with sparse gradients only reset the
+// entries they wrote themselves
+void NeuralNetwork::swap_window_gradients() {
+    size_t i = 0;
+    for (std::shared_ptr<Layer> layer : layers)
+        for (SharedStorage& grad : layer->return_gradients())
+            grad->return_data().swap(window_gradients[i++]);
+}
+
 void NeuralNetwork::consumer(std::shared_ptr<GradientDescent>& sgd,
                              DebugInfo& debug, vector<Metric*>& metrics) {
-    vector<SharedStorage> vals = allocate_forward(train_args->batch_size());
-    vector<SharedStorage> grads = allocate_backward(train_args->batch_size());
+    // only the activations of one truncation window are kept
+    int windows = train_args->windows();
+    int size = train_args->window_size();
+    vector<SharedStorage> vals = allocate_forward(size, train_args->sparse());
+    vector<SharedStorage> grads = allocate_backward(size, train_args->sparse());
     auto begin = std::chrono::system_clock::now();
-    const std::string type("train");
     std::chrono::milliseconds diff;
     dtype train_loss(0.);
     dtype val_loss;
     while (continue_training()) {
         std::shared_ptr<std::pair<SharedStorage, SharedStorage>> out =
             train_args->data_queue.wait_and_pop();
-        vals[0] = out->first;
-        forward(vals, type, debug);
-        loss->grad_loss(grads.back(), vals.back(), out->second, out->second);
-        backwards(grads, vals, debug);
-        train_loss += loss->loss(vals.back(), out->second);
+        for (int window = 0; window < windows; ++window) {
+            SharedStorage target = window_of(out->second, window);
+            vals[0] = window_of(out->first, window);
+            forward(vals, Mode::Train, debug);
+            loss->grad_loss(grads.back(), vals.back(), target, target);
+            backwards(grads, vals, debug);
+            train_loss += loss->loss(vals.back(), target);
+            if (windows > 1) accumulate_gradients(window);
+        }
+        if (windows > 1) swap_window_gradients();
         update_weights(sgd, train_args->optimizer(), train_args->batch_size());
+        if (windows > 1) swap_window_gradients();
         train_args->advance_total_iter();
         display_train_loss(train_loss);
         if (train_args->total_iter() > train_args->max_total_iter()) {
             diff = std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::system_clock::now() - begin);
             val_loss = validate(diff);
-            for (Metric* metric : metrics) 
-                metric->validate(train_args->x_val(), train_args->y_val());
+            for (Metric* metric : metrics) {
+                if (train_args->sparse())
+                    metric->validate(train_args->x_val_sparse(),
+                                     train_args->y_val());
+                else
+                    metric->validate(train_args->x_val(), train_args->y_val());
+            }
             if (val_loss < train_args->best_error()) {
                 train_args->reset_iter_since_update();
                 train_args->best_error() = val_loss;
@@ -6,6 +6,35 @@ using std::make_shared;
 using std::vector;
 
 trainArgs::trainArgs(const Matrix& features, const Matrix& target,
+                     Epochs __epochs, Patience __patience,
+                     BatchSize __batch_size,
+                     std::shared_ptr<GradientDescent>& sgd,
+                     std::deque<std::shared_ptr<Layer>>& layers,
+                     Shuffle shuffle, Sequences sequences,
+                     Truncation truncation)
+    : _x_train(),
+      _x_val(),
+      _y_train(),
+      _y_val(),
+      _iter_since_update(0),
+      _total_iter(0),
+      _current_epoch(0),
+      _cum_iter(0),
+      _best_error(std::numeric_limits<double>::infinity()),
+      _batch_size(__batch_size.get()),
+      _epochs(__epochs.get()),
+      _patience(__patience.get()),
+      _shuffle(shuffle.get()),
+      _sparse(false),
+      _sequences(sequences.get()),
+      _truncation(truncation.get() > 0 ? truncation.get()
+                                       : __batch_size.get()) {
+    train_test_split(features, target, 0.1);
+    _y_val_shared = std::make_shared<Storage>(_y_val.transpose());
+    create_optimizers(sgd, layers);
+};
+
+trainArgs::trainArgs(const SparseMatrix& features, const Matrix& target,
                      Epochs __epochs, Patience __patience,
                      BatchSize __batch_size,
                      std::shared_ptr<GradientDescent>& sgd,
@@ -23,7 +52,10 @@ trainArgs::trainArgs(const Matrix& features, const Matrix& target,
       _batch_size(__batch_size.get()),
       _epochs(__epochs.get()),
       _patience(__patience.get()),
-      _shuffle(shuffle.get()) {
+      _shuffle(shuffle.get()),
+      _sparse(true),
+      _sequences(1),
+      _truncation(__batch_size.get()) {
     train_test_split(features, target, 0.1);
     _y_val_shared = std::make_shared<Storage>(_y_val.transpose());
     create_optimizers(sgd, layers);
@@ -63,3 +95,16 @@ void trainArgs::train_test_split(const Matrix& features, const Matrix& target,
         _y_val = target(test_set, all);
     }
 }
+
+void trainArgs::train_test_split(const SparseMatrix& features,
+                                 const Matrix& target,
+                                 dtype validation_fraction) {
+    int cutoff = features.rows() * (1 - validation_fraction);
+    int remaining = features.rows() - cutoff;
+    _x_train_sparse = features.topRows(cutoff);
+    _y_train = target.topRows(cutoff);
+    if (validation_fraction > 0.) {
+        _x_val_sparse = features.bottomRows(remaining);
+        _y_val = target.bottomRows(remaining);
+    }
+}
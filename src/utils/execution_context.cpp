@@ -0,0 +1,187 @@
+#include "../../include/utils/execution_context.hpp"
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// the library links OpenBLAS, whose own threads are limited to ours
+extern "C" void openblas_set_num_threads(int);
+
+namespace {
+// set on the workers, and on a caller while it runs the chunks of a job
+thread_local bool in_pool = false;
+
+struct Arena {
+    std::vector<std::vector<float>> buffers;
+    size_t depth = 0;
+};
+thread_local Arena arena;
+
+int cores() { return std::max(1u, std::thread::hardware_concurrency()); }
+}  // namespace
+
+ExecutionContext& ExecutionContext::instance() {
+    static ExecutionContext context;
+    return context;
+}
+
+ExecutionContext::ExecutionContext()
+    : _threads(cores()),
+      _affinity(false),
+      _seed(0),
+      _layers(0),
+      _workers(),
+      _busy(),
+      _mutex(),
+      _wake(),
+      _finished(),
+      _job(nullptr),
+      _chunks(0),
+      _next(0),
+      _done(0),
+      _active(0),
+      _error(),
+      _failed(false),
+      _generation(0),
+      _stop(false) {
+    start();
+}
+
+ExecutionContext::~ExecutionContext() { stop(); }
+
+void ExecutionContext::threads(int threads) {
+    std::lock_guard<std::mutex> busy(_busy);
+    stop();
+    _threads = (threads > 0) ? threads : cores();
+    start();
+}
+
+void ExecutionContext::affinity(bool enable) {
+    std::lock_guard<std::mutex> busy(_busy);
+    stop();
+    _affinity = enable;
+    start();
+}
+
+void ExecutionContext::start() {
+    _stop = false;
+    for (int worker = 1; worker < _threads; ++worker) {
+        _workers.emplace_back(&ExecutionContext::work, this);
+        if (_affinity) pin(_workers.back(), worker);
+    }
+    openblas_set_num_threads(_threads);
+}
+
+void ExecutionContext::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& worker : _workers) worker.join();
+    _workers.clear();
+}
+
+void ExecutionContext::pin(std::thread& thread, int core) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores(), &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &set);
+#endif
+}
+
+// An exception must not leave a worker, it is kept for the caller. The
+// chunks after it are still counted, without running, so that the caller
+// waits for the others as usual
+int ExecutionContext::take_chunks(const std::function<void(int)>& f,
+                                  int chunks) {
+    int finished = 0;
+    for (int chunk = _next++; chunk < chunks; chunk = _next++) {
+        if (!_failed) {
+            try {
+                f(chunk);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_error) _error = std::current_exception();
+                _failed = true;
+            }
+        }
+        finished++;
+    }
+    return finished;
+}
+
+// A worker copies the job under the lock and counts itself active, so the
+// caller cannot return, and start the next job, while it still works
+void ExecutionContext::work() {
+    in_pool = true;
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock,
+                   [&]() { return _stop or (_job and (_generation != seen)); });
+        if (_stop) return;
+        seen = _generation;
+        const std::function<void(int)>& job = *_job;
+        int chunks = _chunks;
+        _active++;
+        lock.unlock();
+        int finished = take_chunks(job, chunks);
+        lock.lock();
+        _active--;
+        _done += finished;
+        if ((_done == _chunks) and (_active == 0)) _finished.notify_one();
+    }
+}
+
+void ExecutionContext::run(int chunks, const std::function<void(int)>& f) {
+    if (chunks <= 0) return;
+    std::unique_lock<std::mutex> busy(_busy, std::defer_lock);
+    if (in_pool or (chunks == 1) or !busy.try_lock() or _workers.empty()) {
+        for (int chunk = 0; chunk < chunks; ++chunk) f(chunk);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _job = &f;
+        _chunks = chunks;
+        _next = 0;
+        _done = 0;
+        _error = nullptr;
+        _failed = false;
+        _generation++;
+    }
+    // every chunk calling BLAS with all threads would run threads squared
+    openblas_set_num_threads(1);
+    _wake.notify_all();
+    in_pool = true;
+    int finished = take_chunks(f, chunks);
+    in_pool = false;
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done += finished;
+    _finished.wait(lock,
+                   [&]() { return (_done == _chunks) and (_active == 0); });
+    _job = nullptr;
+    std::exception_ptr error = _error;
+    _error = nullptr;
+    lock.unlock();
+    openblas_set_num_threads(_threads);
+    if (error) std::rethrow_exception(error);
+}
+
+std::mt19937 ExecutionContext::generator(unsigned layer, int stream) const {
+    std::seed_seq seq{_seed, layer, static_cast<unsigned>(stream)};
+    return std::mt19937(seq);
+}
+
+// Moving the outer vector keeps the data of the inner ones where it is
+ScratchBuffer::ScratchBuffer(size_t size) {
+    if (arena.buffers.size() <= arena.depth) arena.buffers.emplace_back();
+    std::vector<float>& buffer = arena.buffers[arena.depth++];
+    buffer.assign(size, 0.0f);
+    _data = buffer.data();
+}
+
+ScratchBuffer::~ScratchBuffer() { arena.depth--; }
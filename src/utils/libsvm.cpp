@@ -0,0 +1,70 @@
+#include "../../include/utils/libsvm.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+void parse_error(const std::string& path, int line, const std::string& token) {
+    std::stringstream ss;
+    ss << "Cannot parse '" << token << "' in line " << line << " of " << path
+       << ", in:\n"
+       << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+       << __LINE__;
+    throw std::invalid_argument(ss.str());
+}
+}  // namespace
+
+void read_libsvm(const std::string& path, SparseMatrix& features,
+                 Labels& labels, int n_features) {
+    std::ifstream in(path);
+    if (!in) {
+        std::stringstream ss;
+        ss << "Cannot open " << path << ", in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::runtime_error(ss.str());
+    }
+    std::vector<Eigen::Triplet<dtype>> entries;
+    std::vector<int> targets;
+    std::string line, token;
+    int line_no = 0, width = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        if (!(tokens >> token)) continue;
+        try {
+            targets.push_back(static_cast<int>(std::stod(token)));
+        } catch (const std::logic_error&) {
+            parse_error(path, line_no, token);
+        }
+        int row = targets.size() - 1;
+        while (tokens >> token) {
+            size_t colon = token.find(':');
+            if (colon == std::string::npos) parse_error(path, line_no, token);
+            if (token.compare(0, colon, "qid") == 0) continue;
+            int index = 0;
+            dtype value = 0;
+            try {
+                index = std::stoi(token.substr(0, colon));
+                value = std::stof(token.substr(colon + 1));
+            } catch (const std::logic_error&) {
+                parse_error(path, line_no, token);
+            }
+            if ((index < 1) or ((n_features > 0) and (index > n_features)))
+                parse_error(path, line_no, token);
+            width = std::max(width, index);
+            entries.emplace_back(row, index - 1, value);
+        }
+    }
+    features.resize(targets.size(), std::max(width, n_features));
+    features.setFromTriplets(entries.begin(), entries.end());
+    features.makeCompressed();
+    labels = Eigen::Map<Labels>(targets.data(), targets.size());
+    bool signed_binary = std::all_of(targets.begin(), targets.end(),
+                                     [](int t) { return t == -1 or t == 1; });
+    if (signed_binary and (labels.size() > 0))
+        labels = (labels.array() + 1) / 2;
+}
@@ -0,0 +1,22 @@
+#include "../../include/utils/parallel.hpp"
+#include <algorithm>
+#include "../../include/utils/execution_context.hpp"
+
+int parallel_chunks(int n) {
+    int threads = ExecutionContext::instance().threads();
+    return std::max(std::min(threads, n), 1);
+}
+
+void parallel_for(int n, const std::function<void(int, int, int)>& f) {
+    if (n <= 0) return;
+    int chunks = parallel_chunks(n);
+    ExecutionContext::instance().run(chunks, [&](int chunk) {
+        int begin = chunk * (n / chunks) + std::min(chunk, n % chunks);
+        int end = begin + n / chunks + (chunk < n % chunks);
+        f(chunk, begin, end);
+    });
+}
+
+void parallel_for(int n, const std::function<void(int, int)>& f) {
+    parallel_for(n, [&f](int, int begin, int end) { f(begin, end); });
+}
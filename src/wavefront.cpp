@@ -0,0 +1,122 @@
+#include "../include/wavefront.hpp"
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include "../include/utils/execution_context.hpp"
+
+Wavefront::Wavefront(const std::deque<std::shared_ptr<Layer>>& layers,
+                     int first, int last)
+    : _layers(), _first(first), _mutex(), _progress() {
+    for (int i = first; i <= last; ++i) {
+        std::shared_ptr<LSTM> lstm = std::dynamic_pointer_cast<LSTM>(layers[i]);
+        if (!lstm) {
+            std::stringstream ss;
+            ss << "Layer " << i << " is a " << layers[i]->name()
+               << " but the stack only runs LSTM layers, in:\n"
+               << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__
+               << " at " << __LINE__;
+            throw std::invalid_argument(ss.str());
+        }
+        _layers.push_back(lstm);
+    }
+}
+
+void Wavefront::wait_for(const std::atomic<int>& progress, int target) {
+    if (progress.load(std::memory_order_acquire) >= target) return;
+    std::unique_lock<std::mutex> lock(_mutex);
+    _progress.wait(lock, [&]() {
+        return progress.load(std::memory_order_acquire) >= target;
+    });
+}
+
+// the store happens under the lock, otherwise a waiter could check the old
+// value, miss the notification and sleep on
+void Wavefront::report(std::atomic<int>& progress, int value) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        progress.store(value, std::memory_order_release);
+    }
+    _progress.notify_all();
+}
+
+// A layer only ever waits for a layer in an earlier chunk, the one below
+// forward and the one above backward. The chunks are handed out in order
+// and run to the end once taken, so whatever waits is behind a layer that
+// is already running, also when the pool is busy and the caller runs all
+// chunks one after the other. A layer that throws releases the ones
+// waiting for it before the pool passes the exception on
+void Wavefront::run(bool reverse, std::atomic<int>* done,
+                    const std::function<void(int)>& layer) {
+    int n_layers = _layers.size();
+    ExecutionContext::instance().run(n_layers, [&](int chunk) {
+        int l = reverse ? n_layers - 1 - chunk : chunk;
+        try {
+            layer(l);
+        } catch (...) {
+            report(done[l], std::numeric_limits<int>::max());
+            throw;
+        }
+    });
+}
+
+// The matrices are fetched before the layers start, the storages
+// themselves are not safe to share between threads
+void Wavefront::forward_cpu(const std::vector<SharedStorage>& values,
+                            const std::string& type) {
+    int n_layers = _layers.size();
+    std::vector<const Matrix*> inputs;
+    std::vector<Matrix*> outputs;
+    int steps = 0;
+    for (int l = 0; l < n_layers; ++l) {
+        inputs.push_back(&values[l]->return_data_const());
+        outputs.push_back(&values[l + 1]->return_data());
+        steps = _layers[l]->prepare_forward_cpu(values[l]->get_cols(), type);
+    }
+    std::unique_ptr<std::atomic<int>[]> done(new std::atomic<int>[n_layers]);
+    for (int l = 0; l < n_layers; ++l) done[l] = 0;
+    run(false, done.get(), [&](int l) {
+        int size = (l == 0) ? steps : block;
+        for (int first = 0; first < steps; first += size) {
+            int last = std::min(first + size, steps);
+            if (l > 0) wait_for(done[l - 1], last);
+            _layers[l]->project_input_cpu(*inputs[l], first, last);
+            for (int t = first; t < last; ++t) {
+                _layers[l]->forward_step_cpu(*outputs[l], t);
+                report(done[l], t + 1);
+            }
+        }
+    });
+}
+
+// Runs in reverse, layer l waits for the input gradient of a block from
+// layer l + 1
+void Wavefront::backward_cpu(const std::vector<SharedStorage>& gradients,
+                             const std::vector<SharedStorage>& values) {
+    int n_layers = _layers.size();
+    std::vector<const Matrix*> grad_in, vals;
+    std::vector<Matrix*> grad_out;
+    int steps = 0;
+    for (int l = 0; l < n_layers; ++l) {
+        grad_in.push_back(&gradients[l + 1]->return_data_const());
+        grad_out.push_back(&gradients[l]->return_data());
+        vals.push_back(&values[l]->return_data_const());
+        steps = _layers[l]->prepare_backward_cpu();
+    }
+    std::unique_ptr<std::atomic<int>[]> done(new std::atomic<int>[n_layers]);
+    for (int l = 0; l < n_layers; ++l) done[l] = 0;
+    run(true, done.get(), [&](int l) {
+        for (int last = steps; last > 0; last -= block) {
+            int first = std::max(last - block, 0);
+            if (l < n_layers - 1) wait_for(done[l + 1], steps - first);
+            for (int t = last - 1; t >= first; --t)
+                _layers[l]->backward_step_cpu(*grad_in[l], t);
+            // nothing waits on the stack's input gradient
+            if (l > 0)
+                _layers[l]->input_gradient_cpu(*grad_out[l], first, last);
+            report(done[l], steps - first);
+        }
+        if (l == 0) _layers[l]->input_gradient_cpu(*grad_out[l], 0, steps);
+        _layers[l]->finish_backward_cpu(*vals[l]);
+    });
+}
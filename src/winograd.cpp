@@ -0,0 +1,218 @@
+#include "../include/winograd.hpp"
+#include <cblas.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+// the matrices B^T, G and A^T of F(m x m, 3 x 3), the transformed tiles are
+// B^T d B, G g G^T and A^T M A
+template <int m>
+struct Transforms {
+    static constexpr int a = m + 2;
+    typedef Eigen::Matrix<float, a, a> Tile;
+    Eigen::Matrix<float, a, a> BT;
+    Eigen::Matrix<float, a, 3> G;
+    Eigen::Matrix<float, m, a> AT;
+    Transforms();
+};
+
+template <>
+Transforms<2>::Transforms() {
+    BT << 1, 0, -1, 0,
+          0, 1, 1, 0,
+          0, -1, 1, 0,
+          0, 1, 0, -1;
+    G << 1, 0, 0,
+         0.5, 0.5, 0.5,
+         0.5, -0.5, 0.5,
+         0, 0, 1;
+    AT << 1, 1, 1, 0,
+          0, 1, -1, -1;
+}
+
+template <>
+Transforms<4>::Transforms() {
+    BT << 4, 0, -5, 0, 1, 0,
+          0, -4, -4, 1, 1, 0,
+          0, 4, -4, -1, 1, 0,
+          0, -2, -1, 2, 1, 0,
+          0, 2, -1, -2, 1, 0,
+          0, 4, 0, -5, 0, 1;
+    G << 1. / 4, 0, 0,
+         -1. / 6, -1. / 6, -1. / 6,
+         -1. / 6, 1. / 6, -1. / 6,
+         1. / 24, 1. / 12, 1. / 6,
+         1. / 24, -1. / 12, 1. / 6,
+         0, 0, 1;
+    AT << 1, 1, 1, 1, 1, 0,
+          0, 1, -1, 2, -2, 0,
+          0, 1, 1, 4, 4, 0,
+          0, 1, -1, 8, -8, 1;
+}
+
+template <int m>
+const Transforms<m>& transforms() {
+    static const Transforms<m> t;
+    return t;
+}
+
+// U holds one in_channels x out_channels matrix per point of the tile.
+// kernel(i, o, r, c) returns the weight of the 3 x 3 filter from input
+// channel i to output channel o
+template <int m, typename Kernel>
+void transform_filters(int in_channels, int out_channels, Kernel kernel,
+                       std::vector<float>& U) {
+    constexpr int a = Transforms<m>::a;
+    const Transforms<m>& t = transforms<m>();
+    U.resize(a * a * in_channels * out_channels);
+    Eigen::Matrix<float, 3, 3> g;
+    for (int o = 0; o < out_channels; ++o)
+        for (int i = 0; i < in_channels; ++i) {
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 3; ++c) g(r, c) = kernel(i, o, r, c);
+            typename Transforms<m>::Tile u = t.G * g * t.G.transpose();
+            for (int xi = 0; xi < a * a; ++xi)
+                U[(xi * out_channels + o) * in_channels + i] =
+                    u(xi / a, xi % a);
+        }
+}
+
+// Correlates the image with the filters in U and adds the result to out.
+// The tiles are processed in blocks: the transformed inputs of a block go
+// into V, a * a GEMMs with U turn them into the transformed outputs in M
+// and those are transformed back right away, so V and M stay in cache
+template <int m>
+void convolve(const float* in, int in_channels, int height, int width,
+              int pad, const std::vector<float>& U, int out_channels,
+              int out_height, int out_width, int block, float* work,
+              float* out) {
+    constexpr int a = Transforms<m>::a;
+    typedef typename Transforms<m>::Tile Tile;
+    const Transforms<m>& t = transforms<m>();
+    int tiles_wide = (out_width + m - 1) / m;
+    int tiles = ((out_height + m - 1) / m) * tiles_wide;
+    int in_size = height * width;
+    int out_size = out_height * out_width;
+    for (int first = 0; first < tiles; first += block) {
+        int count = std::min(block, tiles - first);
+        float* V = work;
+        float* M = work + a * a * count * in_channels;
+        for (int c = 0; c < in_channels; ++c) {
+            const float* channel = in + c * in_size;
+            for (int p = 0; p < count; ++p) {
+                int row = ((first + p) / tiles_wide) * m - pad;
+                int col = ((first + p) % tiles_wide) * m - pad;
+                Tile d;
+                for (int i = 0; i < a; ++i)
+                    for (int j = 0; j < a; ++j) {
+                        int r = row + i, w = col + j;
+                        d(i, j) = ((r < 0) or (r >= height) or (w < 0) or
+                                   (w >= width))
+                                      ? 0.0f
+                                      : channel[r * width + w];
+                    }
+                Tile v = t.BT * d * t.BT.transpose();
+                for (int xi = 0; xi < a * a; ++xi)
+                    V[(xi * in_channels + c) * count + p] = v(xi / a, xi % a);
+            }
+        }
+        for (int xi = 0; xi < a * a; ++xi)
+            cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, count,
+                        out_channels, in_channels, 1.0f,
+                        V + xi * count * in_channels, count,
+                        U.data() + xi * in_channels * out_channels,
+                        in_channels, 0.0f, M + xi * count * out_channels,
+                        count);
+        for (int o = 0; o < out_channels; ++o) {
+            float* channel = out + o * out_size;
+            for (int p = 0; p < count; ++p) {
+                int row = ((first + p) / tiles_wide) * m;
+                int col = ((first + p) % tiles_wide) * m;
+                Tile mt;
+                for (int xi = 0; xi < a * a; ++xi)
+                    mt(xi / a, xi % a) = M[(xi * out_channels + o) * count + p];
+                Eigen::Matrix<float, m, m> y = t.AT * mt * t.AT.transpose();
+                int rows = std::min(m, out_height - row);
+                int cols = std::min(m, out_width - col);
+                for (int i = 0; i < rows; ++i)
+                    for (int j = 0; j < cols; ++j)
+                        channel[(row + i) * out_width + col + j] += y(i, j);
+            }
+        }
+    }
+}
+}  // namespace
+
+Winograd::Winograd(int tile, Channels channels, Filters filters,
+                   ImageShape image, Pad pad)
+    : _m(tile),
+      _channels(channels.get()),
+      _filters(filters.get()),
+      _height(image.first()),
+      _width(image.second()),
+      _pad(pad.get()),
+      _out_height(image.first() + 2 * pad.get() - 2),
+      _out_width(image.second() + 2 * pad.get() - 2),
+      _block(0) {
+    if (((_m != 2) and (_m != 4)) or (_pad > 2)) {
+        std::stringstream ss;
+        ss << "Winograd convolutions need tiles of 2 or 4 and a pad of at "
+              "most 2, received tile "
+           << _m << " and pad " << _pad << " in:\n"
+           << __PRETTY_FUNCTION__ << "\ncalled from " << __FILE__ << " at "
+           << __LINE__;
+        throw std::invalid_argument(ss.str());
+    }
+    // blocks of about 512kB for the transformed in- and outputs
+    int a = _m + 2;
+    int tiles = std::max(((_out_height + _m - 1) / _m) *
+                             ((_out_width + _m - 1) / _m),
+                         ((_height + _m - 1) / _m) * ((_width + _m - 1) / _m));
+    _block = std::min(
+        tiles, std::max(16, (1 << 17) / (a * a * (_channels + _filters))));
+}
+
+// the backward pass correlates the output gradient with the filters turned
+// by 180 degrees, with channels and filters swapped
+void Winograd::transform_filters(const Matrix& weights) {
+    auto forward = [&](int c, int f, int r, int col) {
+        return weights((c * 3 + r) * 3 + col, f);
+    };
+    auto backward = [&](int f, int c, int r, int col) {
+        return weights((c * 3 + 2 - r) * 3 + 2 - col, f);
+    };
+    if (_m == 2) {
+        ::transform_filters<2>(_channels, _filters, forward, _forward);
+        ::transform_filters<2>(_filters, _channels, backward, _backward);
+    } else {
+        ::transform_filters<4>(_channels, _filters, forward, _forward);
+        ::transform_filters<4>(_filters, _channels, backward, _backward);
+    }
+}
+
+int Winograd::workspace() const {
+    return (_m + 2) * (_m + 2) * _block * (_channels + _filters);
+}
+
+void Winograd::forward_cpu(const float* image, float* out,
+                           float* work) const {
+    if (_m == 2)
+        convolve<2>(image, _channels, _height, _width, _pad, _forward,
+                    _filters, _out_height, _out_width, _block, work, out);
+    else
+        convolve<4>(image, _channels, _height, _width, _pad, _forward,
+                    _filters, _out_height, _out_width, _block, work, out);
+}
+
+void Winograd::backward_cpu(const float* grad, float* image_grad,
+                            float* work) const {
+    if (_m == 2)
+        convolve<2>(grad, _filters, _out_height, _out_width, 2 - _pad,
+                    _backward, _channels, _height, _width, _block, work,
+                    image_grad);
+    else
+        convolve<4>(grad, _filters, _out_height, _out_width, 2 - _pad,
+                    _backward, _channels, _height, _width, _block, work,
+                    image_grad);
+}
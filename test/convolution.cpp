@@ -1,6 +1,7 @@
 #include <eigen-git-mirror/Eigen/Core>
 #define CATCH_CONFIG_MAIN
 #include <sys/time.h>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <thread>
@@ -318,3 +319,715 @@ TEST_CASE("NeuralNetwork backward equivalence", "[backward equivalance]") {
     REQUIRE(cpuEnd > gpuEnd);
     REQUIRE(maxDiff < 1e-5);
 }
+
+// direct convolution of one sample, the output is filter-major like the
+// convolution layer's and includes the per-position bias
+Matrix direct_convolution(const Matrix& image, const Matrix& weights,
+                          const Matrix& bias, int channels, int height,
+                          int width, int kernel, int pad, int stride) {
+    int out_height = (height + 2 * pad - kernel) / stride + 1;
+    int out_width = (width + 2 * pad - kernel) / stride + 1;
+    int positions = out_height * out_width;
+    Matrix out = bias;
+    for (int f = 0; f < weights.cols(); ++f)
+        for (int row = 0; row < out_height; ++row)
+            for (int col = 0; col < out_width; ++col)
+                for (int c = 0; c < channels; ++c)
+                    for (int kr = 0; kr < kernel; ++kr)
+                        for (int kc = 0; kc < kernel; ++kc) {
+                            int r = row * stride - pad + kr;
+                            int w = col * stride - pad + kc;
+                            if ((r < 0) or (r >= height) or (w < 0) or
+                                (w >= width))
+                                continue;
+                            out(f * positions + row * out_width + col, 0) +=
+                                weights((c * kernel + kr) * kernel + kc, f) *
+                                image((c * height + r) * width + w, 0);
+                        }
+    return out;
+}
+
+TEST_CASE("Convolution forward reference cpu", "[cpu]") {
+    srand((unsigned int)4);
+    int kernel(3), pad(1), stride(1), channels(2), height(5), width(5);
+    int batches(5);
+    Init* init = new Glorot();
+    std::shared_ptr<Convolution> conv = make_shared<Convolution>(
+        FilterShape(kernel, kernel), Pad(pad), Stride(stride), Filters(4),
+        ImageShape(height, width), Channels(channels), init);
+    s_Layer im2col = make_shared<Im2ColLayer>(conv);
+    Matrix& bias = conv->return_parameters()[1]->return_data();
+    bias = Matrix::Random(bias.rows(), 1);
+    int positions = height * width;
+    Matrix images = Matrix::Random(channels * positions, batches);
+    std::shared_ptr<Storage> input = make_shared<Storage>(images);
+    std::shared_ptr<Storage> cols = make_shared<Storage>(
+        Matrix(positions, channels * kernel * kernel * batches));
+    std::shared_ptr<Storage> out =
+        make_shared<Storage>(Matrix(4 * positions, batches));
+    im2col->forward_cpu(input, cols, "train");
+    conv->forward_cpu(cols, out, "train");
+    const Matrix& weights = conv->return_parameters()[0]->return_data_const();
+    for (int n = 0; n < batches; ++n) {
+        Matrix expected =
+            direct_convolution(images.col(n), weights, bias, channels, height,
+                               width, kernel, pad, stride);
+        REQUIRE(out->return_data_const().col(n).isApprox(expected, 1e-5));
+    }
+}
+
+TEST_CASE("Convolution backward reference cpu", "[cpu]") {
+    srand((unsigned int)5);
+    int kernel(3), channels(2), positions(16), filters(3), batches(7);
+    int depth = channels * kernel * kernel;
+    Init* init = new Glorot();
+    Convolution conv(FilterShape(kernel, kernel), Pad(1), Stride(1),
+                     Filters(filters), ImageShape(4, 4), Channels(channels),
+                     init);
+    Matrix cols = Matrix::Random(positions, depth * batches);
+    Matrix grad = Matrix::Random(positions * filters, batches);
+    std::shared_ptr<Storage> values = make_shared<Storage>(cols);
+    std::shared_ptr<Storage> grad_in = make_shared<Storage>(grad);
+    std::shared_ptr<Storage> grad_out =
+        make_shared<Storage>(Matrix(positions, depth * batches));
+    conv.backward_cpu(values, grad_in, grad_out);
+    const Matrix& weights = conv.return_parameters()[0]->return_data_const();
+    Matrix weight_grad = Matrix::Zero(depth, filters);
+    for (int n = 0; n < batches; ++n) {
+        Matrix sample_grad = Eigen::Map<const Matrix>(
+            grad.col(n).data(), positions, filters);
+        Matrix sample_cols = cols.middleCols(n * depth, depth);
+        weight_grad += sample_cols.transpose() * sample_grad;
+        REQUIRE(grad_out->return_data_const()
+                    .middleCols(n * depth, depth)
+                    .isApprox(sample_grad * weights.transpose(), 1e-5));
+    }
+    std::vector<std::shared_ptr<Storage>> grads = conv.return_gradients();
+    REQUIRE(grads[0]->return_data_const().isApprox(weight_grad, 1e-5));
+    REQUIRE(grads[1]->return_data_const().isApprox(grad.rowwise().sum(),
+                                                    1e-5));
+}
+
+TEST_CASE("Convolution implicit gemm cpu", "[cpu]") {
+    // large enough for several im2col tiles per image
+    int kernel(3), pad(1), stride(2), channels(2), height(130), width(130);
+    int filters(3), batches(2);
+    Init* init = new Glorot();
+    std::shared_ptr<Convolution> conv = make_shared<Convolution>(
+        FilterShape(kernel, kernel), Pad(pad), Stride(stride),
+        Filters(filters), ImageShape(height, width), Channels(channels), init);
+    Convolution implicit(FilterShape(kernel, kernel), Pad(pad), Stride(stride),
+                         Filters(filters), ImageShape(height, width),
+                         Channels(channels), init);
+    implicit.implicit_gemm(true);
+    implicit.algorithm(ConvAlgorithm::Gemm);
+    srand((unsigned int)6);
+    Matrix bias = Matrix::Random(conv->return_parameters()[1]->get_rows(), 1);
+    conv->return_parameters()[1]->return_data() = bias;
+    implicit.return_parameters()[1]->return_data() = bias;
+    s_Layer im2col = make_shared<Im2ColLayer>(conv);
+    int out_side = (height + 2 * pad - kernel) / stride + 1;
+    int positions = out_side * out_side;
+    int depth = channels * kernel * kernel;
+    std::shared_ptr<Storage> images = make_shared<Storage>(
+        Matrix(Matrix::Random(channels * height * width, batches)));
+    std::shared_ptr<Storage> cols =
+        make_shared<Storage>(Matrix(positions, depth * batches));
+    std::shared_ptr<Storage> out =
+        make_shared<Storage>(Matrix(filters * positions, batches));
+    std::shared_ptr<Storage> out_implicit =
+        make_shared<Storage>(Matrix(filters * positions, batches));
+    im2col->forward_cpu(images, cols, "train");
+    conv->forward_cpu(cols, out, "train");
+    implicit.forward_cpu(images, out_implicit, "train");
+    REQUIRE(out->return_data_const().isApprox(out_implicit->return_data_const(),
+                                              1e-5));
+
+    std::shared_ptr<Storage> grad_in = make_shared<Storage>(
+        Matrix(Matrix::Random(filters * positions, batches)));
+    std::shared_ptr<Storage> grad_cols =
+        make_shared<Storage>(Matrix(positions, depth * batches));
+    std::shared_ptr<Storage> grad_images = make_shared<Storage>(
+        Matrix(Matrix::Zero(channels * height * width, batches)));
+    std::shared_ptr<Storage> grad_implicit = make_shared<Storage>(
+        Matrix(channels * height * width, batches));
+    conv->backward_cpu(cols, grad_in, grad_cols);
+    im2col->backward_cpu(images, grad_cols, grad_images);
+    implicit.backward_cpu(images, grad_in, grad_implicit);
+    REQUIRE(grad_images->return_data_const().isApprox(
+        grad_implicit->return_data_const(), 1e-4));
+    for (int i = 0; i < 2; ++i)
+        REQUIRE(conv->return_gradients()[i]->return_data_const().isApprox(
+            implicit.return_gradients()[i]->return_data_const(), 1e-4));
+}
+
+// runs forward and backward of a convolution reading the images directly,
+// out and the image gradient are returned through the storages
+void implicit_passes(Convolution& conv, const Matrix& images,
+                     const Matrix& grad, std::shared_ptr<Storage>& out,
+                     std::shared_ptr<Storage>& grad_images) {
+    std::shared_ptr<Storage> in = make_shared<Storage>(images);
+    std::shared_ptr<Storage> grad_in = make_shared<Storage>(grad);
+    out = make_shared<Storage>(Matrix(grad.rows(), grad.cols()));
+    grad_images = make_shared<Storage>(Matrix(images.rows(), images.cols()));
+    conv.forward_cpu(in, out, "train");
+    conv.backward_cpu(in, grad_in, grad_images);
+}
+
+TEST_CASE("Convolution winograd cpu", "[cpu]") {
+    int channels(16), filters(5), batches(3);
+    Init* init = new Glorot();
+    for (int pad = 0; pad < 3; ++pad)
+        for (ConvAlgorithm algorithm :
+             {ConvAlgorithm::Winograd2x2, ConvAlgorithm::Winograd4x4}) {
+            // odd sizes leave partial tiles at the borders
+            int height(11), width(9);
+            Convolution gemm(FilterShape(3, 3), Pad(pad), Stride(1),
+                             Filters(filters), ImageShape(height, width),
+                             Channels(channels), init);
+            Convolution winograd(FilterShape(3, 3), Pad(pad), Stride(1),
+                                 Filters(filters), ImageShape(height, width),
+                                 Channels(channels), init);
+            gemm.implicit_gemm(true);
+            gemm.algorithm(ConvAlgorithm::Gemm);
+            winograd.implicit_gemm(true);
+            winograd.algorithm(algorithm);
+            srand((unsigned int)7 + pad);
+            Matrix bias =
+                Matrix::Random(gemm.return_parameters()[1]->get_rows(), 1);
+            gemm.return_parameters()[1]->return_data() = bias;
+            winograd.return_parameters()[1]->return_data() = bias;
+            int outputs =
+                filters * (height + 2 * pad - 2) * (width + 2 * pad - 2);
+            Matrix images = Matrix::Random(channels * height * width, batches);
+            Matrix grad = Matrix::Random(outputs, batches);
+            std::shared_ptr<Storage> out, out_w, grad_images, grad_images_w;
+            implicit_passes(gemm, images, grad, out, grad_images);
+            implicit_passes(winograd, images, grad, out_w, grad_images_w);
+            REQUIRE(out->return_data_const().isApprox(
+                out_w->return_data_const(), 1e-4));
+            REQUIRE(grad_images->return_data_const().isApprox(
+                grad_images_w->return_data_const(), 1e-4));
+            for (int i = 0; i < 2; ++i)
+                REQUIRE(
+                    gemm.return_gradients()[i]->return_data_const().isApprox(
+                        winograd.return_gradients()[i]->return_data_const(),
+                        1e-4));
+            // new weights have to reach the transformed filters
+            Matrix weights = Matrix::Random(channels * 9, filters);
+            gemm.return_parameters()[0]->update_cpu_data(weights);
+            winograd.return_parameters()[0]->update_cpu_data(weights);
+            implicit_passes(gemm, images, grad, out, grad_images);
+            implicit_passes(winograd, images, grad, out_w, grad_images_w);
+            REQUIRE(out->return_data_const().isApprox(
+                out_w->return_data_const(), 1e-4));
+            REQUIRE(grad_images->return_data_const().isApprox(
+                grad_images_w->return_data_const(), 1e-4));
+        }
+    REQUIRE_THROWS(Convolution(FilterShape(3, 3), Pad(1), Stride(2),
+                               Filters(filters), ImageShape(8, 8),
+                               Channels(channels), init)
+                       .algorithm(ConvAlgorithm::Winograd2x2));
+    // an explicit choice holds however few the input channels are, only
+    // the autotuner decides whether the transforms pay off
+    Convolution rgb(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                    ImageShape(8, 8), Channels(3), init);
+    rgb.algorithm(ConvAlgorithm::Winograd4x4);
+    REQUIRE(rgb.algorithm() == ConvAlgorithm::Winograd4x4);
+    rgb.algorithm(ConvAlgorithm::Winograd2x2);
+    REQUIRE(rgb.algorithm() == ConvAlgorithm::Winograd2x2);
+}
+
+// hidden, run with "[benchmark cpu]" for the speedup per layer shape
+TEST_CASE("Convolution winograd speed cpu", "[.][benchmark cpu]") {
+    // channels, filters and image side of common 3x3 layers
+    std::vector<std::vector<int>> shapes{
+        {3, 32, 32}, {32, 32, 32}, {64, 64, 16}, {128, 128, 8}, {64, 64, 56}};
+    int batches(8);
+    Init* init = new Glorot();
+    for (const std::vector<int>& shape : shapes) {
+        int channels(shape[0]), filters(shape[1]), side(shape[2]);
+        Matrix images = Matrix::Random(channels * side * side, batches);
+        Matrix grad = Matrix::Random(filters * side * side, batches);
+        std::cout << channels << "x" << side << "x" << side << " -> "
+                  << filters << " filters:";
+        double gemm_time(0);
+        for (ConvAlgorithm algorithm :
+             {ConvAlgorithm::Gemm, ConvAlgorithm::Winograd2x2,
+              ConvAlgorithm::Winograd4x4}) {
+            Convolution conv(FilterShape(3, 3), Pad(1), Stride(1),
+                             Filters(filters), ImageShape(side, side),
+                             Channels(channels), init);
+            conv.implicit_gemm(true);
+            conv.algorithm(algorithm);
+            std::shared_ptr<Storage> out, grad_images;
+            implicit_passes(conv, images, grad, out, grad_images);
+            double start = cpuSecond();
+            for (int i = 0; i < 5; ++i)
+                implicit_passes(conv, images, grad, out, grad_images);
+            double time = (cpuSecond() - start) / 5;
+            if (algorithm == ConvAlgorithm::Gemm) {
+                gemm_time = time;
+                std::cout << " gemm " << time << "s";
+            } else {
+                int m = (algorithm == ConvAlgorithm::Winograd2x2) ? 2 : 4;
+                std::cout << ", F(" << m << "x" << m << ",3x3) speedup "
+                          << gemm_time / time;
+            }
+        }
+        std::cout << std::endl;
+    }
+}
+
+TEST_CASE("Convolution fft cpu", "[cpu]") {
+    int channels(8), filters(3), batches(2), height(23), width(19);
+    Init* init = new Glorot();
+    // kernel rows, kernel columns, pad and stride, several of them take
+    // more than one overlap-add block, the 3x5 filters keep the GEMM
+    std::vector<std::vector<int>> shapes{
+        {5, 5, 2, 1}, {7, 7, 3, 2}, {11, 11, 2, 4}, {3, 5, 1, 1}, {9, 9, 0, 3}};
+    for (const std::vector<int>& shape : shapes) {
+        FilterShape kernel(shape[0], shape[1]);
+        Pad pad(shape[2]);
+        Stride stride(shape[3]);
+        Convolution gemm(kernel, pad, stride, Filters(filters),
+                         ImageShape(height, width), Channels(channels), init);
+        Convolution fft(kernel, pad, stride, Filters(filters),
+                        ImageShape(height, width), Channels(channels), init);
+        gemm.implicit_gemm(true);
+        gemm.algorithm(ConvAlgorithm::Gemm);
+        fft.implicit_gemm(true);
+        fft.algorithm(ConvAlgorithm::FFT);
+        REQUIRE(fft.algorithm() == ConvAlgorithm::FFT);
+        srand((unsigned int)8);
+        Matrix bias =
+            Matrix::Random(gemm.return_parameters()[1]->get_rows(), 1);
+        gemm.return_parameters()[1]->return_data() = bias;
+        fft.return_parameters()[1]->return_data() = bias;
+        Matrix images = Matrix::Random(channels * height * width, batches);
+        Matrix grad = Matrix::Random(bias.rows(), batches);
+        std::shared_ptr<Storage> out, out_f, grad_images, grad_images_f;
+        implicit_passes(gemm, images, grad, out, grad_images);
+        implicit_passes(fft, images, grad, out_f, grad_images_f);
+        REQUIRE(out->return_data_const().isApprox(out_f->return_data_const(),
+                                                  1e-4));
+        REQUIRE(grad_images->return_data_const().isApprox(
+            grad_images_f->return_data_const(), 1e-4));
+        // the spectra follow new weights
+        Matrix weights =
+            Matrix::Random(channels * shape[0] * shape[1], filters);
+        gemm.return_parameters()[0]->update_cpu_data(weights);
+        fft.return_parameters()[0]->update_cpu_data(weights);
+        implicit_passes(gemm, images, grad, out, grad_images);
+        implicit_passes(fft, images, grad, out_f, grad_images_f);
+        REQUIRE(out->return_data_const().isApprox(out_f->return_data_const(),
+                                                  1e-4));
+    }
+    // an explicit choice holds on any filter size, the autotuner decides
+    // whether the FFT pays off
+    Convolution rgb(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                    ImageShape(height, width), Channels(3), init);
+    rgb.algorithm(ConvAlgorithm::FFT);
+    REQUIRE(rgb.algorithm() == ConvAlgorithm::FFT);
+}
+
+// hidden, run with "[benchmark cpu]" for the kernel size from which on the
+// FFT beats the GEMM
+TEST_CASE("Convolution fft speed cpu", "[.][benchmark cpu]") {
+    int batches(8);
+    Init* init = new Glorot();
+    // channels, filters and image side
+    std::vector<std::vector<int>> layers{{3, 64, 64}, {32, 32, 32}};
+    for (const std::vector<int>& layer : layers) {
+        int channels(layer[0]), filters(layer[1]), side(layer[2]);
+        Matrix images = Matrix::Random(channels * side * side, batches);
+        for (int kernel = 3; kernel < 13; kernel += 2) {
+            double times[2];
+            for (int i = 0; i < 2; ++i) {
+                Convolution conv(FilterShape(kernel, kernel),
+                                 Pad(kernel / 2), Stride(1), Filters(filters),
+                                 ImageShape(side, side), Channels(channels),
+                                 init);
+                conv.implicit_gemm(true);
+                conv.algorithm(i ? ConvAlgorithm::FFT : ConvAlgorithm::Gemm);
+                Matrix grad = Matrix::Random(filters * side * side, batches);
+                std::shared_ptr<Storage> out, grad_images;
+                implicit_passes(conv, images, grad, out, grad_images);
+                double start = cpuSecond();
+                for (int j = 0; j < 3; ++j)
+                    implicit_passes(conv, images, grad, out, grad_images);
+                times[i] = (cpuSecond() - start) / 3;
+            }
+            std::cout << channels << "x" << side << "x" << side << " -> "
+                      << filters << " filters of " << kernel << "x" << kernel
+                      << ": gemm " << times[0] << "s, fft " << times[1]
+                      << "s, speedup " << times[0] / times[1] << std::endl;
+        }
+    }
+}
+
+TEST_CASE("Convolution direct cpu", "[cpu]") {
+    // channel counts which are no multiple of the blocks
+    int channels(19), filters(21), batches(2), height(13), width(17);
+    Init* init = new Glorot();
+    // kernel, pad and stride
+    std::vector<std::vector<int>> shapes{{3, 1, 1}, {5, 2, 2}, {1, 0, 1}};
+    std::vector<DirectConvolution::Isa> isas{DirectConvolution::Isa::Generic};
+    if (DirectConvolution::detect() != DirectConvolution::Isa::Generic)
+        isas.push_back(DirectConvolution::Isa::AVX2);
+    if (DirectConvolution::detect() == DirectConvolution::Isa::AVX512)
+        isas.push_back(DirectConvolution::Isa::AVX512);
+    for (const std::vector<int>& shape : shapes) {
+        FilterShape kernel(shape[0], shape[0]);
+        Pad pad(shape[1]);
+        Stride stride(shape[2]);
+        Convolution gemm(kernel, pad, stride, Filters(filters),
+                         ImageShape(height, width), Channels(channels), init);
+        gemm.implicit_gemm(true);
+        gemm.algorithm(ConvAlgorithm::Gemm);
+        srand((unsigned int)9);
+        Matrix& bias = gemm.return_parameters()[1]->return_data();
+        bias.setZero();
+        Matrix images = Matrix::Random(channels * height * width, batches);
+        Matrix grad = Matrix::Random(bias.rows(), batches);
+        std::shared_ptr<Storage> out, grad_images;
+        implicit_passes(gemm, images, grad, out, grad_images);
+        for (DirectConvolution::Isa isa : isas) {
+            DirectConvolution direct(kernel, Channels(channels),
+                                     Filters(filters),
+                                     ImageShape(height, width), pad, stride,
+                                     isa);
+            direct.prepare(gemm.return_parameters()[0]);
+            std::vector<float> work(direct.workspace());
+            Matrix out_d = Matrix::Zero(bias.rows(), batches);
+            Matrix grad_d = Matrix::Zero(images.rows(), batches);
+            for (int n = 0; n < batches; ++n) {
+                direct.forward_cpu(images.col(n).data(), out_d.col(n).data(),
+                                   work.data());
+                direct.backward_cpu(grad.col(n).data(), grad_d.col(n).data(),
+                                    work.data());
+            }
+            REQUIRE(out->return_data_const().isApprox(out_d, 1e-5));
+            REQUIRE(grad_images->return_data_const().isApprox(grad_d, 1e-5));
+        }
+        Convolution direct(kernel, pad, stride, Filters(filters),
+                           ImageShape(height, width), Channels(channels),
+                           init);
+        direct.implicit_gemm(true);
+        direct.algorithm(ConvAlgorithm::Direct);
+        direct.return_parameters()[1]->return_data().setZero();
+        std::shared_ptr<Storage> out_d, grad_images_d;
+        implicit_passes(direct, images, grad, out_d, grad_images_d);
+        REQUIRE(out->return_data_const().isApprox(out_d->return_data_const(),
+                                                  1e-5));
+        REQUIRE(grad_images->return_data_const().isApprox(
+            grad_images_d->return_data_const(), 1e-5));
+    }
+    // an explicit choice holds on few input channels as well
+    Convolution gemm(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                     ImageShape(height, width), Channels(3), init);
+    Convolution rgb(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                    ImageShape(height, width), Channels(3), init);
+    gemm.implicit_gemm(true);
+    gemm.algorithm(ConvAlgorithm::Gemm);
+    rgb.implicit_gemm(true);
+    rgb.algorithm(ConvAlgorithm::Direct);
+    REQUIRE(rgb.algorithm() == ConvAlgorithm::Direct);
+    for (int param = 0; param < 2; ++param)
+        rgb.return_parameters()[param]->update_cpu_data(
+            gemm.return_parameters()[param]->return_data());
+    Matrix images = Matrix::Random(3 * height * width, batches);
+    Matrix grad = Matrix::Random(filters * height * width, batches);
+    std::shared_ptr<Storage> out, grad_images, out_d, grad_images_d;
+    implicit_passes(gemm, images, grad, out, grad_images);
+    implicit_passes(rgb, images, grad, out_d, grad_images_d);
+    REQUIRE(out->return_data_const().isApprox(out_d->return_data_const(),
+                                              1e-5));
+    REQUIRE(grad_images->return_data_const().isApprox(
+        grad_images_d->return_data_const(), 1e-5));
+}
+
+// two direct layers pass their activations and gradients in the blocked
+// layout from the second batch on, the results must not change
+TEST_CASE("Convolution direct blocked layers cpu", "[cpu]") {
+    int channels(16), side(8), batches(3);
+    Init* init = new Glorot();
+    std::vector<std::shared_ptr<Convolution>> convs[2];
+    std::unique_ptr<NeuralNetwork> networks[2];
+    std::shared_ptr<Loss> loss = std::make_shared<CrossEntropy>();
+    for (int net = 0; net < 2; ++net) {
+        s_Layer in = make_shared<Input>(Channels(channels),
+                                        ImageShape(side, side));
+        s_Layer prev = in;
+        for (int layer = 0; layer < 2; ++layer) {
+            convs[net].push_back(make_shared<Convolution>(
+                FilterShape(3, 3), Pad(1), Stride(1), Filters(channels),
+                prev, init));
+            prev = make_shared<Relu>(convs[net].back());
+        }
+        networks[net] = std::make_unique<NeuralNetwork>(prev, loss, "CPU");
+    }
+    for (int layer = 0; layer < 2; ++layer) {
+        convs[0][layer]->algorithm(ConvAlgorithm::Gemm);
+        std::shared_ptr<Convolution> direct = convs[1][layer];
+        direct->algorithm(ConvAlgorithm::Direct);
+        REQUIRE(direct->algorithm() == ConvAlgorithm::Direct);
+        for (int param = 0; param < 2; ++param)
+            direct->return_parameters()[param]->update_cpu_data(
+                convs[0][layer]->return_parameters()[param]->return_data());
+    }
+    srand((unsigned int)5);
+    Matrix images = Matrix::Random(channels * side * side, batches);
+    Matrix grad = Matrix::Random(channels * side * side, batches);
+    DebugInfo no_debugging("", "");
+    std::vector<SharedStorage> values[2], gradients[2];
+    for (int net = 0; net < 2; ++net) {
+        values[net] = networks[net]->allocate_forward(batches);
+        gradients[net] = networks[net]->allocate_backward(batches);
+        for (int batch = 0; batch < 2; ++batch) {
+            values[net][0]->update_cpu_data(images);
+            networks[net]->forward(values[net], "train", no_debugging);
+        }
+        gradients[net].back()->update_cpu_data(grad);
+        networks[net]->backwards(gradients[net], values[net], no_debugging);
+    }
+    // the first layer writes the same numbers in another order
+    Matrix plain = values[0][1]->return_data_const();
+    Matrix blocked = values[1][1]->return_data_const();
+    REQUIRE(!plain.isApprox(blocked, 1e-5));
+    std::sort(plain.data(), plain.data() + plain.size());
+    std::sort(blocked.data(), blocked.data() + blocked.size());
+    REQUIRE(plain.isApprox(blocked, 1e-5));
+    REQUIRE(values[0].back()->return_data_const().isApprox(
+        values[1].back()->return_data_const(), 1e-5));
+    REQUIRE(gradients[0][0]->return_data_const().isApprox(
+        gradients[1][0]->return_data_const(), 1e-5));
+    for (int layer = 0; layer < 2; ++layer)
+        for (int param = 0; param < 2; ++param)
+            REQUIRE(convs[0][layer]
+                        ->return_gradients()[param]
+                        ->return_data_const()
+                        .isApprox(convs[1][layer]
+                                      ->return_gradients()[param]
+                                      ->return_data_const(),
+                                  1e-5));
+}
+
+// hidden, run with "[benchmark cpu]" for the forward GFLOP/s per layer
+TEST_CASE("Convolution direct speed cpu", "[.][benchmark cpu]") {
+    int batches(8);
+    Init* init = new Glorot();
+    // channels, filters, image side, kernel and stride
+    std::vector<std::vector<int>> layers{{3, 32, 64, 3, 1},
+                                         {8, 32, 32, 3, 1},
+                                         {16, 32, 32, 3, 1},
+                                         {32, 32, 32, 3, 1},
+                                         {64, 64, 16, 3, 1},
+                                         {64, 128, 32, 3, 2},
+                                         {128, 128, 8, 1, 1}};
+    for (const std::vector<int>& layer : layers) {
+        int channels(layer[0]), filters(layer[1]), side(layer[2]);
+        int kernel(layer[3]), stride(layer[4]), pad(kernel / 2);
+        int out_side = (side + 2 * pad - kernel) / stride + 1;
+        double flops = 2. * channels * kernel * kernel * filters * out_side *
+                       out_side * batches;
+        std::shared_ptr<Storage> images = make_shared<Storage>(
+            Matrix(Matrix::Random(channels * side * side, batches)));
+        std::shared_ptr<Storage> out = make_shared<Storage>(
+            Matrix(filters * out_side * out_side, batches));
+        std::cout << channels << "x" << side << "x" << side << " -> "
+                  << filters << " filters of " << kernel << "x" << kernel
+                  << " stride " << stride << ":";
+        for (ConvAlgorithm algorithm :
+             {ConvAlgorithm::Gemm, ConvAlgorithm::Direct}) {
+            Convolution conv(FilterShape(kernel, kernel), Pad(pad),
+                             Stride(stride), Filters(filters),
+                             ImageShape(side, side), Channels(channels), init);
+            conv.implicit_gemm(true);
+            conv.algorithm(algorithm);
+            conv.forward_cpu(images, out, "train");
+            double start = cpuSecond();
+            for (int i = 0; i < 5; ++i) conv.forward_cpu(images, out, "train");
+            double time = (cpuSecond() - start) / 5;
+            std::cout << (algorithm == ConvAlgorithm::Gemm ? " im2col "
+                                                           : ", direct ")
+                      << flops / time * 1e-9 << " GFLOP/s";
+        }
+        std::cout << std::endl;
+    }
+}
+
+TEST_CASE("Convolution autotune cpu", "[cpu]") {
+    int channels(8), filters(6), batches(3), height(9), width(9);
+    Init* init = new Glorot();
+    std::string cache("conv_autotune_test.txt");
+    std::remove(cache.c_str());
+    Convolution gemm(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                     ImageShape(height, width), Channels(channels), init);
+    gemm.implicit_gemm(true);
+    gemm.algorithm(ConvAlgorithm::Gemm);
+    srand((unsigned int)3);
+    Matrix images = Matrix::Random(channels * height * width, batches);
+    Matrix grad = Matrix::Random(filters * height * width, batches);
+    std::shared_ptr<Storage> out, grad_images;
+    implicit_passes(gemm, images, grad, out, grad_images);
+    // the GEMM on the whole im2col matrix of a sample, one of the choices
+    Convolution im2col(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                       ImageShape(height, width), Channels(channels), init);
+    im2col.implicit_gemm(true);
+    im2col.algorithm(ConvAlgorithm::Im2Col);
+    std::shared_ptr<Storage> out_i, grad_images_i;
+    implicit_passes(im2col, images, grad, out_i, grad_images_i);
+    REQUIRE(out->return_data_const().isApprox(out_i->return_data_const(),
+                                              1e-5));
+    REQUIRE(grad_images->return_data_const().isApprox(
+        grad_images_i->return_data_const(), 1e-5));
+    REQUIRE(gemm.return_gradients()[0]->return_data_const().isApprox(
+        im2col.return_gradients()[0]->return_data_const(), 1e-5));
+    // the first layer benchmarks and stores its choice
+    Convolution tuned(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                      ImageShape(height, width), Channels(channels), init);
+    tuned.implicit_gemm(true);
+    tuned.autotune(cache);
+    std::shared_ptr<Storage> out_t, grad_images_t;
+    implicit_passes(tuned, images, grad, out_t, grad_images_t);
+    REQUIRE(out->return_data_const().isApprox(out_t->return_data_const(),
+                                              1e-5));
+    REQUIRE(grad_images->return_data_const().isApprox(
+        grad_images_t->return_data_const(), 1e-5));
+    std::ifstream in(cache);
+    std::string line, rest;
+    REQUIRE(std::getline(in, line));
+    REQUIRE(!std::getline(in, rest));
+    // a later one reads the choice from the cache, here replaced by
+    // winograd
+    std::string key = line.substr(0, line.rfind('\t'));
+    ConvCache(cache).store(key, "winograd4x4");
+    Convolution cached(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                       ImageShape(height, width), Channels(channels), init);
+    cached.implicit_gemm(true);
+    cached.autotune(cache);
+    std::shared_ptr<Storage> out_c, grad_images_c;
+    implicit_passes(cached, images, grad, out_c, grad_images_c);
+    REQUIRE(cached.algorithm() == ConvAlgorithm::Winograd4x4);
+    REQUIRE(out->return_data_const().isApprox(out_c->return_data_const(),
+                                              1e-5));
+    std::remove(cache.c_str());
+    // without a call a layer keeps the GEMM and writes no cache
+    Convolution plain(FilterShape(3, 3), Pad(1), Stride(1), Filters(filters),
+                      ImageShape(height, width), Channels(channels), init);
+    plain.implicit_gemm(true);
+    std::shared_ptr<Storage> out_p, grad_images_p;
+    implicit_passes(plain, images, grad, out_p, grad_images_p);
+    REQUIRE(plain.algorithm() == ConvAlgorithm::Gemm);
+    REQUIRE(!std::ifstream(cache).good());
+    // a cache that cannot be written leaves the choice in the layer only
+    Convolution unkept(FilterShape(3, 3), Pad(1), Stride(1),
+                       Filters(filters), ImageShape(height, width),
+                       Channels(channels), init);
+    unkept.implicit_gemm(true);
+    unkept.autotune("no_such_directory/" + cache);
+    std::shared_ptr<Storage> out_u, grad_images_u;
+    implicit_passes(unkept, images, grad, out_u, grad_images_u);
+    REQUIRE(out->return_data_const().isApprox(out_u->return_data_const(),
+                                              1e-5));
+}
+
+TEST_CASE("Convolution block fusion cpu", "[cpu]") {
+    int channels(3), filters(4), batches(3), height(10), width(9);
+    Init* init = new Glorot();
+    for (bool relu : {false, true}) {
+        std::shared_ptr<Layer> l1 = make_shared<Input>(
+            Channels(channels), ImageShape(height, width));
+        std::shared_ptr<Convolution> conv = make_shared<Convolution>(
+            FilterShape(3, 3), Pad(1), Stride(1), Filters(filters), l1, init);
+        conv->implicit_gemm(true);
+        conv->algorithm(ConvAlgorithm::Gemm);
+        std::shared_ptr<Layer> act = make_shared<Relu>(conv);
+        std::shared_ptr<Pooling> pool = make_shared<Pooling>(
+            Window(3), Stride(2), relu ? act : conv);
+        srand((unsigned int)11);
+        conv->return_parameters()[1]->return_data() =
+            Matrix::Random(conv->return_parameters()[1]->get_rows(), 1);
+        int conv_rows = filters * height * width;
+        int pool_rows = filters * 5 * 4;
+        Matrix images = Matrix::Random(channels * height * width, batches);
+        Matrix grad = Matrix::Random(pool_rows, batches);
+        // the separate layers
+        std::shared_ptr<Storage> in = make_shared<Storage>(images);
+        std::shared_ptr<Storage> conv_out =
+            make_shared<Storage>(Matrix::Zero(conv_rows, batches));
+        std::shared_ptr<Storage> act_out =
+            make_shared<Storage>(Matrix::Zero(conv_rows, batches));
+        std::shared_ptr<Storage> out =
+            make_shared<Storage>(Matrix::Zero(pool_rows, batches));
+        std::shared_ptr<Storage> grad_in = make_shared<Storage>(grad);
+        std::shared_ptr<Storage> grad_pool =
+            make_shared<Storage>(Matrix::Zero(conv_rows, batches));
+        std::shared_ptr<Storage> grad_act =
+            make_shared<Storage>(Matrix::Zero(conv_rows, batches));
+        std::shared_ptr<Storage> grad_images =
+            make_shared<Storage>(Matrix::Zero(images.rows(), batches));
+        conv->forward_cpu(in, conv_out, "train");
+        if (relu) act->forward_cpu(conv_out, act_out, "train");
+        pool->forward_cpu(relu ? act_out : conv_out, out, "train");
+        pool->backward_cpu(conv_out, grad_in, grad_pool);
+        if (relu) act->backward_cpu(conv_out, grad_pool, grad_act);
+        conv->backward_cpu(in, relu ? grad_act : grad_pool, grad_images);
+        Matrix weight_grad = conv->return_gradients()[0]->return_data_const();
+        Matrix bias_grad = conv->return_gradients()[1]->return_data_const();
+        // the fused block
+        ConvBlock block(conv, relu, pool);
+        REQUIRE(block.output_dimension() == pool->output_dimension());
+        std::shared_ptr<Storage> out_b =
+            make_shared<Storage>(Matrix::Zero(pool_rows, batches));
+        std::shared_ptr<Storage> grad_images_b =
+            make_shared<Storage>(Matrix::Zero(images.rows(), batches));
+        block.forward_cpu(in, out_b, "train");
+        block.backward_cpu(in, grad_in, grad_images_b);
+        REQUIRE(out->return_data_const().isApprox(out_b->return_data_const(),
+                                                  1e-6));
+        REQUIRE(grad_images->return_data_const().isApprox(
+            grad_images_b->return_data_const(), 1e-5));
+        REQUIRE(weight_grad.isApprox(
+            block.return_gradients()[0]->return_data_const(), 1e-5));
+        REQUIRE(bias_grad.isApprox(
+            block.return_gradients()[1]->return_data_const(), 1e-5));
+    }
+}
+
+TEST_CASE("NeuralNetwork conv block cpu", "[cpu]") {
+    int channels(3), filters(4), batches(3), height(10), width(9);
+    Init* init = new Glorot();
+    srand((unsigned int)12);
+    s_Layer l1 =
+        make_shared<Input>(Channels(channels), ImageShape(height, width));
+    std::shared_ptr<Convolution> conv = make_shared<Convolution>(
+        FilterShape(3, 3), Pad(1), Stride(1), Filters(filters), l1, init);
+    conv->algorithm(ConvAlgorithm::Gemm);
+    s_Layer relu = make_shared<Relu>(conv);
+    s_Layer pool = make_shared<Pooling>(Window(3), Stride(2), relu);
+    s_Layer dense = make_shared<Dense>(Features(5), pool, init);
+    s_Layer softmax = make_shared<Softmax>(dense);
+    std::shared_ptr<Loss> loss =
+        std::make_shared<CrossEntropy>(CrossEntropy("CPU"));
+    NeuralNetwork network(softmax, loss, "CPU");
+    // the input, one ConvBlock in place of the three layers, the Dense and
+    // the Softmax layer
+    std::vector<SharedStorage> values = network.allocate_forward(batches);
+    REQUIRE(values.size() == 4);
+    REQUIRE(values[1]->get_rows() == filters * 5 * 4);
+    // the same layers one after the other
+    Matrix images = Matrix::Random(channels * height * width, batches);
+    SharedStorage in = make_shared<Storage>(images);
+    for (const s_Layer& layer : {s_Layer(conv), relu, pool, dense, softmax}) {
+        int rows = 1;
+        for (int dim : layer->output_dimension()) rows *= dim;
+        SharedStorage out =
+            make_shared<Storage>(Matrix::Zero(rows, batches));
+        layer->forward_cpu(in, out, "predict");
+        in = out;
+    }
+    REQUIRE(network.predict(images.transpose())
+                .isApprox(in->return_data_const().transpose(), 1e-5));
+}
@@ -167,3 +167,67 @@ TEST_CASE("CrossEntropy equivalence gradient", "[gradient]") {
     // THR GPU IS RELATIVELY SLOW HERE!!!
     REQUIRE(maxDiff < 1e-5);
 }
+
+TEST_CASE("CrossEntropy labels cpu", "[labels]") {
+    srand((unsigned int)time(0));
+    CrossEntropy cross_entropy("CPU");
+    Loss* inp1 = &cross_entropy;
+    int classes = 7;
+    int obs = 64;
+    Matrix prediction = Matrix::Random(classes, obs).array().exp();
+    for (int i = 0; i < obs; ++i)
+        prediction.col(i) /= prediction.col(i).sum();
+    Matrix one_hot = Matrix::Zero(classes, obs);
+    Matrix labels = Matrix::Zero(1, obs);
+    for (int i = 0; i < obs; ++i) {
+        int label = rand() % classes;
+        one_hot(label, i) = 1;
+        labels(0, i) = label;
+    }
+    SharedStorage SharedPrediction = std::make_shared<Storage>(prediction);
+    SharedStorage SharedOneHot = std::make_shared<Storage>(one_hot);
+    SharedStorage SharedLabels = std::make_shared<Storage>(labels);
+    SharedStorage grad_one_hot =
+        std::make_shared<Storage>(Matrix::Zero(classes, obs));
+    SharedStorage grad_labels =
+        std::make_shared<Storage>(Matrix::Zero(classes, obs));
+    dtype loss_one_hot = inp1->loss_cpu(SharedPrediction, SharedOneHot);
+    dtype loss_labels = inp1->loss_cpu(SharedPrediction, SharedLabels);
+    inp1->grad_loss_cpu(grad_one_hot, SharedPrediction, SharedOneHot,
+                        SharedOneHot);
+    inp1->grad_loss_cpu(grad_labels, SharedPrediction, SharedLabels,
+                        SharedLabels);
+    Matrix diff = grad_one_hot->return_data_const() -
+                  grad_labels->return_data_const();
+    REQUIRE(std::abs(loss_one_hot - loss_labels) / obs < 1e-5);
+    REQUIRE(diff.array().abs().maxCoeff() < 1e-6);
+}
+
+TEST_CASE("CrossEntropy labels equivalence", "[labels gpu]") {
+    srand((unsigned int)time(0));
+    CrossEntropy cross_entropy;
+    Loss* inp1 = &cross_entropy;
+    int classes = 65;
+    int obs = 1024;
+    Matrix prediction = Matrix::Random(classes, obs).array().exp();
+    for (int i = 0; i < obs; ++i)
+        prediction.col(i) /= prediction.col(i).sum();
+    Matrix labels = Matrix::Zero(1, obs);
+    for (int i = 0; i < obs; ++i) labels(0, i) = rand() % classes;
+    SharedStorage SharedPrediction = std::make_shared<Storage>(prediction);
+    SharedStorage SharedLabels = std::make_shared<Storage>(labels);
+    SharedStorage grad_cpu =
+        std::make_shared<Storage>(Matrix::Zero(classes, obs));
+    SharedStorage grad_gpu =
+        std::make_shared<Storage>(Matrix::Zero(classes, obs));
+    dtype loss_cpu = inp1->loss_cpu(SharedPrediction, SharedLabels);
+    dtype loss_gpu = inp1->loss_gpu(SharedPrediction, SharedLabels);
+    inp1->grad_loss_cpu(grad_cpu, SharedPrediction, SharedLabels,
+                        SharedLabels);
+    inp1->grad_loss_gpu(grad_gpu, SharedPrediction, SharedLabels,
+                        SharedLabels);
+    Matrix diff =
+        grad_cpu->return_data_const() - grad_gpu->return_data_const();
+    REQUIRE(std::abs(loss_cpu - loss_gpu) / obs < 1e-5);
+    REQUIRE(diff.array().abs().maxCoeff() < 1e-5);
+}
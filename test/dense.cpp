@@ -155,3 +155,53 @@ TEST_CASE("Dense forward equivalence", "[forward equivalence]") {
     std::cout << "maximum difference: " << out << std::endl;
     REQUIRE(out < allowed);
 }
+
+TEST_CASE("Dense block fusion cpu", "[cpu]") {
+    srand((unsigned int)13);
+    Init* init = new Glorot();
+    int batches(37);
+    for (Activation activation :
+         {Activation::Relu, Activation::Sigmoid, Activation::Tanh}) {
+        shared_ptr<Layer> l1 = make_shared<Input>(Features(5));
+        shared_ptr<Dense> dense = make_shared<Dense>(Features(6), l1, init);
+        dense->return_parameters()[1]->return_data() = Matrix::Random(6, 1);
+        Matrix in = Matrix::Random(5, batches);
+        Matrix grad = Matrix::Random(6, batches);
+        // the separate passes, the activation done on the matrices
+        SharedStorage storage_in = make_shared<Storage>(in);
+        SharedStorage linear = make_shared<Storage>(Matrix::Zero(6, batches));
+        dense->forward_cpu(storage_in, linear, "train");
+        Matrix z = linear->return_data_const();
+        Matrix expected, deriv;
+        if (activation == Activation::Relu) {
+            expected = z.cwiseMax(0.);
+            deriv = (z.array() > 0).cast<dtype>();
+        } else if (activation == Activation::Sigmoid) {
+            expected = (1. + (-z.array()).exp()).inverse();
+            deriv = expected.array() * (1. - expected.array());
+        } else {
+            expected = z.array().tanh();
+            deriv = 1. - expected.array().square();
+        }
+        SharedStorage delta =
+            make_shared<Storage>(Matrix(grad.array() * deriv.array()));
+        SharedStorage grad_out = make_shared<Storage>(Matrix::Zero(5, batches));
+        dense->backward_cpu(storage_in, delta, grad_out);
+        Matrix weight_grad = dense->return_gradients()[0]->return_data_const();
+        Matrix bias_grad = dense->return_gradients()[1]->return_data_const();
+        // the fused block
+        DenseBlock block(dense, activation);
+        SharedStorage out = make_shared<Storage>(Matrix::Zero(6, batches));
+        SharedStorage grad_out_b =
+            make_shared<Storage>(Matrix::Zero(5, batches));
+        block.forward_cpu(storage_in, out, "train");
+        block.backward_cpu(storage_in, make_shared<Storage>(grad), grad_out_b);
+        REQUIRE(out->return_data_const().isApprox(expected, 1e-5));
+        REQUIRE(grad_out_b->return_data_const().isApprox(
+            grad_out->return_data_const(), 1e-5));
+        REQUIRE(block.return_gradients()[0]->return_data_const().isApprox(
+            weight_grad, 1e-5));
+        REQUIRE(block.return_gradients()[1]->return_data_const().isApprox(
+            bias_grad, 1e-5));
+    }
+}
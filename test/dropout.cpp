@@ -4,6 +4,7 @@
 #include <iostream>
 #include <memory>
 #include "../include/neural_network.h"
+#include "../include/utils/parallel.hpp"
 #include "../third_party/catch/catch.hpp"
 
 using std::make_shared;
@@ -79,6 +80,68 @@ TEST_CASE("Dropout forward_cpu", "[cpu]") {
     REQUIRE(equal);
 }
 
+TEST_CASE("Dropout thread pool cpu", "[cpu]") {
+    ExecutionContext& context = ExecutionContext::instance();
+    Matrix in = Matrix::Constant(7, 9, 1.);
+    SharedStorage storage_in = std::make_shared<Storage>(in);
+    // every layer draws masks of its own, whatever the threads
+    context.seed(7);
+    context.threads(1);
+    std::vector<SharedStorage> outs;
+    std::vector<std::unique_ptr<Dropout>> layers;
+    for (int i = 0; i < 4; ++i) {
+        outs.push_back(std::make_shared<Storage>(Matrix(Matrix::Zero(7, 9))));
+        layers.push_back(std::make_unique<Dropout>(0.5));
+    }
+    for (int i = 0; i < 4; ++i)
+        layers[i]->forward_cpu(storage_in, outs[i], "train");
+    for (int i = 0; i < 4; ++i) {
+        const Matrix& out = outs[i]->return_data_const();
+        REQUIRE((out.array() == 0. or out.array() == 2.).all());
+        for (int j = 0; j < i; ++j)
+            REQUIRE(out != outs[j]->return_data_const());
+    }
+    // the same seed gives the layers built after it the same masks, also
+    // with more threads and inside the chunks of another parallel_for
+    context.seed(7);
+    context.threads(4);
+    std::vector<SharedStorage> again;
+    std::vector<std::unique_ptr<Dropout>> rebuilt;
+    for (int i = 0; i < 4; ++i) {
+        again.push_back(std::make_shared<Storage>(Matrix(Matrix::Zero(7, 9))));
+        rebuilt.push_back(std::make_unique<Dropout>(0.5));
+    }
+    rebuilt[0]->forward_cpu(storage_in, again[0], "train");
+    parallel_for(3, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            rebuilt[i + 1]->forward_cpu(storage_in, again[i + 1], "train");
+    });
+    for (int i = 0; i < 4; ++i)
+        REQUIRE(again[i]->return_data_const() == outs[i]->return_data_const());
+    context.seed(0);
+    context.threads(0);
+    REQUIRE(context.threads() ==
+            std::max(1u, std::thread::hardware_concurrency()));
+}
+
+TEST_CASE("ExecutionContext exceptions cpu", "[cpu]") {
+    ExecutionContext& context = ExecutionContext::instance();
+    context.threads(4);
+    // a chunk throwing on a worker or on the caller reaches the caller, the
+    // pool keeps working afterwards
+    for (int thrower : {0, 5, -1}) {
+        std::function<void(int)> fail = [&](int chunk) {
+            if ((thrower < 0) or (chunk == thrower))
+                throw std::runtime_error("chunk failed");
+        };
+        REQUIRE_THROWS_AS(context.run(8, fail), std::runtime_error);
+        std::atomic<int> count(0);
+        context.run(8, [&](int) { count++; });
+        REQUIRE(count == 8);
+    }
+    context.threads(0);
+}
+
 TEST_CASE("Dropout forward_cpu test", "[cpu test]") {
     srand((unsigned int)time(0));
     Matrix in = Matrix::Random(10, 3);
@@ -0,0 +1,119 @@
+#define CATCH_CONFIG_MAIN
+#include "../include/layer/embedding.hpp"
+#include <eigen-git-mirror/Eigen/Core>
+#include <memory>
+#include "../include/common.h"
+#include "../include/layer/layer.h"
+#include "../include/neural_network.h"
+#include "../include/storage.h"
+#include "../third_party/catch/catch.hpp"
+
+using std::make_shared;
+using std::shared_ptr;
+using std::vector;
+typedef std::shared_ptr<Storage> SharedStorage;
+
+TEST_CASE("Embedding forward_cpu", "[cpu]") {
+    srand((unsigned int)time(0));
+    Init* init = new Glorot();
+    Embedding s1(Features(4), Vocabulary(7), init);
+    Matrix ids(1, 5);
+    ids << 3, 0, 6, 3, 1;
+    SharedStorage storage_in = make_shared<Storage>(ids);
+    SharedStorage storage_out = make_shared<Storage>(Matrix::Zero(4, 5));
+    s1.forward_cpu(storage_in, storage_out, "train");
+    const Matrix& table = s1.return_parameters()[0]->return_data_const();
+    const Matrix& out = storage_out->return_data_const();
+    for (int i = 0; i < ids.cols(); ++i)
+        REQUIRE(out.col(i) == table.col(static_cast<int>(ids(0, i))));
+}
+
+TEST_CASE("Embedding backward_cpu", "[cpu]") {
+    srand((unsigned int)time(0));
+    Init* init = new Glorot();
+    Embedding s1(Features(4), Vocabulary(7), init);
+    Matrix ids(1, 5);
+    ids << 3, 0, 6, 3, 1;
+    Matrix gradient_in = Matrix::Random(4, 5);
+    SharedStorage shared_values = make_shared<Storage>(ids);
+    SharedStorage shared_gradient_in = make_shared<Storage>(gradient_in);
+    SharedStorage shared_gradient_out = make_shared<Storage>(Matrix::Zero(1, 5));
+    s1.backward_cpu(shared_values, shared_gradient_in, shared_gradient_out);
+    Matrix expected = Matrix::Zero(4, 7);
+    for (int i = 0; i < ids.cols(); ++i)
+        expected.col(static_cast<int>(ids(0, i))) += gradient_in.col(i);
+    REQUIRE(s1.return_gradients()[0]->return_data_const().isApprox(expected));
+    // a second pass only keeps the contribution of the new ids
+    ids << 2, 2, 2, 2, 2;
+    shared_values->update_cpu_data(ids);
+    s1.backward_cpu(shared_values, shared_gradient_in, shared_gradient_out);
+    expected.setZero();
+    expected.col(2) = gradient_in.rowwise().sum();
+    REQUIRE(s1.return_gradients()[0]->return_data_const().isApprox(expected));
+}
+
+TEST_CASE("Embedding out of range", "[cpu]") {
+    Init* init = new Glorot();
+    Embedding s1(Features(4), Vocabulary(7), init);
+    Matrix ids(1, 2);
+    ids << 1, 7;
+    SharedStorage storage_in = make_shared<Storage>(ids);
+    SharedStorage storage_out = make_shared<Storage>(Matrix::Zero(4, 2));
+    REQUIRE_THROWS(s1.forward_cpu(storage_in, storage_out, "train"));
+}
+
+TEST_CASE("Embedding gpu equivalence", "[gpu]") {
+    srand((unsigned int)time(0));
+    Init* init = new Glorot();
+    Embedding s1(Features(4), Vocabulary(7), init);
+    Matrix ids(1, 5);
+    ids << 3, 0, 6, 3, 1;
+    SharedStorage storage_in = make_shared<Storage>(ids);
+    SharedStorage out_cpu = make_shared<Storage>(Matrix::Zero(4, 5));
+    SharedStorage out_gpu = make_shared<Storage>(Matrix::Zero(4, 5));
+    s1.forward_cpu(storage_in, out_cpu, "train");
+    s1.forward_gpu(storage_in, out_gpu, "train");
+    REQUIRE(out_cpu->return_data_const().isApprox(
+        out_gpu->return_data_const()));
+    Matrix gradient_in = Matrix::Random(4, 5);
+    SharedStorage shared_gradient_in = make_shared<Storage>(gradient_in);
+    SharedStorage shared_gradient_out = make_shared<Storage>(Matrix::Zero(1, 5));
+    s1.backward_cpu(storage_in, shared_gradient_in, shared_gradient_out);
+    Matrix grad_cpu = s1.return_gradients()[0]->return_data_const();
+    s1.backward_gpu(storage_in, shared_gradient_in, shared_gradient_out);
+    REQUIRE(grad_cpu.isApprox(s1.return_gradients()[0]->return_data_const()));
+}
+
+// without recurrent layers the windows of a batch add up to its gradient
+Matrix train_in_windows(const Labels& tokens, const Labels& targets,
+                        int truncation) {
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    shared_ptr<Layer> l1 = make_shared<Input>(Features(1));
+    shared_ptr<Layer> e1 =
+        make_shared<Embedding>(Features(4), Vocabulary(6), l1, init);
+    shared_ptr<Layer> d1 = make_shared<Dense>(Features(6), e1, init);
+    shared_ptr<Layer> s1 = make_shared<Softmax>(d1);
+    shared_ptr<Loss> loss = make_shared<CrossEntropy>(CrossEntropy("CPU"));
+    NeuralNetwork network(s1, loss, "CPU");
+    shared_ptr<GradientDescent> sgd =
+        make_shared<StochasticGradientDescent>(LearningRate(0.1));
+    vector<Metric*> metrics;
+    network.train(tokens, targets, sgd, Epochs(2), Patience(10), BatchSize(20),
+                  metrics, DebugInfo("", ""), Shuffle(false), Sequences(1),
+                  Truncation(truncation));
+    Matrix all_tokens = tokens.cast<dtype>();
+    return network.predict(all_tokens);
+}
+
+TEST_CASE("Embedding truncation windows", "[cpu]") {
+    srand((unsigned int)3);
+    Labels tokens(200), targets(200);
+    for (int i = 0; i < tokens.size(); ++i) {
+        tokens(i) = rand() % 6;
+        targets(i) = (tokens(i) + 1) % 6;
+    }
+    Matrix whole = train_in_windows(tokens, targets, 0);
+    Matrix windows = train_in_windows(tokens, targets, 5);
+    REQUIRE(whole.isApprox(windows, 1e-4));
+}
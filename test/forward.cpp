@@ -3,6 +3,7 @@
 #include <cuda_runtime.h>
 #include <eigen-git-mirror/Eigen/Dense>
 #include <sys/time.h>
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include "../include/neural_network.h"
@@ -76,3 +77,147 @@ TEST_CASE("NeuralNetwork equivalence", "[equivalence]") {
     REQUIRE(cpuEnd > gpuEnd);
     REQUIRE(maxDiff < 1e-6);
 }
+
+// a small network's layers and the values of a batch, as allocated by the
+// network itself
+static std::deque<s_Layer> small_network(std::vector<SharedStorage>& values,
+                                         int obs) {
+    Init* init = new Glorot();
+    s_Layer l1 = make_shared<Input>(Features(5));
+    s_Layer l2 = make_shared<Dense>(Features(8), l1, init);
+    s_Layer l3 = make_shared<Relu>(l2);
+    s_Layer l4 = make_shared<Dense>(Features(4), l3, init);
+    s_Layer l5 = make_shared<Softmax>(l4);
+    std::deque<s_Layer> layers{l1, l2, l3, l4, l5};
+    values.clear();
+    for (int rows : {5, 8, 8, 4, 4})
+        values.push_back(make_shared<Storage>(Matrix(Matrix::Zero(rows, obs))));
+    values[0]->update_cpu_data(Matrix(Matrix::Random(5, obs)));
+    return layers;
+}
+
+TEST_CASE("ExecutionPlan forward cpu", "[cpu]") {
+    srand((unsigned int)1);
+    int obs = 3;
+    std::vector<SharedStorage> values, expected;
+    std::deque<s_Layer> layers = small_network(values, obs);
+    small_network(expected, obs);
+    expected[0]->update_cpu_data(values[0]->return_data_const());
+    for (size_t i = 1; i < layers.size(); ++i)
+        layers[i]->forward_cpu(expected[i - 1], expected[i], "predict");
+    ExecutionPlan plan;
+    plan.compile(layers, {});
+    REQUIRE(plan.forward_steps() == 4);
+    REQUIRE(plan.backward_steps() == 3);
+    plan.forward_cpu(values, Mode::Predict);
+    REQUIRE(values.back()->return_data_const().isApprox(
+        expected.back()->return_data_const()));
+    REQUIRE(mode_of("train") == Mode::Train);
+    REQUIRE_THROWS_AS(mode_of("validate"), std::invalid_argument);
+}
+
+TEST_CASE("ExecutionPlan bound buffers cpu", "[cpu]") {
+    srand((unsigned int)3);
+    int obs = 3;
+    std::vector<SharedStorage> values, expected;
+    std::deque<s_Layer> layers = small_network(values, obs);
+    small_network(expected, obs);
+    ExecutionPlan plan;
+    plan.compile(layers, {});
+    // every batch brings a new input storage, as in training, the step
+    // reading it is bound again and the others keep their buffers
+    for (int batch = 0; batch < 2; ++batch) {
+        values[0] = make_shared<Storage>(Matrix(Matrix::Random(5, obs)));
+        expected[0]->update_cpu_data(values[0]->return_data_const());
+        for (size_t i = 1; i < layers.size(); ++i)
+            layers[i]->forward_cpu(expected[i - 1], expected[i], "train");
+        // the bound Relu marks its output as written on the cpu
+        unsigned long version = values[2]->version();
+        plan.forward_cpu(values, Mode::Train);
+        REQUIRE(values[2]->version() > version);
+        REQUIRE(values.back()->return_data_const().isApprox(
+            expected.back()->return_data_const()));
+    }
+    std::vector<SharedStorage> grads, expected_grads;
+    for (int rows : {5, 8, 8, 4}) {
+        grads.push_back(make_shared<Storage>(Matrix(Matrix::Zero(rows, obs))));
+        expected_grads.push_back(
+            make_shared<Storage>(Matrix(Matrix::Zero(rows, obs))));
+    }
+    Matrix delta = Matrix::Random(4, obs);
+    grads.back()->update_cpu_data(delta);
+    expected_grads.back()->update_cpu_data(delta);
+    for (size_t i = layers.size() - 2; i > 0; --i)
+        layers[i]->backward_cpu(expected[i - 1], expected_grads[i],
+                                expected_grads[i - 1]);
+    unsigned long version = grads[1]->version();
+    plan.backward_cpu(grads, values);
+    REQUIRE(grads[1]->version() > version);
+    for (size_t i = 0; i < grads.size(); ++i)
+        REQUIRE(grads[i]->return_data_const().isApprox(
+            expected_grads[i]->return_data_const()));
+}
+
+// hidden, run with "[benchmark cpu]" for the dispatch overhead of a step,
+// the network is small enough that the layers themselves cost little
+TEST_CASE("ExecutionPlan speed cpu", "[.][benchmark cpu]") {
+    srand((unsigned int)1);
+    int obs = 4;
+    int steps = 100000;
+    std::vector<SharedStorage> values;
+    std::deque<s_Layer> layers = small_network(values, obs);
+    ExecutionPlan plan;
+    plan.compile(layers, {});
+    // the best of a few interleaved rounds, the difference is small
+    // against the noise of a single one
+    double dispatched = 1e9, planned = 1e9;
+    for (int round = 0; round < 5; ++round) {
+        double start = cpuSecond();
+        for (int s = 0; s < steps; ++s) {
+            // what the network did before, one deque walk with shared
+            // pointer copies and the mode built as a string every step
+            const std::string type("train");
+            for (size_t i = 1; i < layers.size(); ++i) {
+                s_Layer layer = layers[i];
+                layer->forward_cpu(values[i - 1], values[i], type);
+            }
+        }
+        dispatched = std::min(dispatched, (cpuSecond() - start) / steps);
+        start = cpuSecond();
+        for (int s = 0; s < steps; ++s) plan.forward_cpu(values, Mode::Train);
+        planned = std::min(planned, (cpuSecond() - start) / steps);
+    }
+    std::cout << "forward step of a small network, dispatched per layer: "
+              << dispatched * 1e6 << " us, compiled plan: " << planned * 1e6
+              << " us" << std::endl;
+}
+
+TEST_CASE("NeuralNetwork freeze cpu", "[cpu]") {
+    srand((unsigned int)2);
+    Init* init = new Glorot();
+    s_Layer l1 = make_shared<Input>(Features(5));
+    s_Layer l2 = make_shared<Dense>(Features(8), l1, init);
+    s_Layer l3 = make_shared<Dropout>(0.5, l2);
+    s_Layer l4 = make_shared<Dense>(Features(3), l3, init);
+    s_Layer l5 = make_shared<Relu>(l4);
+    s_Layer l6 = make_shared<Dense>(Features(4), l5, init);
+    s_Layer l7 = make_shared<Softmax>(l6);
+    std::shared_ptr<Loss> loss =
+        std::make_shared<CrossEntropy>(CrossEntropy("CPU"));
+    NeuralNetwork network(l7, loss, "CPU");
+    Matrix in = Matrix::Random(6, 5);
+    Matrix expected = network.predict(in);
+    // the dropout goes, the first Dense folds into the DenseBlock
+    InferenceReport report = network.freeze();
+    REQUIRE(report.layers == 2);
+    REQUIRE(report.activation_bytes == 16 * sizeof(dtype));
+    REQUIRE(report.parameter_bytes == (48 + 27 - 18) * sizeof(dtype));
+    REQUIRE(network.predict(in).isApprox(expected, 1e-5));
+    std::shared_ptr<GradientDescent> sgd =
+        make_shared<StochasticGradientDescent>(LearningRate(0.1));
+    std::vector<Metric*> metrics;
+    Matrix targets = Matrix::Zero(6, 4);
+    REQUIRE_THROWS_AS(network.train(in, targets, sgd, Epochs(1), Patience(1),
+                                    BatchSize(2), metrics),
+                      std::runtime_error);
+}
@@ -0,0 +1,225 @@
+#define CATCH_CONFIG_MAIN
+#include "../include/layer/gru.hpp"
+#include <eigen-git-mirror/Eigen/Core>
+#include <memory>
+#include "../include/common.h"
+#include "../include/neural_network.h"
+#include "../include/storage.h"
+#include "../third_party/catch/catch.hpp"
+
+using Eigen::all;
+using std::make_shared;
+using std::vector;
+typedef std::shared_ptr<Storage> SharedStorage;
+
+// a fresh layer per evaluation so that no state is carried between them,
+// the weights of parameter para are replaced if given
+dtype gru_objective(const Matrix& in, const Matrix& weights, int para = -1,
+                    const Matrix& value = Matrix()) {
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    GRU gru(Features(weights.rows()), Features(in.rows()), init);
+    if (para >= 0) gru.return_parameters()[para]->return_data() = value;
+    SharedStorage storage_in = make_shared<Storage>(in);
+    SharedStorage storage_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(weights.rows(), in.cols())));
+    gru.forward_cpu(storage_in, storage_out, "train");
+    return (storage_out->return_data_const().array() * weights.array()).sum();
+}
+
+TEST_CASE("GRU backward_cpu numerical", "[back cpu]") {
+    int outf = 5;
+    int inf = 3;
+    int steps = 6;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, steps);
+    Matrix weights = Matrix::Random(outf, steps) * 0.1;
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    GRU gru(Features(outf), Features(inf), init);
+    SharedStorage storage_in = make_shared<Storage>(in);
+    SharedStorage storage_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(outf, steps)));
+    SharedStorage grad_in = make_shared<Storage>(weights);
+    SharedStorage grad_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(inf, steps)));
+    gru.forward_cpu(storage_in, storage_out, "train");
+    gru.backward_cpu(storage_in, grad_in, grad_out);
+    const dtype eps = 1e-2;
+    for (int col = 0; col < steps; ++col) {
+        for (int row = 0; row < inf; ++row) {
+            Matrix plus = in, minus = in;
+            plus(row, col) += eps;
+            minus(row, col) -= eps;
+            dtype numeric = (gru_objective(plus, weights) -
+                             gru_objective(minus, weights)) /
+                            (2 * eps);
+            REQUIRE(grad_out->return_data_const()(row, col) ==
+                    Approx(numeric).margin(1e-3));
+        }
+    }
+    vector<SharedStorage> paras = gru.return_parameters();
+    vector<SharedStorage> grads = gru.return_gradients();
+    for (size_t p = 0; p < paras.size(); ++p) {
+        const Matrix& para = paras[p]->return_data_const();
+        for (int row = 0; row < para.rows(); row += 2) {
+            Matrix plus = para, minus = para;
+            plus(row, 0) += eps;
+            minus(row, 0) -= eps;
+            dtype numeric = (gru_objective(in, weights, p, plus) -
+                             gru_objective(in, weights, p, minus)) /
+                            (2 * eps);
+            REQUIRE(grads[p]->return_data_const()(row, 0) ==
+                    Approx(numeric).margin(1e-3));
+        }
+    }
+}
+
+TEST_CASE("GRU sequences cpu", "[cpu]") {
+    int outf = 6;
+    int inf = 4;
+    int steps = 5;
+    int sequences = 3;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, steps * sequences);
+    Matrix gin = Matrix::Random(outf, steps * sequences);
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    GRU batched(Features(outf), Features(inf), init);
+    batched.set_sequences(sequences);
+    SharedStorage storage_in = make_shared<Storage>(in);
+    SharedStorage storage_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(outf, in.cols())));
+    SharedStorage grad_in = make_shared<Storage>(gin);
+    SharedStorage grad_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(inf, in.cols())));
+    batched.forward_cpu(storage_in, storage_out, "train");
+    batched.backward_cpu(storage_in, grad_in, grad_out);
+    for (int b = 0; b < sequences; ++b) {
+        vector<int> cols;
+        for (int t = 0; t < steps; ++t) cols.push_back(t * sequences + b);
+        srand((unsigned int)1);
+        GRU single(Features(outf), Features(inf), init);
+        SharedStorage seq_in = make_shared<Storage>(in(all, cols));
+        SharedStorage seq_out =
+            make_shared<Storage>(Matrix(Matrix::Zero(outf, steps)));
+        SharedStorage seq_grad_in = make_shared<Storage>(gin(all, cols));
+        SharedStorage seq_grad_out =
+            make_shared<Storage>(Matrix(Matrix::Zero(inf, steps)));
+        single.forward_cpu(seq_in, seq_out, "train");
+        single.backward_cpu(seq_in, seq_grad_in, seq_grad_out);
+        REQUIRE(seq_out->return_data_const().isApprox(
+            storage_out->return_data_const()(all, cols), 1e-5));
+        REQUIRE(seq_grad_out->return_data_const().isApprox(
+            grad_out->return_data_const()(all, cols), 1e-5));
+    }
+}
+
+// runs a fresh layer over the first window and, with the weights of
+// parameter para replaced, over the second; the state carried into the
+// second window stays that of the original weights
+dtype gru_window_objective(const Matrix& first, const Matrix& second,
+                            const Matrix& weights, int sequences, int para,
+                            const Matrix& value) {
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    GRU gru(Features(weights.rows()), Features(first.rows()), init);
+    gru.set_sequences(sequences);
+    SharedStorage out = make_shared<Storage>(
+        Matrix(Matrix::Zero(weights.rows(), first.cols())));
+    gru.forward_cpu(make_shared<Storage>(first), out, "train");
+    gru.return_parameters()[para]->return_data() = value;
+    gru.forward_cpu(make_shared<Storage>(second), out, "train");
+    return (out->return_data_const().array() * weights.array()).sum();
+}
+
+TEST_CASE("GRU truncation cpu", "[cpu]") {
+    int outf = 5;
+    int inf = 3;
+    int steps = 4;
+    int sequences = 2;
+    int cols = steps * sequences;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, 2 * cols);
+    Matrix gin = Matrix::Random(outf, cols);
+    Matrix first = in.leftCols(cols), second = in.rightCols(cols);
+    Init* init = new Glorot();
+    srand((unsigned int)1);
+    GRU whole(Features(outf), Features(inf), init);
+    srand((unsigned int)1);
+    GRU windowed(Features(outf), Features(inf), init);
+    whole.set_sequences(sequences);
+    windowed.set_sequences(sequences);
+    SharedStorage whole_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(outf, 2 * cols)));
+    SharedStorage window_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(outf, cols)));
+    whole.forward_cpu(make_shared<Storage>(in), whole_out, "train");
+    // the state of every sequence carries from the first window on
+    windowed.forward_cpu(make_shared<Storage>(first), window_out,
+                         "train");
+    REQUIRE(window_out->return_data_const().isApprox(
+        whole_out->return_data_const().leftCols(cols), 1e-5));
+    windowed.forward_cpu(make_shared<Storage>(second), window_out,
+                         "train");
+    REQUIRE(window_out->return_data_const().isApprox(
+        whole_out->return_data_const().rightCols(cols), 1e-5));
+    // the gradient of the second window stops at its first step, the state
+    // it started from counts as a constant
+    SharedStorage grad_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(inf, cols)));
+    windowed.backward_cpu(make_shared<Storage>(second),
+                          make_shared<Storage>(gin), grad_out);
+    Matrix whole_gin = Matrix::Zero(outf, 2 * cols);
+    whole_gin.rightCols(cols) = gin;
+    SharedStorage whole_grad_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(inf, 2 * cols)));
+    whole.backward_cpu(make_shared<Storage>(in),
+                       make_shared<Storage>(whole_gin), whole_grad_out);
+    vector<SharedStorage> paras = windowed.return_parameters();
+    vector<SharedStorage> grads = windowed.return_gradients();
+    const dtype eps = 1e-2;
+    for (size_t p = 0; p < paras.size(); ++p) {
+        const Matrix& para = paras[p]->return_data_const();
+        for (int row = 0; row < para.rows(); row += 2) {
+            Matrix plus = para, minus = para;
+            plus(row, 0) += eps;
+            minus(row, 0) -= eps;
+            dtype numeric =
+                (gru_window_objective(first, second, gin, sequences, p,
+                                       plus) -
+                 gru_window_objective(first, second, gin, sequences, p,
+                                       minus)) /
+                (2 * eps);
+            REQUIRE(grads[p]->return_data_const()(row, 0) ==
+                    Approx(numeric).margin(1e-3));
+        }
+        // backpropagating through both windows reaches further
+        REQUIRE(!grads[p]->return_data_const().isApprox(
+            whole.return_gradients()[p]->return_data_const(), 1e-3));
+    }
+}
+
+TEST_CASE("GRU step cpu", "[cpu]") {
+    int outf = 6;
+    int inf = 4;
+    int steps = 7;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, steps);
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    GRU gru(Features(outf), Features(inf), init);
+    SharedStorage storage_in = make_shared<Storage>(in);
+    SharedStorage storage_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(outf, steps)));
+    gru.forward_cpu(storage_in, storage_out, "predict");
+    gru.reset_state(1);
+    SharedStorage step_out =
+        make_shared<Storage>(Matrix(Matrix::Zero(outf, 1)));
+    for (int t = 0; t < steps; ++t) {
+        SharedStorage step_in = make_shared<Storage>(Matrix(in.col(t)));
+        gru.step(step_in, step_out);
+        REQUIRE(step_out->return_data_const().isApprox(
+            storage_out->return_data_const().col(t), 1e-5));
+    }
+}
@@ -5,10 +5,13 @@
 //#include "../include/layer/lstm.hpp"
 //#include "../include/storage.h"
 #include <sys/time.h>
+#include <algorithm>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include "../include/neural_network.h"
 using std::vector;
+using Eigen::all;
 
 double cpuSecond() {
     struct timeval tp;
@@ -198,3 +201,409 @@ TEST_CASE("NeuralNetwork backward equivalance", "[backward]") {
     REQUIRE(out < allowed);
     REQUIRE(max_grad_diff < allowed);
 }
+
+// a fresh layer per evaluation so that no state is carried between them
+dtype lstm_objective(const Matrix& in, const Matrix& weights) {
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    LSTM lstm(Features(weights.rows()), Features(in.rows()), init);
+    SharedStorage storage_in = std::make_shared<Storage>(in);
+    Matrix out = Matrix::Zero(weights.rows(), in.cols());
+    SharedStorage storage_out = std::make_shared<Storage>(out);
+    lstm.forward_cpu(storage_in, storage_out, "train");
+    return (storage_out->return_data_const().array() * weights.array()).sum();
+}
+
+TEST_CASE("NeuralNetwork back cpu numerical", "[back cpu]") {
+    int outf = 6;
+    int inf = 4;
+    int steps = 5;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, steps);
+    Matrix weights = Matrix::Random(outf, steps);
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    LSTM lstm(Features(outf), Features(inf), init);
+    SharedStorage storage_in = std::make_shared<Storage>(in);
+    SharedStorage storage_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, steps)));
+    SharedStorage grad_in = std::make_shared<Storage>(weights);
+    SharedStorage grad_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, steps)));
+    lstm.forward_cpu(storage_in, storage_out, "train");
+    lstm.backward_cpu(storage_in, grad_in, grad_out);
+    const dtype eps = 1e-2;
+    for (int col = 0; col < steps; ++col) {
+        for (int row = 0; row < inf; ++row) {
+            Matrix plus = in, minus = in;
+            plus(row, col) += eps;
+            minus(row, col) -= eps;
+            dtype numeric = (lstm_objective(plus, weights) -
+                             lstm_objective(minus, weights)) /
+                            (2 * eps);
+            REQUIRE(grad_out->return_data_const()(row, col) ==
+                    Approx(numeric).margin(1e-3));
+        }
+    }
+}
+
+// runs a fresh layer over the first window and, with the weights of
+// parameter para replaced, over the second; the state carried into the
+// second window stays that of the original weights
+dtype lstm_window_objective(const Matrix& first, const Matrix& second,
+                            const Matrix& weights, int sequences, int para,
+                            const Matrix& value) {
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    LSTM lstm(Features(weights.rows()), Features(first.rows()), init);
+    lstm.set_sequences(sequences);
+    SharedStorage out = std::make_shared<Storage>(
+        Matrix(Matrix::Zero(weights.rows(), first.cols())));
+    lstm.forward_cpu(std::make_shared<Storage>(first), out, "train");
+    lstm.return_parameters()[para]->return_data() = value;
+    lstm.forward_cpu(std::make_shared<Storage>(second), out, "train");
+    return (out->return_data_const().array() * weights.array()).sum();
+}
+
+TEST_CASE("LSTM truncation cpu", "[cpu]") {
+    int outf = 5;
+    int inf = 3;
+    int steps = 4;
+    int sequences = 2;
+    int cols = steps * sequences;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, 2 * cols);
+    Matrix gin = Matrix::Random(outf, cols);
+    Matrix first = in.leftCols(cols), second = in.rightCols(cols);
+    Init* init = new Glorot();
+    srand((unsigned int)1);
+    LSTM whole(Features(outf), Features(inf), init);
+    srand((unsigned int)1);
+    LSTM windowed(Features(outf), Features(inf), init);
+    whole.set_sequences(sequences);
+    windowed.set_sequences(sequences);
+    SharedStorage whole_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, 2 * cols)));
+    SharedStorage window_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, cols)));
+    whole.forward_cpu(std::make_shared<Storage>(in), whole_out, "train");
+    // the state of every sequence carries from the first window on
+    windowed.forward_cpu(std::make_shared<Storage>(first), window_out,
+                         "train");
+    REQUIRE(window_out->return_data_const().isApprox(
+        whole_out->return_data_const().leftCols(cols), 1e-5));
+    windowed.forward_cpu(std::make_shared<Storage>(second), window_out,
+                         "train");
+    REQUIRE(window_out->return_data_const().isApprox(
+        whole_out->return_data_const().rightCols(cols), 1e-5));
+    // the gradient of the second window stops at its first step, the state
+    // it started from counts as a constant
+    SharedStorage grad_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, cols)));
+    windowed.backward_cpu(std::make_shared<Storage>(second),
+                          std::make_shared<Storage>(gin), grad_out);
+    Matrix whole_gin = Matrix::Zero(outf, 2 * cols);
+    whole_gin.rightCols(cols) = gin;
+    SharedStorage whole_grad_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, 2 * cols)));
+    whole.backward_cpu(std::make_shared<Storage>(in),
+                       std::make_shared<Storage>(whole_gin), whole_grad_out);
+    vector<SharedStorage> paras = windowed.return_parameters();
+    vector<SharedStorage> grads = windowed.return_gradients();
+    const dtype eps = 1e-2;
+    for (size_t p = 0; p < paras.size(); ++p) {
+        const Matrix& para = paras[p]->return_data_const();
+        for (int row = 0; row < para.rows(); row += 2) {
+            Matrix plus = para, minus = para;
+            plus(row, 0) += eps;
+            minus(row, 0) -= eps;
+            dtype numeric =
+                (lstm_window_objective(first, second, gin, sequences, p,
+                                       plus) -
+                 lstm_window_objective(first, second, gin, sequences, p,
+                                       minus)) /
+                (2 * eps);
+            REQUIRE(grads[p]->return_data_const()(row, 0) ==
+                    Approx(numeric).margin(1e-3));
+        }
+        // backpropagating through both windows reaches further
+        REQUIRE(!grads[p]->return_data_const().isApprox(
+            whole.return_gradients()[p]->return_data_const(), 1e-3));
+    }
+}
+
+TEST_CASE("NeuralNetwork sequences cpu", "[cpu]") {
+    int outf = 6;
+    int inf = 4;
+    int steps = 5;
+    int sequences = 3;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, steps * sequences);
+    Matrix gin = Matrix::Random(outf, steps * sequences);
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    LSTM batched(Features(outf), Features(inf), init);
+    batched.set_sequences(sequences);
+    SharedStorage storage_in = std::make_shared<Storage>(in);
+    SharedStorage storage_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, in.cols())));
+    SharedStorage grad_in = std::make_shared<Storage>(gin);
+    SharedStorage grad_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, in.cols())));
+    batched.forward_cpu(storage_in, storage_out, "train");
+    batched.backward_cpu(storage_in, grad_in, grad_out);
+    // every sequence on its own gives the same outputs and input gradients
+    for (int b = 0; b < sequences; ++b) {
+        std::vector<int> cols;
+        for (int t = 0; t < steps; ++t) cols.push_back(t * sequences + b);
+        srand((unsigned int)1);
+        LSTM single(Features(outf), Features(inf), init);
+        SharedStorage seq_in = std::make_shared<Storage>(in(all, cols));
+        SharedStorage seq_out =
+            std::make_shared<Storage>(Matrix(Matrix::Zero(outf, steps)));
+        SharedStorage seq_grad_in = std::make_shared<Storage>(gin(all, cols));
+        SharedStorage seq_grad_out =
+            std::make_shared<Storage>(Matrix(Matrix::Zero(inf, steps)));
+        single.forward_cpu(seq_in, seq_out, "train");
+        single.backward_cpu(seq_in, seq_grad_in, seq_grad_out);
+        REQUIRE(seq_out->return_data_const().isApprox(
+            storage_out->return_data_const()(all, cols), 1e-5));
+        REQUIRE(seq_grad_out->return_data_const().isApprox(
+            grad_out->return_data_const()(all, cols), 1e-5));
+    }
+}
+
+TEST_CASE("NeuralNetwork step cpu", "[cpu]") {
+    int outf = 6;
+    int inf = 4;
+    int steps = 7;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, steps);
+    srand((unsigned int)1);
+    Init* init = new Glorot();
+    LSTM lstm(Features(outf), Features(inf), init);
+    SharedStorage storage_in = std::make_shared<Storage>(in);
+    SharedStorage storage_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, steps)));
+    lstm.forward_cpu(storage_in, storage_out, "predict");
+    // two streams fed the same sequence follow the full forward pass
+    lstm.reset_state(2);
+    SharedStorage step_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, 2)));
+    for (int t = 0; t < steps; ++t) {
+        Matrix token(inf, 2);
+        token << in.col(t), in.col(t);
+        SharedStorage step_in = std::make_shared<Storage>(token);
+        lstm.step(step_in, step_out);
+        for (int stream = 0; stream < 2; ++stream)
+            REQUIRE(step_out->return_data_const().col(stream).isApprox(
+                storage_out->return_data_const().col(t), 1e-5));
+    }
+}
+
+TEST_CASE("NeuralNetwork step tokens cpu", "[cpu]") {
+    srand((unsigned int)1);
+    int vocab = 5;
+    Init* init = new Glorot();
+    std::shared_ptr<Layer> l1 = std::make_shared<Input>(Features(1));
+    std::shared_ptr<Layer> e1 =
+        std::make_shared<Embedding>(Features(3), Vocabulary(vocab), l1, init);
+    std::shared_ptr<Layer> r1 = std::make_shared<LSTM>(Features(6), e1, init);
+    std::shared_ptr<Layer> d1 =
+        std::make_shared<Dense>(Features(vocab), r1, init);
+    std::shared_ptr<Layer> s1 = std::make_shared<Softmax>(d1);
+    std::shared_ptr<Loss> loss =
+        std::make_shared<CrossEntropy>(CrossEntropy("CPU"));
+    NeuralNetwork network(s1, loss, "CPU");
+    Matrix tokens(6, 1);
+    tokens << 0, 3, 1, 4, 4, 2;
+    Matrix expected = network.predict(tokens);
+    network.reset_state(1);
+    for (int t = 0; t < tokens.rows(); ++t) {
+        Labels token = Labels::Constant(1, tokens(t, 0));
+        const Matrix& probs = network.step(token);
+        REQUIRE(probs.transpose().isApprox(expected.row(t), 1e-5));
+    }
+}
+
+TEST_CASE("NeuralNetwork wavefront cpu", "[cpu]") {
+    int inf = 4;
+    int steps = 9;
+    int sequences = 2;
+    std::vector<int> features{6, 5, 3};
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, steps * sequences);
+    Matrix gin = Matrix::Random(features.back(), steps * sequences);
+    Init* init = new Glorot();
+    // three identical stacks, one run layer after layer, one as a
+    // wavefront on a single thread and one as a wavefront on the pool
+    std::vector<std::deque<std::shared_ptr<Layer>>> stacks(3);
+    for (std::deque<std::shared_ptr<Layer>>& stack : stacks) {
+        srand((unsigned int)1);
+        stack.push_back(std::make_shared<Input>(Features(inf)));
+        for (int f : features) {
+            stack.push_back(
+                std::make_shared<LSTM>(Features(f), stack.back(), init));
+            stack.back()->set_sequences(sequences);
+        }
+    }
+    std::vector<std::vector<SharedStorage>> values(3), grads(3);
+    for (int s = 0; s < 3; ++s) {
+        values[s].push_back(std::make_shared<Storage>(in));
+        grads[s].push_back(
+            std::make_shared<Storage>(Matrix(Matrix::Zero(inf, in.cols()))));
+        for (int f : features) {
+            values[s].push_back(std::make_shared<Storage>(
+                Matrix(Matrix::Zero(f, in.cols()))));
+            grads[s].push_back(std::make_shared<Storage>(
+                Matrix(Matrix::Zero(f, in.cols()))));
+        }
+        grads[s].back() = std::make_shared<Storage>(gin);
+    }
+    for (size_t l = 1; l < stacks[0].size(); ++l)
+        stacks[0][l]->forward_cpu(values[0][l - 1], values[0][l], "train");
+    for (size_t l = stacks[0].size() - 1; l > 0; --l)
+        stacks[0][l]->backward_cpu(values[0][l - 1], grads[0][l],
+                                   grads[0][l - 1]);
+    for (int s = 1; s < 3; ++s) {
+        ExecutionContext::instance().threads((s == 1) ? 1 : 3);
+        Wavefront wavefront(stacks[s], 1, features.size());
+        wavefront.forward_cpu(values[s], "train");
+        wavefront.backward_cpu(grads[s], values[s]);
+        REQUIRE(maximum_gradient_difference(values[0], values[s]) < 1e-6);
+        REQUIRE(maximum_gradient_difference(grads[0], grads[s]) < 1e-6);
+        for (size_t l = 1; l < stacks[0].size(); ++l)
+            REQUIRE(maximum_gradient_difference(
+                        stacks[0][l]->return_gradients(),
+                        stacks[s][l]->return_gradients()) < 1e-6);
+    }
+    ExecutionContext::instance().threads(0);
+}
+
+// hidden, run with "[benchmark cpu]": the LSTM stack of the Shakespeare
+// example in examples/rnn, a 64 feature embedding into two layers of 128,
+// on a window of 50 steps of 16 streams, run layer after layer and as a
+// wavefront
+TEST_CASE("NeuralNetwork wavefront speed cpu", "[.][benchmark cpu]") {
+    int inf = 64;
+    int steps = 50;
+    int sequences = 16;
+    int repetitions = 20;
+    std::vector<int> features{128, 128};
+    srand((unsigned int)3);
+    Matrix in = Matrix::Random(inf, steps * sequences);
+    Matrix gin = Matrix::Random(features.back(), steps * sequences);
+    Init* init = new Glorot();
+    std::deque<std::shared_ptr<Layer>> stack;
+    std::vector<SharedStorage> values{std::make_shared<Storage>(in)};
+    std::vector<SharedStorage> grads{
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, in.cols())))};
+    stack.push_back(std::make_shared<Input>(Features(inf)));
+    for (int f : features) {
+        stack.push_back(
+            std::make_shared<LSTM>(Features(f), stack.back(), init));
+        stack.back()->set_sequences(sequences);
+        values.push_back(
+            std::make_shared<Storage>(Matrix(Matrix::Zero(f, in.cols()))));
+        grads.push_back(
+            std::make_shared<Storage>(Matrix(Matrix::Zero(f, in.cols()))));
+    }
+    grads.back() = std::make_shared<Storage>(gin);
+    Wavefront wavefront(stack, 1, features.size());
+    double layered = 1e9, waved = 1e9;
+    for (int round = 0; round < 3; ++round) {
+        double start = cpuSecond();
+        for (int r = 0; r < repetitions; ++r) {
+            for (size_t l = 1; l < stack.size(); ++l)
+                stack[l]->forward_cpu(values[l - 1], values[l], "train");
+            for (size_t l = stack.size() - 1; l > 0; --l)
+                stack[l]->backward_cpu(values[l - 1], grads[l], grads[l - 1]);
+        }
+        layered = std::min(layered, (cpuSecond() - start) / repetitions);
+        start = cpuSecond();
+        for (int r = 0; r < repetitions; ++r) {
+            wavefront.forward_cpu(values, "train");
+            wavefront.backward_cpu(grads, values);
+        }
+        waved = std::min(waved, (cpuSecond() - start) / repetitions);
+    }
+    std::cout << "forward+backward of the Shakespeare LSTM stack, layer "
+              << "after layer: " << layered * 1e3 << " ms, wavefront: "
+              << waved * 1e3 << " ms on " << std::thread::hardware_concurrency()
+              << " cores" << std::endl;
+}
+
+// the columns of the steps in reverse order, each step keeps its sequences
+Matrix reverse_steps(const Matrix& in, int sequences) {
+    Matrix out(in.rows(), in.cols());
+    int steps = in.cols() / sequences;
+    for (int t = 0; t < steps; ++t)
+        out.middleCols((steps - 1 - t) * sequences, sequences) =
+            in.middleCols(t * sequences, sequences);
+    return out;
+}
+
+TEST_CASE("NeuralNetwork bilstm cpu", "[cpu]") {
+    int outf = 5;
+    int inf = 4;
+    int steps = 6;
+    int sequences = 2;
+    int cols = steps * sequences;
+    srand((unsigned int)2);
+    Matrix in = Matrix::Random(inf, cols);
+    Matrix gin = Matrix::Random(2 * outf, cols);
+    Init* init = new Glorot();
+    srand((unsigned int)1);
+    BiLSTM bilstm(Features(outf), Features(inf), init);
+    bilstm.set_sequences(sequences);
+    // the same weights as the two directions
+    srand((unsigned int)1);
+    LSTM forward(Features(outf), Features(inf), init);
+    LSTM reverse(Features(outf), Features(inf), init);
+    forward.set_sequences(sequences);
+    reverse.set_sequences(sequences);
+    SharedStorage storage_in = std::make_shared<Storage>(in);
+    SharedStorage storage_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(2 * outf, cols)));
+    SharedStorage grad_in = std::make_shared<Storage>(gin);
+    SharedStorage grad_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, cols)));
+    // the directions run side by side on the pool
+    ExecutionContext::instance().threads(2);
+    bilstm.forward_cpu(storage_in, storage_out, "train");
+    bilstm.backward_cpu(storage_in, grad_in, grad_out);
+    ExecutionContext::instance().threads(0);
+
+    SharedStorage fwd_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, cols)));
+    SharedStorage fwd_grad_in =
+        std::make_shared<Storage>(Matrix(gin.topRows(outf)));
+    SharedStorage fwd_grad_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, cols)));
+    forward.forward_cpu(storage_in, fwd_out, "train");
+    forward.backward_cpu(storage_in, fwd_grad_in, fwd_grad_out);
+
+    SharedStorage rev_in =
+        std::make_shared<Storage>(reverse_steps(in, sequences));
+    SharedStorage rev_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(outf, cols)));
+    SharedStorage rev_grad_in = std::make_shared<Storage>(
+        reverse_steps(gin.bottomRows(outf), sequences));
+    SharedStorage rev_grad_out =
+        std::make_shared<Storage>(Matrix(Matrix::Zero(inf, cols)));
+    reverse.forward_cpu(rev_in, rev_out, "train");
+    reverse.backward_cpu(rev_in, rev_grad_in, rev_grad_out);
+
+    const Matrix& out = storage_out->return_data_const();
+    REQUIRE(out.topRows(outf).isApprox(fwd_out->return_data_const(), 1e-5));
+    REQUIRE(out.bottomRows(outf).isApprox(
+        reverse_steps(rev_out->return_data_const(), sequences), 1e-5));
+    Matrix expected = fwd_grad_out->return_data_const() +
+                      reverse_steps(rev_grad_out->return_data_const(),
+                                    sequences);
+    REQUIRE(grad_out->return_data_const().isApprox(expected, 1e-5));
+    vector<SharedStorage> grads = forward.return_gradients();
+    for (SharedStorage grad : reverse.return_gradients()) grads.push_back(grad);
+    REQUIRE(maximum_gradient_difference(bilstm.return_gradients(), grads) <
+            1e-5);
+}
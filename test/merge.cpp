@@ -0,0 +1,194 @@
+#define CATCH_CONFIG_MAIN
+#include <eigen-git-mirror/Eigen/Dense>
+#include <memory>
+#include <vector>
+#include "../include/neural_network.h"
+#include "../third_party/catch/catch.hpp"
+
+using std::make_shared;
+typedef std::shared_ptr<Layer> s_Layer;
+typedef std::shared_ptr<Storage> SharedStorage;
+
+static SharedStorage zeros(int rows, int cols) {
+    return make_shared<Storage>(Matrix(Matrix::Zero(rows, cols)));
+}
+
+TEST_CASE("Add residual block cpu", "[cpu]") {
+    srand((unsigned int)1);
+    int obs = 3;
+    Init* init = new Glorot();
+    s_Layer l1 = make_shared<Input>(Features(4));
+    s_Layer fork = make_shared<Dense>(Features(4), l1, init);
+    s_Layer d1 = make_shared<Dense>(Features(5), fork, init);
+    s_Layer r1 = make_shared<Relu>(d1);
+    s_Layer d2 = make_shared<Dense>(Features(4), r1, init);
+    std::shared_ptr<Add> add = make_shared<Add>(std::vector<s_Layer>{d2, fork});
+    REQUIRE(add->previous() == fork);
+    REQUIRE(add->output_dimension() == std::vector<int>{4});
+    REQUIRE(add->return_parameters().size() == 4);
+    SharedStorage in = make_shared<Storage>(Matrix(Matrix::Random(4, obs)));
+    SharedStorage grad = make_shared<Storage>(Matrix(Matrix::Random(4, obs)));
+    // the branch on its own, the skip adds the input and its gradient
+    std::vector<SharedStorage> vals{in, zeros(5, obs), zeros(5, obs),
+                                    zeros(4, obs)};
+    std::vector<SharedStorage> grads{zeros(4, obs), zeros(5, obs),
+                                     zeros(5, obs), grad};
+    std::vector<s_Layer> branch{d1, r1, d2};
+    for (int k = 0; k < 3; ++k)
+        branch[k]->forward_cpu(vals[k], vals[k + 1], "train");
+    for (int k = 2; k >= 0; --k)
+        branch[k]->backward_cpu(vals[k], grads[k + 1], grads[k]);
+    Matrix expected = in->return_data_const() + vals[3]->return_data_const();
+    Matrix expected_grad =
+        grad->return_data_const() + grads[0]->return_data_const();
+    SharedStorage out = zeros(4, obs);
+    SharedStorage grad_out = zeros(4, obs);
+    add->forward_cpu(in, out, "train");
+    add->backward_cpu(in, grad, grad_out);
+    REQUIRE(out->return_data_const().isApprox(expected, 1e-5));
+    REQUIRE(grad_out->return_data_const().isApprox(expected_grad, 1e-5));
+    REQUIRE_THROWS_AS(Add(std::vector<s_Layer>{d1, fork}),
+                      std::invalid_argument);
+}
+
+TEST_CASE("Concat branches cpu", "[cpu]") {
+    srand((unsigned int)2);
+    int obs = 4;
+    Init* init = new Glorot();
+    s_Layer l1 = make_shared<Input>(Features(5));
+    s_Layer d1 = make_shared<Dense>(Features(3), l1, init);
+    s_Layer d2 = make_shared<Dense>(Features(2), l1, init);
+    Concat concat(std::vector<s_Layer>{d1, d2, l1});
+    REQUIRE(concat.previous() == l1);
+    REQUIRE(concat.output_dimension() == std::vector<int>{10});
+    SharedStorage in = make_shared<Storage>(Matrix(Matrix::Random(5, obs)));
+    Matrix grad = Matrix::Random(10, obs);
+    SharedStorage out = zeros(10, obs);
+    SharedStorage grad_out = zeros(5, obs);
+    concat.forward_cpu(in, out, "train");
+    concat.backward_cpu(in, make_shared<Storage>(grad), grad_out);
+    SharedStorage out1 = zeros(3, obs), out2 = zeros(2, obs);
+    SharedStorage grad1 = zeros(5, obs), grad2 = zeros(5, obs);
+    d1->forward_cpu(in, out1, "train");
+    d2->forward_cpu(in, out2, "train");
+    d1->backward_cpu(in, make_shared<Storage>(Matrix(grad.topRows(3))), grad1);
+    d2->backward_cpu(in, make_shared<Storage>(Matrix(grad.middleRows(3, 2))),
+                     grad2);
+    const Matrix& result = out->return_data_const();
+    REQUIRE(result.topRows(3).isApprox(out1->return_data_const()));
+    REQUIRE(result.middleRows(3, 2).isApprox(out2->return_data_const()));
+    REQUIRE(result.bottomRows(5) == in->return_data_const());
+    Matrix expected_grad = grad1->return_data_const() +
+                           grad2->return_data_const() + grad.bottomRows(5);
+    REQUIRE(grad_out->return_data_const().isApprox(expected_grad, 1e-5));
+}
+
+TEST_CASE("Concat images cpu", "[cpu]") {
+    Init* init = new Glorot();
+    s_Layer l1 = make_shared<Input>(Channels(2), ImageShape(6, 6));
+    s_Layer c1 = make_shared<Convolution>(FilterShape(3, 3), Pad(1),
+                                          Stride(1), Filters(3), l1, init);
+    s_Layer c2 = make_shared<Convolution>(FilterShape(1, 1), Pad(0),
+                                          Stride(1), Filters(4), l1, init);
+    Concat concat(std::vector<s_Layer>{c1, c2});
+    REQUIRE(concat.output_dimension() == std::vector<int>{7, 6, 6});
+}
+
+// two max pooling branches start at the merge, their backward passes write
+// into buffers reused from batch to batch, which must not keep the
+// gradient of the previous one
+TEST_CASE("Concat pooling branches cpu", "[cpu]") {
+    srand((unsigned int)4);
+    int obs = 2;
+    s_Layer l1 = make_shared<Input>(Channels(2), ImageShape(6, 6));
+    s_Layer p1 = make_shared<Pooling>(Window(2), Stride(2), l1);
+    s_Layer p2 = make_shared<Pooling>(Window(3), Stride(3), l1);
+    Concat concat(std::vector<s_Layer>{p1, p2});
+    REQUIRE(concat.output_dimension() == std::vector<int>{26});
+    SharedStorage out = zeros(26, obs);
+    SharedStorage grad_out = zeros(72, obs);
+    for (int batch = 0; batch < 2; ++batch) {
+        SharedStorage in =
+            make_shared<Storage>(Matrix(Matrix::Random(72, obs)));
+        Matrix grad = Matrix::Random(26, obs);
+        concat.forward_cpu(in, out, "train");
+        concat.backward_cpu(in, make_shared<Storage>(grad), grad_out);
+        SharedStorage out1 = zeros(18, obs), out2 = zeros(8, obs);
+        SharedStorage grad1 = zeros(72, obs), grad2 = zeros(72, obs);
+        p1->forward_cpu(in, out1, "train");
+        p2->forward_cpu(in, out2, "train");
+        p1->backward_cpu(in, make_shared<Storage>(Matrix(grad.topRows(18))),
+                         grad1);
+        p2->backward_cpu(
+            in, make_shared<Storage>(Matrix(grad.bottomRows(8))), grad2);
+        const Matrix& result = out->return_data_const();
+        REQUIRE(result.topRows(18) == out1->return_data_const());
+        REQUIRE(result.bottomRows(8) == out2->return_data_const());
+        Matrix expected_grad =
+            grad1->return_data_const() + grad2->return_data_const();
+        REQUIRE(grad_out->return_data_const().isApprox(expected_grad, 1e-5));
+    }
+}
+
+static Matrix affine(const s_Layer& dense, const Matrix& x) {
+    const Matrix& w = dense->return_parameters()[0]->return_data_const();
+    const Matrix& b = dense->return_parameters()[1]->return_data_const();
+    return (w * x).colwise() + b.col(0);
+}
+
+TEST_CASE("NeuralNetwork residual cpu", "[cpu]") {
+    srand((unsigned int)3);
+    Init* init = new Glorot();
+    s_Layer l1 = make_shared<Input>(Features(5));
+    s_Layer fork = make_shared<Dense>(Features(6), l1, init);
+    s_Layer r1 = make_shared<Relu>(fork);
+    s_Layer d1 = make_shared<Dense>(Features(6), r1, init);
+    s_Layer r2 = make_shared<Relu>(d1);
+    s_Layer d2 = make_shared<Dense>(Features(6), r2, init);
+    s_Layer a1 = make_shared<Add>(std::vector<s_Layer>{d2, r1});
+    s_Layer d3 = make_shared<Dense>(Features(3), a1, init);
+    s_Layer s1 = make_shared<Softmax>(d3);
+    std::shared_ptr<Loss> loss =
+        std::make_shared<CrossEntropy>(CrossEntropy("CPU"));
+    NeuralNetwork network(s1, loss, "CPU");
+    // the branch is fused like the network's own layers
+    std::shared_ptr<Merge> merge = std::dynamic_pointer_cast<Merge>(a1);
+    REQUIRE(merge->branch(0).size() == 2);
+    REQUIRE(merge->branch(0)[0]->name() == "DenseBlock");
+    REQUIRE(merge->branch(1).empty());
+    Matrix in = Matrix::Random(7, 5);
+    Matrix out = network.predict(in);
+    Matrix h = affine(fork, in.transpose()).cwiseMax(0.);
+    Matrix u = affine(d2, affine(d1, h).cwiseMax(0.));
+    Matrix z = affine(d3, u + h);
+    Matrix expected = z.array().exp();
+    for (int i = 0; i < expected.cols(); ++i)
+        expected.col(i) /= expected.col(i).sum();
+    REQUIRE(out.transpose().isApprox(expected, 1e-5));
+}
+
+TEST_CASE("NeuralNetwork residual freeze cpu", "[cpu]") {
+    srand((unsigned int)4);
+    Init* init = new Glorot();
+    s_Layer l1 = make_shared<Input>(Features(5));
+    s_Layer fork = make_shared<Dense>(Features(6), l1, init);
+    s_Layer r1 = make_shared<Relu>(fork);
+    s_Layer d1 = make_shared<Dense>(Features(6), r1, init);
+    s_Layer drop = make_shared<Dropout>(0.5, d1);
+    s_Layer d2 = make_shared<Dense>(Features(6), drop, init);
+    s_Layer a1 = make_shared<Add>(std::vector<s_Layer>{d2, r1});
+    s_Layer d3 = make_shared<Dense>(Features(3), a1, init);
+    s_Layer s1 = make_shared<Softmax>(d3);
+    std::shared_ptr<Loss> loss =
+        std::make_shared<CrossEntropy>(CrossEntropy("CPU"));
+    NeuralNetwork network(s1, loss, "CPU");
+    Matrix in = Matrix::Random(7, 5);
+    Matrix expected = network.predict(in);
+    // the Dropout in the branch goes, the two Dense layers around it fold
+    InferenceReport report = network.freeze();
+    REQUIRE(report.layers == 2);
+    std::shared_ptr<Merge> merge = std::dynamic_pointer_cast<Merge>(a1);
+    REQUIRE(merge->branch(0).size() == 1);
+    REQUIRE(merge->return_parameters().size() == 2);
+    REQUIRE(network.predict(in).isApprox(expected, 1e-5));
+}
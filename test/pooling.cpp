@@ -5,6 +5,7 @@
 #include "../include/neural_network.h"
 #include "../third_party/catch/catch.hpp"
 #include <sys/time.h>
+#include <cfloat>
 #include <iostream>
 
 double cpuSecond() {
@@ -218,3 +219,174 @@ TEST_CASE("Pooling backward comparison", "[backward comparison]") {
     REQUIRE(maxDiff < 1e-5);
     REQUIRE(gpuEnd < cpuEnd);
 }
+
+TEST_CASE("Pooling specialized kernels cpu", "[cpu]") {
+    // 2/2 and 3/2 take the specialized kernels, 3/1 and 1/3 the generic
+    // one, the image sizes leave windows clipped at the border and, for the
+    // window smaller than the stride, windows past it
+    std::vector<std::pair<int, int>> configs{{2, 2}, {3, 2}, {3, 1}, {1, 3}};
+    int channels(3), batches(4), rows(9), cols(38);
+    srand((unsigned int)5);
+    for (const auto& config : configs) {
+        int window(config.first), stride(config.second);
+        int out_height = static_cast<int>(ceil(
+                             static_cast<float>(rows - window) / stride)) +
+                         1;
+        int out_width = static_cast<int>(ceil(
+                            static_cast<float>(cols - window) / stride)) +
+                        1;
+        Pooling pool(Window(window), Stride(stride), ImageShape(rows, cols),
+                     Channels(channels));
+        Matrix images = Matrix::Random(channels * rows * cols, batches);
+        Matrix grad = Matrix::Random(channels * out_height * out_width,
+                                     batches);
+        Matrix expected_out(channels * out_height * out_width, batches);
+        Matrix expected_grad = Matrix::Zero(channels * rows * cols, batches);
+        for (int n = 0; n < batches; ++n)
+            for (int c = 0; c < channels; ++c)
+                for (int ph = 0; ph < out_height; ++ph)
+                    for (int pw = 0; pw < out_width; ++pw) {
+                        int best = -1;
+                        for (int h = ph * stride;
+                             h < std::min(ph * stride + window, rows); ++h)
+                            for (int w = pw * stride;
+                                 w < std::min(pw * stride + window, cols);
+                                 ++w) {
+                                int index = (c * rows + h) * cols + w;
+                                if ((best < 0) or
+                                    (images(index, n) > images(best, n)))
+                                    best = index;
+                            }
+                        int o = (c * out_height + ph) * out_width + pw;
+                        expected_out(o, n) =
+                            (best < 0) ? -FLT_MAX : images(best, n);
+                        if (best >= 0) expected_grad(best, n) += grad(o, n);
+                    }
+        SharedStorage in = std::make_shared<Storage>(images);
+        SharedStorage out = std::make_shared<Storage>(
+            Matrix::Zero(channels * out_height * out_width, batches));
+        SharedStorage grad_in = std::make_shared<Storage>(grad);
+        // the gradient overwrites whatever the buffer held, also on a
+        // second pass
+        SharedStorage grad_out = std::make_shared<Storage>(
+            Matrix::Random(channels * rows * cols, batches));
+        pool.forward_cpu(in, out, "train");
+        for (int pass = 0; pass < 2; ++pass) {
+            pool.backward_cpu(in, grad_in, grad_out);
+            REQUIRE(grad_out->return_data_const().isApprox(expected_grad,
+                                                           1e-6));
+        }
+        REQUIRE(out->return_data_const() == expected_out);
+    }
+}
+
+// hidden, run with "[benchmark cpu]" for the time per batch of the
+// specialized max and average pooling kernels
+TEST_CASE("Pooling speed cpu", "[.][benchmark cpu]") {
+    int channels(64), batches(8), side(56);
+    for (int window : {2, 3}) {
+        int out_side = static_cast<int>(ceil(
+                           static_cast<float>(side - window) / 2)) +
+                       1;
+        Pooling max(Window(window), Stride(2), ImageShape(side, side),
+                    Channels(channels));
+        AvgPooling avg(Window(window), Stride(2), ImageShape(side, side),
+                       Channels(channels));
+        SharedStorage in = std::make_shared<Storage>(
+            Matrix(Matrix::Random(channels * side * side, batches)));
+        SharedStorage out = std::make_shared<Storage>(
+            Matrix::Zero(channels * out_side * out_side, batches));
+        std::cout << channels << "x" << side << "x" << side << " window "
+                  << window << " stride 2:";
+        for (Layer* pool : std::vector<Layer*>{&max, &avg}) {
+            pool->forward_cpu(in, out, "train");
+            double start = cpuSecond();
+            for (int i = 0; i < 20; ++i) pool->forward_cpu(in, out, "train");
+            std::cout << " " << pool->name() << " "
+                      << (cpuSecond() - start) / 20 * 1e3 << " ms";
+        }
+        std::cout << std::endl;
+    }
+}
+
+TEST_CASE("Average pooling cpu", "[cpu]") {
+    // 3/2 and 2/2 take the specialized kernels, the image is wide enough
+    // for their vector loop and leaves windows clipped at the border
+    int channels(3), batches(4), rows(10), cols(38), stride(2);
+    srand((unsigned int)7);
+    for (int window : {3, 2}) {
+        int out_height = (rows - window + stride - 1) / stride + 1;
+        int out_width = (cols - window + stride - 1) / stride + 1;
+        AvgPooling pool(Window(window), Stride(stride), ImageShape(rows, cols),
+                        Channels(channels));
+        REQUIRE(pool.output_dimension() ==
+                std::vector<int>{channels, out_height, out_width});
+        Matrix images = Matrix::Random(channels * rows * cols, batches);
+        Matrix grad =
+            Matrix::Random(channels * out_height * out_width, batches);
+        Matrix expected_out(channels * out_height * out_width, batches);
+        Matrix expected_grad = Matrix::Zero(channels * rows * cols, batches);
+        for (int n = 0; n < batches; ++n)
+            for (int c = 0; c < channels; ++c)
+                for (int ph = 0; ph < out_height; ++ph)
+                    for (int pw = 0; pw < out_width; ++pw) {
+                        // the windows at the border only cover the image
+                        int hend = std::min(ph * stride + window, rows);
+                        int wend = std::min(pw * stride + window, cols);
+                        int count =
+                            (hend - ph * stride) * (wend - pw * stride);
+                        int o = (c * out_height + ph) * out_width + pw;
+                        dtype sum = 0;
+                        for (int h = ph * stride; h < hend; ++h)
+                            for (int w = pw * stride; w < wend; ++w) {
+                                int index = (c * rows + h) * cols + w;
+                                sum += images(index, n);
+                                expected_grad(index, n) += grad(o, n) / count;
+                            }
+                        expected_out(o, n) = sum / count;
+                    }
+        SharedStorage in = std::make_shared<Storage>(images);
+        SharedStorage out = std::make_shared<Storage>(
+            Matrix::Zero(channels * out_height * out_width, batches));
+        SharedStorage grad_in = std::make_shared<Storage>(grad);
+        SharedStorage grad_out = std::make_shared<Storage>(
+            Matrix::Zero(channels * rows * cols, batches));
+        pool.forward_cpu(in, out, "train");
+        pool.backward_cpu(in, grad_in, grad_out);
+        REQUIRE(out->return_data_const().isApprox(expected_out, 1e-6));
+        REQUIRE(grad_out->return_data_const().isApprox(expected_grad, 1e-6));
+    }
+}
+
+TEST_CASE("Global average pooling cpu", "[cpu]") {
+    int channels(5), batches(3), rows(4), cols(6);
+    srand((unsigned int)9);
+    std::shared_ptr<Layer> l1 =
+        std::make_shared<Input>(Channels(channels), ImageShape(rows, cols));
+    std::shared_ptr<Layer> gap = std::make_shared<GlobalAvgPooling>(l1);
+    REQUIRE(gap->output_dimension() == std::vector<int>{channels, 1, 1});
+    // a Dense layer on top sees one feature per channel
+    Dense d1(Features(2), gap, new Glorot());
+    REQUIRE(d1.return_parameters()[0]->get_cols() == channels);
+    Matrix images = Matrix::Random(channels * rows * cols, batches);
+    Matrix grad = Matrix::Random(channels, batches);
+    Matrix expected_out(channels, batches);
+    Matrix expected_grad(channels * rows * cols, batches);
+    for (int n = 0; n < batches; ++n)
+        for (int c = 0; c < channels; ++c) {
+            int size = rows * cols;
+            expected_out(c, n) = images.block(c * size, n, size, 1).mean();
+            expected_grad.block(c * size, n, size, 1).setConstant(
+                grad(c, n) / size);
+        }
+    SharedStorage in = std::make_shared<Storage>(images);
+    SharedStorage out =
+        std::make_shared<Storage>(Matrix::Zero(channels, batches));
+    SharedStorage grad_in = std::make_shared<Storage>(grad);
+    SharedStorage grad_out = std::make_shared<Storage>(
+        Matrix::Zero(channels * rows * cols, batches));
+    gap->forward_cpu(in, out, "train");
+    gap->backward_cpu(in, grad_in, grad_out);
+    REQUIRE(out->return_data_const().isApprox(expected_out, 1e-6));
+    REQUIRE(grad_out->return_data_const().isApprox(expected_grad, 1e-6));
+}
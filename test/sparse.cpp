@@ -0,0 +1,108 @@
+#define CATCH_CONFIG_MAIN
+#include <eigen-git-mirror/Eigen/Core>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include "../include/common.h"
+#include "../include/layer/dense.h"
+#include "../include/neural_network.h"
+#include "../include/storage.h"
+#include "../include/utils/libsvm.hpp"
+#include "../third_party/catch/catch.hpp"
+
+using std::make_shared;
+typedef std::shared_ptr<Storage> SharedStorage;
+
+// batch of observations with a few active features each
+SparseMatrix sparse_batch(int obs, int features) {
+    Matrix dense = Matrix::Random(obs, features);
+    dense = (dense.array().abs() > 0.8).select(dense, 0);
+    return dense.sparseView();
+}
+
+TEST_CASE("Sparse storage", "[cpu]") {
+    SparseMatrix batch = sparse_batch(3, 20);
+    SharedStorage storage = make_shared<Storage>(batch);
+    REQUIRE(storage->is_sparse());
+    REQUIRE(storage->get_rows() == 20);
+    REQUIRE(storage->get_cols() == 3);
+    REQUIRE_THROWS(storage->return_data_const());
+}
+
+TEST_CASE("Dense sparse forward_cpu", "[cpu]") {
+    srand((unsigned int)time(0));
+    Init* init = new Glorot();
+    Dense s1(Features(6), Features(20), init);
+    s1.return_parameters()[1]->update_cpu_data(Matrix::Random(6, 1));
+    SparseMatrix batch = sparse_batch(4, 20);
+    SharedStorage sparse_in = make_shared<Storage>(batch);
+    SharedStorage dense_in =
+        make_shared<Storage>(Matrix(batch.toDense().transpose()));
+    SharedStorage sparse_out = make_shared<Storage>(Matrix::Zero(6, 4));
+    SharedStorage dense_out = make_shared<Storage>(Matrix::Zero(6, 4));
+    s1.forward_cpu(sparse_in, sparse_out, "train");
+    s1.forward_cpu(dense_in, dense_out, "train");
+    REQUIRE(sparse_out->return_data_const().isApprox(
+        dense_out->return_data_const()));
+}
+
+TEST_CASE("Dense sparse backward_cpu", "[cpu]") {
+    srand((unsigned int)time(0));
+    Init* init = new Glorot();
+    Dense s1(Features(6), Features(20), init);
+    Matrix gradient_in = Matrix::Random(6, 4);
+    SharedStorage shared_gradient_in = make_shared<Storage>(gradient_in);
+    SharedStorage gradient_out = make_shared<Storage>();
+    for (int pass = 0; pass < 2; ++pass) {
+        SparseMatrix batch = sparse_batch(4, 20);
+        SharedStorage values = make_shared<Storage>(batch);
+        s1.backward_cpu(values, shared_gradient_in, gradient_out);
+        Matrix expected = gradient_in * batch.toDense();
+        REQUIRE(s1.return_gradients()[0]->return_data_const().isApprox(
+            expected));
+        REQUIRE(s1.return_gradients()[1]->return_data_const().isApprox(
+            gradient_in.rowwise().sum()));
+    }
+}
+
+TEST_CASE("Read libsvm", "[cpu]") {
+    const char* path = "sparse_test.libsvm";
+    std::ofstream out(path);
+    out << "+1 3:0.5 7:2 # comment\n"
+        << "\n"
+        << "-1 qid:4 1:1.5\n";
+    out.close();
+    SparseMatrix features;
+    Labels labels;
+    read_libsvm(path, features, labels);
+    REQUIRE(features.rows() == 2);
+    REQUIRE(features.cols() == 7);
+    REQUIRE(features.nonZeros() == 3);
+    REQUIRE(features.coeff(0, 2) == Approx(0.5));
+    REQUIRE(features.coeff(0, 6) == Approx(2));
+    REQUIRE(features.coeff(1, 0) == Approx(1.5));
+    REQUIRE(labels(0) == 1);
+    REQUIRE(labels(1) == 0);
+    read_libsvm(path, features, labels, 10);
+    REQUIRE(features.cols() == 10);
+    REQUIRE_THROWS(read_libsvm(path, features, labels, 5));
+    std::remove(path);
+}
+
+// the storages follow the input passed, a sparse prediction leaves the
+// network allocating dense inputs afterwards
+TEST_CASE("NeuralNetwork sparse predict cpu", "[cpu]") {
+    srand((unsigned int)4);
+    Init* init = new Glorot();
+    std::shared_ptr<Layer> l1 = make_shared<Input>(Features(20));
+    std::shared_ptr<Layer> l2 = make_shared<Dense>(Features(6), l1, init);
+    std::shared_ptr<Layer> l3 = make_shared<Softmax>(l2);
+    std::shared_ptr<Loss> loss =
+        std::make_shared<CrossEntropy>(CrossEntropy("CPU"));
+    NeuralNetwork network(l3, loss, "CPU");
+    SparseMatrix batch = sparse_batch(5, 20);
+    Matrix expected = network.predict(Matrix(batch.toDense()));
+    REQUIRE(network.predict(batch).isApprox(expected, 1e-5));
+    REQUIRE(network.allocate_forward(5)[0]->get_rows() == 20);
+    REQUIRE(!network.allocate_forward(5, true)[0]->is_set());
+}
@@ -6,18 +6,19 @@
 
 typedef float dtype;
 typedef Eigen::Matrix<dtype, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef Eigen::Matrix<int, Eigen::Dynamic, 1> Labels;
 class Cifar10 {
 public:
     Cifar10();
     Matrix get_x_train() { return x_train; }
     Matrix get_x_test() { return x_test; }
-    Matrix get_y_train() { return y_train; }
-    Matrix get_y_test() { return y_test; }
+    Labels get_y_train() { return y_train; }
+    Labels get_y_test() { return y_test; }
 
 private:
     Matrix x_train, x_test;
-    Matrix y_train, y_test;
-    Matrix labels(const std::vector<uint8_t>&);
+    Labels y_train, y_test;
+    Labels labels(const std::vector<uint8_t>&);
     Matrix features(const std::vector<std::vector<uint8_t>>&);
     std::vector<dtype> read(const std::vector<std::vector<uint8_t>>&);
 };
@@ -35,14 +36,11 @@ std::vector<dtype> Cifar10::read(const std::vector<std::vector<uint8_t>>& inp) {
     return res;
 }
 
-Matrix Cifar10::labels(const std::vector<uint8_t>& inp) {
+Labels Cifar10::labels(const std::vector<uint8_t>& inp) {
     int size   = inp.size();
-    Matrix res = Matrix::Zero(size, 10);
+    Labels res(size);
     for (int i = 0; i < size; ++i) {
-        for (int j = 0; j < 10; ++j) {
-            if (inp[i] == j)
-                res(i, j) = 1;
-        }
+        res(i) = inp[i];
     }
     return res;
 }